@@ -0,0 +1,835 @@
+/* capture.c */
+/*   Framed capture files: a reader that mmaps mcap (the mdump-native
+ * format written by 'mdump -O file -F mcap', see capwrite.c), pcap or
+ * pcapng files and hands back one UDP payload at a time (used by
+ * 'msend -R'), and can seek to a time or msend sequence number.  Packed
+ * (compressed) mcap blocks are decompressed one at a time as they are
+ * reached.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted without restriction.
+ *
+  THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+  EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+  NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+  PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+  UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+  BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+  INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+  TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+  THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+#include "mtools.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#if defined(HAVE_LZ4)
+#include <lz4frame.h>
+#endif
+#if defined(HAVE_ZSTD)
+#include <zstd.h>
+#endif
+
+/* pcap / pcapng constants */
+#define PCAP_MAGIC_US 0xa1b2c3d4
+#define PCAP_MAGIC_NS 0xa1b23c4d
+#define PCAPNG_SHB 0x0A0D0D0A
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_SPB 0x00000003
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_BOM 0x1A2B3C4D
+
+#define LINKTYPE_NULL 0
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+#define LINKTYPE_LOOP 108
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_IPV4 228
+#define LINKTYPE_LINUX_SLL2 276
+
+/* Seeking: a version 2 mcap file is searched through its block index (from
+ * the trailer, or rebuilt by hopping from block header to block header if
+ * the capture was cut short), then record by record within the block.
+ * Anything else is read from the start.
+ *   Splitting for parallel reads: mcap version 2 and 3 at block boundaries
+ * (each part decompresses into a buffer of its own); pcap
+ * and unblocked mcap at the first offset past each cut where a chain of
+ * plausible record headers starts.  A wrong guess shows up as a record
+ * running past the end of the part before, and is reported as corrupt. */
+#define CAP_RESYNC_SCAN (1024 * 1024)  /* bytes searched for a record start */
+#define CAP_RESYNC_CHAIN 8  /* headers that must follow on from it */
+#define CAP_RESYNC_SECS 10000000  /* timestamps this close to the first record's */
+
+
+static unsigned int cap_swap32(unsigned int v)
+{
+	return (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+}  /* cap_swap32 */
+
+
+static unsigned int cap_u32(const cap_reader *r, const unsigned char *p)
+{
+	unsigned int v;
+
+	memcpy(&v, p, 4);
+	return r->swapped ? cap_swap32(v) : v;
+}  /* cap_u32 */
+
+
+static unsigned short cap_u16(const cap_reader *r, const unsigned char *p)
+{
+	unsigned short v;
+
+	memcpy(&v, p, 2);
+	if (r->swapped)
+		v = (unsigned short)((v >> 8) | (v << 8));
+	return v;
+}  /* cap_u16 */
+
+
+/* Convert a timestamp in units of 1/units_per_sec seconds to ns. */
+static TLONGLONG cap_ts_ns(unsigned long long ts, unsigned long long units_per_sec)
+{
+	return (TLONGLONG)(ts / units_per_sec) * 1000000000 +
+		(TLONGLONG)((double)(ts % units_per_sec) * 1e9 / (double)units_per_sec);
+}  /* cap_ts_ns */
+
+
+/* Find the UDP payload inside a captured link-layer frame.  Returns 1 and
+ * fills 'rec' for an unfragmented IPv4/UDP packet, 0 for anything else. */
+static int cap_decode_frame(int linktype, const unsigned char *p, int caplen, cap_record *rec)
+{
+	int off = 0, ethertype = 0x0800, ihl, ip_len, udp_len;
+	const unsigned char *ip, *udp;
+
+	switch (linktype) {
+	  case LINKTYPE_ETHERNET:
+		if (caplen < 14) return 0;
+		ethertype = (p[12] << 8) | p[13];
+		off = 14;
+		while ((ethertype == 0x8100 || ethertype == 0x88a8) && caplen >= off + 4) {
+			ethertype = (p[off+2] << 8) | p[off+3];
+			off += 4;
+		}
+		break;
+	  case LINKTYPE_LINUX_SLL:
+		if (caplen < 16) return 0;
+		ethertype = (p[14] << 8) | p[15];
+		off = 16;
+		break;
+	  case LINKTYPE_LINUX_SLL2:
+		if (caplen < 20) return 0;
+		ethertype = (p[0] << 8) | p[1];
+		off = 20;
+		break;
+	  case LINKTYPE_NULL:
+	  case LINKTYPE_LOOP:
+		off = 4;  /* address family; only IPv4 is decoded below anyway */
+		break;
+	  case LINKTYPE_RAW:
+	  case LINKTYPE_IPV4:
+		break;
+	  default:
+		return 0;
+	}
+	if (ethertype != 0x0800 || caplen < off + 20)
+		return 0;
+
+	ip = p + off;
+	ihl = (ip[0] & 0x0f) * 4;
+	ip_len = (ip[2] << 8) | ip[3];
+	if ((ip[0] >> 4) != 4 || ihl < 20 || ip[9] != IPPROTO_UDP)
+		return 0;
+	if (((ip[6] << 8) | ip[7]) & 0x3fff)
+		return 0;  /* fragment (MF set or non-zero offset); we do not reassemble */
+	if (caplen < off + ihl + 8)
+		return 0;
+
+	udp = ip + ihl;
+	udp_len = (udp[4] << 8) | udp[5];
+	if (udp_len < 8 || udp_len > ip_len - ihl)
+		return 0;
+	rec->data = (const char *)udp + 8;
+	rec->len = udp_len - 8;
+	if (rec->len > caplen - (off + ihl + 8))
+		return 0;  /* truncated by the capture snaplen */
+	memcpy(&rec->src_addr, ip + 12, 4);
+	memcpy(&rec->dst_addr, ip + 16, 4);
+	memcpy(&rec->src_port, udp, 2);
+	memcpy(&rec->dst_port, udp + 2, 2);
+	return 1;
+}  /* cap_decode_frame */
+
+
+/* mcap: the index, if the file ends with a trailer that makes sense. */
+static void cap_mcap_trailer(cap_reader *r)
+{
+	const mcap_trailer *t;
+	TLONGLONG idx_len;
+
+	if (r->size < r->start + sizeof(*t))
+		return;
+	t = (const mcap_trailer *)(r->base + r->size - sizeof(*t));
+	idx_len = (TLONGLONG)t->num_ents * sizeof(mcap_idx_ent);
+	if (memcmp(t->magic, MCAP_IDX_MAGIC, 4) != 0 || t->idx_off < (TLONGLONG)r->start ||
+			t->idx_off % MCAP_ALIGN != 0 || t->idx_off + idx_len + sizeof(*t) != r->size)
+		return;  /* no index: cap_build_index() if it is needed */
+	r->index = (const mcap_idx_ent *)(r->base + t->idx_off);
+	r->num_index = (int)t->num_ents;
+	r->data_end = (size_t)t->idx_off;
+}  /* cap_mcap_trailer */
+
+
+/* "lz4", "zstd", or "none". */
+const char *cap_codec_name(int codec)
+{
+	switch (codec) {
+	  case MCAP_CODEC_LZ4:  return "lz4";
+	  case MCAP_CODEC_ZSTD:  return "zstd";
+	  default:  return "none";
+	}
+}  /* cap_codec_name */
+
+
+/* Can this build decompress 'codec'? */
+static int cap_codec_ok(int codec)
+{
+	(void)codec;  /* unused without lz4 and zstd */
+#if defined(HAVE_LZ4)
+	if (codec == MCAP_CODEC_LZ4)
+		return 1;
+#endif
+#if defined(HAVE_ZSTD)
+	if (codec == MCAP_CODEC_ZSTD)
+		return 1;
+#endif
+	return 0;
+}  /* cap_codec_ok */
+
+
+/* mcap: go to the block whose header is at 'off'.  Returns 1, 0 if there
+ * are no more blocks, -1 if the header is corrupt. */
+static int cap_enter_block(cap_reader *r, size_t off)
+{
+	static const char zero[4] = { 0 };
+	const mcap_blk_hdr *bh = (const mcap_blk_hdr *)(r->base + off);
+	const mcap_pblk_hdr *ph = (const mcap_pblk_hdr *)bh;
+	size_t hdr_len = (r->codec != 0) ? sizeof(*ph) : sizeof(*bh);
+
+	if (off + hdr_len > r->data_end || memcmp(bh->magic, zero, 4) == 0 ||
+			(r->codec != 0 && off + hdr_len + ph->packed_len > r->data_end)) {
+		/* the end, the padding of a file that was not closed, or a
+		 * packed block that was not all written */
+		r->pos = r->blk_end = r->blk_next = r->data_end;
+		return 0;
+	}
+	if (r->codec != 0) {
+		if (memcmp(bh->magic, MCAP_PBLK_MAGIC, 4) != 0 || bh->len < sizeof(*bh) || bh->len > r->block_size ||
+				(ph->codec != MCAP_CODEC_NONE && ph->codec != (unsigned int)r->codec)) {
+			fprintf(stderr, "capture: corrupt packed mcap block at offset %lu\n", (unsigned long)off);
+			return -1;
+		}
+		r->blk_off = off;
+		r->pos = off + sizeof(*bh);
+		r->blk_end = off + bh->len;  /* decompressed by cap_next() */
+		r->blk_next = off + ((hdr_len + ph->packed_len + MCAP_ALIGN - 1) & ~((size_t)MCAP_ALIGN - 1));
+		return 1;
+	}
+	if (memcmp(bh->magic, MCAP_BLK_MAGIC, 4) != 0 || bh->len < sizeof(*bh) ||
+			off % r->block_size + bh->len > r->block_size) {
+		fprintf(stderr, "capture: corrupt mcap block at offset %lu\n", (unsigned long)off);
+		return -1;
+	}
+	r->blk_off = off;
+	r->pos = off + sizeof(*bh);
+	r->blk_end = off + bh->len;
+	if (r->blk_end > r->data_end)
+		r->blk_end = r->data_end;  /* cut short */
+	r->blk_next = (off / r->block_size + 1) * r->block_size;
+	return 1;
+}  /* cap_enter_block */
+
+
+/* Packed mcap: decompress the current block into r->unpacked.  Returns 0,
+ * or -1 if it is corrupt. */
+static int cap_unpack(cap_reader *r)
+{
+	const mcap_pblk_hdr *ph = (const mcap_pblk_hdr *)(r->base + r->blk_off);
+	cap_unpacked *u = r->unpacked;
+	const char *src = (const char *)(ph + 1);
+	size_t want = ph->blk.len - sizeof(mcap_blk_hdr), got = (size_t)-1;
+	char *dst;
+
+	if (u->data == NULL && (u->data = (char *)malloc(r->block_size)) == NULL) {
+		fprintf(stderr, "capture: out of memory to decompress\n");
+		return -1;
+	}
+	u->blk_off = 0;
+	memcpy(u->data, &ph->blk, sizeof(mcap_blk_hdr));
+	dst = u->data + sizeof(mcap_blk_hdr);
+	if (ph->codec == MCAP_CODEC_NONE) {
+		if (ph->packed_len == want) {
+			memcpy(dst, src, want);
+			got = want;
+		}
+	}
+#if defined(HAVE_LZ4)
+	else if (ph->codec == MCAP_CODEC_LZ4) {
+		LZ4F_dctx *dc;
+		size_t dlen = want, slen = ph->packed_len;
+		if (! LZ4F_isError(LZ4F_createDecompressionContext(&dc, LZ4F_VERSION))) {
+			if (LZ4F_decompress(dc, dst, &dlen, src, &slen, NULL) == 0 && slen == ph->packed_len)
+				got = dlen;
+			LZ4F_freeDecompressionContext(dc);
+		}
+	}
+#endif
+#if defined(HAVE_ZSTD)
+	else if (ph->codec == MCAP_CODEC_ZSTD) {
+		size_t n = ZSTD_decompress(dst, want, src, ph->packed_len);
+		if (! ZSTD_isError(n))
+			got = n;
+	}
+#endif
+	if (got != want) {
+		fprintf(stderr, "capture: corrupt %s data in the mcap block at offset %lu\n",
+				cap_codec_name(ph->codec), (unsigned long)r->blk_off);
+		return -1;
+	}
+	u->blk_off = r->blk_off;
+	return 0;
+}  /* cap_unpack */
+
+
+/* mcap without a trailer: index the blocks from their headers, one page
+ * read per block. */
+static int cap_build_index(cap_reader *r)
+{
+	cap_reader scan = *r;
+	size_t off;
+	int n = 0, max_ents = 0;
+
+	for (off = r->start; cap_enter_block(&scan, off) > 0; off = scan.blk_next) {
+		const mcap_blk_hdr *bh = (const mcap_blk_hdr *)(r->base + off);
+		mcap_idx_ent *e;
+		if (n == max_ents) {
+			max_ents = (max_ents > 0) ? max_ents * 2 : 256;
+			e = (mcap_idx_ent *)realloc(r->index_built, max_ents * sizeof(mcap_idx_ent));
+			if (e == NULL) {
+				fprintf(stderr, "capture: out of memory for the block index\n");
+				return -1;
+			}
+			r->index_built = e;
+		}
+		e = &r->index_built[n];
+		e->off = off;
+		e->first_ns = bh->first_ns;
+		e->ns_hi = bh->last_ns;
+		e->seq_hi = bh->seq_hi;
+		e->num_recs = bh->num_recs;
+		if (n > 0) {
+			if (e[-1].ns_hi > e->ns_hi)
+				e->ns_hi = e[-1].ns_hi;
+			if (e[-1].seq_hi > e->seq_hi)
+				e->seq_hi = e[-1].seq_hi;
+		}
+		++n;
+	}
+	r->index = r->index_built;
+	r->num_index = n;
+	return 0;
+}  /* cap_build_index */
+
+
+/* Map a capture file and identify its format.  Returns 0 on success, -1
+ * (after printing why) on error. */
+int cap_open(cap_reader *r, const char *file)
+{
+	unsigned int magic;
+
+	memset(r, 0, sizeof(*r));
+#if defined(_WIN32)
+	{
+		FILE *fp = fopen(file, "rb");
+		long len;
+		if (fp == NULL) {
+			fprintf(stderr, "capture: cannot open '%s': %s\n", file, strerror(errno));
+			return -1;
+		}
+		fseek(fp, 0, SEEK_END);  len = ftell(fp);  fseek(fp, 0, SEEK_SET);
+		r->base = (const unsigned char *)malloc(len > 0 ? len : 1);
+		if (r->base == NULL || fread((void *)r->base, 1, len, fp) != (size_t)len) {
+			fprintf(stderr, "capture: cannot read '%s'\n", file);
+			fclose(fp);
+			cap_close(r);
+			return -1;
+		}
+		fclose(fp);
+		r->size = len;
+	}
+#else
+	{
+		struct stat st;
+		int fd = open(file, O_RDONLY);
+		if (fd < 0 || fstat(fd, &st) < 0) {
+			fprintf(stderr, "capture: cannot open '%s': %s\n", file, strerror(errno));
+			if (fd >= 0) close(fd);
+			return -1;
+		}
+		r->size = st.st_size;
+		if (r->size > 0) {
+			void *base = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (base == MAP_FAILED) {
+				fprintf(stderr, "capture: cannot mmap '%s': %s\n", file, strerror(errno));
+				close(fd);
+				return -1;
+			}
+			madvise(base, r->size, MADV_SEQUENTIAL);
+			r->base = (const unsigned char *)base;
+		}
+		close(fd);  /* the mapping stays valid */
+	}
+#endif
+
+	if (r->size < 8) {
+		fprintf(stderr, "capture: '%s' is too short to be a capture file\n", file);
+		cap_close(r);
+		return -1;
+	}
+	memcpy(&magic, r->base, 4);
+	r->data_end = r->size;
+
+	if (memcmp(r->base, MCAP_MAGIC, 4) == 0) {
+		const mcap_file_hdr *fh = (const mcap_file_hdr *)r->base;
+		if (r->size < sizeof(*fh) || fh->version < 1 || fh->version > MCAP_VERSION) {
+			fprintf(stderr, "capture: '%s' has an unsupported mcap version\n", file);
+			cap_close(r);
+			return -1;
+		}
+		r->format = CAP_FORMAT_MCAP;
+		r->version = fh->version;
+		r->pos = r->start = fh->hdr_len;
+		if (fh->flags & MCAP_F_BLOCKS) {
+			if (fh->block_size < fh->hdr_len + sizeof(mcap_blk_hdr) || fh->block_size % MCAP_ALIGN != 0) {
+				fprintf(stderr, "capture: '%s' has a bad mcap block size\n", file);
+				cap_close(r);
+				return -1;
+			}
+			r->block_size = fh->block_size;
+			if (fh->flags & MCAP_F_PACKED) {
+				if (! cap_codec_ok(fh->codec)) {
+					fprintf(stderr, "capture: '%s' is compressed with %s, which this build cannot read\n",
+							file, cap_codec_name(fh->codec));
+					cap_close(r);
+					return -1;
+				}
+				r->codec = fh->codec;
+				if ((r->unpacked = (cap_unpacked *)calloc(1, sizeof(cap_unpacked))) == NULL) {
+					fprintf(stderr, "capture: out of memory\n");
+					cap_close(r);
+					return -1;
+				}
+			}
+			cap_mcap_trailer(r);
+			if (cap_enter_block(r, r->start) < 0) {
+				cap_close(r);
+				return -1;
+			}
+		}
+	}
+	else if (magic == PCAP_MAGIC_US || magic == PCAP_MAGIC_NS ||
+			cap_swap32(magic) == PCAP_MAGIC_US || cap_swap32(magic) == PCAP_MAGIC_NS) {
+		r->format = CAP_FORMAT_PCAP;
+		r->swapped = (magic != PCAP_MAGIC_US && magic != PCAP_MAGIC_NS);
+		if (r->size < 24) {
+			fprintf(stderr, "capture: '%s' has a truncated pcap header\n", file);
+			cap_close(r);
+			return -1;
+		}
+		r->if_units[0] = (cap_u32(r, r->base) == PCAP_MAGIC_NS) ? 1000000000 : 1000000;
+		r->if_linktype[0] = (int)(cap_u32(r, r->base + 20) & 0xffff);
+		r->num_ifs = 1;
+		r->pos = r->start = 24;
+	}
+	else if (magic == PCAPNG_SHB) {
+		r->format = CAP_FORMAT_PCAPNG;
+		r->pos = r->start = 0;  /* the SHB is parsed by cap_next() like any block */
+	}
+	else {
+		fprintf(stderr, "capture: '%s' is not an mcap, pcap or pcapng file\n", file);
+		cap_close(r);
+		return -1;
+	}
+	return 0;
+}  /* cap_open */
+
+
+static int cap_next_pcapng(cap_reader *r, cap_record *rec)
+{
+	while (r->pos + 12 <= r->size) {
+		const unsigned char *b = r->base + r->pos;
+		unsigned int type, blen;
+
+		memcpy(&type, b, 4);
+		if (type == PCAPNG_SHB) {
+			unsigned int bom;
+			memcpy(&bom, b + 8, 4);
+			r->swapped = (bom != PCAPNG_BOM);
+			r->num_ifs = 0;  /* interface ids are per section */
+		}
+		type = cap_u32(r, b);
+		blen = cap_u32(r, b + 4);
+		if (blen < 12 || (blen & 3) || r->pos + blen > r->size) {
+			fprintf(stderr, "capture: corrupt pcapng block at offset %lu\n", (unsigned long)r->pos);
+			return -1;
+		}
+		r->pos += blen;
+
+		if (type == PCAPNG_IDB && blen >= 20 && r->num_ifs < CAP_MAX_IFS) {
+			const unsigned char *opt = b + 16, *end = b + blen - 4;
+			int n = r->num_ifs++;
+			r->if_linktype[n] = cap_u16(r, b + 8);
+			r->if_units[n] = 1000000;  /* default if_tsresol: microseconds */
+			while (opt + 4 <= end) {
+				unsigned short code = cap_u16(r, opt), olen = cap_u16(r, opt + 2);
+				if (code == 0)
+					break;
+				if (code == 9 && olen >= 1) {  /* if_tsresol */
+					unsigned char res = opt[4];
+					int i;
+					if ((res & 0x7f) > ((res & 0x80) ? 63 : 18)) {  /* units would not fit 64 bits */
+						fprintf(stderr, "capture: pcapng interface at offset %lu has a bad if_tsresol 0x%02x\n",
+								(unsigned long)(r->pos - blen), res);
+						return -1;
+					}
+					r->if_units[n] = 1;
+					for (i = 0; i < (res & 0x7f); ++i)
+						r->if_units[n] *= (res & 0x80) ? 2 : 10;
+				}
+				opt += 4 + ((olen + 3) & ~3);
+			}
+			if (r->if_units[n] == 0) {  /* cap_ts_ns() divides by it */
+				fprintf(stderr, "capture: pcapng interface at offset %lu has no timestamp units\n",
+						(unsigned long)(r->pos - blen));
+				return -1;
+			}
+		}
+		else if (type == PCAPNG_EPB && blen >= 32) {
+			unsigned int ifid = cap_u32(r, b + 8);
+			unsigned long long ts = ((unsigned long long)cap_u32(r, b + 12) << 32) | cap_u32(r, b + 16);
+			int caplen = (int)cap_u32(r, b + 20);
+			if (ifid >= (unsigned int)r->num_ifs || caplen > (int)blen - 32)
+				continue;
+			r->last_ts_ns = cap_ts_ns(ts, r->if_units[ifid]);
+			if (cap_decode_frame(r->if_linktype[ifid], b + 28, caplen, rec)) {
+				rec->ts_ns = r->last_ts_ns;
+				return 1;
+			}
+		}
+		else if (type == PCAPNG_SPB && blen >= 16 && r->num_ifs > 0) {
+			/* no timestamp: reuse the previous packet's */
+			int caplen = (int)cap_u32(r, b + 8);
+			if (caplen > (int)blen - 16)
+				caplen = (int)blen - 16;
+			if (cap_decode_frame(r->if_linktype[0], b + 12, caplen, rec)) {
+				rec->ts_ns = r->last_ts_ns;
+				return 1;
+			}
+		}
+	}
+	return 0;
+}  /* cap_next_pcapng */
+
+
+/* Return the next UDP payload: 1 = got a record, 0 = end of file,
+ * -1 = corrupt file.  rec->data points into the mapping (no copy), or for
+ * a packed file into the decompressed block, valid until the reader (or a
+ * copy of it) moves on to another block. */
+int cap_next(cap_reader *r, cap_record *rec)
+{
+	memset(rec, 0, sizeof(*rec));
+
+	rec->seq = MCAP_NO_SEQ;
+
+	if (r->format == CAP_FORMAT_MCAP) {
+		const mcap_rec_hdr *rh;
+		size_t end = r->data_end;
+		if (r->block_size > 0) {
+			while (r->pos >= r->blk_end) {  /* on to the next block */
+				int n;
+				if (r->blk_next >= r->data_end)
+					return 0;
+				n = cap_enter_block(r, r->blk_next);
+				if (n <= 0)
+					return n;
+			}
+			end = r->blk_end;
+		}
+		if (r->pos + sizeof(mcap_rec_hdr) > end)
+			return 0;
+		if (r->codec != 0) {
+			if (r->unpacked->blk_off != r->blk_off && cap_unpack(r) < 0)
+				return -1;
+			rh = (const mcap_rec_hdr *)(r->unpacked->data + (r->pos - r->blk_off));
+		}
+		else
+			rh = (const mcap_rec_hdr *)(r->base + r->pos);
+		if (r->pos + sizeof(mcap_rec_hdr) + rh->len > end) {
+			if (r->block_size > 0 && r->codec == 0 && end == r->data_end) {
+				r->pos = end;
+				return 0;  /* the capture was cut short in this block */
+			}
+			fprintf(stderr, "capture: truncated mcap record at offset %lu\n", (unsigned long)r->pos);
+			return -1;
+		}
+		rec->data = (const char *)(rh + 1);
+		rec->len = (int)rh->len;
+		rec->ts_ns = rh->ts_ns;
+		if (r->version >= 2)
+			rec->seq = rh->seq;
+		rec->dst_addr = ((const mcap_file_hdr *)r->base)->group_addr;
+		rec->dst_port = ((const mcap_file_hdr *)r->base)->group_port;
+		rec->src_addr = rh->src_addr;
+		rec->src_port = rh->src_port;
+		r->pos += MCAP_REC_SIZE(rh->len);
+		return 1;
+	}
+
+	if (r->format == CAP_FORMAT_PCAP) {
+		while (r->pos + 16 <= r->data_end) {
+			const unsigned char *p = r->base + r->pos;
+			unsigned int sec = cap_u32(r, p), frac = cap_u32(r, p + 4);
+			int caplen = (int)cap_u32(r, p + 8);
+			if (caplen < 0 || r->pos + 16 + caplen > r->data_end) {
+				fprintf(stderr, "capture: truncated pcap record at offset %lu\n", (unsigned long)r->pos);
+				return -1;
+			}
+			r->pos += 16 + caplen;
+			if (cap_decode_frame(r->if_linktype[0], p + 16, caplen, rec)) {
+				rec->ts_ns = (TLONGLONG)sec * 1000000000 +
+					(TLONGLONG)frac * (1000000000 / (TLONGLONG)r->if_units[0]);
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	return cap_next_pcapng(r, rec);
+}  /* cap_next */
+
+
+/* Position the reader at the first record (in file order) with a time or
+ * seq of at least 'key'. */
+static int cap_seek(cap_reader *r, int by_seq, TLONGLONG key)
+{
+	cap_reader save;
+	cap_record rec;
+	int n;
+
+	if (r->format == CAP_FORMAT_MCAP && r->block_size > 0) {
+		int lo = 0, hi;
+		if (r->index == NULL && cap_build_index(r) < 0)
+			return -1;
+		/* the first block with anything at or past 'key': the maxima
+		 * never decrease, so a binary search finds it */
+		hi = r->num_index;
+		while (lo < hi) {
+			int mid = (lo + hi) / 2;
+			if ((by_seq ? (TLONGLONG)r->index[mid].seq_hi : r->index[mid].ns_hi) < key)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		if (lo == r->num_index) {
+			r->pos = r->blk_end = r->blk_next = r->data_end;
+			return 0;
+		}
+		if (cap_enter_block(r, (size_t)r->index[lo].off) < 0)
+			return -1;
+	}
+	else {
+		r->pos = r->start;
+		r->num_ifs = (r->format == CAP_FORMAT_PCAPNG) ? 0 : r->num_ifs;
+	}
+
+	for (;;) {
+		save = *r;
+		if ((n = cap_next(r, &rec)) <= 0)
+			return n;
+		if ((by_seq ? (TLONGLONG)rec.seq : rec.ts_ns) >= key) {
+			*r = save;  /* cap_next() returns it again */
+			return 1;
+		}
+	}
+}  /* cap_seek */
+
+
+/* Make the next record returned the first at or after 'ns' (ns since the
+ * epoch).  Returns 1, 0 if there is none (the reader is at the end), or
+ * -1 on error. */
+int cap_seek_ns(cap_reader *r, TLONGLONG ns)
+{
+	return cap_seek(r, 0, ns);
+}  /* cap_seek_ns */
+
+
+/* The same for the first record with msend sequence number 'seq' or
+ * later; only mcap version 2 files record them. */
+int cap_seek_seq(cap_reader *r, int seq)
+{
+	return cap_seek(r, 1, seq);
+}  /* cap_seek_seq */
+
+
+/* pcap or unblocked mcap: do CAP_RESYNC_CHAIN plausible records (or as
+ * many as there are to the end) start at 'pos'? */
+static int cap_chain_ok(const cap_reader *r, size_t pos, unsigned int snaplen, long long ref_sec)
+{
+	long long sec;
+	int i;
+
+	for (i = 0; i < CAP_RESYNC_CHAIN && pos < r->data_end; ++i) {
+		if (r->format == CAP_FORMAT_PCAP) {
+			const unsigned char *p = r->base + pos;
+			unsigned int caplen;
+			if (pos + 16 > r->data_end)
+				return 0;
+			sec = cap_u32(r, p);
+			caplen = cap_u32(r, p + 8);
+			if (caplen > snaplen || caplen > cap_u32(r, p + 12) || cap_u32(r, p + 4) >= r->if_units[0])
+				return 0;
+			pos += 16 + caplen;
+		}
+		else {
+			const mcap_rec_hdr *rh = (const mcap_rec_hdr *)(r->base + pos);
+			if (pos + sizeof(*rh) > r->data_end || rh->len > 65536 || rh->flags != 0)
+				return 0;
+			sec = rh->ts_ns / 1000000000;
+			pos += MCAP_REC_SIZE(rh->len);
+		}
+		if (sec < ref_sec - CAP_RESYNC_SECS || sec > ref_sec + CAP_RESYNC_SECS)
+			return 0;
+	}
+	return pos <= r->data_end;
+}  /* cap_chain_ok */
+
+
+/* Packed mcap: a decompression buffer for each of 'n' parts, freed by
+ * cap_close(r).  Returns n, or -1. */
+static int cap_split_unpacked(cap_reader *r, cap_reader *parts, int n)
+{
+	int i;
+
+	if (r->codec == 0 || n <= 0)
+		return n;
+	if (r->part_unpacked != NULL) {  /* from an earlier split */
+		for (i = 0; i < r->num_part_unpacked; ++i)
+			free(r->part_unpacked[i].data);
+		free(r->part_unpacked);
+	}
+	r->num_part_unpacked = n;
+	if ((r->part_unpacked = (cap_unpacked *)calloc(n, sizeof(cap_unpacked))) == NULL) {
+		fprintf(stderr, "capture: out of memory\n");
+		return -1;
+	}
+	for (i = 0; i < n; ++i)
+		parts[i].unpacked = &r->part_unpacked[i];
+	return n;
+}  /* cap_split_unpacked */
+
+
+/* Split the records into at most 'max_parts' consecutive ranges of about
+ * the same size, for reading in parallel: parts[i] reads range i only.
+ * Every record is in exactly one part.  The parts share the mapping of
+ * 'r' (do not cap_close() them).  A pcapng file is not split.  Returns
+ * the number of parts, or -1 on error. */
+int cap_split(cap_reader *r, cap_reader *parts, int max_parts)
+{
+	int n, i;
+
+	if (max_parts > 1 && r->format == CAP_FORMAT_MCAP && r->block_size > 0) {
+		if (r->index == NULL && cap_build_index(r) < 0)
+			return -1;
+		if (max_parts > r->num_index)
+			max_parts = r->num_index;
+		for (n = 0; n < max_parts; ++n) {
+			int first = (int)((long long)r->num_index * n / max_parts);
+			int next = (int)((long long)r->num_index * (n + 1) / max_parts);
+			parts[n] = *r;
+			parts[n].data_end = (next < r->num_index) ? (size_t)r->index[next].off : r->data_end;
+			if (cap_enter_block(&parts[n], (size_t)r->index[first].off) < 0)
+				return -1;
+		}
+		if (n > 0)
+			return cap_split_unpacked(r, parts, n);
+	}
+
+	parts[0] = *r;
+	parts[0].pos = r->start;
+	if (r->format == CAP_FORMAT_PCAPNG)
+		parts[0].num_ifs = 0;
+	else if (r->format == CAP_FORMAT_MCAP && r->block_size > 0)
+		return (cap_enter_block(&parts[0], r->start) < 0) ? -1 : cap_split_unpacked(r, parts, 1);
+	n = 1;
+	if (max_parts > 1 && (r->format == CAP_FORMAT_PCAP || r->format == CAP_FORMAT_MCAP) &&
+			r->start + 16 <= r->data_end) {
+		size_t span = (r->data_end - r->start) / max_parts, prev = r->start, pos, from, limit;
+		size_t step = (r->format == CAP_FORMAT_MCAP) ? MCAP_ALIGN : 1;
+		unsigned int snaplen = 0;
+		long long ref_sec;
+
+		if (r->format == CAP_FORMAT_PCAP) {
+			snaplen = cap_u32(r, r->base + 16);
+			if (snaplen == 0)
+				snaplen = 262144;  /* not set by some writers */
+			ref_sec = cap_u32(r, r->base + r->start);
+		}
+		else
+			ref_sec = ((const mcap_rec_hdr *)(r->base + r->start))->ts_ns / 1000000000;
+		for (i = 1; i < max_parts; ++i) {
+			from = (r->start + span * i + step - 1) / step * step;
+			limit = (from + CAP_RESYNC_SCAN < r->data_end) ? from + CAP_RESYNC_SCAN : r->data_end;
+			if (from <= prev)
+				continue;
+			for (pos = from; pos < limit; pos += step) {
+				if (cap_chain_ok(r, pos, snaplen, ref_sec))
+					break;
+			}
+			if (pos >= limit)
+				continue;  /* the part before takes this range too */
+			parts[n - 1].data_end = pos;
+			parts[n] = *r;
+			parts[n].pos = pos;
+			prev = pos;
+			++n;
+		}
+	}
+	return n;
+}  /* cap_split */
+
+
+void cap_close(cap_reader *r)
+{
+	int i;
+
+	free(r->index_built);
+	if (r->unpacked != NULL) {
+		free(r->unpacked->data);
+		free(r->unpacked);
+	}
+	for (i = 0; i < r->num_part_unpacked; ++i)
+		free(r->part_unpacked[i].data);
+	free(r->part_unpacked);
+	if (r->base != NULL) {
+#if defined(_WIN32)
+		free((void *)r->base);
+#else
+		munmap((void *)r->base, r->size);
+#endif
+	}
+	memset(r, 0, sizeof(*r));
+}  /* cap_close */
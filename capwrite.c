@@ -0,0 +1,1139 @@
+/* capwrite.c */
+/*   Capture file writer for 'mdump -O': the receive loop copies datagrams
+ * (raw, or framed as mcap records) into large aligned buffers, and a
+ * writer thread puts full buffers on disk, rotating files by size or time
+ * and removing old ones.  An mcap file is written in blocks, one per
+ * buffer, and ends with an index of them.  Optionally, packer threads
+ * compress each buffer on its own before it is written.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted without restriction.
+ *
+  THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+  EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+  NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+  PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+  UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+  BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+  INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+  TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+  THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+/* The buffers are used in strict rotation, so the two threads share no
+ * lock on the data path: the receive side owns buffer 'filled % num_bufs'
+ * and hands it over by bumping 'filled'; the writer gives it back by
+ * bumping 'written'.  A raw record may straddle two buffers, but a file
+ * always starts at the start of a buffer, so every write is CAPW_BUF_SIZE
+ * bytes at a CAPW_BUF_SIZE offset, except the last of each file, which is
+ * padded to CAPW_ALIGN (for O_DIRECT) and then truncated back.  When every
+ * buffer is waiting for the disk, records are dropped and counted; the
+ * receive loop never waits.
+ *   In mcap, each buffer is one block: the receive side keeps the block
+ * header at its start up to date record by record, and moves on to the
+ * next buffer (zeroing the rest) rather than split a record.  The writer
+ * thread collects the block headers as it writes them, and appends the
+ * index and trailer when it closes the file (see mtools.h).
+ *   Compressing (lz4, zstd), the packer threads take the buffers handed
+ * over in turn and compress each into its own 'out' buffer: an mcap block
+ * becomes a packed block, raw bytes one lz4/zstd frame, so a file is
+ * still a plain stream of frames for the lz4/zstd tools.  They finish in
+ * any order; the writer waits for the oldest and writes what comes out,
+ * through the page cache (the sizes are no longer whole pages).  The
+ * receive side does not wait for them either: a slow packer holds its
+ * buffer like a slow disk would, and drops are counted against it. */
+
+#if defined(__linux__)
+#define _GNU_SOURCE  /* fallocate, sync_file_range, O_DIRECT */
+#endif
+
+#include "mtools.h"
+
+#if defined(_WIN32)
+#include <malloc.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+#if defined(HAVE_LZ4)
+#include <lz4frame.h>
+#endif
+#if defined(HAVE_ZSTD)
+#include <zstd.h>
+#endif
+
+#if defined(_MSC_VER)
+#define capw_load(p) InterlockedCompareExchange64((volatile LONGLONG *)(p), 0, 0)
+#define capw_store(p, v) InterlockedExchange64((volatile LONGLONG *)(p), (v))
+#define capw_load_sc(p) capw_load(p)
+#define capw_store_sc(p, v) capw_store(p, v)
+#else
+#define capw_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define capw_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+/* the stop handshake: each side's store must be seen before its next load */
+#define capw_load_sc(p) __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define capw_store_sc(p, v) __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+#endif
+
+#define CAPW_POLL_MS 100  /* writer looks for a stop request this often */
+#define CAPW_ZSTD_LEVEL 1  /* fast enough for line rate on one or two cores */
+
+struct capw_packer {
+    cap_writer *w;
+#if defined(_WIN32)
+    HANDLE thread;
+#else
+    pthread_t thread;
+#endif
+#if defined(HAVE_LZ4)
+    LZ4F_cctx *lz4;
+#endif
+#if defined(HAVE_ZSTD)
+    ZSTD_CCtx *zstd;
+#endif
+};
+
+static cap_writer *signal_writer;  /* capw_stop_signal() */
+static volatile sig_atomic_t signal_num;
+
+
+/* Compress with 'tok' ("lz4" or "zstd") at 'level', if built in. */
+static int capw_codec(cap_writer *w, const char *tok, int level)
+{
+	(void)w;  (void)level;  /* unused without lz4 and zstd */
+	if (strcmp(tok, "lz4") == 0) {
+#if defined(HAVE_LZ4)
+		w->codec = MCAP_CODEC_LZ4;
+		w->level = level;
+		return 0;
+#else
+		fprintf(stderr, "capwrite: lz4 is not built in (HAVE_LZ4)\n");
+		return -1;
+#endif
+	}
+#if defined(HAVE_ZSTD)
+	w->codec = MCAP_CODEC_ZSTD;
+	w->level = (level >= 0) ? level : CAPW_ZSTD_LEVEL;
+	return 0;
+#else
+	fprintf(stderr, "capwrite: zstd is not built in (HAVE_ZSTD)\n");
+	return -1;
+#endif
+}  /* capw_codec */
+
+
+/* Parse the -R spec: comma-separated size=bytes[k|m|g], time=secs,
+ * keep=files, bufs=count, direct, lz4[=level], zstd[=level],
+ * packers=threads.  Returns 0, or -1 after printing why. */
+int capw_parse(cap_writer *w, const char *spec)
+{
+	char buf[256], *tok, *val, *end;
+	double num;
+
+	if (strlen(spec) >= sizeof(buf)) {
+		fprintf(stderr, "capwrite: rotation spec too long\n");
+		return -1;
+	}
+	strcpy(buf, spec);
+	for (tok = strtok(buf, ","); tok != NULL; tok = strtok(NULL, ",")) {
+		if (strcmp(tok, "direct") == 0) {
+			w->direct = 1;
+			continue;
+		}
+		if (strcmp(tok, "lz4") == 0 || strcmp(tok, "zstd") == 0) {
+			if (capw_codec(w, tok, (tok[0] == 'l') ? 0 : -1) < 0)  /* default level */
+				return -1;
+			continue;
+		}
+		if ((val = strchr(tok, '=')) == NULL) {
+			fprintf(stderr, "capwrite: expected key=value, not '%s'\n", tok);
+			return -1;
+		}
+		*val++ = '\0';
+		num = strtod(val, &end);
+		if (end == val || num < 0) {
+			fprintf(stderr, "capwrite: bad %s value '%s'\n", tok, val);
+			return -1;
+		}
+		if (strcmp(tok, "size") == 0) {
+			if (*end == 'k' || *end == 'K')  num *= 1024;
+			else if (*end == 'm' || *end == 'M')  num *= 1024 * 1024;
+			else if (*end == 'g' || *end == 'G')  num *= 1024.0 * 1024 * 1024;
+			if (num < CAPW_BUF_SIZE) {
+				fprintf(stderr, "capwrite: size must be at least %d bytes\n", CAPW_BUF_SIZE);
+				return -1;
+			}
+			w->rotate_bytes = (long long)num;
+		}
+		else if (strcmp(tok, "time") == 0 && num >= 1)
+			w->rotate_secs = (int)num;
+		else if (strcmp(tok, "keep") == 0 && num >= 1)
+			w->keep = (int)num;
+		else if (strcmp(tok, "bufs") == 0 && num >= 2)
+			w->num_bufs = (int)num;
+		else if ((strcmp(tok, "lz4") == 0 || strcmp(tok, "zstd") == 0) && num <= 22) {
+			if (capw_codec(w, tok, (int)num) < 0)
+				return -1;
+		}
+		else if (strcmp(tok, "packers") == 0 && num >= 1 && num <= CAPW_MAX_PACKERS)
+			w->num_packers = (int)num;
+		else {
+			fprintf(stderr, "capwrite: unknown or out of range: %s=%s\n", tok, val);
+			return -1;
+		}
+	}
+	if (w->direct && w->codec != 0) {
+		fprintf(stderr, "capwrite: direct cannot be used with lz4 or zstd\n");
+		return -1;
+	}
+	return 0;
+}  /* capw_parse */
+
+
+/* File 'num' of the run, started at 'secs': template 'tmpl' with %N
+ * replaced by the number and everything else by strftime. */
+void cap_file_name(const char *tmpl, char *name, size_t size, unsigned int num, time_t secs)
+{
+	char fmt[CAPW_MAX_NAME + 16], *out = fmt;
+	const char *in;
+
+	for (in = tmpl; *in != '\0' && out < fmt + sizeof(fmt) - 12; ++in) {
+		if (in[0] == '%' && in[1] == 'N') {
+			out += sprintf(out, "%06u", num);
+			++in;
+		}
+		else if (in[0] == '%' && in[1] == '%') {
+			*out++ = *in++;
+			*out++ = *in;
+		}
+		else
+			*out++ = *in;
+	}
+	*out = '\0';
+	if (strftime(name, size, fmt, localtime(&secs)) == 0) {  /* expanded to nothing or too long */
+		strncpy(name, tmpl, size - 1);
+		name[size - 1] = '\0';
+	}
+}  /* cap_file_name */
+
+
+/* The mcap file header; 'block_size' 0 if the records are not in blocks,
+ * 'codec' 0 if the blocks are not packed. */
+void cap_mcap_header(mcap_file_hdr *fh, unsigned long groupaddr, unsigned short groupport,
+		unsigned int block_size, int codec)
+{
+	memset(fh, 0, sizeof(*fh));
+	memcpy(fh->magic, MCAP_MAGIC, 4);
+	fh->version = (codec != 0) ? MCAP_VERSION : 2;
+	fh->hdr_len = sizeof(*fh);
+	if (block_size > 0)
+		fh->flags = MCAP_F_BLOCKS;
+	if (codec != 0) {
+		fh->flags |= MCAP_F_PACKED;
+		fh->codec = (unsigned short)codec;
+	}
+	fh->block_size = block_size;
+	fh->group_addr = (unsigned int)groupaddr;
+	fh->group_port = htons(groupport);
+}  /* cap_mcap_header */
+
+
+static int capw_open_file(cap_writer *w, capw_buf *b)
+{
+	char *name = w->names[w->num_files % w->keep_slots];
+
+	cap_file_name(w->name, name, CAPW_MAX_NAME, b->file_num, b->file_secs);
+	w->file_off = 0;
+	w->file_len = 0;
+	w->num_index = 0;
+	if (w->max_index < 0)
+		w->max_index = 0;  /* try again */
+#if defined(_WIN32)
+	w->fh = CreateFileA(name, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, CREATE_ALWAYS,
+			FILE_ATTRIBUTE_NORMAL | (w->direct ? FILE_FLAG_NO_BUFFERING : 0), NULL);
+	if (w->fh == INVALID_HANDLE_VALUE) {
+		fprintf(stderr, "capwrite: open %s: %d\n", name, GetLastError());
+		return -1;
+	}
+	if (w->rotate_bytes > 0) {
+		FILE_ALLOCATION_INFO fai;
+		fai.AllocationSize.QuadPart = w->rotate_bytes;
+		SetFileInformationByHandle(w->fh, FileAllocationInfo, &fai, sizeof(fai));
+	}
+#else
+	w->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC
+#if defined(O_DIRECT)
+			| (w->direct ? O_DIRECT : 0)
+#endif
+			, 0644);
+#if defined(O_DIRECT)
+	if (w->fd < 0 && errno == EINVAL && w->direct) {  /* e.g. tmpfs */
+		fprintf(stderr, "capwrite: %s: O_DIRECT not supported here, writing through the page cache\n", name);
+		w->direct = 0;
+		w->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	}
+#endif
+	if (w->fd < 0) {
+		fprintf(stderr, "capwrite: open %s: %s\n", name, strerror(errno));
+		return -1;
+	}
+#if defined(__linux__)
+	/* reserve the whole file up front (size unchanged until written) */
+	if (w->rotate_bytes > 0 && fallocate(w->fd, FALLOC_FL_KEEP_SIZE, 0, w->rotate_bytes) < 0 &&
+			errno != EOPNOTSUPP && ! w->warned_prealloc) {
+		fprintf(stderr, "capwrite: fallocate %s: %s\n", name, strerror(errno));
+		w->warned_prealloc = 1;
+	}
+#endif
+#endif
+	++w->num_files;
+	w->file_open = 1;
+	return 0;
+}  /* capw_open_file */
+
+
+/* Write 'len' bytes at the current offset, 'len' a multiple of CAPW_ALIGN
+ * unless the file is written through the page cache. */
+static int capw_write_at(cap_writer *w, const char *data, size_t len)
+{
+	TLONGLONG t0 = mt_clock_ns(), t;
+	size_t done = 0;
+
+	while (done < len) {
+#if defined(_WIN32)
+		DWORD n;
+		if (! WriteFile(w->fh, data + done, (DWORD)(len - done), &n, NULL)) {
+			fprintf(stderr, "capwrite: write: %d\n", GetLastError());
+			return -1;
+		}
+#else
+		ssize_t n = pwrite(w->fd, data + done, len - done, (off_t)(w->file_off + done));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			fprintf(stderr, "capwrite: write: %s\n", (n < 0) ? strerror(errno) : "no space");
+			return -1;
+		}
+#endif
+		done += n;
+	}
+#if defined(__linux__)
+	/* Through the page cache, start writeback now and drop the previous
+	 * buffer's pages once on disk, so dirty pages never pile up into the
+	 * long writeback stalls that made -O lose datagrams. */
+	if (! w->direct) {
+		sync_file_range(w->fd, (off_t)w->file_off, len, SYNC_FILE_RANGE_WRITE);
+		if (w->file_off >= CAPW_BUF_SIZE) {
+			sync_file_range(w->fd, (off_t)(w->file_off - CAPW_BUF_SIZE), CAPW_BUF_SIZE,
+					SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+			posix_fadvise(w->fd, (off_t)(w->file_off - CAPW_BUF_SIZE), CAPW_BUF_SIZE, POSIX_FADV_DONTNEED);
+		}
+	}
+#endif
+	w->file_off += len;
+	t = mt_clock_ns() - t0;
+	if (t > w->max_write_ns)
+		w->max_write_ns = t;
+	return 0;
+}  /* capw_write_at */
+
+
+/* mcap: note the block at the start of 'b' (after the file header if it
+ * starts the file), before it is written. */
+static void capw_index_block(cap_writer *w, capw_buf *b)
+{
+	const mcap_blk_hdr *bh = (const mcap_blk_hdr *)(b->data + (b->start_file ? sizeof(mcap_file_hdr) : 0));
+	mcap_idx_ent *e;
+
+	if (w->max_index < 0 || memcmp(bh->magic, MCAP_BLK_MAGIC, 4) != 0)
+		return;
+	if (w->num_index == w->max_index) {
+		int n = (w->max_index > 0) ? w->max_index * 2 : 256;
+		e = (mcap_idx_ent *)realloc(w->index, n * sizeof(mcap_idx_ent));
+		if (e == NULL) {  /* no index for this file; readers rebuild it */
+			w->num_index = 0;
+			w->max_index = -1;
+			return;
+		}
+		w->index = e;
+		w->max_index = n;
+	}
+	e = &w->index[w->num_index];
+	e->off = w->file_off + ((const char *)bh - b->data);
+	e->first_ns = bh->first_ns;
+	e->ns_hi = bh->last_ns;
+	e->seq_hi = bh->seq_hi;
+	e->num_recs = bh->num_recs;
+	if (w->num_index > 0) {  /* running maxima, for the binary search */
+		if (e[-1].ns_hi > e->ns_hi)
+			e->ns_hi = e[-1].ns_hi;
+		if (e[-1].seq_hi > e->seq_hi)
+			e->seq_hi = e[-1].seq_hi;
+	}
+	++w->num_index;
+}  /* capw_index_block */
+
+
+/* mcap: the index and trailer, after the last block. */
+static void capw_write_index(cap_writer *w)
+{
+	size_t len = w->num_index * sizeof(mcap_idx_ent);
+	mcap_trailer t;
+
+	if (w->num_index > 0 && ! w->write_failed) {
+		memset(&t, 0, sizeof(t));
+		memcpy(t.magic, MCAP_IDX_MAGIC, 4);
+		t.num_ents = w->num_index;
+		t.idx_off = w->file_len;
+		w->file_off = w->file_len;
+		if (capw_write_at(w, (const char *)w->index, len) == 0 &&
+				capw_write_at(w, (const char *)&t, sizeof(t)) == 0)
+			w->file_len += len + sizeof(t);
+	}
+	w->num_index = 0;
+}  /* capw_write_index */
+
+
+/* Cut the file to what was really written (dropping the padding and the
+ * unused preallocation), add the index, close it, and remove the oldest
+ * beyond 'keep'. */
+static void capw_close_file(cap_writer *w)
+{
+	if (! w->file_open)
+		return;
+#if defined(_WIN32)
+	{
+		LARGE_INTEGER pos;
+		if (w->direct) {  /* the size cannot be set on an unbuffered handle */
+			CloseHandle(w->fh);
+			w->fh = CreateFileA(w->names[(w->num_files - 1) % w->keep_slots], GENERIC_WRITE,
+					FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		}
+		pos.QuadPart = w->file_len;
+		if (w->fh != INVALID_HANDLE_VALUE) {
+			SetFilePointerEx(w->fh, pos, NULL, FILE_BEGIN);
+			capw_write_index(w);
+			SetEndOfFile(w->fh);
+			CloseHandle(w->fh);
+		}
+	}
+#else
+#if defined(O_DIRECT)
+	if (w->direct && w->num_index > 0)  /* the index is not whole pages */
+		fcntl(w->fd, F_SETFL, fcntl(w->fd, F_GETFL) & ~O_DIRECT);
+#endif
+	capw_write_index(w);
+	if (ftruncate(w->fd, (off_t)w->file_len) < 0)
+		fprintf(stderr, "capwrite: ftruncate: %s\n", strerror(errno));
+	close(w->fd);
+#endif
+	w->file_open = 0;
+	if (w->keep > 0 && w->num_files > (unsigned int)w->keep) {
+		const char *old = w->names[(w->num_files - 1 - w->keep) % w->keep_slots];
+#if defined(_WIN32)
+		DeleteFileA(old);
+#else
+		unlink(old);
+#endif
+	}
+}  /* capw_close_file */
+
+
+/* Put one buffer on disk: 'len' bytes (or what they were packed into), of
+ * which the last of a file is padded out for O_DIRECT. */
+static void capw_write_buf(cap_writer *w, capw_buf *b, size_t len)
+{
+	const char *data = b->data;
+	size_t raw_len = len, wlen;
+
+	if (w->codec != 0) {
+		data = b->out;
+		len = b->out_len;
+	}
+	wlen = len;
+	if (b->start_file) {
+		capw_close_file(w);
+		if (capw_open_file(w, b) < 0)
+			w->write_failed = 1;
+		else
+			w->write_failed = 0;
+	}
+	if (w->file_open && ! w->write_failed && len > 0) {
+		if (w->format == CAPW_FORMAT_MCAP)
+			capw_index_block(w, b);
+		if (w->direct && len % CAPW_ALIGN != 0) {
+			wlen = (len + CAPW_ALIGN - 1) & ~((size_t)CAPW_ALIGN - 1);
+			memset(b->data + len, 0, wlen - len);
+		}
+		if (capw_write_at(w, data, wlen) < 0)
+			w->write_failed = 1;  /* drop the rest of this file */
+		else
+			w->file_len += len;
+	}
+	if (w->write_failed || (len == 0 && raw_len > 0))  /* or not packed */
+		w->lost_bytes += raw_len;
+	if (b->end_file)
+		capw_close_file(w);
+}  /* capw_write_buf */
+
+
+#if defined(HAVE_LZ4)
+static void capw_lz4_prefs(const cap_writer *w, LZ4F_preferences_t *prefs, size_t len)
+{
+	memset(prefs, 0, sizeof(*prefs));
+	prefs->frameInfo.contentSize = len;
+	prefs->compressionLevel = w->level;
+}  /* capw_lz4_prefs */
+#endif
+
+
+/* Room for a buffer once packed, whatever it holds. */
+static size_t capw_out_size(const cap_writer *w)
+{
+	size_t n = CAPW_BUF_SIZE;
+
+	(void)w;  /* unused without lz4 and zstd */
+#if defined(HAVE_LZ4)
+	if (w->codec == MCAP_CODEC_LZ4) {
+		LZ4F_preferences_t prefs;
+		capw_lz4_prefs(w, &prefs, CAPW_BUF_SIZE);
+		n = LZ4F_compressFrameBound(CAPW_BUF_SIZE, &prefs);
+	}
+#endif
+#if defined(HAVE_ZSTD)
+	if (w->codec == MCAP_CODEC_ZSTD)
+		n = ZSTD_compressBound(CAPW_BUF_SIZE);
+#endif
+	return n + sizeof(mcap_file_hdr) + sizeof(mcap_pblk_hdr) + MCAP_ALIGN;
+}  /* capw_out_size */
+
+
+/* One lz4/zstd frame of 'len' bytes into 'dst': its length, or 0. */
+static size_t capw_compress(struct capw_packer *p, char *dst, size_t room, const char *src, size_t len)
+{
+	size_t n = 0;
+
+	(void)p;  (void)dst;  (void)room;  (void)src;  (void)len;  /* unused without lz4 and zstd */
+#if defined(HAVE_LZ4)
+	if (p->w->codec == MCAP_CODEC_LZ4) {
+		LZ4F_preferences_t prefs;
+		size_t m;
+		capw_lz4_prefs(p->w, &prefs, len);
+		n = LZ4F_compressBegin(p->lz4, dst, room, &prefs);
+		if (LZ4F_isError(n))
+			return 0;
+		m = LZ4F_compressUpdate(p->lz4, dst + n, room - n, src, len, NULL);
+		if (LZ4F_isError(m))
+			return 0;
+		n += m;
+		m = LZ4F_compressEnd(p->lz4, dst + n, room - n, NULL);
+		n = LZ4F_isError(m) ? 0 : n + m;
+	}
+#endif
+#if defined(HAVE_ZSTD)
+	if (p->w->codec == MCAP_CODEC_ZSTD) {
+		n = ZSTD_compressCCtx(p->zstd, dst, room, src, len, p->w->level);
+		if (ZSTD_isError(n))
+			n = 0;
+	}
+#endif
+	return n;
+}  /* capw_compress */
+
+
+/* Compress the first 'len' bytes of 'b' into b->out: mcap as the file
+ * header (if any) and one packed block, kept as it is if it does not
+ * shrink; raw as one frame (out_len 0 if that failed). */
+static void capw_pack(struct capw_packer *p, capw_buf *b, size_t len)
+{
+	cap_writer *w = p->w;
+	const char *src = b->data;
+	char *dst = b->out;
+	size_t n, in = len;
+
+	if (len > 0 && w->format == CAPW_FORMAT_MCAP) {
+		size_t pre = b->start_file ? sizeof(mcap_file_hdr) : 0;
+		const mcap_blk_hdr *bh = (const mcap_blk_hdr *)(b->data + pre);
+		mcap_pblk_hdr *ph = (mcap_pblk_hdr *)(b->out + pre);
+		memcpy(b->out, b->data, pre);
+		memset(ph, 0, sizeof(*ph));
+		ph->blk = *bh;
+		memcpy(ph->blk.magic, MCAP_PBLK_MAGIC, 4);
+		src = (const char *)(bh + 1);
+		in = bh->len - sizeof(*bh);
+		if (in > len - pre - sizeof(*bh))  /* stopped in the middle of a record */
+			in = len - pre - sizeof(*bh);
+		ph->blk.len = (unsigned int)(in + sizeof(*bh));
+		dst = (char *)(ph + 1);
+		n = capw_compress(p, dst, w->out_size - (dst - b->out), src, in);
+		ph->codec = w->codec;
+		if (n == 0 || n >= in) {
+			memcpy(dst, src, in);
+			n = in;
+			ph->codec = MCAP_CODEC_NONE;
+		}
+		ph->packed_len = (unsigned int)n;
+		while (n % MCAP_ALIGN != 0)
+			dst[n++] = 0;
+	}
+	else
+		n = (len > 0) ? capw_compress(p, dst, w->out_size, src, in) : 0;
+	b->out_len = (n > 0) ? (dst - b->out) + n : 0;
+}  /* capw_pack */
+
+
+static void capw_pack_run(struct capw_packer *p)
+{
+	cap_writer *w = p->w;
+	TLONGLONG i, t0;
+	capw_buf *b;
+
+	for (;;) {
+#if defined(_WIN32)
+		EnterCriticalSection(&w->lock);
+		while ((i = w->pack_next) == capw_load(&w->filled) && ! w->done)
+			SleepConditionVariableCS(&w->pack_cond, &w->lock, INFINITE);
+#else
+		pthread_mutex_lock(&w->lock);
+		while ((i = w->pack_next) == capw_load(&w->filled) && ! w->done)
+			pthread_cond_wait(&w->pack_cond, &w->lock);
+#endif
+		if (i < capw_load(&w->filled))
+			w->pack_next = i + 1;
+		else
+			i = -1;  /* done, and nothing left */
+#if defined(_WIN32)
+		LeaveCriticalSection(&w->lock);
+#else
+		pthread_mutex_unlock(&w->lock);
+#endif
+		if (i < 0)
+			return;
+
+		b = &w->bufs[i % w->num_bufs];
+		t0 = mt_clock_ns();
+		capw_pack(p, b, b->len);
+
+		/* the totals are shared with the other packers */
+#if defined(_WIN32)
+		EnterCriticalSection(&w->lock);
+#else
+		pthread_mutex_lock(&w->lock);
+#endif
+		w->pack_ns += mt_clock_ns() - t0;
+		w->pack_in += b->len;
+		w->pack_out += b->out_len;
+		capw_store(&w->packs_done, w->packs_done + 1);
+		capw_store(&b->packed, i + 1);
+#if defined(_WIN32)
+		WakeConditionVariable(&w->cond);
+		LeaveCriticalSection(&w->lock);
+#else
+		pthread_cond_signal(&w->cond);
+		pthread_mutex_unlock(&w->lock);
+#endif
+	}
+}  /* capw_pack_run */
+
+
+#if defined(_WIN32)
+static DWORD WINAPI capw_pack_thread(LPVOID arg)
+{
+	capw_pack_run((struct capw_packer *)arg);
+	return 0;
+}  /* capw_pack_thread */
+#else
+static void *capw_pack_thread(void *arg)
+{
+	capw_pack_run((struct capw_packer *)arg);
+	return NULL;
+}  /* capw_pack_thread */
+#endif
+
+
+/* Is the oldest buffer not written yet ready to write? */
+static int capw_ready(cap_writer *w)
+{
+	return w->written < capw_load(&w->filled) &&
+		(w->codec == 0 || capw_load(&w->bufs[w->written % w->num_bufs].packed) == w->written + 1);
+}  /* capw_ready */
+
+
+/* Everything handed over (and packed), then (on a stop) what is in the
+ * buffer being filled, up to the last complete record, waiting for the
+ * packers if need be. */
+static void capw_drain(cap_writer *w, int final)
+{
+	TLONGLONG filled = capw_load(&w->filled);
+
+	while (w->written < filled) {
+		capw_buf *b = &w->bufs[w->written % w->num_bufs];
+		if (! capw_ready(w)) {
+			if (! final)
+				break;
+			SLEEP_MSEC(1);
+			continue;
+		}
+		capw_write_buf(w, b, b->len);
+		capw_store(&w->written, w->written + 1);
+	}
+	if (final) {
+		capw_buf *b = &w->bufs[filled % w->num_bufs];
+		size_t len = (size_t)capw_load(&w->committed);
+		if (len > 0) {
+			b->end_file = 1;
+			if (w->codec != 0) {  /* with the writer's own packer */
+				capw_pack(&w->packers[w->num_packers], b, len);
+				w->pack_in += len;
+				w->pack_out += b->out_len;
+			}
+			capw_write_buf(w, b, len);
+		}
+		else
+			capw_close_file(w);
+	}
+}  /* capw_drain */
+
+
+static void capw_run(cap_writer *w)
+{
+	for (;;) {
+#if defined(_WIN32)
+		EnterCriticalSection(&w->lock);
+		while (! capw_ready(w) && ! (w->done && w->written == capw_load(&w->filled)) && signal_num == 0)
+			SleepConditionVariableCS(&w->cond, &w->lock, CAPW_POLL_MS);
+		LeaveCriticalSection(&w->lock);
+#else
+		pthread_mutex_lock(&w->lock);
+		while (! capw_ready(w) && ! (w->done && w->written == capw_load(&w->filled)) && signal_num == 0) {
+			struct timespec ts;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += CAPW_POLL_MS * 1000000;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&w->cond, &w->lock, &ts);
+		}
+		pthread_mutex_unlock(&w->lock);
+#endif
+		if (signal_num != 0) {
+			/* stop taking records, wait for one in progress to
+			 * finish, and write out what there is */
+			capw_store_sc(&w->closing, 1);
+			while (capw_load_sc(&w->recording))
+				SLEEP_MSEC(1);
+			capw_drain(w, 1);
+			signal(signal_num, SIG_DFL);
+			raise(signal_num);
+			return;
+		}
+		capw_drain(w, 0);
+		if (w->done && w->written == capw_load(&w->filled))
+			return;
+	}
+}  /* capw_run */
+
+
+#if defined(_WIN32)
+static DWORD WINAPI capw_thread(LPVOID arg)
+{
+	capw_run((cap_writer *)arg);
+	return 0;
+}  /* capw_thread */
+#else
+static void *capw_thread(void *arg)
+{
+	capw_run((cap_writer *)arg);
+	return NULL;
+}  /* capw_thread */
+#endif
+
+
+/* Start writing 'name' (a template if rotating, see cap_file_name) in
+ * 'format' (CAPW_FORMAT_xxx), with the settings from capw_parse() already
+ * in 'w' (or zero).  Returns 0, or -1 after printing why. */
+int capw_open(cap_writer *w, const char *name, int format, unsigned long groupaddr,
+		unsigned short groupport)
+{
+	int i;
+
+	if (strlen(name) + 4 >= CAPW_MAX_NAME) {
+		fprintf(stderr, "capwrite: file name too long\n");
+		return -1;
+	}
+	strcpy(w->name, name);
+	if ((w->rotate_bytes > 0 || w->rotate_secs > 0) && strstr(name, "%N") == NULL)
+		strcat(w->name, ".%N");  /* every file gets its own name */
+	w->format = format;
+	w->groupaddr = groupaddr;
+	w->groupport = groupport;
+	if (w->num_bufs == 0)
+		w->num_bufs = CAPW_DEFAULT_BUFS;
+	if (w->num_packers == 0)
+		w->num_packers = CAPW_DEFAULT_PACKERS;
+	w->start_ns = mt_clock_ns();
+	w->keep_slots = (w->keep > 0) ? w->keep + 1 : 1;
+	w->names = (char (*)[CAPW_MAX_NAME])calloc(w->keep_slots, CAPW_MAX_NAME);
+	w->bufs = (capw_buf *)calloc(w->num_bufs, sizeof(capw_buf));
+	if (w->names == NULL || w->bufs == NULL) {
+		fprintf(stderr, "capwrite: out of memory\n");
+		return -1;
+	}
+	for (i = 0; i < w->num_bufs; ++i) {
+		/* aligned for O_DIRECT, with room to pad the last write */
+#if defined(_WIN32)
+		w->bufs[i].data = (char *)_aligned_malloc(CAPW_BUF_SIZE + CAPW_ALIGN, CAPW_ALIGN);
+#else
+		if (posix_memalign((void **)&w->bufs[i].data, CAPW_ALIGN, CAPW_BUF_SIZE + CAPW_ALIGN) != 0)
+			w->bufs[i].data = NULL;
+#endif
+		if (w->codec != 0) {
+			w->out_size = capw_out_size(w);
+			w->bufs[i].out = (char *)malloc(w->out_size);
+		}
+		if (w->bufs[i].data == NULL || (w->codec != 0 && w->bufs[i].out == NULL)) {
+			fprintf(stderr, "capwrite: out of memory for %d buffers\n", w->num_bufs);
+			return -1;
+		}
+	}
+	w->new_file = 1;
+
+#if defined(_WIN32)
+	InitializeCriticalSection(&w->lock);
+	InitializeConditionVariable(&w->cond);
+	InitializeConditionVariable(&w->pack_cond);
+#else
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->cond, NULL);
+	pthread_cond_init(&w->pack_cond, NULL);
+#endif
+	if (w->codec != 0) {
+		/* the last packer is the writer's, for the final buffer on a stop */
+		w->packers = (struct capw_packer *)calloc(w->num_packers + 1, sizeof(struct capw_packer));
+		if (w->packers == NULL) {
+			fprintf(stderr, "capwrite: out of memory\n");
+			return -1;
+		}
+		for (i = 0; i <= w->num_packers; ++i) {
+			struct capw_packer *p = &w->packers[i];
+			p->w = w;
+#if defined(HAVE_LZ4)
+			if (w->codec == MCAP_CODEC_LZ4 && LZ4F_isError(LZ4F_createCompressionContext(&p->lz4, LZ4F_VERSION))) {
+				fprintf(stderr, "capwrite: cannot create an lz4 context\n");
+				return -1;
+			}
+#endif
+#if defined(HAVE_ZSTD)
+			if (w->codec == MCAP_CODEC_ZSTD && (p->zstd = ZSTD_createCCtx()) == NULL) {
+				fprintf(stderr, "capwrite: cannot create a zstd context\n");
+				return -1;
+			}
+#endif
+			if (i == w->num_packers)
+				break;
+#if defined(_WIN32)
+			if ((p->thread = CreateThread(NULL, 0, capw_pack_thread, p, 0, NULL)) == NULL) {
+				fprintf(stderr, "capwrite: CreateThread: %d\n", GetLastError());
+				return -1;
+			}
+#else
+			if ((errno = pthread_create(&p->thread, NULL, capw_pack_thread, p)) != 0) {
+				fprintf(stderr, "capwrite: pthread_create: %s\n", strerror(errno));
+				return -1;
+			}
+#endif
+		}
+	}
+
+#if defined(_WIN32)
+	if ((w->thread = CreateThread(NULL, 0, capw_thread, w, 0, NULL)) == NULL) {
+		fprintf(stderr, "capwrite: CreateThread: %d\n", GetLastError());
+		return -1;
+	}
+#else
+	if ((errno = pthread_create(&w->thread, NULL, capw_thread, w)) != 0) {
+		fprintf(stderr, "capwrite: pthread_create: %s\n", strerror(errno));
+		return -1;
+	}
+#endif
+	return 0;
+}  /* capw_open */
+
+
+/* Give the buffer being filled to the writer; 'end_file' if the next
+ * record starts a new file. */
+static void capw_hand_over(cap_writer *w, int end_file)
+{
+	capw_buf *b = &w->bufs[w->filled % w->num_bufs];
+	TLONGLONG queued;
+
+	if (w->fill == 0)
+		b->start_file = 0;  /* only closes the file */
+	else if (w->format == CAPW_FORMAT_MCAP && ! end_file) {
+		/* whole blocks, so that block k is at k * CAPW_BUF_SIZE */
+		memset(b->data + w->fill, 0, CAPW_BUF_SIZE - w->fill);
+		w->file_bytes += CAPW_BUF_SIZE - w->fill;
+		w->fill = CAPW_BUF_SIZE;
+	}
+	w->blk = NULL;
+	b->len = w->fill;
+	b->end_file = end_file;
+	capw_store(&w->filled, w->filled + 1);
+	w->fill = 0;
+	capw_store(&w->committed, 0);
+	queued = w->filled - capw_load(&w->written);
+	if (queued > w->max_queued)
+		w->max_queued = queued;
+	if (w->codec != 0) {
+		queued = w->filled - capw_load(&w->packs_done);
+		if (queued > w->max_pack_queued)
+			w->max_pack_queued = queued;
+	}
+	/* to a packer, which passes it on to the writer */
+#if defined(_WIN32)
+	EnterCriticalSection(&w->lock);
+	WakeConditionVariable((w->codec != 0) ? &w->pack_cond : &w->cond);
+	LeaveCriticalSection(&w->lock);
+#else
+	pthread_mutex_lock(&w->lock);
+	pthread_cond_signal((w->codec != 0) ? &w->pack_cond : &w->cond);
+	pthread_mutex_unlock(&w->lock);
+#endif
+}  /* capw_hand_over */
+
+
+/* Copy into the buffers, handing each over as it fills.  The caller has
+ * checked there is room. */
+static void capw_copy(cap_writer *w, const char *data, size_t len)
+{
+	while (len > 0) {
+		size_t n = CAPW_BUF_SIZE - w->fill;
+		capw_buf *b = &w->bufs[w->filled % w->num_bufs];
+		if (n > len)
+			n = len;
+		if (w->fill == 0) {  /* first bytes of this buffer */
+			b->start_file = w->start_pending;
+			b->file_num = w->file_num;
+			b->file_secs = w->file_secs;
+			w->start_pending = 0;
+		}
+		memcpy(b->data + w->fill, data, n);
+		w->fill += n;
+		data += n;
+		len -= n;
+		if (w->fill == CAPW_BUF_SIZE)
+			capw_hand_over(w, 0);
+	}
+}  /* capw_copy */
+
+
+/* Count a datagram dropped for want of a buffer, noting whether the
+ * packers were what held the oldest one up.  Returns -1. */
+static int capw_drop(cap_writer *w)
+{
+	TLONGLONG oldest = capw_load(&w->written);
+
+	++w->dropped;
+	if (w->codec != 0 && capw_load(&w->bufs[oldest % w->num_bufs].packed) != oldest + 1)
+		++w->dropped_packing;
+	return -1;
+}  /* capw_drop */
+
+
+/* Bytes that can be taken without waiting for the disk. */
+static size_t capw_room(cap_writer *w)
+{
+	TLONGLONG free_bufs = w->num_bufs - (w->filled - capw_load(&w->written));
+
+	return (free_bufs > 0) ? (size_t)free_bufs * CAPW_BUF_SIZE - w->fill : 0;
+}  /* capw_room */
+
+
+/* capw_record(), past the stop check. */
+static int capw_add(cap_writer *w, const char *data, int len, TLONGLONG ts_ns,
+		const struct sockaddr_in *src, int seq)
+{
+	static const char pad[MCAP_ALIGN] = { 0 };
+	size_t rec_len = (w->format == CAPW_FORMAT_MCAP) ? MCAP_REC_SIZE(len) : (size_t)len;
+	size_t hdr_len = 0, skip = 0;
+
+	if (! w->new_file) {
+		if ((w->rotate_bytes > 0 && w->file_bytes + (long long)rec_len > w->rotate_bytes) ||
+				(w->rotate_secs > 0 && mt_clock_ns() >= w->file_end_ns)) {
+			if (w->fill == 0 && w->file_bytes == 0)
+				;  /* nothing to close */
+			else if (capw_room(w) == 0)
+				return capw_drop(w);
+			else {
+				capw_hand_over(w, 1);
+				w->new_file = 1;
+			}
+		}
+	}
+	if (w->format == CAPW_FORMAT_MCAP) {
+		if (w->fill > 0 && w->fill + rec_len > CAPW_BUF_SIZE)
+			skip = CAPW_BUF_SIZE - w->fill;  /* would cross the block */
+		if (w->new_file)
+			hdr_len = sizeof(mcap_file_hdr);
+		if (w->blk == NULL || skip > 0)
+			hdr_len += sizeof(mcap_blk_hdr);
+	}
+	if (capw_room(w) < skip + hdr_len + rec_len)
+		return capw_drop(w);
+	if (skip > 0)
+		capw_hand_over(w, 0);
+
+	if (w->new_file) {  /* the buffer is empty: see capw_copy() */
+		w->start_pending = 1;
+		++w->file_num;
+		w->file_secs = time(NULL);
+		w->file_bytes = 0;
+		if (w->rotate_secs > 0)
+			w->file_end_ns = mt_clock_ns() + (TLONGLONG)w->rotate_secs * 1000000000;
+		if (w->format == CAPW_FORMAT_MCAP) {
+			mcap_file_hdr fh;
+			cap_mcap_header(&fh, w->groupaddr, w->groupport, CAPW_BUF_SIZE, w->codec);
+			capw_copy(w, (const char *)&fh, sizeof(fh));
+		}
+		w->new_file = 0;
+	}
+	if (w->format == CAPW_FORMAT_MCAP) {
+		mcap_rec_hdr rh;
+		if (w->blk == NULL) {  /* start the block */
+			mcap_blk_hdr bh;
+			memset(&bh, 0, sizeof(bh));
+			memcpy(bh.magic, MCAP_BLK_MAGIC, 4);
+			bh.len = sizeof(bh);
+			bh.seq_hi = MCAP_NO_SEQ;
+			bh.first_ns = ts_ns;
+			capw_copy(w, (const char *)&bh, sizeof(bh));
+			w->blk = (mcap_blk_hdr *)(w->bufs[w->filled % w->num_bufs].data + w->fill - sizeof(bh));
+		}
+		/* before the copy, which hands the buffer over if it fills it */
+		w->blk->len += (unsigned int)rec_len;
+		++w->blk->num_recs;
+		if (ts_ns > w->blk->last_ns)
+			w->blk->last_ns = ts_ns;
+		if (seq > w->blk->seq_hi)
+			w->blk->seq_hi = seq;
+		memset(&rh, 0, sizeof(rh));
+		rh.len = len;
+		rh.seq = seq;
+		rh.ts_ns = ts_ns;
+		if (src != NULL) {
+			rh.src_addr = src->sin_addr.s_addr;
+			rh.src_port = src->sin_port;
+		}
+		capw_copy(w, (const char *)&rh, sizeof(rh));
+		capw_copy(w, data, len);
+		capw_copy(w, pad, rec_len - sizeof(rh) - len);
+	}
+	else
+		capw_copy(w, data, len);
+	w->file_bytes += hdr_len + rec_len;
+	++w->records;
+	w->bytes += len;
+	capw_store(&w->committed, (TLONGLONG)w->fill);
+	return 0;
+}  /* capw_add */
+
+
+/* Append one datagram (framed if mcap, with msend sequence number 'seq' or
+ * MCAP_NO_SEQ).  Never waits: returns 0, or -1 if it was dropped because
+ * the writer is behind (or stopping).  On a stop signal the writer sets
+ * 'closing' and waits for 'recording' to clear before it takes the buffer
+ * being filled. */
+int capw_record(cap_writer *w, const char *data, int len, TLONGLONG ts_ns,
+		const struct sockaddr_in *src, int seq)
+{
+	int rtn;
+
+	capw_store_sc(&w->recording, 1);
+	if (capw_load_sc(&w->closing)) {
+		++w->dropped;
+		rtn = -1;
+	}
+	else
+		rtn = capw_add(w, data, len, ts_ns, src, seq);
+	capw_store_sc(&w->recording, 0);
+	return rtn;
+}  /* capw_record */
+
+
+/* "Capture: ..." totals so far. */
+void capw_report(cap_writer *w, FILE *fp)
+{
+	fprintf(fp, "Capture: %llu datagrams (%llu bytes) to %u file%s, %llu dropped (all %d buffers waiting for the disk)",
+			w->records, w->bytes, w->file_num, (w->file_num == 1) ? "" : "s", w->dropped, w->num_bufs);
+	fprintf(fp, ", at most %lld buffers queued, slowest write %.1f ms%s\n", (long long)w->max_queued,
+			w->max_write_ns / 1e6, w->direct ? " (O_DIRECT)" : "");
+	if (w->codec != 0) {
+		TLONGLONG t = mt_clock_ns() - w->start_ns;
+		fprintf(fp, "Capture: %s packed %llu bytes to %llu (%.2f:1) on %d thread%s, %.0f%% busy, at most %lld buffers waiting for them, %llu datagrams dropped while they were behind: %s\n",
+				cap_codec_name(w->codec), w->pack_in, w->pack_out,
+				(w->pack_out > 0) ? (double)w->pack_in / w->pack_out : 0.0, w->num_packers,
+				(w->num_packers == 1) ? "" : "s", (t > 0) ? 100.0 * w->pack_ns / ((double)t * w->num_packers) : 0.0,
+				(long long)w->max_pack_queued, w->dropped_packing, (w->dropped_packing > 0) ? "falling behind" : "keeping up");
+	}
+	if (w->lost_bytes > 0)
+		fprintf(fp, "Capture: %llu bytes lost to write errors\n", w->lost_bytes);
+}  /* capw_report */
+
+
+/* For a SIGINT/SIGTERM handler: the writer thread finishes the files,
+ * then raises the signal again with its default action. */
+static void capw_stop_signal(int sig)
+{
+	if (signal_writer != NULL)
+		signal_num = sig;
+	else {
+		signal(sig, SIG_DFL);
+		raise(sig);
+	}
+}  /* capw_stop_signal */
+
+
+void capw_catch_signals(cap_writer *w)
+{
+	signal_writer = w;
+	signal(SIGINT, capw_stop_signal);
+	signal(SIGTERM, capw_stop_signal);
+}  /* capw_catch_signals */
+
+
+/* Write out everything and stop the writer and packer threads. */
+void capw_close(cap_writer *w)
+{
+	int i;
+
+	if (w->bufs == NULL)
+		return;
+	if (w->fill > 0 || ! w->new_file) {
+		while (w->fill == 0 && w->filled - capw_load(&w->written) >= w->num_bufs)
+			SLEEP_MSEC(1);  /* the empty buffer is still being written */
+		capw_hand_over(w, 1);
+	}
+	w->done = 1;
+#if defined(_WIN32)
+	EnterCriticalSection(&w->lock);
+	WakeConditionVariable(&w->cond);
+	WakeAllConditionVariable(&w->pack_cond);
+	LeaveCriticalSection(&w->lock);
+	WaitForSingleObject(w->thread, INFINITE);
+	for (i = 0; w->packers != NULL && i < w->num_packers; ++i)
+		WaitForSingleObject(w->packers[i].thread, INFINITE);
+#else
+	pthread_mutex_lock(&w->lock);
+	pthread_cond_signal(&w->cond);
+	pthread_cond_broadcast(&w->pack_cond);
+	pthread_mutex_unlock(&w->lock);
+	pthread_join(w->thread, NULL);
+	for (i = 0; w->packers != NULL && i < w->num_packers; ++i)
+		pthread_join(w->packers[i].thread, NULL);
+#endif
+	capw_close_file(w);
+	free(w->index);
+	w->index = NULL;
+	signal_writer = NULL;
+}  /* capw_close */
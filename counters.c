@@ -0,0 +1,213 @@
+/* counters.c */
+/*   Live tool counters in a named shared-memory segment: the tool creates
+ * it with -C name and bumps the counters from its own loops; 'mstat'
+ * attaches read-only and prints totals, deltas and rates while it runs.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted without restriction.
+ *
+  THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+  EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+  NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+  PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+  UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+  BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+  INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+  TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+  THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+/* On Unix the segment is a POSIX shared-memory object ("/mtools.name", a
+ * file under /dev/shm on Linux); on Windows a named file mapping in the
+ * session ("Local\mtools.name").  The creator fills in the header and
+ * writes the magic and version last, so a reader never trusts a half-made
+ * block.  A tool killed before it closes leaves its segment behind; mstat
+ * shows such an instance as exited. */
+
+#include "mtools.h"
+
+#if ! defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#endif
+
+
+static int ctr_name(mt_counters *c, const char *name)
+{
+	if (strlen(name) == 0 || strlen(name) > 48 || strchr(name, '/') != NULL) {
+		fprintf(stderr, "counters: name '%s' must be 1 to 48 characters, without '/'\n", name);
+		return -1;
+	}
+#if defined(_WIN32)
+	sprintf(c->name, "Local\\%s%s", MT_CTR_PREFIX, name);
+#else
+	sprintf(c->name, "/%s%s", MT_CTR_PREFIX, name);
+#endif
+	return 0;
+}  /* ctr_name */
+
+
+/* Create (or take over) segment 'name' holding 'num_ctrs' counters, all
+ * zero.  Returns 0, or -1 after printing why. */
+int mt_ctr_create(mt_counters *c, const char *name, const char *tool, const char *label,
+		const char * const *names, const unsigned char *flags, int num_ctrs)
+{
+	mt_ctr_block *blk;
+	int i;
+
+	memset(c, 0, sizeof(*c));
+	if (ctr_name(c, name) < 0)
+		return -1;
+	if (num_ctrs > MT_CTR_MAX) {
+		fprintf(stderr, "counters: too many counters (%d)\n", num_ctrs);
+		return -1;
+	}
+#if defined(_WIN32)
+	c->map = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0,
+			sizeof(mt_ctr_block), c->name);
+	if (c->map == NULL) {
+		fprintf(stderr, "counters: CreateFileMapping %s: %d\n", c->name, GetLastError());
+		return -1;
+	}
+	blk = (mt_ctr_block *)MapViewOfFile(c->map, FILE_MAP_WRITE, 0, 0, sizeof(mt_ctr_block));
+	if (blk == NULL) {
+		fprintf(stderr, "counters: MapViewOfFile %s: %d\n", c->name, GetLastError());
+		CloseHandle(c->map);
+		return -1;
+	}
+#else
+	{
+		int fd = shm_open(c->name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0 || ftruncate(fd, sizeof(mt_ctr_block)) < 0) {
+			fprintf(stderr, "counters: shm_open %s: %s\n", c->name, strerror(errno));
+			if (fd >= 0)
+				close(fd);
+			return -1;
+		}
+		blk = (mt_ctr_block *)mmap(NULL, sizeof(mt_ctr_block), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (blk == (mt_ctr_block *)MAP_FAILED) {
+			fprintf(stderr, "counters: mmap %s: %s\n", c->name, strerror(errno));
+			shm_unlink(c->name);
+			return -1;
+		}
+	}
+#endif
+
+	memset(blk, 0, sizeof(*blk));
+#if defined(_WIN32)
+	blk->pid = (int)GetCurrentProcessId();
+#else
+	blk->pid = (int)getpid();
+#endif
+	blk->num_ctrs = num_ctrs;
+	blk->start_ns = mt_clock_ns();
+	strncpy(blk->tool, tool, sizeof(blk->tool) - 1);
+	strncpy(blk->label, label, sizeof(blk->label) - 1);
+	for (i = 0; i < num_ctrs; ++i) {
+		strncpy(blk->names[i], names[i], MT_CTR_NAME_LEN - 1);
+		blk->flags[i] = flags ? flags[i] : 0;
+	}
+	blk->magic = MT_CTR_MAGIC;
+#if defined(_MSC_VER)
+	MemoryBarrier();
+	blk->version = MT_CTR_VERSION;
+#else
+	__atomic_store_n(&blk->version, MT_CTR_VERSION, __ATOMIC_RELEASE);
+#endif
+
+	c->blk = blk;
+	c->owner = 1;
+	return 0;
+}  /* mt_ctr_create */
+
+
+/* Map an existing segment read-only.  Returns 0, or -1 (quietly: the
+ * caller knows whether a missing segment is an error). */
+int mt_ctr_attach(mt_counters *c, const char *name)
+{
+	mt_ctr_block *blk;
+
+	memset(c, 0, sizeof(*c));
+	if (ctr_name(c, name) < 0)
+		return -1;
+#if defined(_WIN32)
+	c->map = OpenFileMappingA(FILE_MAP_READ, FALSE, c->name);
+	if (c->map == NULL)
+		return -1;
+	blk = (mt_ctr_block *)MapViewOfFile(c->map, FILE_MAP_READ, 0, 0, sizeof(mt_ctr_block));
+	if (blk == NULL) {
+		CloseHandle(c->map);
+		return -1;
+	}
+#else
+	{
+		struct stat st;
+		int fd = shm_open(c->name, O_RDONLY, 0);
+		if (fd < 0)
+			return -1;
+		if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(mt_ctr_block)) {
+			close(fd);
+			return -1;
+		}
+		blk = (mt_ctr_block *)mmap(NULL, sizeof(mt_ctr_block), PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (blk == (mt_ctr_block *)MAP_FAILED)
+			return -1;
+	}
+#endif
+	c->blk = blk;
+#if defined(_MSC_VER)
+	if (blk->version != MT_CTR_VERSION || blk->magic != MT_CTR_MAGIC) {
+#else
+	if (__atomic_load_n(&blk->version, __ATOMIC_ACQUIRE) != MT_CTR_VERSION || blk->magic != MT_CTR_MAGIC) {
+#endif
+		mt_ctr_close(c);
+		return -1;
+	}
+	return 0;
+}  /* mt_ctr_attach */
+
+
+/* Names (as given to -C) of the segments present, at most 'max_names'.
+ * Returns how many, or -1 where segments cannot be listed (Windows). */
+int mt_ctr_list(char names[][80], int max_names)
+{
+#if defined(__linux__)
+	DIR *dir;
+	struct dirent *ent;
+	int num = 0;
+
+	if ((dir = opendir("/dev/shm")) == NULL)
+		return 0;
+	while ((ent = readdir(dir)) != NULL && num < max_names) {
+		if (strncmp(ent->d_name, MT_CTR_PREFIX, strlen(MT_CTR_PREFIX)) != 0 ||
+				strlen(ent->d_name + strlen(MT_CTR_PREFIX)) >= 80)
+			continue;
+		strcpy(names[num++], ent->d_name + strlen(MT_CTR_PREFIX));
+	}
+	closedir(dir);
+	return num;
+#else
+	return -1;
+#endif
+}  /* mt_ctr_list */
+
+
+/* Unmap; the creator also removes the segment. */
+void mt_ctr_close(mt_counters *c)
+{
+	if (c->blk == NULL)
+		return;
+#if defined(_WIN32)
+	UnmapViewOfFile(c->blk);
+	CloseHandle(c->map);
+#else
+	munmap(c->blk, sizeof(mt_ctr_block));
+	if (c->owner)
+		shm_unlink(c->name);
+#endif
+	c->blk = NULL;
+}  /* mt_ctr_close */
@@ -0,0 +1,472 @@
+/* flightrec.c */
+/*   Flight recorder for 'mdump -L': the most recent datagrams, framed as
+ * mcap records, in a ring allocated up front.  Nothing touches the disk
+ * until a trigger (a sequence gap, a kernel drop, a late datagram, a
+ * signal); then a thread writes the window around it to a new mcap file.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted without restriction.
+ *
+  THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+  EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+  NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+  PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+  UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+  BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+  INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+  TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+  THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+/* 'head' and 'tail' are byte offsets that only grow; the ring index is the
+ * offset modulo the size.  A record is never split: one that does not fit
+ * before the end of the ring goes to the start, and the space skipped is
+ * marked with a header of length FR_WRAP (or is too short to hold one).
+ * The oldest records are dropped to make room, except those a dump has
+ * yet to write: while it runs, new datagrams that would need their space
+ * are not kept (and are counted). */
+
+#include "mtools.h"
+
+#if defined(_MSC_VER)
+#define fr_load(p) InterlockedCompareExchange64((volatile LONGLONG *)(p), 0, 0)
+#define fr_store(p, v) InterlockedExchange64((volatile LONGLONG *)(p), (v))
+#define fr_load_sc(p) fr_load(p)
+#define fr_store_sc(p, v) fr_store(p, v)
+#else
+#define fr_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define fr_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+/* the stop handshake: each side's store must be seen before its next load */
+#define fr_load_sc(p) __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define fr_store_sc(p, v) __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+#endif
+
+#define FR_WRAP 0xffffffff  /* record length marking the unused end of the ring */
+#define FR_CHUNK (4 * 1024 * 1024)  /* most bytes per write, so space frees as it goes */
+#define FR_POLL_MS 100  /* the thread looks for a stop request this often */
+
+static flight_rec *signal_rec;  /* fr_stop_signal() */
+static volatile sig_atomic_t signal_num;
+
+static void fr_fire(flight_rec *f);
+
+
+/* Parse the -L spec: comma-separated size=bytes[k|m|g], window=ms,
+ * post=ms, gap, drop, lat=us.  Returns 0, or -1 after printing why. */
+int fr_parse(flight_rec *f, const char *spec)
+{
+	char buf[256], *tok, *val, *end;
+	double num;
+
+	memset(f, 0, sizeof(*f));
+	f->size = FR_DEFAULT_SIZE;
+	if (strlen(spec) >= sizeof(buf)) {
+		fprintf(stderr, "flightrec: spec too long\n");
+		return -1;
+	}
+	strcpy(buf, spec);
+	for (tok = strtok(buf, ","); tok != NULL; tok = strtok(NULL, ",")) {
+		if (strcmp(tok, "gap") == 0) {
+			f->trig_gap = 1;
+			continue;
+		}
+		if (strcmp(tok, "drop") == 0) {
+			f->trig_drop = 1;
+			continue;
+		}
+		if ((val = strchr(tok, '=')) == NULL) {
+			fprintf(stderr, "flightrec: unknown trigger '%s'\n", tok);
+			return -1;
+		}
+		*val++ = '\0';
+		num = strtod(val, &end);
+		if (end == val || num < 0) {
+			fprintf(stderr, "flightrec: bad %s value '%s'\n", tok, val);
+			return -1;
+		}
+		if (strcmp(tok, "size") == 0) {
+			if (*end == 'k' || *end == 'K')  num *= 1024;
+			else if (*end == 'm' || *end == 'M')  num *= 1024 * 1024;
+			else if (*end == 'g' || *end == 'G')  num *= 1024.0 * 1024 * 1024;
+			if (num < 1024 * 1024) {
+				fprintf(stderr, "flightrec: size must be at least 1m\n");
+				return -1;
+			}
+			f->size = (size_t)num & ~((size_t)MCAP_ALIGN - 1);
+		}
+		else if (strcmp(tok, "window") == 0)
+			f->window_ns = (TLONGLONG)(num * 1000000);
+		else if (strcmp(tok, "post") == 0)
+			f->post_ns = (TLONGLONG)(num * 1000000);
+		else if (strcmp(tok, "lat") == 0 && num > 0)
+			f->trig_lat_ns = (TLONGLONG)(num * 1000);
+		else {
+			fprintf(stderr, "flightrec: unknown or out of range: %s=%s\n", tok, val);
+			return -1;
+		}
+	}
+	return 0;
+}  /* fr_parse */
+
+
+/* Record at offset 'off', or NULL if the ring wraps there. */
+static mcap_rec_hdr *fr_rec_at(flight_rec *f, TLONGLONG off)
+{
+	size_t idx = (size_t)(off % f->size);
+	mcap_rec_hdr *rh = (mcap_rec_hdr *)(f->ring + idx);
+
+	if (f->size - idx < sizeof(mcap_rec_hdr) || rh->len == FR_WRAP)
+		return NULL;
+	return rh;
+}  /* fr_rec_at */
+
+
+/* Offset after the record (or wrap) at 'off'. */
+static TLONGLONG fr_next(flight_rec *f, TLONGLONG off)
+{
+	mcap_rec_hdr *rh = fr_rec_at(f, off);
+
+	if (rh == NULL)
+		return off + (f->size - (size_t)(off % f->size));
+	return off + MCAP_REC_SIZE(rh->len);
+}  /* fr_next */
+
+
+/* The thread: write each window handed over, then wait for the next. */
+static void fr_write_dump(flight_rec *f)
+{
+	char name[CAPW_MAX_NAME];
+	mcap_file_hdr fh;
+	FILE *fp;
+	TLONGLONG pos = f->dump_from;
+	int ok = 1;
+
+	cap_file_name(f->name, name, sizeof(name), f->num_dumps, (time_t)(f->dump_trig_ns / 1000000000));
+	if ((fp = fopen(name, "wb")) == NULL) {
+		fprintf(stderr, "flightrec: open %s: %s\n", name, strerror(errno));
+		ok = 0;
+	}
+	cap_mcap_header(&fh, f->groupaddr, f->groupport, 0, 0);  /* not in blocks */
+	if (ok && fwrite(&fh, sizeof(fh), 1, fp) != 1)
+		ok = 0;
+	while (pos < f->dump_to) {
+		/* the longest run of whole records without a wrap, up to FR_CHUNK */
+		TLONGLONG end = pos;
+		while (end < f->dump_to && end - pos < FR_CHUNK && fr_rec_at(f, end) != NULL)
+			end = fr_next(f, end);
+		if (end == pos)
+			end = fr_next(f, pos);  /* skip the wrap */
+		else if (ok && fwrite(f->ring + (size_t)(pos % f->size), (size_t)(end - pos), 1, fp) != 1) {
+			fprintf(stderr, "flightrec: write %s: %s\n", name, strerror(errno));
+			ok = 0;
+		}
+		pos = end;
+		fr_store(&f->dump_pos, pos);
+	}
+	if (fp != NULL && fclose(fp) != 0)
+		ok = 0;
+	if (ok)
+		fprintf(stderr, "flightrec: %s: %llu datagrams from %.3f s before to %.3f s after the %s\n",
+				name, f->dump_records, (f->dump_trig_ns - f->dump_first_ns) / 1e9,
+				(f->dump_last_ns - f->dump_trig_ns) / 1e9, f->dump_why);
+	else
+		++f->failed;
+}  /* fr_write_dump */
+
+
+static void fr_run(flight_rec *f)
+{
+	for (;;) {
+#if defined(_WIN32)
+		EnterCriticalSection(&f->lock);
+		while (! fr_load(&f->dumping) && ! f->done && signal_num == 0)
+			SleepConditionVariableCS(&f->cond, &f->lock, FR_POLL_MS);
+		LeaveCriticalSection(&f->lock);
+#else
+		pthread_mutex_lock(&f->lock);
+		while (! fr_load(&f->dumping) && ! f->done && signal_num == 0) {
+			struct timespec ts;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += FR_POLL_MS * 1000000;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&f->cond, &f->lock, &ts);
+		}
+		pthread_mutex_unlock(&f->lock);
+#endif
+		if (signal_num != 0) {
+			/* keep no more datagrams, wait for the receive side to
+			 * leave the ring, and write the window handed over or
+			 * still waiting for its 'post' */
+			fr_store_sc(&f->closing, 1);
+			while (fr_load_sc(&f->recording))
+				SLEEP_MSEC(1);
+			if (! fr_load(&f->dumping) && f->armed)
+				fr_fire(f);
+			if (fr_load(&f->dumping)) {
+				fr_write_dump(f);
+				fr_store(&f->dumping, 0);
+			}
+			signal(signal_num, SIG_DFL);
+			raise(signal_num);
+			return;
+		}
+		if (fr_load(&f->dumping)) {
+			fr_write_dump(f);
+			fr_store(&f->dumping, 0);
+		}
+		else if (f->done)
+			return;
+	}
+}  /* fr_run */
+
+
+#if defined(_WIN32)
+static DWORD WINAPI fr_thread(LPVOID arg)
+{
+	fr_run((flight_rec *)arg);
+	return 0;
+}  /* fr_thread */
+#else
+static void *fr_thread(void *arg)
+{
+	fr_run((flight_rec *)arg);
+	return NULL;
+}  /* fr_thread */
+#endif
+
+
+/* Allocate (and touch) the ring and start the thread; windows go to files
+ * named from template 'name' (see cap_file_name, %N = dump number).
+ * Returns 0, or -1 after printing why. */
+int fr_open(flight_rec *f, const char *name, unsigned long groupaddr, unsigned short groupport)
+{
+	if (strlen(name) + 4 >= CAPW_MAX_NAME) {
+		fprintf(stderr, "flightrec: file name too long\n");
+		return -1;
+	}
+	strcpy(f->name, name);
+	if (strstr(name, "%N") == NULL)
+		strcat(f->name, ".%N");  /* every window gets its own file */
+	f->groupaddr = groupaddr;
+	f->groupport = groupport;
+	if ((f->ring = (char *)malloc(f->size)) == NULL) {
+		fprintf(stderr, "flightrec: cannot allocate %llu bytes\n", (unsigned long long)f->size);
+		return -1;
+	}
+	memset(f->ring, 0, f->size);  /* no page faults in the receive loop */
+
+#if defined(_WIN32)
+	InitializeCriticalSection(&f->lock);
+	InitializeConditionVariable(&f->cond);
+	if ((f->thread = CreateThread(NULL, 0, fr_thread, f, 0, NULL)) == NULL) {
+		fprintf(stderr, "flightrec: CreateThread: %d\n", GetLastError());
+		return -1;
+	}
+#else
+	pthread_mutex_init(&f->lock, NULL);
+	pthread_cond_init(&f->cond, NULL);
+	if ((errno = pthread_create(&f->thread, NULL, fr_thread, f)) != 0) {
+		fprintf(stderr, "flightrec: pthread_create: %s\n", strerror(errno));
+		return -1;
+	}
+#endif
+	return 0;
+}  /* fr_open */
+
+
+/* Hand the window around the pending trigger to the thread. */
+static void fr_fire(flight_rec *f)
+{
+	TLONGLONG off, start_ns = f->trig_ns - f->window_ns;
+	mcap_rec_hdr *rh;
+
+	f->armed = 0;
+	/* the oldest record inside the window */
+	for (off = f->tail; off < f->head; off = fr_next(f, off)) {
+		rh = fr_rec_at(f, off);
+		if (rh != NULL && (f->window_ns == 0 || rh->ts_ns >= start_ns))
+			break;
+	}
+	f->dump_from = off;
+	f->dump_to = f->head;
+	f->dump_records = 0;
+	f->dump_first_ns = f->dump_last_ns = f->trig_ns;
+	for (; off < f->head; off = fr_next(f, off)) {
+		if ((rh = fr_rec_at(f, off)) == NULL)
+			continue;
+		if (f->dump_records++ == 0)
+			f->dump_first_ns = rh->ts_ns;
+		f->dump_last_ns = rh->ts_ns;
+	}
+	if (f->dump_records == 0)
+		return;
+	f->dump_why = f->why;
+	f->dump_trig_ns = f->trig_ns;
+	++f->num_dumps;
+	fr_store(&f->dump_pos, f->dump_from);
+	fr_store(&f->dumping, 1);
+#if defined(_WIN32)
+	EnterCriticalSection(&f->lock);
+	WakeConditionVariable(&f->cond);
+	LeaveCriticalSection(&f->lock);
+#else
+	pthread_mutex_lock(&f->lock);
+	pthread_cond_signal(&f->cond);
+	pthread_mutex_unlock(&f->lock);
+#endif
+}  /* fr_fire */
+
+
+/* Something worth keeping happened at 'now_ns' (ns since the epoch): the
+ * window is written once 'post' has been recorded too.  Ignored (and
+ * counted) while a window is pending or being written, or on a stop. */
+void fr_trigger(flight_rec *f, const char *why, TLONGLONG now_ns)
+{
+	fr_store_sc(&f->recording, 1);  /* see fr_run() */
+	++f->triggers;
+	if (fr_load_sc(&f->closing) || f->armed || fr_load(&f->dumping))
+		++f->ignored;
+	else {
+		f->armed = 1;
+		f->why = why;
+		f->trig_ns = now_ns;
+		if (f->post_ns == 0)
+			fr_fire(f);
+	}
+	fr_store_sc(&f->recording, 0);
+}  /* fr_trigger */
+
+
+/* Drop the oldest record; 0 if it has yet to be written by a dump. */
+static int fr_evict(flight_rec *f)
+{
+	if (f->tail >= f->head)
+		return 0;
+	if (fr_load(&f->dumping) && f->tail >= fr_load(&f->dump_pos))
+		return 0;
+	f->tail = fr_next(f, f->tail);
+	return 1;
+}  /* fr_evict */
+
+
+/* Keep one datagram (arrival 'ts_ns', ns since the epoch).  A copy and a
+ * few compares; the oldest records make room. */
+void fr_record(flight_rec *f, const char *data, int len, TLONGLONG ts_ns,
+		const struct sockaddr_in *src, int seq)
+{
+	size_t rec_len = MCAP_REC_SIZE(len);
+	size_t idx = (size_t)(f->head % f->size);
+	TLONGLONG start = f->head;
+	mcap_rec_hdr *rh;
+
+	fr_store_sc(&f->recording, 1);  /* see fr_run() */
+	if (fr_load_sc(&f->closing)) {
+		++f->not_kept;
+		goto out;
+	}
+	if (f->size - idx < rec_len)
+		start += f->size - idx;  /* no room before the end: wrap */
+	while (f->tail < start + (TLONGLONG)rec_len - (TLONGLONG)f->size) {
+		if (! fr_evict(f)) {
+			++f->not_kept;
+			goto check;
+		}
+	}
+	if (start != f->head && f->size - idx >= sizeof(mcap_rec_hdr))
+		((mcap_rec_hdr *)(f->ring + idx))->len = FR_WRAP;
+
+	rh = (mcap_rec_hdr *)(f->ring + (size_t)(start % f->size));
+	memset(rh, 0, sizeof(*rh));
+	rh->len = len;
+	rh->seq = seq;
+	rh->ts_ns = ts_ns;
+	if (src != NULL) {
+		rh->src_addr = src->sin_addr.s_addr;
+		rh->src_port = src->sin_port;
+	}
+	memcpy((char *)(rh + 1), data, len);
+	f->head = start + rec_len;
+	++f->records;
+
+check:
+	if (f->armed && ts_ns >= f->trig_ns + f->post_ns)
+		fr_fire(f);
+out:
+	fr_store_sc(&f->recording, 0);
+}  /* fr_record */
+
+
+void fr_report(flight_rec *f, FILE *fp)
+{
+	unsigned long long recs = 0;
+	TLONGLONG off, first_ns = 0, last_ns = 0;
+	mcap_rec_hdr *rh;
+
+	if (! fr_load(&f->dumping)) {  /* the thread may be reading the ring */
+		for (off = f->tail; off < f->head; off = fr_next(f, off)) {
+			if ((rh = fr_rec_at(f, off)) == NULL)
+				continue;
+			if (recs++ == 0)
+				first_ns = rh->ts_ns;
+			last_ns = rh->ts_ns;
+		}
+		fprintf(fp, "Flight recorder: %llu datagrams (%.1f MB, %.3f s) in the ring of %.1f MB",
+				recs, (f->head - f->tail) / 1048576.0, (last_ns - first_ns) / 1e9, f->size / 1048576.0);
+	}
+	else
+		fprintf(fp, "Flight recorder: writing a window");
+	fprintf(fp, ", %llu triggers, %u windows written", f->triggers, f->num_dumps - f->failed);
+	if (f->ignored > 0)
+		fprintf(fp, ", %llu triggers during a window ignored", f->ignored);
+	if (f->not_kept > 0)
+		fprintf(fp, ", %llu datagrams not kept (ring held by a dump)", f->not_kept);
+	fprintf(fp, "\n");
+}  /* fr_report */
+
+
+/* For a SIGINT/SIGTERM handler: the thread writes the pending window, then
+ * raises the signal again with its default action. */
+static void fr_stop_signal(int sig)
+{
+	if (signal_rec != NULL)
+		signal_num = sig;
+	else {
+		signal(sig, SIG_DFL);
+		raise(sig);
+	}
+}  /* fr_stop_signal */
+
+
+void fr_catch_signals(flight_rec *f)
+{
+	signal_rec = f;
+	signal(SIGINT, fr_stop_signal);
+	signal(SIGTERM, fr_stop_signal);
+}  /* fr_catch_signals */
+
+
+/* Write a pending window and stop the thread. */
+void fr_close(flight_rec *f)
+{
+	if (f->ring == NULL)
+		return;
+	if (f->armed && ! fr_load(&f->dumping))
+		fr_fire(f);
+	f->done = 1;
+#if defined(_WIN32)
+	EnterCriticalSection(&f->lock);
+	WakeConditionVariable(&f->cond);
+	LeaveCriticalSection(&f->lock);
+	WaitForSingleObject(f->thread, INFINITE);
+#else
+	pthread_mutex_lock(&f->lock);
+	pthread_cond_signal(&f->cond);
+	pthread_mutex_unlock(&f->lock);
+	pthread_join(f->thread, NULL);
+#endif
+	free(f->ring);
+	f->ring = NULL;
+}  /* fr_close */
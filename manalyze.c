@@ -0,0 +1,731 @@
+/* manalyze.c */
+/*   Program to analyse mdump captures (mcap, or pcap/pcapng from any
+ * capture tool) after the fact: per source, datagrams and rates, the
+ * highest rate over a short window, msend sequence gaps, duplicates and
+ * reorders, and the spread of inter-arrival times.  The files are mapped,
+ * cut into chunks, and the chunks analysed in parallel.
+ * See https://community.informatica.com/solutions/1470 for more info.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted without restriction.
+ *
+ THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+ EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+ NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+ PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+ UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+ BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+ INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+ TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+ THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+/* Each chunk (see cap_split) is analysed as if it were the whole capture;
+ * the main thread then merges the chunks in file order.  Counts add up;
+ * what spans a boundary is patched up at the merge: the inter-arrival time
+ * across it, a rate window split by it, and the sequence numbers.  The
+ * sequence rules are mdump's (-S): the classification of a datagram
+ * depends on what came before it, so each chunk also keeps, per source,
+ * the numbers it saw until its own history took over from whatever came
+ * before (the highest number well past its first, or an 'echo' that starts
+ * a new test).  The merge replays those from the real history before the
+ * chunk and swaps the results in.  Where that history still matters at the
+ * end of the prefix (long reordering across the boundary, or more than
+ * MANALYZE_PREFIX datagrams before the chunk settles), the merge reads the
+ * chunk's datagrams of that source again instead, so the counts are always
+ * those of a single pass. */
+
+#include "mtools.h"
+
+#include <stdarg.h>
+
+#define MANALYZE_MAX_FILES 1024
+#define MANALYZE_MAX_THREADS 256
+#define MANALYZE_CHUNKS_PER_THREAD 4  /* to even out the load */
+#define MANALYZE_HASH 1024  /* per chunk; a power of 2 */
+#define MANALYZE_MAX_SOURCES (MANALYZE_HASH / 2)
+#define MANALYZE_SEQ_WINDOW 1024  /* as mdump's MDUMP_SEQ_WINDOW */
+#define MANALYZE_PREFIX (8 * MANALYZE_SEQ_WINDOW)
+#define MANALYZE_IA_BINS 64  /* inter-arrival times, by powers of 2 of ns */
+
+#if defined(_MSC_VER)
+#define ma_next_chunk(p) (InterlockedIncrement((volatile LONG *)(p)) - 1)
+#else
+#define ma_next_chunk(p) __atomic_fetch_add((p), 1, __ATOMIC_RELAXED)
+#endif
+
+typedef struct manalyze_options {
+    /* program name (from argv[0] */
+    char *prog_name;
+
+    /* program options */
+    TLONGLONG o_burst_ns;  /* -b */
+    int o_threads;  /* -j */
+    FILE *o_output;
+    int o_quiet;
+} manalyze_options;
+
+/* mdump's -S sequence state */
+typedef struct ma_seqs {
+    int hi;  /* highest number, -1 = none */
+    unsigned int seen[MANALYZE_SEQ_WINDOW / 32];
+    unsigned long long gaps, dups, reorders;
+} ma_seqs;
+
+#define MA_PREFIX_OPEN 0  /* still collecting */
+#define MA_PREFIX_SETTLED 1  /* the chunk's own history took over */
+#define MA_PREFIX_FULL 2  /* MANALYZE_PREFIX reached first */
+#define MA_RESET -1  /* prefix entry: an 'echo' */
+#define MA_NONE -2  /* not an msend message */
+
+/* what was seen of one source (in a chunk, or merged) */
+typedef struct ma_src {
+    unsigned int src_addr, dst_addr;
+    unsigned short src_port, dst_port;
+    unsigned long long pkts, bytes;
+    TLONGLONG first_ns, last_ns;
+    /* -b windows: the first and last (partly in this chunk) and the busiest */
+    TLONGLONG win_first, win_last;
+    unsigned long long n_first, n_last, n_peak;
+    /* inter-arrival */
+    TLONGLONG ia_min, ia_max;
+    double ia_sum;
+    unsigned long long ia_num, ia_hist[MANALYZE_IA_BINS];
+    /* sequence numbers */
+    unsigned long long seq_pkts;
+    ma_seqs seqs;
+    int *prefix;
+    int num_prefix, max_prefix, prefix_state, prefix_base;
+} ma_src;
+
+/* one part of one file, analysed by one worker */
+typedef struct ma_chunk {
+    cap_reader rd;
+    cap_reader start;  /* rd before it was read */
+    int file;
+    ma_src *hash[MANALYZE_HASH];
+    ma_src *srcs[MANALYZE_MAX_SOURCES];  /* in order of appearance */
+    int num_srcs;
+    unsigned long long pkts, bytes, no_room;
+    int status;  /* last cap_next(): 0 = end, -1 = corrupt */
+} ma_chunk;
+
+static ma_chunk *chunks;
+static int num_chunks;
+#if defined(_MSC_VER)
+static volatile LONG next_chunk;
+#else
+static int next_chunk;
+#endif
+
+
+static const char usage_str[] = "[-b burst_us] [-h] [-j threads] [-o ofile] [-q] capture_file ...";
+
+void usage(manalyze_options *opts, char *msg)
+{
+	if (msg != NULL)
+		fprintf(stderr, "\n%s\n\n", msg);
+	fprintf(stderr, "Usage: %s %s\n\n"
+			"(use -h for detailed help)\n",
+			opts->prog_name, usage_str);
+}  /* usage */
+
+
+void help(manalyze_options *opts, char *msg)
+{
+	if (msg != NULL)
+		fprintf(stderr, "\n%s\n\n", msg);
+	fprintf(stderr, "Usage: %s %s\n", opts->prog_name, usage_str);
+	fprintf(stderr, "Where:\n"
+			"  -b burst_us : window for the highest rate of each source [1000]\n"
+			"  -h : help\n"
+			"  -j threads : worker threads [number of CPUs]\n"
+			"  -o ofile : print results to file (in addition to stdout)\n"
+			"  -q : one line per source (no sequence or inter-arrival details)\n"
+			"\n"
+			"  capture_file : mcap ('mdump -O file -F mcap'), pcap or pcapng; several\n"
+			"                 files (e.g. a rotated capture) are taken as one, in\n"
+			"                 the order given\n"
+			"\n"
+			"For each source (address:port -> group:port): datagrams, bytes, average\n"
+			"and highest rate, msend sequence gaps, duplicates and reorders (counted\n"
+			"as 'mdump -S' does, starting afresh at each 'echo'), and inter-arrival\n"
+			"times.  Indexed mcap files are cut at block boundaries and pcap at\n"
+			"record boundaries, so they are analysed in parallel; pcapng is read by\n"
+			"one thread.\n"
+	);
+}  /* help */
+
+
+/* results go to stdout (and -o ofile) */
+static void display(manalyze_options *opts, const char *format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	vprintf(format, ap);
+	va_end(ap);
+	if (opts->o_output) {
+		va_start(ap, format);
+		vfprintf(opts->o_output, format, ap);
+		va_end(ap);
+	}
+}  /* display */
+
+
+static int num_cpus(void)
+{
+#if defined(_WIN32)
+	SYSTEM_INFO si;
+
+	GetSystemInfo(&si);
+	return (int)si.dwNumberOfProcessors;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return (n > 0) ? (int)n : 1;
+#endif
+}  /* num_cpus */
+
+
+/* Sequence number of an msend data message ("Message <hex>"), or -1. */
+static int msg_seq(const char *data, int len)
+{
+	int i, seq = 0;
+
+	if (len <= 8 || memcmp(data, "Message ", 8) != 0)
+		return -1;
+	for (i = 8; i < len && i < 16; ++i) {  /* hex, as sent by msend */
+		char c = data[i];
+		if (c >= '0' && c <= '9') seq = (seq << 4) + c - '0';
+		else if (c >= 'a' && c <= 'f') seq = (seq << 4) + c - 'a' + 10;
+		else break;
+	}
+	return (i > 8) ? seq : -1;
+}  /* msg_seq */
+
+
+/* mdump's track_seq(): a jump ahead adds the numbers skipped to the gaps;
+ * one at or below the highest seen is a duplicate if it was already seen,
+ * otherwise a reorder.  Beyond the window it counts as a reorder. */
+static void ma_track(ma_seqs *t, int seq)
+{
+	unsigned int *seen = t->seen;
+	int s;
+
+	if (seq == MA_RESET) {
+		t->hi = -1;
+		return;
+	}
+	if (t->hi < 0 || seq > t->hi) {
+		if (t->hi < 0 || seq - t->hi >= MANALYZE_SEQ_WINDOW)
+			memset(t->seen, 0, sizeof(t->seen));
+		else
+			for (s = t->hi + 1; s < seq; ++s)
+				seen[(s % MANALYZE_SEQ_WINDOW) / 32] &= ~(1U << (s % 32));
+		if (t->hi >= 0)
+			t->gaps += seq - t->hi - 1;
+		t->hi = seq;
+	}
+	else if (t->hi - seq >= MANALYZE_SEQ_WINDOW) {
+		t->reorders++;
+		return;
+	}
+	else if (seen[(seq % MANALYZE_SEQ_WINDOW) / 32] & (1U << (seq % 32))) {
+		t->dups++;
+		return;
+	}
+	else
+		t->reorders++;
+	seen[(seq % MANALYZE_SEQ_WINDOW) / 32] |= 1U << (seq % 32);
+}  /* ma_track */
+
+
+/* Would the two states classify whatever comes next the same way? */
+static int ma_same_state(const ma_seqs *a, const ma_seqs *b)
+{
+	if (a->hi < 0 || b->hi < 0)
+		return a->hi == b->hi;
+	return a->hi == b->hi && memcmp(a->seen, b->seen, sizeof(a->seen)) == 0;
+}  /* ma_same_state */
+
+
+static void ma_add_interarrival(ma_src *s, TLONGLONG ia)
+{
+	int bin = 0;
+
+	if (ia < 0)
+		ia = 0;  /* timestamps went back */
+	if (s->ia_num == 0 || ia < s->ia_min)
+		s->ia_min = ia;
+	if (ia > s->ia_max)
+		s->ia_max = ia;
+	s->ia_sum += (double)ia;
+	++s->ia_num;
+	while (bin < MANALYZE_IA_BINS - 1 && ((unsigned long long)ia >> bin) > 0)
+		++bin;
+	++s->ia_hist[bin];
+}  /* ma_add_interarrival */
+
+
+/* Keep the sequence number (or MA_RESET) in the chunk's prefix while the
+ * classification still depends on what came before the chunk. */
+static void ma_add_prefix(ma_src *s, int seq)
+{
+	if (s->prefix_state != MA_PREFIX_OPEN)
+		return;
+	if (s->num_prefix == s->max_prefix) {
+		int n = (s->max_prefix > 0) ? s->max_prefix * 2 : 256;
+		int *p = (int *)realloc(s->prefix, n * sizeof(int));
+		if (p == NULL) {
+			fprintf(stderr, "manalyze: out of memory\n");
+			exit(1);
+		}
+		s->prefix = p;
+		s->max_prefix = n;
+	}
+	if (s->num_prefix == 0)
+		s->prefix_base = seq;
+	s->prefix[s->num_prefix++] = seq;
+	if (seq == MA_RESET || (s->prefix_base >= 0 && s->seqs.hi >= s->prefix_base + 2 * MANALYZE_SEQ_WINDOW))
+		s->prefix_state = MA_PREFIX_SETTLED;
+	else if (s->num_prefix >= MANALYZE_PREFIX)
+		s->prefix_state = MA_PREFIX_FULL;
+}  /* ma_add_prefix */
+
+
+static ma_src *ma_find(ma_src **hash, ma_src **srcs, int *num_srcs, const cap_record *rec)
+{
+	unsigned int h = (rec->src_addr * 2654435761U) ^ (rec->src_port * 40503U) ^
+		(rec->dst_addr * 2246822519U) ^ rec->dst_port;
+	ma_src *s;
+
+	for (h &= MANALYZE_HASH - 1; (s = hash[h]) != NULL; h = (h + 1) & (MANALYZE_HASH - 1)) {
+		if (s->src_addr == rec->src_addr && s->src_port == rec->src_port &&
+				s->dst_addr == rec->dst_addr && s->dst_port == rec->dst_port)
+			return s;
+	}
+	if (*num_srcs == MANALYZE_MAX_SOURCES)
+		return NULL;
+	if ((s = (ma_src *)calloc(1, sizeof(ma_src))) == NULL) {
+		fprintf(stderr, "manalyze: out of memory\n");
+		exit(1);
+	}
+	s->src_addr = rec->src_addr;
+	s->src_port = rec->src_port;
+	s->dst_addr = rec->dst_addr;
+	s->dst_port = rec->dst_port;
+	s->seqs.hi = -1;
+	hash[h] = s;
+	srcs[(*num_srcs)++] = s;
+	return s;
+}  /* ma_find */
+
+
+/* msend sequence number, MA_RESET or MA_NONE */
+static int ma_seq_of(const cap_record *rec)
+{
+	int seq;
+
+	if (rec->len > 5 && memcmp(rec->data, "echo ", 5) == 0)
+		return MA_RESET;  /* mdump starts a test afresh */
+	if ((seq = rec->seq) < 0 && (seq = msg_seq(rec->data, rec->len)) < 0)
+		return MA_NONE;
+	return seq;
+}  /* ma_seq_of */
+
+
+static void ma_datagram(manalyze_options *opts, ma_src *s, const cap_record *rec)
+{
+	TLONGLONG win = rec->ts_ns / opts->o_burst_ns;
+	int seq;
+
+	if (s->pkts == 0) {
+		s->first_ns = rec->ts_ns;
+		s->win_first = s->win_last = win;
+	}
+	else
+		ma_add_interarrival(s, rec->ts_ns - s->last_ns);
+	s->last_ns = rec->ts_ns;
+	++s->pkts;
+	s->bytes += rec->len;
+
+	if (win != s->win_last) {
+		s->win_last = win;
+		s->n_last = 0;
+	}
+	++s->n_last;
+	if (win == s->win_first && s->n_last > s->n_first)
+		s->n_first = s->n_last;  /* still in the first window */
+	if (s->n_last > s->n_peak)
+		s->n_peak = s->n_last;
+
+	if ((seq = ma_seq_of(rec)) == MA_NONE)
+		return;
+	if (seq != MA_RESET)
+		++s->seq_pkts;
+	ma_track(&s->seqs, seq);
+	ma_add_prefix(s, seq);
+}  /* ma_datagram */
+
+
+static void ma_run_chunk(manalyze_options *opts, ma_chunk *c)
+{
+	cap_record rec;
+	ma_src *s;
+
+	while ((c->status = cap_next(&c->rd, &rec)) > 0) {
+		++c->pkts;
+		c->bytes += rec.len;
+		if ((s = ma_find(c->hash, c->srcs, &c->num_srcs, &rec)) == NULL)
+			++c->no_room;
+		else
+			ma_datagram(opts, s, &rec);
+	}
+}  /* ma_run_chunk */
+
+
+static void ma_worker(manalyze_options *opts)
+{
+	int i;
+
+	while ((i = (int)ma_next_chunk(&next_chunk)) < num_chunks)
+		ma_run_chunk(opts, &chunks[i]);
+}  /* ma_worker */
+
+
+#if defined(_WIN32)
+static DWORD WINAPI ma_thread(LPVOID arg)
+{
+	ma_worker((manalyze_options *)arg);
+	return 0;
+}  /* ma_thread */
+#else
+static void *ma_thread(void *arg)
+{
+	ma_worker((manalyze_options *)arg);
+	return NULL;
+}  /* ma_thread */
+#endif
+
+
+/* Sequence numbers of source 'g' in a part, from the start. */
+static void ma_reread(ma_src *g, const cap_reader *start)
+{
+	cap_reader rd = *start;
+	cap_record rec;
+	int seq;
+
+	while (cap_next(&rd, &rec) > 0) {
+		if (rec.src_addr == g->src_addr && rec.src_port == g->src_port &&
+				rec.dst_addr == g->dst_addr && rec.dst_port == g->dst_port &&
+				(seq = ma_seq_of(&rec)) != MA_NONE)
+			ma_track(&g->seqs, seq);
+	}
+}  /* ma_reread */
+
+
+/* Add chunk source 'c' (read from 'start') to the merged 'g', which holds
+ * everything of that source before it.  Returns 1 if the part had to be
+ * read again. */
+static int ma_merge(ma_src *g, ma_src *c, const cap_reader *start)
+{
+	ma_seqs before, fresh;
+	int i, reread = 0;
+
+	if (g->pkts == 0) {  /* nothing before: as it is */
+		int *prefix = c->prefix;
+		*g = *c;
+		g->prefix = NULL;
+		g->num_prefix = g->max_prefix = 0;
+		free(prefix);
+		c->prefix = NULL;
+		return 0;
+	}
+
+	ma_add_interarrival(g, c->first_ns - g->last_ns);
+	if (c->ia_num > 0) {
+		if (g->ia_num == 0 || c->ia_min < g->ia_min)
+			g->ia_min = c->ia_min;
+		if (c->ia_max > g->ia_max)
+			g->ia_max = c->ia_max;
+		g->ia_sum += c->ia_sum;
+		g->ia_num += c->ia_num;
+		for (i = 0; i < MANALYZE_IA_BINS; ++i)
+			g->ia_hist[i] += c->ia_hist[i];
+	}
+	if (c->last_ns > g->last_ns)
+		g->last_ns = c->last_ns;
+	g->pkts += c->pkts;
+	g->bytes += c->bytes;
+
+	/* a window cut in two by the boundary */
+	if (c->win_first == g->win_last) {
+		unsigned long long n = g->n_last + c->n_first;
+		if (n > g->n_peak)
+			g->n_peak = n;
+		if (c->win_last == c->win_first)
+			g->n_last = n;
+		else
+			g->n_last = c->n_last;
+	}
+	else
+		g->n_last = c->n_last;
+	g->win_last = c->win_last;
+	if (c->n_peak > g->n_peak)
+		g->n_peak = c->n_peak;
+
+	/* replay the prefix from the real history, and from none (as the
+	 * chunk did), and swap the results */
+	g->seq_pkts += c->seq_pkts;
+	if (c->num_prefix > 0) {
+		before = g->seqs;
+		memset(&fresh, 0, sizeof(fresh));
+		fresh.hi = -1;
+		for (i = 0; i < c->num_prefix; ++i) {
+			ma_track(&g->seqs, c->prefix[i]);
+			ma_track(&fresh, c->prefix[i]);
+		}
+		if (c->prefix_state == MA_PREFIX_OPEN)
+			;  /* the prefix was all of it */
+		else if (ma_same_state(&g->seqs, &fresh)) {  /* the rest is in c->seqs */
+			memcpy(g->seqs.seen, c->seqs.seen, sizeof(g->seqs.seen));
+			g->seqs.hi = c->seqs.hi;
+			g->seqs.gaps += c->seqs.gaps - fresh.gaps;
+			g->seqs.dups += c->seqs.dups - fresh.dups;
+			g->seqs.reorders += c->seqs.reorders - fresh.reorders;
+		}
+		else {
+			g->seqs = before;
+			ma_reread(g, start);
+			reread = 1;
+		}
+	}
+	free(c->prefix);
+	c->prefix = NULL;
+	return reread;
+}  /* ma_merge */
+
+
+/* Upper bound (us) of the inter-arrival bin holding fraction 'q'. */
+static double ma_percentile(const ma_src *s, double q)
+{
+	unsigned long long want = (unsigned long long)(q * s->ia_num), sum = 0;
+	int bin;
+
+	for (bin = 0; bin < MANALYZE_IA_BINS; ++bin) {
+		sum += s->ia_hist[bin];
+		if (sum > want)
+			break;
+	}
+	if (bin >= MANALYZE_IA_BINS)
+		bin = MANALYZE_IA_BINS - 1;
+	return (bin == 0) ? 0.0 : (double)(1ULL << bin) / 1e3;
+}  /* ma_percentile */
+
+
+static void ma_report_source(manalyze_options *opts, const ma_src *s)
+{
+	struct in_addr src, dst;
+	char src_str[32];
+	double secs = (s->last_ns - s->first_ns) / 1e9;
+
+	src.s_addr = s->src_addr;
+	dst.s_addr = s->dst_addr;
+	sprintf(src_str, "%s:%d", inet_ntoa(src), ntohs(s->src_port));
+	if (s->dst_addr != 0 || s->dst_port != 0)
+		display(opts, "%s -> %s:%d:", src_str, inet_ntoa(dst), ntohs(s->dst_port));
+	else
+		display(opts, "%s:", src_str);
+	display(opts, " %llu datagrams, %llu bytes in %.3f s", s->pkts, s->bytes, secs);
+	if (secs > 0)
+		display(opts, " (%.0f msgs/sec, %.3f Mbit/s)", s->pkts / secs, s->bytes * 8 / secs / 1e6);
+	display(opts, ", at most %llu in %.0f us (%.0f msgs/sec)\n", s->n_peak, opts->o_burst_ns / 1e3,
+			s->n_peak * 1e9 / opts->o_burst_ns);
+	if (opts->o_quiet)
+		return;
+	if (s->seq_pkts > 0)
+		display(opts, "  sequence: %llu numbered, %llu gaps, %llu duplicates, %llu reorders\n",
+				s->seq_pkts, s->seqs.gaps, s->seqs.dups, s->seqs.reorders);
+	if (s->ia_num > 0)
+		display(opts, "  inter-arrival: min %.1f us, mean %.1f us, 50%% < %.1f us, 99%% < %.1f us, "
+				"99.9%% < %.1f us, max %.1f us\n",
+				s->ia_min / 1e3, s->ia_sum / s->ia_num / 1e3, ma_percentile(s, 0.5),
+				ma_percentile(s, 0.99), ma_percentile(s, 0.999), s->ia_max / 1e3);
+}  /* ma_report_source */
+
+
+int main(int argc, char **argv)
+{
+	manalyze_options opts;
+	static cap_reader files[MANALYZE_MAX_FILES];
+	static ma_src *g_hash[MANALYZE_HASH];
+	static ma_src *g_srcs[MANALYZE_MAX_SOURCES];
+	int g_num_srcs = 0;
+	cap_reader *parts;
+	int opt, i, j, k, num_files, max_chunks, num_reread = 0, num_corrupt = 0;
+	unsigned long long tot_pkts = 0, tot_bytes = 0, no_room = 0;
+	double tot_size = 0, secs;
+	TLONGLONG start_ns;
+#if defined(_WIN32)
+	HANDLE threads[MANALYZE_MAX_THREADS];
+#else
+	pthread_t threads[MANALYZE_MAX_THREADS];
+#endif
+
+	memset(&opts, 0, sizeof(opts));
+	opts.prog_name = argv[0];
+
+	/* default values for options */
+	opts.o_burst_ns = 1000000;
+	opts.o_threads = num_cpus();
+	opts.o_output = NULL;
+	opts.o_quiet = 0;
+
+	while ((opt = tgetopt(argc, argv, "b:hj:o:q")) != EOF) {
+		switch (opt) {
+		  case 'b':
+			opts.o_burst_ns = (TLONGLONG)(atof(toptarg) * 1000);
+			if (opts.o_burst_ns < 1000) {
+				usage(&opts, "-b must be at least 1 us");
+				exit(1);
+			}
+			break;
+		  case 'h':
+			help(&opts, NULL);  exit(0);
+			break;
+		  case 'j':
+			opts.o_threads = atoi(toptarg);
+			if (opts.o_threads < 1 || opts.o_threads > MANALYZE_MAX_THREADS) {
+				usage(&opts, "-j must be 1 to 256");
+				exit(1);
+			}
+			break;
+		  case 'o':
+			opts.o_output = fopen(toptarg, "w");
+			if (opts.o_output == NULL) {
+				mprintf((&opts), "ERROR: ");  perror((&opts), "fopen");
+				exit(1);
+			}
+			break;
+		  case 'q':
+			opts.o_quiet = 1;
+			break;
+		  default:
+			usage(&opts, "unrecognized option");
+			exit(1);
+			break;
+		}  /* switch */
+	}  /* while opt */
+	if (opts.o_threads > MANALYZE_MAX_THREADS)
+		opts.o_threads = MANALYZE_MAX_THREADS;
+
+	num_files = argc - toptind;
+	if (num_files < 1) {
+		usage(&opts, "need at least one capture file");
+		exit(1);
+	}
+	if (num_files > MANALYZE_MAX_FILES) {
+		usage(&opts, "too many capture files");
+		exit(1);
+	}
+	for (i = 0; i < num_files; ++i) {
+		if (cap_open(&files[i], argv[toptind + i]) < 0)
+			exit(1);
+		tot_size += (double)files[i].size;
+	}
+
+	/* chunks: in proportion to the size of each file */
+	start_ns = mt_clock_ns();
+	max_chunks = opts.o_threads * MANALYZE_CHUNKS_PER_THREAD;
+	chunks = (ma_chunk *)calloc(max_chunks + num_files, sizeof(ma_chunk));
+	parts = (cap_reader *)malloc((max_chunks + 1) * sizeof(cap_reader));
+	if (chunks == NULL || parts == NULL) {
+		mprintf((&opts), "ERROR: out of memory\n");
+		exit(1);
+	}
+	for (i = 0; i < num_files; ++i) {
+		int want = (int)(max_chunks * (double)files[i].size / tot_size + 0.5);
+		if (want < 1)
+			want = 1;
+		if (num_chunks + want > max_chunks + num_files)
+			want = max_chunks + num_files - num_chunks;
+		if ((k = cap_split(&files[i], parts, want)) < 0)
+			exit(1);
+		for (j = 0; j < k; ++j) {
+			chunks[num_chunks].rd = chunks[num_chunks].start = parts[j];
+			chunks[num_chunks].file = i;
+			++num_chunks;
+		}
+	}
+
+	if (opts.o_threads > num_chunks)
+		opts.o_threads = num_chunks;
+	for (i = 0; i < opts.o_threads; ++i) {
+#if defined(_WIN32)
+		if ((threads[i] = CreateThread(NULL, 0, ma_thread, &opts, 0, NULL)) == NULL) {
+			mprintf((&opts), "ERROR: CreateThread: %d\n", GetLastError());
+			exit(1);
+		}
+#else
+		if ((errno = pthread_create(&threads[i], NULL, ma_thread, &opts)) != 0) {
+			mprintf((&opts), "ERROR: ");  perror((&opts), "pthread_create");
+			exit(1);
+		}
+#endif
+	}
+	for (i = 0; i < opts.o_threads; ++i) {
+#if defined(_WIN32)
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+#else
+		pthread_join(threads[i], NULL);
+#endif
+	}
+
+	/* merge, in file order */
+	for (i = 0; i < num_chunks; ++i) {
+		ma_chunk *c = &chunks[i];
+		tot_pkts += c->pkts;
+		tot_bytes += c->bytes;
+		no_room += c->no_room;
+		if (c->status < 0) {
+			mprintf((&opts), "WARNING: %s: stopped at a corrupt record (part %d); the results leave out the rest of that part\n",
+					argv[toptind + c->file], i);
+			++num_corrupt;
+		}
+		for (j = 0; j < c->num_srcs; ++j) {
+			cap_record key;
+			ma_src *g;
+			memset(&key, 0, sizeof(key));
+			key.src_addr = c->srcs[j]->src_addr;
+			key.src_port = c->srcs[j]->src_port;
+			key.dst_addr = c->srcs[j]->dst_addr;
+			key.dst_port = c->srcs[j]->dst_port;
+			if ((g = ma_find(g_hash, g_srcs, &g_num_srcs, &key)) == NULL)
+				no_room += c->srcs[j]->pkts;
+			else
+				num_reread += ma_merge(g, c->srcs[j], &c->start);
+			free(c->srcs[j]->prefix);
+			free(c->srcs[j]);
+		}
+	}
+	secs = (mt_clock_ns() - start_ns) / 1e9;
+
+	for (i = 0; i < g_num_srcs; ++i)
+		ma_report_source(&opts, g_srcs[i]);
+	display(&opts, "%llu datagrams (%llu bytes) from %d source%s in %d file%s, analysed in %.3f s as %d parts on %d thread%s (%.0f MB/s)\n",
+			tot_pkts, tot_bytes, g_num_srcs, (g_num_srcs == 1) ? "" : "s", num_files, (num_files == 1) ? "" : "s",
+			secs, num_chunks, opts.o_threads, (opts.o_threads == 1) ? "" : "s", (secs > 0) ? tot_size / secs / 1e6 : 0.0);
+	if (no_room > 0)
+		display(&opts, "%llu datagrams not analysed: more than %d sources\n", no_room, MANALYZE_MAX_SOURCES);
+	if (num_reread > 0 && ! opts.o_quiet)
+		display(&opts, "(%d source%s read twice in a part, for long reordering across its start)\n",
+				num_reread, (num_reread == 1) ? "" : "s");
+
+	for (i = 0; i < num_files; ++i)
+		cap_close(&files[i]);
+	if (opts.o_output)
+		fclose(opts.o_output);
+	return (num_corrupt > 0) ? 1 : 0;
+}  /* main */
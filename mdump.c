@@ -29,8 +29,45 @@
 
 #include "mtools.h"
 
+#if defined(__linux__)
+#include <linux/sock_diag.h>  /* SK_MEMINFO_xxx */
+#endif
+#if defined(_WIN32)
+#define poll WSAPoll
+#else
+#include <fcntl.h>
+#include <poll.h>
+#endif
+
 #define FF_ARRAY_ELEMS(a)   (sizeof(a) / sizeof((a)[0]))
 
+/* -S: how far back a late datagram can be told apart from a duplicate */
+#define MDUMP_SEQ_WINDOW 1024
+
+/* -J churn benchmark */
+#define MDUMP_CHURN_MAX_COUNTS 16
+#define MDUMP_CHURN_TIMEOUT_MS 5000  /* give up on a group's first datagram */
+#define MDUMP_CHURN_QUIET_MS 200  /* after leaving, this long without datagrams is silence */
+
+/* -A line arbitration */
+#define MDUMP_ARB_WINDOW 4096  /* sequence numbers held open for the slower line */
+#define MDUMP_ARB_BATCH 64  /* datagrams read from one line before looking at the other */
+#define MDUMP_ARB_CMD_MS 1000  /* longest wait for a command's copy on the other line */
+
+/* -M microbursts */
+#define MDUMP_MB_MAX_SIZES 8
+#define MDUMP_MB_MAX_TOP 100
+#define MDUMP_MB_HIST 32  /* burst lengths, by powers of 2 of the finest bucket */
+
+/* -T MPEG-TS analysis */
+#define MDUMP_TS_PKT 188
+#define MDUMP_TS_SYNC 0x47
+#define MDUMP_TS_PIDS 8192
+#define MDUMP_TS_NULL_PID 0x1fff
+#define MDUMP_TS_PCR_WRAP ((TLONGLONG)300 << 33)  /* 27 MHz ticks */
+#define MDUMP_TS_PCR_MAX_NS 40000000  /* TR 101 290 PCR repetition limit */
+#define MDUMP_TS_PCR_JUMP_NS 100000000  /* further than this is a discontinuity */
+
 typedef struct mdump_options {
     /* program name (from argv[0] */
     char *prog_name;
@@ -38,13 +75,39 @@ typedef struct mdump_options {
     /* program options */
     int o_quiet_lvl;
     int o_rcvbuf_size;
+    int o_rcvbuf_max;  /* -r size/max: grow SO_RCVBUF up to this, 0 = fixed */
     int o_pause_ms;
     int o_pause_num;
     int o_verify;
     int o_stop;
     int o_tcp;
     FILE *o_output;
-    FILE *O_bin_output;
+    char *O_dumpfile;  /* -O file (name template with -R), NULL = none */
+    char *O_rotate;  /* -R spec, NULL = one file */
+    flight_rec *fr;  /* -L: -O names the windows written, NULL = off */
+    int O_format;  /* DUMP_FORMAT_xxx */
+    int o_backend;  /* MDUMP_BACKEND_xxx */
+    char *o_backend_if;  /* interface for -B rxring (NULL = all) */
+    int o_transport, o_transport_flags;  /* MT_TRANSPORT_xxx, MT_URING_xxx */
+    int o_transport_report;  /* -B given: report transport cost with 'stat' */
+    char *o_filter;  /* -f expression, NULL = none */
+    sockfilt o_filt;
+    int o_interval_ms;  /* -I: loss report period, 0 = none */
+    FILE *o_stats;  /* -S file, NULL = none */
+    int o_stats_json;  /* -S file ends in .json: JSON lines, else CSV */
+    int o_report_ms;  /* -I or -S period, 0 = no monitor reports */
+    char *o_counters;  /* -C name for live counters, NULL = none */
+    int o_perf;  /* -E: report CPU cost per datagram with 'stat' */
+    int o_feedback_ms;  /* -a: loss feedback period, 0 = none */
+    int o_churn_counts[MDUMP_CHURN_MAX_COUNTS];  /* -J group counts */
+    int o_churn_num;  /* number of -J counts, 0 = no churn benchmark */
+    int o_churn_cycles;  /* -J: join/leave cycles per count */
+    char *o_arb_line;  /* -A group_b[:port_b][@interface], NULL = one line */
+    int o_mb_us[MDUMP_MB_MAX_SIZES];  /* -M bucket sizes, smallest first */
+    int o_mb_num;  /* number of -M sizes, 0 = no microburst detection */
+    int o_mb_top;  /* -M: bursts listed */
+    int o_mb_min_pkts;  /* -M: datagrams in a bucket that make it part of a burst */
+    int o_ts_report_ms;  /* -T report period, 0 = no MPEG-TS analysis */
     char o_output_equiv_opt[1024], O_dumpfile_equiv_opt[1024];
 
     /* program positional parameters */
@@ -61,6 +124,33 @@ typedef struct mdump_options {
     /* state */
     struct sockaddr_storage addr;
     socklen_t addrlen;
+    char *buff;  /* receive buffer (one extra byte for a trailing null) */
+    int num_rcvd;
+    int cur_seq;
+    long long kdrops_base;  /* local_drops() at the last 'echo'/'stat' */
+    unsigned int ovfl_base;  /* SO_RXQ_OVFL count at the last 'echo'/'stat' */
+    int max_seq;  /* highest sequence number since then (-I), -1 = none */
+    int test_gen;  /* bumped at each 'echo'/'stat' reset */
+    int cur_rcvbuf;  /* SO_RCVBUF size last asked for */
+    struct sockaddr_in fb_addr;  /* -a: sender of the last 'echo', port 0 = none yet */
+
+    /* run totals for -S, never reset; the receive loop only adds to them */
+    unsigned long long tot_pkts, tot_bytes, tot_gaps, tot_dups, tot_reorders;
+    int seq_hi;  /* highest sequence number this test, -1 = none */
+    unsigned int seq_seen[MDUMP_SEQ_WINDOW / 32];  /* bit per sequence number below seq_hi */
+    mt_counters ctrs;  /* -C */
+    mt_perf perf;  /* -E, counting since the last 'echo'/'stat' */
+    SOCKET sock;
+    pkt_rxring rxring;  /* -B rxring */
+    mt_transport xport;  /* -B socket / uring (UDP only) */
+    struct arb_state *arb;  /* -A */
+    SOCKET sock_b;  /* -A line B */
+    struct sockaddr_in arb_addr[2];  /* -A lines, for the report */
+    struct mb_state *mb;  /* -M */
+    struct ts_state *ts;  /* -T */
+    cap_writer capw;  /* -O, with the -R settings */
+    int fr_seq;  /* -L gap: highest sequence number, -1 = none */
+    unsigned long long fr_drops;  /* -L drop: kernel drops seen so far */
 
     /* tcp state */
     SOCKET tcp_listen_sock;
@@ -69,8 +159,32 @@ typedef struct mdump_options {
 
 } mdump_options;
 
+/* -O dump file formats (-F) */
+#define DUMP_FORMAT_RAW 0  /* payload bytes only, no framing */
+#define DUMP_FORMAT_MCAP 1  /* framed records (see capture.c), replayable by 'msend -R' */
+
+/* how datagrams are received (-B) */
+#define MDUMP_BACKEND_SOCKET 0  /* recvfrom() per datagram */
+#define MDUMP_BACKEND_RXRING 1  /* AF_PACKET TPACKET_V3 ring (Linux) */
+#define MDUMP_BACKEND_URING 2  /* io_uring multishot recvmsg (Linux) */
+
+/* how often -r size/max looks at drops and queue depth (and -C publishes them) */
+#define MDUMP_ADAPT_MS 100
+
+/* -C live counters */
+#define MDUMP_CTR_PKTS 0
+#define MDUMP_CTR_BYTES 1
+#define MDUMP_CTR_GAPS 2
+#define MDUMP_CTR_DUPS 3
+#define MDUMP_CTR_REORDERS 4
+#define MDUMP_CTR_KDROPS 5
+#define MDUMP_CTR_RCVBUF 6
+static const char *ctr_names[] = { "packets", "bytes", "seq_gaps", "seq_dups", "seq_reorders",
+	"kernel_drops", "rcvbuf_bytes" };
+static const unsigned char ctr_flags[] = { 0, 0, 0, 0, 0, 0, MT_CTR_GAUGE };
 
-static const char usage_str[] = "[-h] [-o ofile] [-O dumpfile][-p pause_ms[/loops]] [-Q Quiet_lvl] [-q] [-r rcvbuf_size] [-s] [-t] [-u] [-v] group port [igmpv3]";
+
+static const char usage_str[] = "[-A group_b[:port_b][@interface]] [-a interval_ms] [-B backend] [-C name] [-E] [-F format] [-f filter] [-h] [-I interval_ms] [-J count[,count...][/cycles]] [-L recorder] [-M bucket_us[,bucket_us...][/top_n[/min_pkts]]] [-o ofile] [-O dumpfile][-p pause_ms[/loops]] [-Q Quiet_lvl] [-q] [-R rotation] [-r rcvbuf_size[/max]] [-S statfile] [-s] [-T report_secs] [-t] [-u] [-v] group port [igmpv3]";
 
 void usage(mdump_options* opts, char *msg)
 {
@@ -88,9 +202,86 @@ void help(mdump_options* opts, char *msg)
 		fprintf(stderr, "\n%s\n\n", msg);
 	fprintf(stderr, "Usage: %s %s\n", opts->prog_name, usage_str);
 	fprintf(stderr, "Where:\n"
+			"  -A group_b[:port_b][@interface] : A/B arbitration: also receive line B\n"
+			"                   (the same msend messages on another group, port or\n"
+			"                   interface) and pass on the first copy of each sequence\n"
+			"                   number; 'stat' reports per-line gaps, gaps filled by the\n"
+			"                   other line, losses on both lines, and how often and by\n"
+			"                   how much each line was first (not with -t, -B or -J)\n"
+			"  -a interval_ms : every interval, send datagrams received, missing and\n"
+			"                   dropped locally (receive buffer overflow) back to the\n"
+			"                   sender of the last 'echo', and answer each 'stat' the\n"
+			"                   same way; this drives 'msend -c' [0: off] (not with -t)\n"
+			"  -B backend : how datagrams are received [socket]\n"
+			"               socket : one recvfrom() per datagram\n"
+			"               rxring[,ifname] : read blocks of datagrams in place from an\n"
+			"                        AF_PACKET TPACKET_V3 ring, filtered in the kernel\n"
+			"                        to group and port (Linux, needs CAP_NET_RAW;\n"
+			"                        all interfaces by default; ring size is -r;\n"
+			"                        fragmented datagrams are not seen)\n"
+			"               uring[,sqpoll] : io_uring multishot recvmsg into a ring of\n"
+			"                        provided buffers, optionally with a kernel\n"
+			"                        polling thread (Linux; not with -t)\n"
+			"             With an explicit -B, each 'stat' message also reports\n"
+			"             system calls and CPU time per datagram\n"
+			"  -C name : publish live counters for 'mstat' under 'name'\n"
+			"  -E : with each 'stat' message, report the CPU cost per datagram of the\n"
+			"       receive loop since 'echo': cycles, IPC and cache misses\n"
+			"       (perf_event_open hardware counters), CPU time and context\n"
+			"       switches per 1000 datagrams (software counters, or getrusage)\n"
+			"  -f filter : drop datagrams in the kernel (SO_ATTACH_FILTER) unless they\n"
+			"              match every comma-separated term (Linux; not with -t or\n"
+			"              -B rxring):\n"
+			"              src=a.b.c.d[/bits] - source address or subnet\n"
+			"              sport=port[-port] - source port or range\n"
+			"              len=min[-max] - payload length\n"
+			"              prefix=text|0xhex - payload starts with these bytes\n"
+			"              ('echo' and 'stat' messages skip the len and prefix tests;\n"
+			"              'stat' reports delivered vs kernel-dropped datagrams, and\n"
+			"              the network/local loss split is not printed)\n"
+			"  -F format : format of the -O dumpfile [raw]:\n"
+			"              raw - payload bytes only, no framing\n"
+			"              mcap - framed records with arrival time, source and\n"
+			"                     msend sequence number, in 1 MB blocks with a\n"
+			"                     time/sequence index at the end; replayable with\n"
+			"                     'msend -R', from any time or message, and\n"
+			"                     analysed again with 'manalyze'\n"
 			"  -h : help\n"
+			"  -I interval_ms : every interval, print datagrams received and missing\n"
+			"                   (from msend sequence numbers), split into network\n"
+			"                   loss and local receive-buffer overflow [0: off]\n"
+			"  -J count[,count...][/cycles] : instead of receiving, benchmark group\n"
+			"                   churn: for each count, join that many consecutive groups\n"
+			"                   from 'group' (with the igmpv3 sources, if any), then\n"
+			"                   leave them, 'cycles' times [1]; print the kernel cost\n"
+			"                   of a join and the distribution of join-to-first-datagram\n"
+			"                   and leave-to-silence times (feed it with a local\n"
+			"                   'msend -N n/n -r rate ...'; not with -t or -B)\n"
+			"  -L recorder : flight recorder: keep the latest datagrams in memory and\n"
+			"                write the window around a trigger to a new -O dumpfile\n"
+			"                (mcap; %%N in the name is the window number), comma-\n"
+			"                separated (not with -R or -t):\n"
+			"                size=bytes[k|m|g] - memory for the datagrams [64m]\n"
+			"                window=ms - how far back to write [all in memory]\n"
+			"                post=ms - also record this long after the trigger [0]\n"
+			"                gap - trigger on a gap in msend sequence numbers\n"
+			"                drop - trigger on a datagram dropped by the kernel\n"
+			"                lat=us - trigger on a datagram read this long after\n"
+			"                         it arrived (the loop fell behind)\n"
+			"                and SIGUSR1 (Unix) triggers at the next datagram; on\n"
+			"                SIGINT/SIGTERM a pending window is written at once\n"
+			"  -M bucket_us[,bucket_us...][/top_n[/min_pkts]] : microburst detection:\n"
+			"                   count datagrams and bytes in time buckets of each\n"
+			"                   size (multiples of the smallest, e.g. 10,100,1000),\n"
+			"                   using kernel arrival times where available; 'stat'\n"
+			"                   reports the peak rate for each size, the distribution\n"
+			"                   of burst lengths (runs of smallest buckets holding\n"
+			"                   min_pkts [2] or more datagrams) and the top_n [10]\n"
+			"                   bursts with their times (not with -t)\n"
 			"  -o ofile : print results to file (in addition to stdout)\n"
             "  -O dumpfile : dumps packets to a binary file without text formatting\n"
+			"                (written from its own thread in 1 MB blocks; with -R the\n"
+			"                name may hold strftime codes and %%N, the file number)\n"
 			"  -p pause_ms[/num] : milliseconds to pause after each receive [0: no pause]\n"
 			"                      and number of loops to apply the pause [0: all loops]\n"
 			"  -Q Quiet_lvl : set quiet level [0] :\n"
@@ -98,9 +289,43 @@ void help(mdump_options* opts, char *msg)
 			"                 1 - print datagram summaries\n"
 			"                 2 - no print per datagram (same as '-q')\n"
 			"  -q : no print per datagram (same as '-Q 2')\n"
-			"  -r rcvbuf_size : size (bytes) of UDP receive buffer (SO_RCVBUF) [4194304]\n"
-			"                   (use 0 for system default buff size)\n"
+			"  -R rotation : -O dumpfile options, comma-separated [one file]:\n"
+			"                size=bytes[k|m|g] - start a new file at this size\n"
+			"                                    (space is preallocated)\n"
+			"                time=secs - start a new file this often\n"
+			"                keep=files - delete older files, keep the last ones\n"
+			"                bufs=count - 1 MB buffers for the disk to fall behind\n"
+			"                             by before datagrams are dropped [16]\n"
+			"                direct - bypass the page cache (O_DIRECT)\n"
+			"                lz4[=level], zstd[=level] - compress each 1 MB buffer\n"
+			"                          on its own, in packer threads (builds with\n"
+			"                          HAVE_LZ4 / HAVE_ZSTD; zstd level [1]): mcap\n"
+			"                          stays seekable block by block, raw becomes\n"
+			"                          a stream of frames for 'lz4 -d' / 'zstd -d';\n"
+			"                          size= counts bytes before compression\n"
+			"                packers=threads - threads compressing [2]\n"
+			"                (without %%N in dumpfile, '.%%N' is added when rotating;\n"
+			"                'stat' reports what was written and dropped, and the\n"
+			"                compression ratio and whether the packers keep up)\n"
+			"  -r rcvbuf_size[/max] : size (bytes) of UDP receive buffer (SO_RCVBUF) [4194304]\n"
+			"                   (use 0 for system default buff size); with '/max', double\n"
+			"                   it (up to max) whenever datagrams are dropped for lack of\n"
+			"                   space or the queue is over half full, logging each resize\n"
+			"                   (SO_RCVBUFFORCE lifts the rmem_max limit if privileged;\n"
+			"                   with -f only the queue counts, as the kernel's drop\n"
+			"                   count includes filtered datagrams)\n"
+			"  -S statfile : every -I interval (or second), append a line of run totals\n"
+			"                (64-bit packets, bytes, sequence gaps, duplicates, reorders,\n"
+			"                kernel drops) and rates (pps, Mbit/s) to statfile; JSON lines\n"
+			"                if it ends in '.json', else CSV with a header (written\n"
+			"                when the file is new)\n"
 			"  -s : stop execution when status msg received\n"
+			"  -T report_secs : MPEG-TS analysis: walk the 188-byte TS packets of each\n"
+			"                   datagram (after an RTP header, if any) and, every\n"
+			"                   report_secs (at the next datagram) and at 'stat', print\n"
+			"                   per PID packets, Mbit/s, continuity and transport errors,\n"
+			"                   and for PCR PIDs the longest PCR interval, intervals over\n"
+			"                   40 ms, jumps, jitter and the PCR-derived rate\n"
 			"  -t : Use TCP (use '0.0.0.0' for group)\n"
 			"  -v : verify the sequence numbers\n"
 			"\n"
@@ -245,16 +470,9 @@ static int parse_igmpv3_sources(const char* sources, char* sources_arr[], int so
 static void initialize_basic_socket(mdump_options* opts, SOCKET sock)
 {
     int opt;
-	int cur_size, sz;
+	int cur_size;
 
-	if(setsockopt(sock,SOL_SOCKET,SO_RCVBUF,(const char *)&opts->o_rcvbuf_size,
-			sizeof(opts->o_rcvbuf_size)) == SOCKET_ERROR) {
-		mprintf((opts), "WARNING: setsockopt - SO_RCVBUF\n");
-		perror((opts), "setsockopt - SO_RCVBUF");
-	}
-	sz = sizeof(cur_size);
-	if (getsockopt(sock,SOL_SOCKET,SO_RCVBUF,(char *)&cur_size,
-			(socklen_t *)&sz) == SOCKET_ERROR) {
+	if ((cur_size = mt_set_sockbuf(sock, SO_RCVBUF, opts->o_rcvbuf_size)) < 0) {
 		mprintf((opts), "ERROR: ");
         perror((opts), "getsockopt - SO_RCVBUF");
 		exit(1);
@@ -262,6 +480,7 @@ static void initialize_basic_socket(mdump_options* opts, SOCKET sock)
 	if (cur_size < opts->o_rcvbuf_size) {
 		mprintf((opts), "WARNING: tried to set SO_RCVBUF to %d, only got %d\n", opts->o_rcvbuf_size, cur_size);
 	}
+	opts->cur_rcvbuf = opts->o_rcvbuf_size;
     	
 	opt = 1;
 	if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (char *)&opt, sizeof(opt)) == SOCKET_ERROR) {
@@ -269,6 +488,39 @@ static void initialize_basic_socket(mdump_options* opts, SOCKET sock)
         perror((opts), "setsockopt SO_REUSEADDR");
 		exit(1);
 	}
+
+#if defined(SO_RXQ_OVFL)
+	/* have the kernel's drop count for this socket come with each datagram */
+	if (! opts->o_tcp) {
+		opt = 1;
+		if (setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, (char *)&opt, sizeof(opt)) == SOCKET_ERROR) {
+			mprintf((opts), "WARNING: ");
+			perror((opts), "setsockopt - SO_RXQ_OVFL");
+		}
+	}
+#endif
+
+#if defined(SO_TIMESTAMPNS)
+	/* -M, -T, -L: arrival times from the kernel, not from when the loop got round to it */
+	if ((opts->o_mb_num > 0 || opts->o_ts_report_ms > 0 || opts->fr) && ! opts->o_tcp) {
+		opt = 1;
+		if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, (char *)&opt, sizeof(opt)) == SOCKET_ERROR) {
+			mprintf((opts), "WARNING: ");
+			perror((opts), "setsockopt - SO_TIMESTAMPNS");
+		}
+	}
+#endif
+
+	if (opts->o_filter && ! opts->o_tcp) {
+		int num_insns = sockfilt_attach(sock, &opts->o_filt);
+		if (num_insns < 0) {
+			mprintf((opts), "ERROR: ");
+			perror((opts), "setsockopt - SO_ATTACH_FILTER");
+			exit(1);
+		}
+		if (opts->o_quiet_lvl < 2)
+			mprintf((opts), "Kernel filter '%s': %d BPF instructions\n", opts->o_filter, num_insns);
+	}
 }
 
 static SOCKET initliaze_tcp_socket(mdump_options* opts)
@@ -336,7 +588,9 @@ static SOCKET initliaze_udp_socket(mdump_options* opts)
 		}
 	}
 
-    if (opts->igmpv3_sources_num == 0 || !opts->igmpv3_include) {
+    if (! IN_MULTICAST(ntohl(opts->groupaddr))) {
+        /* unicast (0.0.0.0 or a local address): nothing to join */
+    } else if (opts->igmpv3_sources_num == 0 || !opts->igmpv3_include) {
         if (udp_join_multicast_group(sock, (struct sockaddr *) &opts->addr) < 0) {
             perror((opts), "udp_join_multicast_group");
             exit(1);
@@ -362,6 +616,66 @@ static SOCKET initliaze_udp_socket(mdump_options* opts)
 }
 
 
+/* -A: the socket for line B, "group_b[:port_b][@interface]" (the port
+ * defaults to line A's, the interface to any). */
+static SOCKET initialize_line_b(mdump_options* opts)
+{
+	SOCKET sock;
+	struct sockaddr_in name;
+	struct ip_mreq imr;
+	char spec[100], *colon, *at;
+
+	if (strlen(opts->o_arb_line) >= sizeof(spec)) {
+		mprintf((opts), "ERROR: -A %s: too long\n", opts->o_arb_line);
+		exit(1);
+	}
+	strcpy(spec, opts->o_arb_line);
+	memset((char *)&imr, 0, sizeof(imr));
+	imr.imr_interface.s_addr = htonl(INADDR_ANY);
+	if ((at = strchr(spec, '@')) != NULL) {
+		*at = '\0';
+		imr.imr_interface.s_addr = inet_addr(at + 1);
+	}
+	memset((char *)&name, 0, sizeof(name));
+	name.sin_family = AF_INET;
+	name.sin_port = htons(opts->groupport);
+	if ((colon = strchr(spec, ':')) != NULL) {
+		*colon = '\0';
+		name.sin_port = htons((unsigned short)atoi(colon + 1));
+	}
+	name.sin_addr.s_addr = inet_addr(spec);
+	imr.imr_multiaddr = name.sin_addr;
+
+	opts->arb_addr[0].sin_addr.s_addr = opts->groupaddr;
+	opts->arb_addr[0].sin_port = htons(opts->groupport);
+	opts->arb_addr[1] = name;
+	if (name.sin_addr.s_addr == opts->groupaddr && name.sin_port == htons(opts->groupport)) {
+		mprintf((opts), "ERROR: -A %s: line B must differ from line A\n", opts->o_arb_line);
+		exit(1);
+	}
+
+	if ((sock = socket(PF_INET,SOCK_DGRAM,0)) == INVALID_SOCKET) {
+		mprintf((opts), "ERROR: ");  perror((opts), "socket");
+		exit(1);
+	}
+	initialize_basic_socket(opts, sock);
+	if (bind(sock,(struct sockaddr *)&name, sizeof(name)) == SOCKET_ERROR) {
+		/* So OSes don't want you to bind to the m/c group. */
+		name.sin_addr.s_addr = htonl(INADDR_ANY);
+		if (bind(sock,(struct sockaddr *)&name, sizeof(name)) == SOCKET_ERROR) {
+			mprintf((opts), "ERROR: ");  perror((opts), "bind");
+			exit(1);
+		}
+	}
+	if (IN_MULTICAST(ntohl(imr.imr_multiaddr.s_addr)) &&
+			setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, (char *)&imr, sizeof(imr)) == SOCKET_ERROR) {
+		mprintf((opts), "ERROR: ");  perror((opts), "setsockopt - IP_ADD_MEMBERSHIP");
+		exit(1);
+	}
+	return sock;
+}  /* initialize_line_b */
+
+
 static SOCKET initialize_socket(mdump_options* opts)
 {
     SOCKET sock;
@@ -372,9 +686,1650 @@ static SOCKET initialize_socket(mdump_options* opts)
         sock = initliaze_udp_socket(opts);
 	}
 
+	if (opts->o_backend == MDUMP_BACKEND_RXRING) {
+		/* the socket now only holds the group membership; datagrams are
+		 * read from the ring */
+		if (pktring_rx_open(&opts->rxring, opts->o_backend_if, opts->groupaddr,
+				htons(opts->groupport), opts->o_rcvbuf_size) < 0)
+			exit(1);
+		if (pktring_mute_socket(sock) < 0) {
+			mprintf((opts), "WARNING: ");  perror((opts), "setsockopt - SO_ATTACH_FILTER");
+		}
+		if (opts->o_quiet_lvl < 2)
+			mprintf((opts), "RX ring on %s: %d blocks of %d bytes\n",
+				opts->rxring.ifname, opts->rxring.block_nr, opts->rxring.block_size);
+	}
+
     return sock;
 }
 
+
+/* Total datagrams dropped locally (receive buffer or RX ring full), as far
+ * as the kernel tells us: the ring's statistics, else the socket's drop
+ * count from /proc/net/udp, else the last SO_RXQ_OVFL value.  -1 if none. */
+static long long local_drops(mdump_options *opts)
+{
+	long long drops;
+
+	if (opts->o_backend == MDUMP_BACKEND_RXRING) {
+		pktring_rx_stats(&opts->rxring);
+		return (long long)opts->rxring.drops;
+	}
+	if ((drops = mt_udp_drops(opts->sock)) >= 0)
+		return drops;
+	if (opts->xport.have_rxq_ovfl)
+		return opts->xport.rxq_ovfl;
+	return -1;
+}  /* local_drops */
+
+
+/* Sequence number of an msend data message ("Message <hex>"), or -1. */
+static int msg_seq(const char *data, int len)
+{
+	int i, seq = 0;
+
+	if (len <= 8 || memcmp(data, "Message ", 8) != 0)
+		return -1;
+	for (i = 8; i < len && i < 16; ++i) {  /* hex, as sent by msend */
+		char c = data[i];
+		if (c >= '0' && c <= '9') seq = (seq << 4) + c - '0';
+		else if (c >= 'a' && c <= 'f') seq = (seq << 4) + c - 'a' + 10;
+		else break;
+	}
+	return (i > 8) ? seq : -1;
+}  /* msg_seq */
+
+
+/* -A: A/B line arbitration.  The same message (same msend sequence number)
+ * comes on two lines; the first copy is handed on to handle_datagram(),
+ * the second only tells which line won and by how much.  A sequence
+ * number is settled once it falls MDUMP_ARB_WINDOW behind the highest
+ * one seen (or at 'stat'): then whatever line never delivered it has a
+ * gap, filled by the other line or lost on both. */
+typedef struct arb_line {
+    unsigned long long rcvd, dups, late;  /* late: after its number was settled */
+    unsigned long long missing, filled;  /* gaps on this line, and those the other line filled */
+    unsigned long long wins;  /* first of two copies */
+    TLONGLONG lead_ns_total, lead_ns_max;  /* by how much it was first */
+} arb_line;
+
+typedef struct arb_state {
+    int lo;  /* lowest sequence number not settled, -1 = none seen since reset */
+    int hi;  /* highest seen + 1 */
+    unsigned char mask[MDUMP_ARB_WINDOW];  /* bit per line that delivered lo + i (ring) */
+    TLONGLONG first_ns[MDUMP_ARB_WINDOW];  /* arrival of the first copy */
+    arb_line line[2];
+    unsigned long long lost;  /* on both lines */
+    /* a command seen on one line, until its copy on the other comes */
+    char cmd[256];
+    int cmd_len;
+    TLONGLONG cmd_ns;  /* 0 = none */
+    int cmd_pending;  /* 'stat' held back until both copies are in */
+    struct sockaddr_in cmd_src;
+} arb_state;
+
+
+static void arb_reset(arb_state *st)
+{
+	memset(st->mask, 0, sizeof(st->mask));
+	memset(st->line, 0, sizeof(st->line));
+	st->lo = -1;
+	st->hi = 0;
+	st->lost = 0;
+}  /* arb_reset */
+
+
+/* Settle every sequence number below 'upto'. */
+static void arb_settle(arb_state *st, int upto)
+{
+	for (; st->lo < upto; ++st->lo) {
+		unsigned char *m = &st->mask[st->lo % MDUMP_ARB_WINDOW];
+		if (*m == 0)
+			++st->lost;
+		else if (*m != 3) {
+			int missed = (*m == 1) ? 1 : 0;
+			++st->line[missed].missing;
+			++st->line[missed].filled;
+		}
+		*m = 0;
+	}
+}  /* arb_settle */
+
+
+/* Count one copy of 'seq' from line 'l'; returns 1 if it is the first. */
+static int arb_packet(arb_state *st, int l, int seq, TLONGLONG now_ns)
+{
+	int slot;
+	unsigned char bit = (unsigned char)(1 << l);
+
+	if (st->lo < 0)
+		st->lo = st->hi = seq;
+	if (seq < st->lo) {
+		++st->line[l].late;
+		return 0;
+	}
+	if (seq - st->lo >= MDUMP_ARB_WINDOW)
+		arb_settle(st, seq - MDUMP_ARB_WINDOW + 1);
+	++st->line[l].rcvd;
+	if (seq >= st->hi)
+		st->hi = seq + 1;
+
+	slot = seq % MDUMP_ARB_WINDOW;
+	if (st->mask[slot] & bit) {
+		++st->line[l].dups;
+		return 0;
+	}
+	if (st->mask[slot] == 0) {
+		st->mask[slot] = bit;
+		st->first_ns[slot] = now_ns;
+		return 1;
+	}
+	st->mask[slot] |= bit;
+	{
+		/* the line read first is not always the one that arrived first
+		 * (the sockets are drained in turn): go by the timestamps */
+		arb_line *winner = &st->line[1 - l];
+		TLONGLONG lead_ns = now_ns - st->first_ns[slot];
+		if (lead_ns < 0) {
+			winner = &st->line[l];
+			lead_ns = -lead_ns;
+		}
+		++winner->wins;
+		winner->lead_ns_total += lead_ns;
+		if (lead_ns > winner->lead_ns_max)
+			winner->lead_ns_max = lead_ns;
+	}
+	return 0;
+}  /* arb_packet */
+
+
+/* Settle what is left and print the results of the test (at 'stat'). */
+static void arb_report(mdump_options *opts)
+{
+	arb_state *st = opts->arb;
+	static const char *names[2] = { "A", "B" };
+	int l;
+
+	if (st->lo >= 0)
+		arb_settle(st, st->hi);
+	mprintf((opts), "A/B arbitration: %d delivered, %llu lost on both lines\n", opts->num_rcvd, st->lost);
+	for (l = 0; l < 2; ++l) {
+		arb_line *ln = &st->line[l];
+		mprintf((opts), "  line %s (%s:%d): %llu received, %llu missing (%llu filled by line %s), %llu duplicates, %llu too late\n",
+				names[l], inet_ntoa(opts->arb_addr[l].sin_addr), ntohs(opts->arb_addr[l].sin_port),
+				ln->rcvd, ln->missing, ln->filled, names[1 - l], ln->dups, ln->late);
+	}
+	for (l = 0; l < 2; ++l) {
+		arb_line *ln = &st->line[l];
+		mprintf((opts), "  line %s first %llu times", names[l], ln->wins);
+		if (ln->wins > 0)
+			mprintf((opts), ", by %.1f us on average (max %.1f us)",
+					ln->lead_ns_total / 1e3 / ln->wins, ln->lead_ns_max / 1e3);
+		mprintf((opts), "\n");
+	}
+}  /* arb_report */
+
+
+/* -M: microburst detection.  Arrivals and bytes are counted in buckets of
+ * the finest size; the per-datagram cost is a division, a compare and two
+ * adds.  When the clock moves past a bucket it is settled: folded into the
+ * coarser bucket sizes (multiples of the finest), whose busiest bucket is
+ * kept, and into the burst in progress.  A burst is a run of consecutive
+ * finest buckets each holding at least min_pkts datagrams.  Nothing is
+ * allocated after start-up, and empty buckets cost nothing. */
+typedef struct mb_size {
+    TLONGLONG ratio;  /* bucket size, in finest buckets */
+    TLONGLONG idx;  /* bucket being filled, -1 = none */
+    unsigned long long pkts, bytes;
+    unsigned long long peak_pkts, peak_bytes;
+    TLONGLONG peak_ns;  /* start of the bucket with the most datagrams */
+} mb_size;
+
+typedef struct mb_burst {
+    TLONGLONG start_ns;
+    TLONGLONG len;  /* in finest buckets, 0 = none */
+    unsigned long long pkts, bytes;
+} mb_burst;
+
+typedef struct mb_state {
+    TLONGLONG fine_ns;
+    TLONGLONG cur;  /* finest bucket being filled, -1 = none since reset */
+    unsigned long long pkts, bytes;  /* in it */
+    TLONGLONG first;  /* first finest bucket since reset */
+    mb_size size[MDUMP_MB_MAX_SIZES];
+    int num_sizes;
+    mb_burst burst;  /* in progress */
+    TLONGLONG burst_last;  /* its last finest bucket */
+    mb_burst top[MDUMP_MB_MAX_TOP];  /* most datagrams first */
+    int num_top;
+    unsigned long long hist_bursts[MDUMP_MB_HIST], hist_pkts[MDUMP_MB_HIST];  /* by log2 length */
+    unsigned long long tot_pkts, num_bursts, burst_pkts;
+} mb_state;
+
+
+/* Parse -M "bucket_us[,bucket_us...][/top_n[/min_pkts]]". */
+static int parse_mburst(mdump_options *opts, char *spec)
+{
+	char *p = spec, *end;
+	int i, j;
+
+	opts->o_mb_num = 0;
+	opts->o_mb_top = 10;
+	opts->o_mb_min_pkts = 2;
+	for (;;) {
+		long us = strtol(p, &end, 10);
+		if (end == p || us <= 0 || us > 10000000 || opts->o_mb_num == MDUMP_MB_MAX_SIZES) {
+			fprintf(stderr, "-M: bucket sizes must be 1 to 10000000 us, at most %d of them\n",
+					MDUMP_MB_MAX_SIZES);
+			return -1;
+		}
+		for (i = opts->o_mb_num; i > 0 && opts->o_mb_us[i - 1] > us; --i)  /* keep sorted */
+			opts->o_mb_us[i] = opts->o_mb_us[i - 1];
+		opts->o_mb_us[i] = (int)us;
+		++opts->o_mb_num;
+		if (*end != ',')
+			break;
+		p = end + 1;
+	}
+	if (*end == '/') {
+		opts->o_mb_top = (int)strtol(end + 1, &end, 10);
+		if (*end == '/')
+			opts->o_mb_min_pkts = (int)strtol(end + 1, &end, 10);
+	}
+	if (*end != '\0' || opts->o_mb_top < 0 || opts->o_mb_top > MDUMP_MB_MAX_TOP || opts->o_mb_min_pkts < 1) {
+		fprintf(stderr, "-M: bad spec '%s' (top_n 0 to %d, min_pkts at least 1)\n", spec, MDUMP_MB_MAX_TOP);
+		return -1;
+	}
+	for (i = 1, j = 1; i < opts->o_mb_num; ++i) {
+		if (opts->o_mb_us[i] % opts->o_mb_us[0] != 0) {
+			fprintf(stderr, "-M: bucket sizes must be multiples of the smallest (%d us)\n", opts->o_mb_us[0]);
+			return -1;
+		}
+		if (opts->o_mb_us[i] != opts->o_mb_us[j - 1])  /* drop repeats */
+			opts->o_mb_us[j++] = opts->o_mb_us[i];
+	}
+	opts->o_mb_num = j;
+	return 0;
+}  /* parse_mburst */
+
+
+static void mb_reset(mdump_options *opts)
+{
+	mb_state *mb = opts->mb;
+	int k;
+
+	memset(mb, 0, sizeof(*mb));
+	mb->fine_ns = (TLONGLONG)opts->o_mb_us[0] * 1000;
+	mb->cur = -1;
+	mb->num_sizes = opts->o_mb_num;
+	for (k = 0; k < mb->num_sizes; ++k) {
+		mb->size[k].ratio = opts->o_mb_us[k] / opts->o_mb_us[0];
+		mb->size[k].idx = -1;
+	}
+}  /* mb_reset */
+
+
+/* Close a bucket of one size: is it the busiest so far? */
+static void mb_size_close(mb_state *mb, mb_size *s)
+{
+	if (s->idx >= 0 && s->pkts > s->peak_pkts) {
+		s->peak_pkts = s->pkts;
+		s->peak_ns = s->idx * s->ratio * mb->fine_ns;
+	}
+	if (s->bytes > s->peak_bytes)
+		s->peak_bytes = s->bytes;
+	s->pkts = s->bytes = 0;
+}  /* mb_size_close */
+
+
+/* The burst in progress is over: add it to the distribution and the top N. */
+static void mb_burst_end(mdump_options *opts, mb_state *mb)
+{
+	mb_burst *b = &mb->burst;
+	int bin = 0, i;
+
+	if (b->len == 0)
+		return;
+	while (bin < MDUMP_MB_HIST - 1 && (b->len >> (bin + 1)) != 0)
+		++bin;
+	++mb->hist_bursts[bin];
+	mb->hist_pkts[bin] += b->pkts;
+	++mb->num_bursts;
+	mb->burst_pkts += b->pkts;
+
+	if (mb->num_top < opts->o_mb_top || (mb->num_top > 0 && b->pkts > mb->top[mb->num_top - 1].pkts)) {
+		if (mb->num_top < opts->o_mb_top)
+			++mb->num_top;
+		for (i = mb->num_top - 1; i > 0 && mb->top[i - 1].pkts < b->pkts; --i)
+			mb->top[i] = mb->top[i - 1];
+		mb->top[i] = *b;
+	}
+	b->len = 0;
+}  /* mb_burst_end */
+
+
+/* The clock has moved on to finest bucket 'next': settle the current one. */
+static void mb_settle(mdump_options *opts, mb_state *mb, TLONGLONG next)
+{
+	TLONGLONG cur = mb->cur;
+	int k;
+
+	mb->cur = next;
+	if (cur < 0) {
+		mb->first = next;
+		return;
+	}
+	mb->tot_pkts += mb->pkts;
+
+	for (k = 0; k < mb->num_sizes; ++k) {
+		mb_size *s = &mb->size[k];
+		TLONGLONG idx = cur / s->ratio;
+		if (idx != s->idx) {
+			mb_size_close(mb, s);
+			s->idx = idx;
+		}
+		s->pkts += mb->pkts;
+		s->bytes += mb->bytes;
+	}
+
+	if (mb->pkts >= (unsigned long long)opts->o_mb_min_pkts) {
+		if (mb->burst.len > 0 && cur != mb->burst_last + 1)
+			mb_burst_end(opts, mb);
+		if (mb->burst.len == 0) {
+			mb->burst.start_ns = cur * mb->fine_ns;
+			mb->burst.pkts = mb->burst.bytes = 0;
+		}
+		++mb->burst.len;
+		mb->burst.pkts += mb->pkts;
+		mb->burst.bytes += mb->bytes;
+		mb->burst_last = cur;
+	}
+	else
+		mb_burst_end(opts, mb);
+
+	mb->pkts = mb->bytes = 0;
+}  /* mb_settle */
+
+
+/* Count one datagram that arrived at 'rcv_ns': the per-datagram cost. */
+static void mb_packet(mdump_options *opts, TLONGLONG rcv_ns, int len)
+{
+	mb_state *mb = opts->mb;
+	TLONGLONG idx = rcv_ns / mb->fine_ns;
+
+	if (idx != mb->cur)
+		mb_settle(opts, mb, idx);
+	++mb->pkts;
+	mb->bytes += len;
+}  /* mb_packet */
+
+
+static const char *mb_time(TLONGLONG ns)
+{
+	struct timeval tv;
+
+	tv.tv_sec = (long)(ns / 1000000000);
+	tv.tv_usec = (long)((ns % 1000000000) / 1000);
+	return format_time(&tv);
+}  /* mb_time */
+
+
+/* Settle what is left and print the results of the test (at 'stat'). */
+static void mb_report(mdump_options *opts)
+{
+	mb_state *mb = opts->mb;
+	double fine_us = mb->fine_ns / 1e3, span_s;
+	int k, i;
+
+	if (mb->cur >= 0) {
+		TLONGLONG last = mb->cur;
+		mb_settle(opts, mb, last + 1);
+		for (k = 0; k < mb->num_sizes; ++k)
+			mb_size_close(mb, &mb->size[k]);
+		mb_burst_end(opts, mb);
+		mb->cur = last;
+	}
+	if (mb->tot_pkts == 0) {
+		mprintf((opts), "Microbursts: no datagrams\n");
+		return;
+	}
+	span_s = (mb->cur + 1 - mb->first) * mb->fine_ns / 1e9;
+	mprintf((opts), "Microbursts: %llu datagrams over %.6f s (%.0f msgs/sec on average)\n",
+			mb->tot_pkts, span_s, mb->tot_pkts / span_s);
+	for (k = 0; k < mb->num_sizes; ++k) {
+		mb_size *s = &mb->size[k];
+		double secs = s->ratio * mb->fine_ns / 1e9;
+		mprintf((opts), "  %7.0f us buckets: peak %llu datagrams (%.0f msgs/sec) at %s, %llu bytes (%.1f Mbit/s)\n",
+				s->ratio * fine_us, s->peak_pkts, s->peak_pkts / secs, mb_time(s->peak_ns),
+				s->peak_bytes, s->peak_bytes * 8 / secs / 1e6);
+	}
+
+	mprintf((opts), "  bursts (runs of %.0f us buckets with %d or more datagrams): %llu, holding %llu datagrams (%.1f%%)\n",
+			fine_us, opts->o_mb_min_pkts, mb->num_bursts, mb->burst_pkts,
+			mb->burst_pkts * 100.0 / mb->tot_pkts);
+	for (i = 0; i < MDUMP_MB_HIST; ++i) {
+		char range[64];
+		if (mb->hist_bursts[i] == 0)
+			continue;
+		if (i == 0)
+			sprintf(range, "%.0f us", fine_us);
+		else
+			sprintf(range, "%.0f-%.0f us", ((TLONGLONG)1 << i) * fine_us, (((TLONGLONG)2 << i) - 1) * fine_us);
+		mprintf((opts), "    %-20s %10llu bursts, %12llu datagrams\n", range,
+				mb->hist_bursts[i], mb->hist_pkts[i]);
+	}
+	if (mb->num_top > 0)
+		mprintf((opts), "  top %d bursts:\n", mb->num_top);
+	for (i = 0; i < mb->num_top; ++i) {
+		mb_burst *b = &mb->top[i];
+		double secs = b->len * mb->fine_ns / 1e9;
+		mprintf((opts), "    %s  %8.0f us  %8llu datagrams  %10llu bytes  (%.0f msgs/sec, %.1f Mbit/s)\n",
+				mb_time(b->start_ns), b->len * fine_us, b->pkts, b->bytes,
+				b->pkts / secs, b->bytes * 8 / secs / 1e6);
+	}
+}  /* mb_report */
+
+
+/* -T: MPEG-TS analysis.  A datagram holds whole 188-byte TS packets
+ * (usually 7), straight after the UDP header or after an RTP header.  Per
+ * packet the cost is a lookup in a flat table indexed by PID and a few
+ * compares; the table is allocated once, and the PIDs are listed in order
+ * of appearance for the report.  Continuity counters follow ISO 13818-1: a
+ * packet with payload steps the counter, one repeat is allowed, and the
+ * discontinuity indicator excuses a jump; a packet without payload keeps
+ * it.  Between consecutive PCRs of a PID, the jitter is how far the
+ * arrival times moved from the PCR values (all packets of a datagram
+ * arrive together, so it includes where in the datagram the PCR sits),
+ * and the transport rate is the TS packets received over the PCR time. */
+typedef struct ts_pid {
+    unsigned long long pkts, cc_errs, tei_errs;  /* this interval */
+    int cc;  /* last continuity counter, -1 = none yet */
+    int repeated;  /* the last packet repeated the one before */
+    int listed;
+    /* PCR */
+    TLONGLONG pcr, pcr_rcv_ns;  /* the last, in 27 MHz ticks, and when it arrived; -1 = none */
+    unsigned long long pcr_pkt;  /* TS packets of the stream before it */
+    unsigned long long pcrs, pcr_late, pcr_jumps;  /* this interval */
+    TLONGLONG pcr_max_ns, jit_max_ns;
+    double jit_sum;
+    unsigned long long jit_num, rate_pkts;
+    TLONGLONG rate_ns;
+} ts_pid;
+
+typedef struct ts_state {
+    ts_pid pid[MDUMP_TS_PIDS];
+    unsigned short list[MDUMP_TS_PIDS];
+    int num_listed;
+    unsigned long long pkts;  /* TS packets since the reset */
+    TLONGLONG start_ns, report_ns;  /* of the interval, and when it ends; 0 = not started */
+    unsigned long long dgrams, rtp, sync_errs, partial;  /* this interval */
+    unsigned long long ipkts, cc_errs, tei_errs;
+    unsigned long long tot_cc_errs, tot_tei_errs;
+} ts_state;
+
+
+static void ts_reset(mdump_options *opts)
+{
+	ts_state *ts = opts->ts;
+	int i;
+
+	memset(ts, 0, sizeof(*ts));
+	for (i = 0; i < MDUMP_TS_PIDS; ++i) {
+		ts->pid[i].cc = -1;
+		ts->pid[i].pcr = -1;
+	}
+}  /* ts_reset */
+
+
+/* The PCR of packet 'b' of PID 'p', which arrived at 'rcv_ns'. */
+static void ts_pcr(ts_state *ts, ts_pid *p, const unsigned char *b, int discontinuity, TLONGLONG rcv_ns)
+{
+	TLONGLONG pcr = (((TLONGLONG)b[6] << 25) | ((TLONGLONG)b[7] << 17) | (b[8] << 9) | (b[9] << 1) | (b[10] >> 7)) * 300 +
+		(((b[10] & 1) << 8) | b[11]);
+	TLONGLONG d_ns, jit;
+
+	++p->pcrs;
+	if (p->pcr >= 0 && ! discontinuity) {
+		d_ns = (pcr - p->pcr + MDUMP_TS_PCR_WRAP) % MDUMP_TS_PCR_WRAP * 1000 / 27;
+		if (d_ns > MDUMP_TS_PCR_JUMP_NS)
+			++p->pcr_jumps;  /* not flagged: a PCR discontinuity error */
+		else if (d_ns > 0) {
+			if (d_ns > p->pcr_max_ns)
+				p->pcr_max_ns = d_ns;
+			if (d_ns > MDUMP_TS_PCR_MAX_NS)
+				++p->pcr_late;
+			jit = (rcv_ns - p->pcr_rcv_ns) - d_ns;
+			if (jit < 0)
+				jit = -jit;
+			if (jit > p->jit_max_ns)
+				p->jit_max_ns = jit;
+			p->jit_sum += (double)jit;
+			++p->jit_num;
+			p->rate_pkts += ts->pkts - p->pcr_pkt;
+			p->rate_ns += d_ns;
+		}
+	}
+	p->pcr = pcr;
+	p->pcr_rcv_ns = rcv_ns;
+	p->pcr_pkt = ts->pkts;
+}  /* ts_pcr */
+
+
+/* One TS packet: the per-packet cost. */
+static void ts_packet(ts_state *ts, const unsigned char *b, TLONGLONG rcv_ns)
+{
+	int pid, afc, cc, discontinuity = 0, has_pcr = 0;
+	ts_pid *p;
+
+	if (b[0] != MDUMP_TS_SYNC) {
+		++ts->sync_errs;
+		return;
+	}
+	pid = ((b[1] & 0x1f) << 8) | b[2];
+	afc = (b[3] >> 4) & 3;
+	cc = b[3] & 0x0f;
+	p = &ts->pid[pid];
+	if (! p->listed) {
+		p->listed = 1;
+		ts->list[ts->num_listed++] = (unsigned short)pid;
+	}
+	++p->pkts;
+	++ts->ipkts;
+	++ts->pkts;
+	if (b[1] & 0x80) {  /* transport error indicator: the header cannot be trusted */
+		++p->tei_errs;
+		++ts->tei_errs;
+		return;
+	}
+	if ((afc & 2) && b[4] > 0) {  /* adaptation field */
+		discontinuity = b[5] & 0x80;
+		has_pcr = (b[5] & 0x10) && b[4] >= 7;
+	}
+	if (pid == MDUMP_TS_NULL_PID)
+		return;
+	if (p->cc >= 0 && ! discontinuity) {
+		if (! (afc & 1)) {  /* no payload: unchanged */
+			if (cc != p->cc) {
+				++p->cc_errs;
+				++ts->cc_errs;
+			}
+		}
+		else if (cc == p->cc && ! p->repeated) {
+			p->repeated = 1;  /* a packet may be sent twice */
+			return;
+		}
+		else if (cc != ((p->cc + 1) & 0x0f)) {
+			++p->cc_errs;
+			++ts->cc_errs;
+		}
+	}
+	p->repeated = 0;
+	p->cc = cc;
+	if (has_pcr)
+		ts_pcr(ts, p, b, discontinuity, rcv_ns);
+}  /* ts_packet */
+
+
+/* Print the interval that ends at 'now_ns' (at -T period, or 'stat'),
+ * then start the next. */
+static void ts_report(mdump_options *opts, TLONGLONG now_ns)
+{
+	ts_state *ts = opts->ts;
+	double secs = (now_ns - ts->start_ns) / 1e9;
+	int i;
+
+	if (ts->start_ns == 0 || secs <= 0)
+		return;
+	ts->tot_cc_errs += ts->cc_errs;
+	ts->tot_tei_errs += ts->tei_errs;
+	mprintf((opts), "TS: %.3f s: %llu datagrams (%llu RTP), %llu packets (%.3f Mbit/s), %llu CC errors (%llu in all), %llu transport errors (%llu in all), %llu sync errors, %llu datagrams not of whole packets\n",
+			secs, ts->dgrams, ts->rtp, ts->ipkts, ts->ipkts * MDUMP_TS_PKT * 8 / secs / 1e6,
+			ts->cc_errs, ts->tot_cc_errs, ts->tei_errs, ts->tot_tei_errs, ts->sync_errs, ts->partial);
+	if (ts->ipkts > 0)
+		mprintf((opts), "     PID     packets    Mbit/s  CC errs  TEI errs |  PCRs  max ms  >40ms  jumps  jitter mean/max us  PCR rate Mbit/s\n");
+	for (i = 0; i < ts->num_listed; ++i) {
+		ts_pid *p = &ts->pid[ts->list[i]];
+		if (p->pkts == 0)
+			continue;
+		mprintf((opts), "  0x%04x %11llu %9.3f %8llu %9llu", ts->list[i], p->pkts,
+				p->pkts * MDUMP_TS_PKT * 8 / secs / 1e6, p->cc_errs, p->tei_errs);
+		if (p->pcrs > 0)
+			mprintf((opts), " | %5llu %7.1f %6llu %6llu  %8.0f/%-8.0f  %12.3f", p->pcrs, p->pcr_max_ns / 1e6,
+					p->pcr_late, p->pcr_jumps, (p->jit_num > 0) ? p->jit_sum / p->jit_num / 1e3 : 0.0,
+					p->jit_max_ns / 1e3, (p->rate_ns > 0) ? p->rate_pkts * MDUMP_TS_PKT * 8 / (p->rate_ns / 1e9) / 1e6 : 0.0);
+		mprintf((opts), "\n");
+		p->pkts = p->cc_errs = p->tei_errs = 0;
+		p->pcrs = p->pcr_late = p->pcr_jumps = p->jit_num = p->rate_pkts = 0;
+		p->pcr_max_ns = p->jit_max_ns = p->rate_ns = 0;
+		p->jit_sum = 0;
+	}
+	ts->dgrams = ts->rtp = ts->sync_errs = ts->partial = 0;
+	ts->ipkts = ts->cc_errs = ts->tei_errs = 0;
+	ts->start_ns = now_ns;
+	ts->report_ns = now_ns + (TLONGLONG)opts->o_ts_report_ms * 1000000;
+}  /* ts_report */
+
+
+/* Walk the TS packets of a datagram that arrived at 'rcv_ns'. */
+static void ts_datagram(mdump_options *opts, const char *data, int len, TLONGLONG rcv_ns)
+{
+	ts_state *ts = opts->ts;
+	const unsigned char *d = (const unsigned char *)data;
+	int off = 0;
+
+	if (ts->start_ns == 0) {
+		ts->start_ns = rcv_ns;
+		ts->report_ns = rcv_ns + (TLONGLONG)opts->o_ts_report_ms * 1000000;
+	}
+	else if (rcv_ns >= ts->report_ns)
+		ts_report(opts, rcv_ns);
+	++ts->dgrams;
+	/* RTP (RFC 2250): version 2, where TS would have its sync byte */
+	if (len >= 12 && d[0] != MDUMP_TS_SYNC && (d[0] >> 6) == 2) {
+		off = 12 + (d[0] & 0x0f) * 4;  /* and the CSRCs */
+		if ((d[0] & 0x10) && len >= off + 4)  /* header extension */
+			off += 4 + ((d[off + 2] << 8) | d[off + 3]) * 4;
+		++ts->rtp;
+	}
+	if (off > len || (len - off) % MDUMP_TS_PKT != 0)
+		++ts->partial;
+	for (; off + MDUMP_TS_PKT <= len; off += MDUMP_TS_PKT)
+		ts_packet(ts, d + off, rcv_ns);
+}  /* ts_datagram */
+
+
+/* -L: SIGUSR1 asks for the window now (seen with the next datagram) */
+static volatile sig_atomic_t fr_usr1;
+
+#if ! defined(_WIN32)
+static void fr_usr1_handler(int sig)
+{
+	(void)sig;
+	fr_usr1 = 1;
+}  /* fr_usr1_handler */
+#endif
+
+
+/* -L: keep the datagram, then look for the triggers.  'kernel_ns' is its
+ * arrival time from the kernel, 0 if not known. */
+static void fr_datagram(mdump_options *opts, const char *data, int len,
+		const struct sockaddr_in *src, TLONGLONG rcv_ns, TLONGLONG kernel_ns)
+{
+	flight_rec *f = opts->fr;
+	unsigned long long drops;
+	int seq = msg_seq(data, len);
+
+	fr_record(f, data, len, rcv_ns, src, seq);
+	if (f->trig_gap && seq >= 0) {
+		if (opts->fr_seq >= 0 && seq > opts->fr_seq + 1)
+			fr_trigger(f, "sequence gap", rcv_ns);
+		if (seq > opts->fr_seq)
+			opts->fr_seq = seq;
+	}
+	if (f->trig_drop) {
+		drops = opts->xport.rxq_ovfl + opts->rxring.drops;
+		if (drops != opts->fr_drops) {
+			fr_trigger(f, "kernel drop", rcv_ns);
+			opts->fr_drops = drops;
+		}
+	}
+	if (f->trig_lat_ns > 0 && kernel_ns != 0) {
+		struct timeval tv;
+		currenttv(&tv);
+		if ((TLONGLONG)tv.tv_sec * 1000000000 + (TLONGLONG)tv.tv_usec * 1000 - kernel_ns > f->trig_lat_ns)
+			fr_trigger(f, "late datagram", rcv_ns);
+	}
+	if (fr_usr1) {
+		fr_usr1 = 0;
+		fr_trigger(f, "SIGUSR1", rcv_ns);
+	}
+}  /* fr_datagram */
+
+
+/* Start counting afresh ('echo' starts a test, 'stat' ends one). */
+static void reset_test_stats(mdump_options *opts)
+{
+	opts->num_rcvd = 0;
+	opts->cur_seq = 0;
+	opts->max_seq = -1;
+	opts->seq_hi = -1;  /* msend numbers each run from 0 */
+	opts->kdrops_base = opts->o_tcp ? 0 : local_drops(opts);
+	opts->ovfl_base = opts->xport.rxq_ovfl;
+	++opts->test_gen;
+	if (opts->arb)
+		arb_reset(opts->arb);
+	if (opts->mb)
+		mb_reset(opts);
+	if (opts->ts)
+		ts_reset(opts);
+	opts->fr_seq = -1;
+	if (opts->o_perf)
+		mt_perf_start(&opts->perf);
+}  /* reset_test_stats */
+
+
+/* -I: what arrived and what went missing since the last report. */
+typedef struct interval_state {
+    int gen, prev_rcvd, prev_missing;
+    long long prev_drops, prev_network;
+} interval_state;
+
+static void interval_report(mdump_options *opts, interval_state *st, double elapsed)
+{
+	int rcvd, max_seq, missing;
+	long long drops, network;
+
+	if (st->gen != opts->test_gen) {  /* new test: counters were reset */
+		memset(st, 0, sizeof(*st));
+		st->gen = opts->test_gen;
+	}
+	rcvd = opts->num_rcvd;
+	max_seq = opts->max_seq;
+	missing = (max_seq >= rcvd) ? max_seq + 1 - rcvd : 0;
+	drops = opts->o_tcp ? -1 : local_drops(opts);
+	if (drops >= 0)
+		drops -= opts->kdrops_base;
+
+	/* A drop is counted when it happens, the gap only when a later
+	 * datagram arrives, so split the totals for the test and report
+	 * the change: a burst of overflow is not mistaken for network loss. */
+	network = (drops >= 0 && missing > drops) ? missing - drops : 0;
+	if (network < st->prev_network)
+		network = st->prev_network;
+	if (max_seq >= 0 && drops >= 0)
+		mprintf((opts), "[+%.3fs] %d rcvd, %d missing (%lld network), %lld local overflow\n",
+			elapsed, rcvd - st->prev_rcvd, missing - st->prev_missing,
+			network - st->prev_network, drops - st->prev_drops);
+	else if (drops >= 0)
+		mprintf((opts), "[+%.3fs] %d rcvd, %lld local overflow\n",
+			elapsed, rcvd - st->prev_rcvd, drops - st->prev_drops);
+	else
+		mprintf((opts), "[+%.3fs] %d rcvd\n", elapsed, rcvd - st->prev_rcvd);
+
+	st->prev_rcvd = rcvd;
+	st->prev_missing = missing;
+	st->prev_network = network;
+	if (drops >= 0)
+		st->prev_drops = drops;
+}  /* interval_report */
+
+
+/* -S: one CSV or JSON line per period with the run totals (64-bit, never
+ * reset) and the rates since the previous line. */
+typedef struct stats_state {
+    TLONGLONG prev_ns;
+    unsigned long long prev_pkts, prev_bytes;
+    long long drops_base;
+} stats_state;
+
+static void stats_report(mdump_options *opts, stats_state *st, double elapsed)
+{
+	TLONGLONG now_ns = mt_clock_ns();
+	unsigned long long pkts = opts->tot_pkts, bytes = opts->tot_bytes;
+	double secs = (now_ns - st->prev_ns) / 1e9, pps = 0, mbps = 0;
+	long long drops = (opts->o_tcp || st->drops_base < 0) ? -1 : local_drops(opts);
+	char drops_str[32];
+	struct timeval tv;
+
+	if (secs > 0) {
+		pps = (pkts - st->prev_pkts) / secs;
+		mbps = (bytes - st->prev_bytes) * 8 / secs / 1e6;
+	}
+	if (drops >= 0)
+		sprintf(drops_str, "%lld", drops - st->drops_base);
+	else
+		strcpy(drops_str, opts->o_stats_json ? "null" : "");
+	currenttv(&tv);
+
+	if (opts->o_stats_json)
+		fprintf(opts->o_stats, "{\"time\":%ld.%03d,\"elapsed_s\":%.3f,\"packets\":%llu,\"bytes\":%llu,"
+			"\"pps\":%.1f,\"mbps\":%.3f,\"gaps\":%llu,\"dups\":%llu,\"reorders\":%llu,\"kernel_drops\":%s}\n",
+			(long)tv.tv_sec, (int)(tv.tv_usec / 1000), elapsed, pkts, bytes, pps, mbps,
+			opts->tot_gaps, opts->tot_dups, opts->tot_reorders, drops_str);
+	else
+		fprintf(opts->o_stats, "%ld.%03d,%.3f,%llu,%llu,%.1f,%.3f,%llu,%llu,%llu,%s\n",
+			(long)tv.tv_sec, (int)(tv.tv_usec / 1000), elapsed, pkts, bytes, pps, mbps,
+			opts->tot_gaps, opts->tot_dups, opts->tot_reorders, drops_str);
+	fflush(opts->o_stats);
+
+	st->prev_ns = now_ns;
+	st->prev_pkts = pkts;
+	st->prev_bytes = bytes;
+}  /* stats_report */
+
+
+/* Ask for a bigger receive buffer.  SO_RCVBUFFORCE (CAP_NET_ADMIN) is not
+ * limited by net.core.rmem_max; SO_RCVBUF is.  Returns the size granted
+ * (as the kernel reports it, i.e. doubled), or -1. */
+static int grow_rcvbuf(mdump_options *opts, int size, int *forced)
+{
+	*forced = 0;
+#if defined(SO_RCVBUFFORCE)
+	if (setsockopt(opts->sock, SOL_SOCKET, SO_RCVBUFFORCE, (char *)&size, sizeof(size)) == 0) {
+		int granted, sz = sizeof(granted);
+		*forced = 1;
+		if (getsockopt(opts->sock, SOL_SOCKET, SO_RCVBUF, (char *)&granted, (socklen_t *)&sz) == SOCKET_ERROR)
+			return -1;
+		return granted;
+	}
+#endif
+	return mt_set_sockbuf(opts->sock, SO_RCVBUF, size);
+}  /* grow_rcvbuf */
+
+
+/* -r size/max: double the receive buffer (up to 'max') whenever the kernel
+ * dropped datagrams for lack of space, or the queue got more than half
+ * full, since the last look.  With -f only the queue counts: the socket's
+ * drop count (behind /proc/net/udp, SO_RXQ_OVFL and SK_MEMINFO_DROPS
+ * alike) includes datagrams the filter rejected. */
+typedef struct adapt_state {
+    long long prev_drops;
+    int granted;  /* SO_RCVBUF as the kernel last reported it */
+    int clamped;  /* the kernel would not go higher */
+} adapt_state;
+
+static void adapt_rcvbuf(mdump_options *opts, adapt_state *st)
+{
+	long long drops = local_drops(opts), d_drops;
+	int fill_pct = -1, want, granted, forced;
+
+	if (drops < 0)
+		return;
+	d_drops = opts->o_filter ? 0 : drops - st->prev_drops;
+	st->prev_drops = drops;
+#if defined(SO_MEMINFO)
+	{
+		/* bytes queued vs the limit; SIOCINQ would only give the size of
+		 * the next datagram on a UDP socket */
+		unsigned int meminfo[SK_MEMINFO_VARS];
+		socklen_t len = sizeof(meminfo);
+		if (getsockopt(opts->sock, SOL_SOCKET, SO_MEMINFO, meminfo, &len) == 0 &&
+				meminfo[SK_MEMINFO_RCVBUF] > 0)
+			fill_pct = (int)((unsigned long long)meminfo[SK_MEMINFO_RMEM_ALLOC] * 100 /
+					meminfo[SK_MEMINFO_RCVBUF]);
+	}
+#endif
+	if ((d_drops == 0 && fill_pct <= 50) || st->clamped || opts->cur_rcvbuf >= opts->o_rcvbuf_max)
+		return;
+
+	want = (opts->cur_rcvbuf > opts->o_rcvbuf_max / 2) ? opts->o_rcvbuf_max : opts->cur_rcvbuf * 2;
+	granted = grow_rcvbuf(opts, want, &forced);
+	if (granted < 0) {
+		mprintf((opts), "WARNING: ");  perror((opts), "setsockopt - SO_RCVBUF");
+		st->clamped = 1;
+		return;
+	}
+	mprintf((opts), "SO_RCVBUF: %d -> %d bytes%s (%lld dropped, queue %d%% full); kernel reports %d\n",
+		opts->cur_rcvbuf, want, forced ? " via SO_RCVBUFFORCE" : "", d_drops, fill_pct, granted);
+	if (granted <= st->granted) {
+		mprintf((opts), "WARNING: SO_RCVBUF clamped by net.core.rmem_max (raise it, or run with CAP_NET_ADMIN); not growing further\n");
+		st->clamped = 1;
+	}
+	st->granted = granted;
+	opts->cur_rcvbuf = want;
+}  /* adapt_rcvbuf */
+
+
+/* Background work, in its own thread so the receive loop pays nothing for
+ * it: -I and -S reports, -r size/max buffer growth and the -C counters
+ * that cost a system call to read.  It only reads counters
+ * the loop maintains anyway. */
+/* One unicast control datagram ("feedback ...", "ready ...") to 'to',
+ * ignoring errors: the sender may have gone, and the test goes on. */
+static void send_reply(mdump_options *opts, const struct sockaddr_in *to, const char *msg)
+{
+	(void)sendto(opts->sock, msg, (int)strlen(msg), 0, (const struct sockaddr *)to, sizeof(*to));
+}  /* send_reply */
+
+
+/* -a: "feedback <received> <missing> <dropped locally>" for the test in
+ * progress, to the sender of its 'echo' (-1 = drops unknown). */
+static void periodic_feedback(mdump_options *opts)
+{
+	int rcvd = opts->num_rcvd, max_seq = opts->max_seq;
+	int missing = (max_seq >= 0 && max_seq + 1 > rcvd) ? max_seq + 1 - rcvd : 0;
+	long long drops = local_drops(opts);
+	char msg[100];
+
+	sprintf(msg, "feedback %d %d %lld", rcvd, missing, (drops >= 0) ? drops - opts->kdrops_base : -1);
+	send_reply(opts, &opts->fb_addr, msg);
+}  /* periodic_feedback */
+
+
+static void monitor(mdump_options *opts)
+{
+	TLONGLONG start_ns = mt_clock_ns(), next_ns = start_ns, report_ns, feedback_ns, tick_ns;
+	interval_state ist;
+	stats_state sst;
+	adapt_state ast;
+	int sz, tick_ms;
+
+	memset(&ist, 0, sizeof(ist));
+	ist.gen = -1;
+	memset(&sst, 0, sizeof(sst));
+	sst.prev_ns = start_ns;
+	sst.drops_base = opts->o_tcp ? -1 : local_drops(opts);
+	if (opts->o_stats && ! opts->o_stats_json &&
+			fseek(opts->o_stats, 0, SEEK_END) == 0 && ftell(opts->o_stats) == 0) {  /* new file */
+		fprintf(opts->o_stats, "time,elapsed_s,packets,bytes,pps,mbps,gaps,dups,reorders,kernel_drops\n");
+		fflush(opts->o_stats);
+	}
+	memset(&ast, 0, sizeof(ast));
+	ast.prev_drops = local_drops(opts);
+	sz = sizeof(ast.granted);
+	(void)getsockopt(opts->sock, SOL_SOCKET, SO_RCVBUF, (char *)&ast.granted, (socklen_t *)&sz);
+
+	/* wake up as often as the most frequent job needs */
+	tick_ms = (opts->o_rcvbuf_max > 0 || opts->o_counters) ? MDUMP_ADAPT_MS : 0;
+	if (opts->o_report_ms > 0 && (tick_ms == 0 || opts->o_report_ms < tick_ms))
+		tick_ms = opts->o_report_ms;
+	if (opts->o_feedback_ms > 0 && (tick_ms == 0 || opts->o_feedback_ms < tick_ms))
+		tick_ms = opts->o_feedback_ms;
+	tick_ns = (TLONGLONG)tick_ms * 1000000;
+	report_ns = start_ns + (TLONGLONG)opts->o_report_ms * 1000000;
+	feedback_ns = start_ns + (TLONGLONG)opts->o_feedback_ms * 1000000;
+
+	for (;;) {
+		TLONGLONG now_ns;
+
+		next_ns += tick_ns;
+		now_ns = mt_clock_ns();
+		if (next_ns > now_ns) {
+			SLEEP_USEC((unsigned int)((next_ns - now_ns) / 1000));
+			now_ns = mt_clock_ns();
+		}
+
+		if (opts->o_rcvbuf_max > 0)
+			adapt_rcvbuf(opts, &ast);
+		if (opts->o_counters) {
+			long long drops = opts->o_tcp ? -1 : local_drops(opts);
+			if (drops >= 0 && sst.drops_base >= 0)
+				mt_ctr_set(&opts->ctrs, MDUMP_CTR_KDROPS, drops - sst.drops_base);
+			mt_ctr_set(&opts->ctrs, MDUMP_CTR_RCVBUF, opts->cur_rcvbuf);
+		}
+		if (opts->o_feedback_ms > 0 && now_ns >= feedback_ns) {
+			if (opts->fb_addr.sin_port != 0)
+				periodic_feedback(opts);
+			feedback_ns += (TLONGLONG)opts->o_feedback_ms * 1000000;
+		}
+		if (opts->o_report_ms > 0 && now_ns >= report_ns) {
+			if (opts->o_interval_ms > 0)
+				interval_report(opts, &ist, (now_ns - start_ns) / 1e9);
+			if (opts->o_stats)
+				stats_report(opts, &sst, (now_ns - start_ns) / 1e9);
+			report_ns += (TLONGLONG)opts->o_report_ms * 1000000;
+		}
+	}
+}  /* monitor */
+
+
+#if defined(_WIN32)
+static DWORD WINAPI monitor_thread(LPVOID arg)
+{
+	monitor((mdump_options *)arg);
+	return 0;
+}  /* monitor_thread */
+#else
+static void *monitor_thread(void *arg)
+{
+	monitor((mdump_options *)arg);
+	return NULL;
+}  /* monitor_thread */
+#endif
+
+
+/* -S, -C: classify a sequence number.  A jump ahead adds the numbers skipped
+ * to the gaps; one at or below the highest seen is a duplicate if it was
+ * already seen, otherwise a reorder (late, perhaps filling a gap).  Beyond
+ * MDUMP_SEQ_WINDOW back it cannot be told, and counts as a reorder. */
+static void track_seq(mdump_options *opts, int seq)
+{
+	unsigned int *seen = opts->seq_seen;
+	int s;
+
+	if (opts->seq_hi < 0 || seq > opts->seq_hi) {
+		if (opts->seq_hi < 0 || seq - opts->seq_hi >= MDUMP_SEQ_WINDOW)
+			memset(opts->seq_seen, 0, sizeof(opts->seq_seen));
+		else
+			for (s = opts->seq_hi + 1; s < seq; ++s)
+				seen[(s % MDUMP_SEQ_WINDOW) / 32] &= ~(1U << (s % 32));
+		if (opts->seq_hi >= 0) {
+			opts->tot_gaps += seq - opts->seq_hi - 1;
+			mt_ctr_add(&opts->ctrs, MDUMP_CTR_GAPS, seq - opts->seq_hi - 1);
+		}
+		opts->seq_hi = seq;
+	}
+	else if (opts->seq_hi - seq >= MDUMP_SEQ_WINDOW) {
+		opts->tot_reorders++;
+		mt_ctr_add(&opts->ctrs, MDUMP_CTR_REORDERS, 1);
+		return;
+	}
+	else if (seen[(seq % MDUMP_SEQ_WINDOW) / 32] & (1U << (seq % 32))) {
+		opts->tot_dups++;
+		mt_ctr_add(&opts->ctrs, MDUMP_CTR_DUPS, 1);
+		return;
+	}
+	else {
+		opts->tot_reorders++;
+		mt_ctr_add(&opts->ctrs, MDUMP_CTR_REORDERS, 1);
+	}
+	seen[(seq % MDUMP_SEQ_WINDOW) / 32] |= 1U << (seq % 32);
+}  /* track_seq */
+
+
+/* Everything done with one received datagram: print and dump it, then act
+ * on 'echo', 'stat' and 'ready?' commands or count (and verify) a data message.
+ * 'data' may point into the RX ring, so it is never written; 'rcv_ns' is
+ * the arrival time in ns since the epoch, or 0 for "now". */
+static void handle_datagram(mdump_options *opts, const char *data, int cur_size,
+		const struct sockaddr_in *src, TLONGLONG rcv_ns)
+{
+	struct timeval tv;
+	int num_sent;
+	float perc_loss;
+	long long ldrops, net_loss, fb_drops = -1;
+	char *buff = opts->buff;
+	TLONGLONG kernel_ns = rcv_ns;
+
+	if (opts->o_quiet_lvl < 2 || (opts->O_dumpfile && opts->O_format == DUMP_FORMAT_MCAP) || opts->mb ||
+			opts->ts || opts->fr) {
+		if (rcv_ns == 0) {
+			currenttv(&tv);
+			rcv_ns = (TLONGLONG)tv.tv_sec * 1000000000 + (TLONGLONG)tv.tv_usec * 1000;
+		} else {
+			tv.tv_sec = (long)(rcv_ns / 1000000000);
+			tv.tv_usec = (long)((rcv_ns % 1000000000) / 1000);
+		}
+	}
+
+	if (opts->o_quiet_lvl == 0) {  /* non-quiet: print full dump */
+		mprintf((opts),"%s %s.%d %d bytes:\n",
+				format_time(&tv),
+				inet_ntoa(((struct sockaddr_in*)&opts->addr)->sin_addr),
+				ntohs(((struct sockaddr_in*)&opts->addr)->sin_port),
+				cur_size
+				);
+		dump(stdout, data,cur_size);
+		if (opts->o_output) {
+			dump(opts->o_output, data,cur_size);
+		}
+	}
+	if (opts->o_quiet_lvl == 1) {  /* semi-quiet: print datagram summary */
+		mprintf((opts),"%s %s.%d %d bytes\n",  /* no colon */
+				format_time(&tv), inet_ntoa(((struct sockaddr_in*)&opts->addr)->sin_addr),
+				ntohs(((struct sockaddr_in*)&opts->addr)->sin_port), cur_size);
+	}
+
+	if (opts->fr)
+		fr_datagram(opts, data, cur_size, src, rcv_ns, kernel_ns);
+	else if(opts->O_dumpfile) /* binary dump of packets, useful for MPEG-TS */
+		capw_record(&opts->capw, data, cur_size, rcv_ns, src,
+				(opts->capw.format == CAPW_FORMAT_MCAP) ? msg_seq(data, cur_size) : MCAP_NO_SEQ);
+	if (cur_size > 5 && memcmp(data, "echo ", 5) == 0) {
+		/* echo command */
+		if (data != buff)
+			memcpy(buff, data, cur_size);
+		buff[cur_size] = '\0';  /* guarantee trailing null */
+		if (buff[cur_size - 1] == '\n')
+			buff[cur_size - 1] = '\0';  /* strip trailing nl */
+		mprintf((opts),"%s\n", buff);
+
+		reset_test_stats(opts);
+		if (opts->o_feedback_ms > 0 && src != NULL)
+			opts->fb_addr = *src;
+	}
+	else if (cur_size > 5 && memcmp(data, "stat ", 5) == 0) {
+		/* when sender tells us to, calc and print stats */
+		if (data != buff)
+			memcpy(buff, data, cur_size);
+		buff[cur_size] = '\0';  /* guarantee trailing null */
+		/* 'stat' message contains num msgs sent */
+		num_sent = atoi(&buff[5]);
+		perc_loss = (float)(num_sent - opts->num_rcvd) * 100.0f / (float)num_sent;
+		mprintf((opts),"%d msgs sent, %d received (not including 'stat')\n", num_sent, opts->num_rcvd);
+		mprintf((opts),"%f%% loss\n", perc_loss);
+		if (opts->o_backend == MDUMP_BACKEND_RXRING) {
+			pktring_rx_stats(&opts->rxring);
+			mprintf((opts),"RX ring: %llu packets, %llu dropped (ring full), %llu queue freezes\n",
+					opts->rxring.packets, opts->rxring.drops, opts->rxring.freezes);
+		}
+		if ((ldrops = local_drops(opts)) >= 0) {
+			ldrops -= opts->kdrops_base;
+			fb_drops = ldrops;
+			if (opts->o_filter)
+				mprintf((opts),"Kernel filter: %d delivered, %lld dropped in the kernel (filtered, or receive buffer full)\n",
+						opts->num_rcvd, ldrops);
+			else {
+				net_loss = (num_sent - opts->num_rcvd) - ldrops;
+				mprintf((opts),"Loss: %lld in the network, %lld local (receive buffer overflow)\n",
+						(net_loss > 0) ? net_loss : 0, ldrops);
+			}
+		}
+		if (opts->xport.have_rxq_ovfl)
+			mprintf((opts),"Socket drops reported with datagrams (SO_RXQ_OVFL): %u\n",
+					opts->xport.rxq_ovfl - opts->ovfl_base);
+		if (opts->o_transport_report && ! opts->o_tcp && opts->o_backend != MDUMP_BACKEND_RXRING) {
+			mt_transport_report(&opts->xport, stderr);
+			if (opts->o_output)
+				mt_transport_report(&opts->xport, opts->o_output);
+		}
+		if (opts->o_perf) {
+			mt_perf_stop(&opts->perf);
+			mt_perf_report(&opts->perf, stderr, "Receive loop", opts->num_rcvd, "datagram");
+			if (opts->o_output)
+				mt_perf_report(&opts->perf, opts->o_output, "Receive loop", opts->num_rcvd, "datagram");
+		}
+
+		if (opts->arb)
+			arb_report(opts);
+		if (opts->mb)
+			mb_report(opts);
+		if (opts->ts)
+			ts_report(opts, rcv_ns);
+		if (opts->fr) {
+			fr_report(opts->fr, stderr);
+			if (opts->o_output)
+				fr_report(opts->fr, opts->o_output);
+		}
+		else if (opts->O_dumpfile) {
+			capw_report(&opts->capw, stderr);
+			if (opts->o_output)
+				capw_report(&opts->capw, opts->o_output);
+		}
+
+		if (opts->o_feedback_ms > 0 && src != NULL) {
+			char fb[100];
+			sprintf(fb, "feedback final %d %d %lld", num_sent, opts->num_rcvd, fb_drops);
+			send_reply(opts, src, fb);
+		}
+
+		if (opts->o_stop) {
+			mt_ctr_close(&opts->ctrs);
+			if (opts->fr)
+				fr_close(opts->fr);
+			else if (opts->O_dumpfile)
+				capw_close(&opts->capw);
+			exit(0);
+		}
+
+		reset_test_stats(opts);
+	}
+	else if (cur_size > 7 && memcmp(data, "ready? ", 7) == 0) {
+		/* readiness probe ('msend -w'): the data path works, say so */
+		if (! opts->o_tcp && src != NULL) {
+			char reply[64];
+			if (data != buff)
+				memcpy(buff, data, cur_size);
+			buff[cur_size] = '\0';  /* guarantee trailing null */
+#if defined(_WIN32)
+			sprintf(reply, "ready %d mdump %lu", atoi(&buff[7]), (unsigned long)GetCurrentProcessId());
+#else
+			sprintf(reply, "ready %d mdump %lu", atoi(&buff[7]), (unsigned long)getpid());
+#endif
+			send_reply(opts, src, reply);
+		}
+	}
+	else {  /* not a cmd */
+		if (opts->o_pause_ms > 0 && ( (opts->o_pause_num > 0 && opts->num_rcvd < opts->o_pause_num)
+								|| (opts->o_pause_num == 0) )) {
+			SLEEP_MSEC(opts->o_pause_ms);
+		}
+
+		if (opts->o_verify) {
+			char seqbuf[65];
+			int seqlen = (cur_size < (int)sizeof(seqbuf)) ? cur_size : (int)sizeof(seqbuf) - 1;
+			memcpy(seqbuf, data, seqlen);
+			seqbuf[seqlen] = '\0';  /* guarantee trailing null */
+			if (seqlen < 8 || opts->cur_seq != strtol(&seqbuf[8], NULL, 16)) {
+				mprintf((opts),"Expected seq %x (hex), got %s\n", opts->cur_seq,
+						(seqlen < 8) ? "short message" : &seqbuf[8]);
+				/* resyncronize sequence numbers in case there is loss */
+				if (seqlen >= 8)
+					opts->cur_seq = strtol(&seqbuf[8], NULL, 16);
+			}
+		}
+
+		if (opts->o_report_ms > 0 || opts->o_counters || opts->o_feedback_ms > 0) {
+			int seq = msg_seq(data, cur_size);
+			if (seq >= 0) {
+				if (seq > opts->max_seq)
+					opts->max_seq = seq;
+				if (opts->o_stats || opts->o_counters)
+					track_seq(opts, seq);
+			}
+		}
+
+		if (opts->mb)
+			mb_packet(opts, rcv_ns, cur_size);
+		if (opts->ts)
+			ts_datagram(opts, data, cur_size, rcv_ns);
+		opts->tot_pkts++;
+		opts->tot_bytes += cur_size;
+		mt_ctr_add(&opts->ctrs, MDUMP_CTR_PKTS, 1);
+		mt_ctr_add(&opts->ctrs, MDUMP_CTR_BYTES, cur_size);
+		++opts->num_rcvd;
+		++opts->cur_seq;
+	}
+}  /* handle_datagram */
+
+
+/* -J: join/leave churn benchmark.  For each group count, open one socket
+ * per group (consecutive groups from 'group', all on 'port'), join them
+ * all, time each join in the kernel and wait for the first datagram of
+ * each group; then leave them all and wait for silence.  A local
+ * 'msend -N groups/groups' fan-out provides the traffic; its per-group
+ * send interval is the resolution of the latencies. */
+typedef struct churn_group {
+    SOCKET sock;
+    struct sockaddr_in addr;
+    TLONGLONG join_ns, leave_ns;  /* when the join/leave call was made */
+    TLONGLONG first_ns, last_ns;  /* first datagram after join, last after leave, 0 = none */
+} churn_group;
+
+
+/* Parse -J "count[,count...][/cycles]". */
+static int parse_churn(mdump_options *opts, char *spec)
+{
+	char *p = spec, *end;
+
+	opts->o_churn_num = 0;
+	opts->o_churn_cycles = 1;
+	for (;;) {
+		long num = strtol(p, &end, 10);
+		if (end == p || num <= 0 || num > 65536 || opts->o_churn_num == MDUMP_CHURN_MAX_COUNTS) {
+			fprintf(stderr, "-J: counts must be 1 to 65536 groups, at most %d of them\n",
+					MDUMP_CHURN_MAX_COUNTS);
+			return -1;
+		}
+		opts->o_churn_counts[opts->o_churn_num++] = (int)num;
+		if (*end != ',')
+			break;
+		p = end + 1;
+	}
+	if (*end == '/')
+		opts->o_churn_cycles = (int)strtol(end + 1, &end, 10);
+	if (*end != '\0' || opts->o_churn_cycles <= 0) {
+		fprintf(stderr, "-J: bad spec '%s'\n", spec);
+		return -1;
+	}
+	return 0;
+}  /* parse_churn */
+
+
+static int cmp_tll(const void *a, const void *b)
+{
+	TLONGLONG x = *(const TLONGLONG *)a, y = *(const TLONGLONG *)b;
+	return (x < y) ? -1 : (x > y);
+}  /* cmp_tll */
+
+
+/* "label: min .. p50 .. p90 .. p99 .. max" of 'num' latencies (ns) out of
+ * 'total' groups, in ms. */
+static void churn_dist(mdump_options *opts, const char *label, TLONGLONG *vals, int num, int total,
+		const char *none)
+{
+	if (num == 0) {
+		mprintf((opts), "  %s: none of %d groups\n", label, total);
+		return;
+	}
+	qsort(vals, num, sizeof(vals[0]), cmp_tll);
+	mprintf((opts), "  %s (ms): min %.3f, p50 %.3f, p90 %.3f, p99 %.3f, max %.3f",
+			label, vals[0] / 1e6, vals[num / 2] / 1e6, vals[(int)(num * 0.9)] / 1e6,
+			vals[(int)(num * 0.99)] / 1e6, vals[num - 1] / 1e6);
+	if (num < total)
+		mprintf((opts), "; %d of %d groups %s", total - num, total, none);
+	mprintf((opts), "\n");
+}  /* churn_dist */
+
+
+/* Read everything queued on group 'g' (the socket is non-blocking);
+ * returns how many datagrams. */
+static int churn_drain(mdump_options *opts, churn_group *g)
+{
+	int num = 0;
+
+	while (recv(g->sock, opts->buff, 65536, 0) >= 0)
+		++num;
+	return num;
+}  /* churn_drain */
+
+
+static void churn_open(mdump_options *opts, churn_group *g, int idx)
+{
+	struct sockaddr_in name;
+	int on = 1;
+#if defined(_WIN32)
+	u_long nonblock = 1;
+#endif
+
+	memset(g, 0, sizeof(*g));
+	g->addr.sin_family = AF_INET;
+	g->addr.sin_addr.s_addr = htonl(ntohl(opts->groupaddr) + idx);
+	g->addr.sin_port = htons(opts->groupport);
+	if ((g->sock = socket(PF_INET, SOCK_DGRAM, 0)) == INVALID_SOCKET) {
+		mprintf((opts), "ERROR: ");  perror((opts), "socket (raise the open files limit for many groups)");
+		exit(1);
+	}
+	if (setsockopt(g->sock, SOL_SOCKET, SO_REUSEADDR, (char *)&on, sizeof(on)) == SOCKET_ERROR) {
+		mprintf((opts), "ERROR: ");  perror((opts), "setsockopt SO_REUSEADDR");
+		exit(1);
+	}
+#if defined(_WIN32)
+	ioctlsocket(g->sock, FIONBIO, &nonblock);
+#else
+	fcntl(g->sock, F_SETFL, fcntl(g->sock, F_GETFL) | O_NONBLOCK);
+#endif
+	/* bound to its group, each socket sees only that group (where allowed) */
+	name = g->addr;
+	if (bind(g->sock, (struct sockaddr *)&name, sizeof(name)) == SOCKET_ERROR) {
+		name.sin_addr.s_addr = htonl(INADDR_ANY);
+		if (bind(g->sock, (struct sockaddr *)&name, sizeof(name)) == SOCKET_ERROR) {
+			mprintf((opts), "ERROR: ");  perror((opts), "bind");
+			exit(1);
+		}
+	}
+}  /* churn_open */
+
+
+/* Join group 'g' as mdump would (with the igmpv3 sources, if any).
+ * Returns the time spent in the kernel, ns. */
+static TLONGLONG churn_join(mdump_options *opts, churn_group *g)
+{
+	int rtn;
+
+	g->join_ns = mt_clock_ns();
+	if (opts->igmpv3_sources_num > 0 && opts->igmpv3_include)
+		rtn = udp_set_multicast_sources(g->sock, (struct sockaddr *)&g->addr, sizeof(g->addr),
+				opts->igmpv3_sources, opts->igmpv3_sources_num, 1);
+	else {
+		rtn = udp_join_multicast_group(g->sock, (struct sockaddr *)&g->addr);
+		if (rtn >= 0 && opts->igmpv3_sources_num > 0)
+			rtn = udp_set_multicast_sources(g->sock, (struct sockaddr *)&g->addr, sizeof(g->addr),
+					opts->igmpv3_sources, opts->igmpv3_sources_num, 0);
+	}
+	if (rtn < 0) {
+		mprintf((opts), "ERROR: joining %s failed\n", inet_ntoa(g->addr.sin_addr));
+		exit(1);
+	}
+	return mt_clock_ns() - g->join_ns;
+}  /* churn_join */
+
+
+/* Leave group 'g' (IP_DROP_MEMBERSHIP also ends a source-specific join).
+ * Returns the time spent in the kernel, ns. */
+static TLONGLONG churn_leave(mdump_options *opts, churn_group *g)
+{
+	struct ip_mreq imr;
+
+	churn_drain(opts, g);  /* what is queued now arrived before the leave */
+	imr.imr_multiaddr = g->addr.sin_addr;
+	imr.imr_interface.s_addr = htonl(INADDR_ANY);
+	g->leave_ns = mt_clock_ns();
+	if (setsockopt(g->sock, IPPROTO_IP, IP_DROP_MEMBERSHIP, (char *)&imr, sizeof(imr)) == SOCKET_ERROR) {
+		mprintf((opts), "ERROR: ");  perror((opts), "setsockopt - IP_DROP_MEMBERSHIP");
+		exit(1);
+	}
+	return mt_clock_ns() - g->leave_ns;
+}  /* churn_leave */
+
+
+/* Wait for datagrams on all groups.  Joined: until every group has had its
+ * first one (or MDUMP_CHURN_TIMEOUT_MS); left: until MDUMP_CHURN_QUIET_MS
+ * pass without any. */
+static void churn_wait(mdump_options *opts, churn_group *groups, struct pollfd *pfds, int num,
+		int joined)
+{
+	TLONGLONG start_ns = mt_clock_ns(), quiet_ns = start_ns, now_ns;
+	int i, waiting = num;
+
+	for (;;) {
+		now_ns = mt_clock_ns();
+		if (joined && (waiting == 0 || now_ns - start_ns >= (TLONGLONG)MDUMP_CHURN_TIMEOUT_MS * 1000000))
+			break;
+		if (! joined && now_ns - quiet_ns >= (TLONGLONG)MDUMP_CHURN_QUIET_MS * 1000000)
+			break;
+		if (poll(pfds, num, 10) <= 0)
+			continue;
+		now_ns = mt_clock_ns();
+		for (i = 0; i < num; ++i) {
+			if (! (pfds[i].revents & POLLIN) || churn_drain(opts, &groups[i]) == 0)
+				continue;
+			if (joined && groups[i].first_ns == 0) {
+				groups[i].first_ns = now_ns;
+				--waiting;
+			}
+			if (! joined) {
+				groups[i].last_ns = now_ns;
+				quiet_ns = now_ns;
+			}
+		}
+	}
+}  /* churn_wait */
+
+
+static void churn_bench(mdump_options *opts)
+{
+	int c, cycle, i, max_num = 0;
+	churn_group *groups;
+	struct pollfd *pfds;
+	TLONGLONG *join_lat, *leave_lat;
+
+	for (c = 0; c < opts->o_churn_num; ++c) {
+		if (opts->o_churn_counts[c] > max_num)
+			max_num = opts->o_churn_counts[c];
+	}
+	groups = (churn_group *)malloc(max_num * sizeof(churn_group));
+	pfds = (struct pollfd *)malloc(max_num * sizeof(struct pollfd));
+	join_lat = (TLONGLONG *)malloc(max_num * opts->o_churn_cycles * sizeof(TLONGLONG));
+	leave_lat = (TLONGLONG *)malloc(max_num * opts->o_churn_cycles * sizeof(TLONGLONG));
+	if (groups == NULL || pfds == NULL || join_lat == NULL || leave_lat == NULL) {
+		mprintf((opts), "malloc failed\n");
+		exit(1);
+	}
+
+	mprintf((opts), "Join/leave churn from %s port %d, %d cycle%s per group count\n",
+			opts->groupaddr_name, opts->groupport, opts->o_churn_cycles,
+			(opts->o_churn_cycles == 1) ? "" : "s");
+	for (c = 0; c < opts->o_churn_num; ++c) {
+		int num = opts->o_churn_counts[c], num_join = 0, num_leave = 0;
+		TLONGLONG join_cost = 0, join_max = 0, leave_cost = 0, t;
+
+		for (cycle = 0; cycle < opts->o_churn_cycles; ++cycle) {
+			for (i = 0; i < num; ++i) {
+				churn_open(opts, &groups[i], i);
+				pfds[i].fd = groups[i].sock;
+				pfds[i].events = POLLIN;
+			}
+			for (i = 0; i < num; ++i) {
+				t = churn_join(opts, &groups[i]);
+				join_cost += t;
+				if (t > join_max)
+					join_max = t;
+			}
+			churn_wait(opts, groups, pfds, num, 1);
+			for (i = 0; i < num; ++i) {
+				if (groups[i].first_ns != 0)
+					join_lat[num_join++] = groups[i].first_ns - groups[i].join_ns;
+			}
+
+			for (i = 0; i < num; ++i)
+				leave_cost += churn_leave(opts, &groups[i]);
+			churn_wait(opts, groups, pfds, num, 0);
+			for (i = 0; i < num; ++i) {
+				leave_lat[num_leave++] = (groups[i].last_ns != 0) ? groups[i].last_ns - groups[i].leave_ns : 0;
+				CLOSESOCKET(groups[i].sock);
+			}
+		}
+
+		mprintf((opts), "%d group%s: kernel join %.1f us/group (max %.1f), leave %.1f us/group\n",
+				num, (num == 1) ? "" : "s", join_cost / 1e3 / num / opts->o_churn_cycles, join_max / 1e3,
+				leave_cost / 1e3 / num / opts->o_churn_cycles);
+		churn_dist(opts, "join to first datagram", join_lat, num_join, num * opts->o_churn_cycles,
+				"got nothing (is msend sending to them?)");
+		churn_dist(opts, "leave to silence", leave_lat, num_leave, num * opts->o_churn_cycles, "");
+	}
+
+	free(groups);  free(pfds);  free(join_lat);  free(leave_lat);
+}  /* churn_bench */
+
+
+/* One datagram from line 'l'.  Commands come on both lines: 'echo' acts
+ * on the first copy; 'stat' waits for the second copy (or
+ * MDUMP_ARB_CMD_MS) so that the slower line's tail is counted. */
+static void arb_datagram(mdump_options *opts, int l, const char *data, int len,
+		const struct sockaddr_in *src, TLONGLONG rcv_ns)
+{
+	arb_state *st = opts->arb;
+	TLONGLONG now_ns = mt_clock_ns();
+	int seq = msg_seq(data, len);
+
+	if (seq >= 0) {
+		if (arb_packet(st, l, seq, rcv_ns))
+			handle_datagram(opts, data, len, src, rcv_ns);
+		return;
+	}
+	if (len < (int)sizeof(st->cmd) && len > 5 &&
+			(memcmp(data, "echo ", 5) == 0 || memcmp(data, "stat ", 5) == 0)) {
+		if (st->cmd_ns != 0 && len == st->cmd_len && memcmp(data, st->cmd, len) == 0 &&
+				now_ns - st->cmd_ns < (TLONGLONG)MDUMP_ARB_CMD_MS * 1000000) {
+			/* the other line's copy */
+			st->cmd_ns = 0;
+			if (st->cmd_pending) {
+				st->cmd_pending = 0;
+				handle_datagram(opts, st->cmd, st->cmd_len, &st->cmd_src, 0);
+			}
+			return;
+		}
+		memcpy(st->cmd, data, len);
+		st->cmd_len = len;
+		st->cmd_ns = now_ns;
+		st->cmd_src = *src;
+		st->cmd_pending = (memcmp(data, "stat ", 5) == 0);
+		if (st->cmd_pending)
+			return;
+	}
+	handle_datagram(opts, data, len, src, 0);
+}  /* arb_datagram */
+
+
+/* Non-blocking receive of one datagram with its arrival time (kernel
+ * timestamp where there is one, so that the order lines are read in does
+ * not decide which was first).  Returns the length, or -1 if none. */
+static int arb_recv(mdump_options *opts, SOCKET sock, struct sockaddr_in *src, TLONGLONG *rcv_ns)
+{
+	int len;
+#if defined(SO_TIMESTAMPNS)
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char cbuf[CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(unsigned int))];
+
+	iov.iov_base = opts->buff;
+	iov.iov_len = 65536;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = src;
+	msg.msg_namelen = sizeof(*src);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+	len = recvmsg(sock, &msg, 0);
+	*rcv_ns = 0;
+	if (len >= 0) {
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+				struct timespec ts;
+				memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+				*rcv_ns = (TLONGLONG)ts.tv_sec * 1000000000 + ts.tv_nsec;
+			}
+		}
+	}
+#else
+	socklen_t src_len = sizeof(*src);
+	len = recvfrom(sock, opts->buff, 65536, 0, (struct sockaddr *)src, &src_len);
+#endif
+	if (len == SOCKET_ERROR) {
+#if defined(_WIN32)
+		if (WSAGetLastError() == WSAEWOULDBLOCK)
+#else
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+#endif
+			return -1;
+		mprintf((opts), "ERROR: ");  perror((opts), "recvfrom");
+		exit(1);
+	}
+#if defined(SO_TIMESTAMPNS)
+	if (*rcv_ns == 0)
+#endif
+	{
+		struct timeval tv;
+		currenttv(&tv);
+		*rcv_ns = (TLONGLONG)tv.tv_sec * 1000000000 + (TLONGLONG)tv.tv_usec * 1000;
+	}
+	return len;
+}  /* arb_recv */
+
+
+/* -A receive loop: both lines non-blocking, read in turns of at most
+ * MDUMP_ARB_BATCH datagrams so neither starves the other. */
+static void arb_loop(mdump_options *opts)
+{
+	struct pollfd pfds[2];
+	SOCKET socks[2];
+	arb_state *st = opts->arb;
+	int l;
+
+	socks[0] = opts->sock;
+	socks[1] = opts->sock_b;
+	for (l = 0; l < 2; ++l) {
+#if defined(_WIN32)
+		u_long nonblock = 1;
+		ioctlsocket(socks[l], FIONBIO, &nonblock);
+#else
+		fcntl(socks[l], F_SETFL, fcntl(socks[l], F_GETFL) | O_NONBLOCK);
+#endif
+#if defined(SO_TIMESTAMPNS)
+		{
+			int on = 1;
+			(void)setsockopt(socks[l], SOL_SOCKET, SO_TIMESTAMPNS, (char *)&on, sizeof(on));
+		}
+#endif
+		pfds[l].fd = socks[l];
+		pfds[l].events = POLLIN;
+	}
+
+	for (;;) {
+		int got = 0, n, len;
+
+		for (l = 0; l < 2; ++l) {
+			for (n = 0; n < MDUMP_ARB_BATCH; ++n) {
+				struct sockaddr_in src;
+				TLONGLONG rcv_ns;
+				if ((len = arb_recv(opts, socks[l], &src, &rcv_ns)) < 0)
+					break;
+				arb_datagram(opts, l, opts->buff, len, &src, rcv_ns);
+				got = 1;
+			}
+		}
+		if (st->cmd_pending && mt_clock_ns() - st->cmd_ns >= (TLONGLONG)MDUMP_ARB_CMD_MS * 1000000) {
+			/* only one line carried it */
+			st->cmd_pending = 0;
+			st->cmd_ns = 0;
+			handle_datagram(opts, st->cmd, st->cmd_len, &st->cmd_src, 0);
+		}
+		if (! got)
+			poll(pfds, 2, st->cmd_pending ? 10 : -1);
+	}
+}  /* arb_loop */
+
+
+/* pktring_rx_poll() callback */
+static void rx_datagram(void *arg, const char *data, int len,
+		const struct sockaddr_in *src, TLONGLONG ts_ns)
+{
+	handle_datagram((mdump_options *)arg, data, len, src, ts_ns);
+}  /* rx_datagram */
+
 int main(int argc, char **argv)
 {
 	int opt;
@@ -383,12 +2338,7 @@ int main(int argc, char **argv)
 	char *buff;
 	SOCKET sock;
 	int default_rcvbuf_sz, cur_size, sz;
-	int num_rcvd;
-	struct timeval tv;
-	int num_sent;
-	float perc_loss;
-	int cur_seq;
-	char *pause_slash;
+	char *pause_slash, *rcvbuf_slash;
     struct sockaddr_storage src;
     mdump_options opts;
 
@@ -397,6 +2347,7 @@ int main(int argc, char **argv)
 
 	buff = malloc(65536 + 1);  /* one extra for trailing null (if needed) */
 	if (buff == NULL) { mprintf((&opts), "malloc failed\n"); exit(1); }
+	opts.buff = buff;
 
 #if defined(_WIN32)
 	{
@@ -433,9 +2384,79 @@ int main(int argc, char **argv)
 	opts.o_tcp = 0;
 	opts.o_output = NULL;
 	opts.o_output_equiv_opt[0] = '\0';
-
-	while ((opt = tgetopt(argc, argv, "hqQ:p:r:o:O:vst")) != EOF) {
+	opts.o_filter = NULL;
+	opts.o_interval_ms = 0;
+	opts.o_stats = NULL;
+	opts.o_stats_json = 0;
+	opts.o_counters = NULL;
+	opts.o_perf = 0;
+	opts.o_rcvbuf_max = 0;
+
+	while ((opt = tgetopt(argc, argv, "A:a:B:C:Ef:F:hI:J:L:M:qQ:p:R:r:o:O:S:T:vst")) != EOF) {
 		switch (opt) {
+		  case 'I':
+			opts.o_interval_ms = atoi(toptarg);
+			break;
+		  case 'A':
+			opts.o_arb_line = toptarg;
+			break;
+		  case 'a':
+			opts.o_feedback_ms = atoi(toptarg);
+			break;
+		  case 'J':
+			if (parse_churn(&opts, toptarg) < 0)
+				exit(1);
+			break;
+		  case 'M':
+			if (parse_mburst(&opts, toptarg) < 0)
+				exit(1);
+			break;
+		  case 'T':
+			opts.o_ts_report_ms = (int)(atof(toptarg) * 1000);
+			if (opts.o_ts_report_ms <= 0) {
+				usage(&opts, "-T needs a report period of at least 0.001 s");
+				exit(1);
+			}
+			break;
+		  case 'C':
+			opts.o_counters = toptarg;
+			break;
+		  case 'E':
+			opts.o_perf = 1;
+			break;
+		  case 'f':
+			if (sockfilt_parse(&opts.o_filt, toptarg) < 0)
+				exit(1);
+			opts.o_filter = toptarg;
+			break;
+		  case 'B':
+			opts.o_transport_report = 1;
+			if (strcmp(toptarg, "socket") == 0)
+				opts.o_backend = MDUMP_BACKEND_SOCKET;
+			else if (strncmp(toptarg, "rxring", 6) == 0 &&
+					(toptarg[6] == '\0' || toptarg[6] == ',')) {
+				opts.o_backend = MDUMP_BACKEND_RXRING;
+				if (toptarg[6] == ',')
+					opts.o_backend_if = toptarg + 7;
+			}
+			else if (strncmp(toptarg, "uring", 5) == 0 &&
+					mt_transport_parse(toptarg, &opts.o_transport, &opts.o_transport_flags) == 0)
+				opts.o_backend = MDUMP_BACKEND_URING;
+			else {
+				usage(&opts, "unknown -B backend");
+				exit(1);
+			}
+			break;
+		  case 'F':
+			if (strcmp(toptarg, "raw") == 0)
+				opts.O_format = DUMP_FORMAT_RAW;
+			else if (strcmp(toptarg, "mcap") == 0)
+				opts.O_format = DUMP_FORMAT_MCAP;
+			else {
+				usage(&opts, "unknown -F format");
+				exit(1);
+			}
+			break;
 		  case 'h':
 			help(&opts, NULL);  exit(0);
 			break;
@@ -451,7 +2472,25 @@ int main(int argc, char **argv)
 				opts.o_pause_num = atoi(pause_slash+1);
 			opts.o_pause_ms = atoi(toptarg);
 			break;
+		  case 'L':
+			opts.fr = (flight_rec *)malloc(sizeof(flight_rec));
+			if (opts.fr == NULL) { mprintf((&opts), "malloc failed\n"); exit(1); }
+			if (fr_parse(opts.fr, toptarg) < 0) {
+				usage(&opts, "bad -L spec");
+				exit(1);
+			}
+			break;
+		  case 'R':
+			if (capw_parse(&opts.capw, toptarg) < 0) {
+				usage(&opts, "bad -R spec");
+				exit(1);
+			}
+			opts.O_rotate = toptarg;
+			break;
 		  case 'r':
+			rcvbuf_slash = strchr(toptarg, '/');
+			if (rcvbuf_slash)
+				opts.o_rcvbuf_max = atoi(rcvbuf_slash+1);
 			opts.o_rcvbuf_size = atoi(toptarg);
 			if (opts.o_rcvbuf_size == 0)
 				opts.o_rcvbuf_size = default_rcvbuf_sz;
@@ -482,12 +2521,16 @@ int main(int argc, char **argv)
 				mprintf((&opts), "ERROR: file name too long (%s)\n", toptarg);
 				exit(1);
 			}
-			opts.O_bin_output = fopen(toptarg, "wb");
-			if (opts.O_bin_output == NULL) {
+			opts.O_dumpfile = toptarg;
+			sprintf(opts.O_dumpfile_equiv_opt, "-O %s ", toptarg);
+			break;
+		  case 'S':
+			opts.o_stats = fopen(toptarg, "a");
+			if (opts.o_stats == NULL) {
 				mprintf((&opts), "ERROR: ");  perror((&opts), "fopen");
 				exit(1);
 			}
-			sprintf(opts.O_dumpfile_equiv_opt, "-O %s ", toptarg);
+			opts.o_stats_json = (strlen(toptarg) > 5 && strcmp(toptarg + strlen(toptarg) - 5, ".json") == 0);
 			break;
 
 		  default:
@@ -533,101 +2576,167 @@ int main(int argc, char **argv)
         if(opts.groupaddr != inet_addr("0.0.0.0") || opts.igmpv3_sources != NULL) {
 		usage(&opts, "-t incompatible with non-zero multicast group");
 	}
+	if (opts.o_tcp && opts.o_backend != MDUMP_BACKEND_SOCKET) {
+		usage(&opts, "-t incompatible with -B rxring and -B uring");
+		exit(1);
+	}
+	if (opts.o_filter && (opts.o_tcp || opts.o_backend == MDUMP_BACKEND_RXRING)) {
+		usage(&opts, "-f incompatible with -t and -B rxring");
+		exit(1);
+	}
+	if (opts.o_rcvbuf_max > 0 && (opts.o_tcp || opts.o_backend == MDUMP_BACKEND_RXRING)) {
+		usage(&opts, "-r size/max incompatible with -t and -B rxring");
+		exit(1);
+	}
+	if (opts.o_churn_num > 0 && (opts.o_tcp || opts.o_backend != MDUMP_BACKEND_SOCKET ||
+			! IN_MULTICAST(ntohl(opts.groupaddr)))) {
+		usage(&opts, "-J needs a multicast group, and is incompatible with -t and -B");
+		exit(1);
+	}
+	if (opts.o_arb_line && (opts.o_tcp || opts.o_backend != MDUMP_BACKEND_SOCKET ||
+			opts.o_transport_report || opts.o_churn_num > 0)) {
+		usage(&opts, "-A incompatible with -t, -B and -J");
+		exit(1);
+	}
+	if (opts.o_churn_num > 0) {
+		churn_bench(&opts);
+		exit(0);
+	}
+	if (opts.o_mb_num > 0 && opts.o_tcp) {
+		usage(&opts, "-M incompatible with -t");
+		exit(1);
+	}
+	if (opts.o_ts_report_ms > 0 && opts.o_tcp) {
+		usage(&opts, "-T incompatible with -t");
+		exit(1);
+	}
+	if (opts.O_rotate && ! opts.O_dumpfile) {
+		usage(&opts, "-R needs -O");
+		exit(1);
+	}
+	if (opts.fr && (! opts.O_dumpfile || opts.O_rotate || opts.o_tcp)) {
+		usage(&opts, "-L needs -O, and is incompatible with -R and -t");
+		exit(1);
+	}
+	if (opts.o_feedback_ms > 0 && opts.o_tcp) {
+		usage(&opts, "-a incompatible with -t");
+		exit(1);
+	}
+	if (opts.o_rcvbuf_max > 0 && opts.o_rcvbuf_max < opts.o_rcvbuf_size) {
+		usage(&opts, "-r size/max: max smaller than size");
+		exit(1);
+	}
 
     sock = initialize_socket(&opts);
+	opts.sock = sock;
+	if (opts.o_arb_line) {
+		opts.arb = (struct arb_state *)malloc(sizeof(struct arb_state));
+		if (opts.arb == NULL) { mprintf((&opts), "malloc failed\n"); exit(1); }
+		memset(opts.arb, 0, sizeof(struct arb_state));
+		opts.sock_b = initialize_line_b(&opts);
+	}
+	if (opts.o_mb_num > 0) {
+		opts.mb = (struct mb_state *)malloc(sizeof(struct mb_state));
+		if (opts.mb == NULL) { mprintf((&opts), "malloc failed\n"); exit(1); }
+		mb_reset(&opts);
+	}
+	if (opts.o_ts_report_ms > 0) {
+		opts.ts = (struct ts_state *)malloc(sizeof(struct ts_state));
+		if (opts.ts == NULL) { mprintf((&opts), "malloc failed\n"); exit(1); }
+		ts_reset(&opts);
+	}
 
-	cur_seq = 0;
-	num_rcvd = 0;
-	for (;;) {
-		if (opts.o_tcp) {
-			cur_size = recv(sock,buff,65536,0);
-			if (cur_size == 0) {
-				mprintf((&opts), "EOF\n");				break;
-			}
-		} else {
-            int fromlen = sizeof(src);
-			cur_size = recvfrom(sock,buff,65536,0, (struct sockaddr*) &src, &fromlen);
+	if (opts.fr) {
+		if (fr_open(opts.fr, opts.O_dumpfile, opts.groupaddr, opts.groupport) < 0)
+			exit(1);
+#if ! defined(_WIN32)
+		signal(SIGUSR1, fr_usr1_handler);
+#endif
+		fr_catch_signals(opts.fr);  /* write a pending window on ^C */
+	}
+	else if (opts.O_dumpfile) {
+		if (capw_open(&opts.capw, opts.O_dumpfile,
+				(opts.O_format == DUMP_FORMAT_MCAP) ? CAPW_FORMAT_MCAP : CAPW_FORMAT_RAW,
+				opts.groupaddr, opts.groupport) < 0)
+			exit(1);
+		capw_catch_signals(&opts.capw);  /* finish the files on ^C */
+	}
+
+	if (opts.o_counters) {
+		char label[64];
+		sprintf(label, "%s:%d", opts.groupaddr_name, opts.groupport);
+		if (mt_ctr_create(&opts.ctrs, opts.o_counters, "mdump", label,
+				ctr_names, ctr_flags, sizeof(ctr_names) / sizeof(ctr_names[0])) < 0)
+			exit(1);
+	}
+
+	if (opts.o_perf)
+		mt_perf_open(&opts.perf);
+	reset_test_stats(&opts);
+	opts.o_report_ms = opts.o_interval_ms;
+	if (opts.o_stats && opts.o_report_ms <= 0)
+		opts.o_report_ms = 1000;
+	if (opts.o_report_ms > 0 || opts.o_rcvbuf_max > 0 || opts.o_counters || opts.o_feedback_ms > 0) {
+#if defined(_WIN32)
+		if (CreateThread(NULL, 0, monitor_thread, &opts, 0, NULL) == NULL) {
+			mprintf((&opts), "ERROR: ");  perror((&opts), "CreateThread");
+			exit(1);
 		}
-		if (cur_size == SOCKET_ERROR) {
-			mprintf((&opts), "ERROR: ");  
-            perror((&opts), "recv");
+#else
+		pthread_t tid;
+		if ((errno = pthread_create(&tid, NULL, monitor_thread, &opts)) != 0) {
+			mprintf((&opts), "ERROR: ");  perror((&opts), "pthread_create");
 			exit(1);
 		}
+#endif
+	}
+	if (opts.arb)
+		arb_loop(&opts);
+	if (opts.o_backend == MDUMP_BACKEND_RXRING) {
+		for (;;) {
+			if (pktring_rx_poll(&opts.rxring, -1, rx_datagram, &opts) < 0)
+				exit(1);
+		}
+	}
+	if (! opts.o_tcp) {
+		const char *data;
 
-		if (opts.o_quiet_lvl == 0) {  /* non-quiet: print full dump */
-			currenttv(&tv);
-			mprintf((&opts),"%s %s.%d %d bytes:\n",
-					format_time(&tv), 
-                    inet_ntoa(((struct sockaddr_in*)&opts.addr)->sin_addr),
-					ntohs(((struct sockaddr_in*)&opts.addr)->sin_port), 
-                    cur_size
-                    );
-			dump(stdout, buff,cur_size);
-			if (opts.o_output) {
-				dump(opts.o_output, buff,cur_size);
+		if (mt_transport_open(&opts.xport, opts.o_transport, opts.o_transport_flags, sock,
+				65536, opts.o_rcvbuf_size) < 0)
+			exit(1);
+		for (;;) {
+			cur_size = mt_transport_recv(&opts.xport, &data, (struct sockaddr_in *)&src, -1);
+			if (cur_size < 0) {
+				mprintf((&opts), "ERROR: ");
+				perror((&opts), "recv");
+				exit(1);
 			}
+			handle_datagram(&opts, data, cur_size, (struct sockaddr_in *)&src, opts.xport.rx_ns);
 		}
-		if (opts.o_quiet_lvl == 1) {  /* semi-quiet: print datagram summary */
-			currenttv(&tv);
-			mprintf((&opts),"%s %s.%d %d bytes\n",  /* no colon */
-					format_time(&tv), inet_ntoa(((struct sockaddr_in*)&opts.addr)->sin_addr),
-					ntohs(((struct sockaddr_in*)&opts.addr)->sin_port), cur_size);
-		}
-
-        if(opts.O_bin_output) { /* binary dump of packets, useful for MPEG-TS */
-			fwrite(buff, cur_size, 1, opts.O_bin_output);			
+	}
+	for (;;) {
+		cur_size = recv(sock,buff,65536,0);
+		if (cur_size == 0) {
+			mprintf((&opts), "EOF\n");				break;
 		}
-		if (cur_size > 5 && memcmp(buff, "echo ", 5) == 0) {
-			/* echo command */
-			buff[cur_size] = '\0';  /* guarantee trailing null */
-			if (buff[cur_size - 1] == '\n')
-				buff[cur_size - 1] = '\0';  /* strip trailing nl */
-			mprintf((&opts),"%s\n", buff);
-
-			/* reset stats */
-			num_rcvd = 0;
-			cur_seq = 0;
+		if (cur_size == SOCKET_ERROR) {
+			mprintf((&opts), "ERROR: ");  
+            perror((&opts), "recv");
+			exit(1);
 		}
-		else if (cur_size > 5 && memcmp(buff, "stat ", 5) == 0) {
-			/* when sender tells us to, calc and print stats */
-			buff[cur_size] = '\0';  /* guarantee trailing null */
-			/* 'stat' message contains num msgs sent */
-			num_sent = atoi(&buff[5]);
-			perc_loss = (float)(num_sent - num_rcvd) * 100.0f / (float)num_sent;
-			mprintf((&opts),"%d msgs sent, %d received (not including 'stat')\n", num_sent, num_rcvd);
-			mprintf((&opts),"%f%% loss\n", perc_loss);
-
-			if (opts.o_stop)
-				exit(0);
-
-			/* reset stats */
-			num_rcvd = 0;
-			cur_seq = 0;
-		}
-		else {  /* not a cmd */
-			if (opts.o_pause_ms > 0 && ( (opts.o_pause_num > 0 && num_rcvd < opts.o_pause_num)
-									|| (opts.o_pause_num == 0) )) {
-				SLEEP_MSEC(opts.o_pause_ms);
-			}
 
-			if (opts.o_verify) {
-				buff[cur_size] = '\0';  /* guarantee trailing null */
-				if (cur_seq != strtol(&buff[8], NULL, 16)) {
-					mprintf((&opts),"Expected seq %x (hex), got %s\n", cur_seq, &buff[8]);
-					/* resyncronize sequence numbers in case there is loss */
-					cur_seq = strtol(&buff[8], NULL, 16);
-				}
-			}
-
-			++num_rcvd;
-			++cur_seq;
-		}
+		handle_datagram(&opts, buff, cur_size, (struct sockaddr_in *)&opts.tcp_sock_src_addr, 0);
 	}  /* for ;; */
 
 	CLOSESOCKET(sock);
 	if (opts.o_tcp) {
 		CLOSESOCKET(opts.tcp_listen_sock);
     }
+	mt_ctr_close(&opts.ctrs);
+	if (opts.fr)
+		fr_close(opts.fr);
+	else if (opts.O_dumpfile)
+		capw_close(&opts.capw);
 
 	exit(0);
 }  /* main */
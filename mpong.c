@@ -35,6 +35,9 @@
 /* Many of the following definitions are intended to make it easier to write
  * portable code between windows and unix. */
 
+#define MPONG_READY_PROBE_MS 10
+#define MPONG_READY_QUIET_MS 50  /* no more probes coming back */
+
 #define EXIT(x) do { fprintf(stdout, "Exit, file: '%s', line: %d\n", __FILE__, __LINE__);  exit(x);  } while (0)
 
 typedef struct mpong_options {
@@ -48,6 +51,11 @@ typedef struct mpong_options {
     int o_Sndbuf_size;
     int o_samples;
     int o_verbose;
+    int o_transport, o_transport_flags;  /* MT_TRANSPORT_xxx, MT_URING_xxx */
+    int o_transport_report;  /* -B given: report transport cost at the end */
+    char *o_counters;  /* -C name for live counters, NULL = none */
+    int o_perf;  /* -E: report CPU cost per round trip (initiator) */
+    int o_ready_ms;  /* -w: wait for the reflector this long, 0 = sleep 1 s */
 
     /* program positional parameters */
     unsigned long int groupaddr;
@@ -58,10 +66,19 @@ typedef struct mpong_options {
 
     struct timeval *start_tvs;
     struct timeval *end_tvs;
+    mt_counters ctrs;  /* -C */
 } mpong_options;
 
+/* -C live counters (the reflector has no RTTs) */
+#define MPONG_CTR_TRIPS 0
+#define MPONG_CTR_BYTES 1
+#define MPONG_CTR_RTT_TOTAL 2
+#define MPONG_CTR_RTT_LAST 3
+static const char *ctr_names[] = { "round_trips", "bytes_received", "rtt_ns_total", "rtt_ns_last" };
+static const unsigned char ctr_flags[] = { 0, 0, 0, MT_CTR_GAUGE };
+
 
-static const char usage_str[] = "[-h] [-i] [-o ofile] [-r rcvbuf_size] [-S Sndbuf_size] [-s samples] [-v] group port [ttl] [interface]";
+static const char usage_str[] = "[-B backend] [-C name] [-E] [-h] [-i] [-o ofile] [-r rcvbuf_size] [-S Sndbuf_size] [-s samples] [-v] [-w timeout_ms] group port [ttl] [interface]";
 
 void usage(mpong_options* opts, char *msg)
 {
@@ -79,6 +96,19 @@ void help(mpong_options* opts, char *msg)
 		fprintf(stderr, "\n%s\n\n", msg);
 	fprintf(stderr, "Usage: %s %s\n", opts->prog_name, usage_str);
 	fprintf(stderr, "Where:\n"
+			"  -B backend : how datagrams are sent and received [socket]\n"
+			"               socket : sendto() then recvfrom()\n"
+			"               uring[,sqpoll] : io_uring, each send linked to the\n"
+			"                        following receive and submitted together,\n"
+			"                        optionally with a kernel polling thread (Linux;\n"
+			"                        sqpoll needs a spare CPU on each side);\n"
+			"                        with either, the initiator also reports system\n"
+			"                        calls and CPU time per datagram\n"
+			"  -C name : publish live counters for 'mstat' under 'name'\n"
+			"  -E : initiator: report the CPU cost per round trip: cycles, IPC and\n"
+			"       cache misses (perf_event_open hardware counters), CPU time and\n"
+			"       context switches per 1000 round trips (software counters, or\n"
+			"       getrusage)\n"
 			"  -h : help\n"
 			"  -i : initiator (sends first packet) [reflector]\n"
 			"  -o ofile : print results to file (in addition to stdout)\n"
@@ -88,6 +118,9 @@ void help(mpong_options* opts, char *msg)
 			"                   (use 0 for system default buff size)\n"
 			"  -s samples : number of cycles to measure [65536]\n"
 			"  -v : verbose (print each RTT sample)\n"
+			"  -w timeout_ms : initiator: instead of waiting 1 second after joining,\n"
+			"                  probe until the reflector answers (printing how long\n"
+			"                  that took), giving up after timeout_ms\n"
 			"\n"
 			"  group : multicast address to send on (use '0.0.0.0' for unicast)\n"
 			"  port : destination port\n"
@@ -137,13 +170,67 @@ void current_tv(struct timeval *tv)
 }  /* current_tv */
 
 
+/* -w: send probes every MPONG_READY_PROBE_MS until one comes back from
+ * the reflector (both joins done, reflector running), then read until the
+ * probes still in flight have come back too, so that the timed loop sees
+ * only its own datagrams. */
+static void wait_ready(mpong_options *opts, SOCKET sock, struct sockaddr_in *out_sa)
+{
+	TLONGLONG start_ns = mt_clock_ns(), next_probe_ns = start_ns, ready_ns = 0, now_ns;
+	int probe = 0, len;
+	char buf[256];
+
+	for (;;) {
+		fd_set readfds;
+		struct timeval tv;
+		TLONGLONG wait_ns;
+
+		now_ns = mt_clock_ns();
+		if (ready_ns == 0 && now_ns - start_ns >= (TLONGLONG)opts->o_ready_ms * 1000000) {
+			fprintf(stderr, "ERROR: no answer from the reflector in %d ms\n", opts->o_ready_ms);
+			EXIT(1);
+		}
+		if (ready_ns == 0 && now_ns >= next_probe_ns) {
+			sprintf(buf, "mpong readiness probe %d", probe++);  /* never sizeof(struct timeval) */
+			if (sendto(sock, buf, strlen(buf) + 1, 0, (struct sockaddr *)out_sa, sizeof(*out_sa)) == SOCKET_ERROR) {
+				fprintf(stderr, "ERROR: ");  perror(opts, "sendto");
+				EXIT(1);
+			}
+			next_probe_ns += MPONG_READY_PROBE_MS * 1000000;
+		}
+
+		wait_ns = (ready_ns == 0) ? next_probe_ns - mt_clock_ns() : MPONG_READY_QUIET_MS * 1000000;
+		FD_ZERO(&readfds);
+		FD_SET(sock, &readfds);
+		tv.tv_sec = 0;
+		tv.tv_usec = (wait_ns > 0) ? (long)(wait_ns / 1000) : 0;
+		if (select((int)sock + 1, &readfds, NULL, NULL, &tv) <= 0) {
+			if (ready_ns != 0)
+				break;  /* quiet: all probes are back */
+			continue;
+		}
+		len = recv(sock, buf, sizeof(buf) - 1, 0);
+		if (len == SOCKET_ERROR) {
+			fprintf(stderr, "ERROR: ");  perror(opts, "recv");
+			EXIT(1);
+		}
+		if (ready_ns == 0)
+			ready_ns = mt_clock_ns();
+	}
+
+	printf("Reflector ready after %.1f ms (%d probes)\n", (ready_ns - start_ns) / 1e6, probe); fflush(stdout);
+	if (opts->o_output) { fprintf(opts->o_output, "Reflector ready after %.1f ms (%d probes)\n", (ready_ns - start_ns) / 1e6, probe); fflush(opts->o_output); }
+}  /* wait_ready */
+
+
 int main(int argc, char **argv)
 {
 	int opt;
 	int num_parms;
-	char *buff;
+	const char *rdata;
 	SOCKET sock;
-	socklen_t fromlen = sizeof(struct sockaddr_in);
+	mt_transport xport;
+	mt_perf perf;  /* -E */
 	int default_rcvbuf_sz, cur_size, sz;
 	int num_rcvd;
 	struct sockaddr_in in_sa;
@@ -168,12 +255,9 @@ int main(int argc, char **argv)
 	struct in_addr iface_in;
 #endif /* _WIN32 */
     mpong_options opts; 
-    memset(&opts, sizeof(opts), 0);
+    memset(&opts, 0, sizeof(opts));
 	opts.prog_name = argv[0];
 
-	buff = malloc(65536 + 1);  /* one extra for trailing null (if needed) */
-	if (buff == NULL) { fprintf(stderr, "malloc failed\n"); EXIT(1); }
-
 #if defined(_WIN32)
 	{
 		WSADATA wsadata;  int wsstatus;
@@ -206,13 +290,30 @@ int main(int argc, char **argv)
 	opts.o_Sndbuf_size = 65536;
 	opts.o_samples = 65536;
 	opts.o_verbose = 0;
+	opts.o_transport = MT_TRANSPORT_SOCKET;  opts.o_transport_flags = 0;
+	opts.o_counters = NULL;
+	opts.o_perf = 0;
+	opts.o_ready_ms = 0;
 
 	/* default values for optional positional params */
 	opts.ttlvar = 2;
 	opts.bind_if = NULL;
 
-	while ((opt = tgetopt(argc, argv, "hio:r:S:s:v")) != EOF) {
+	while ((opt = tgetopt(argc, argv, "B:C:Ehio:r:S:s:vw:")) != EOF) {
 		switch (opt) {
+		  case 'B':
+			if (mt_transport_parse(toptarg, &opts.o_transport, &opts.o_transport_flags) < 0) {
+				usage(&opts, "unknown -B backend");
+				EXIT(1);
+			}
+			opts.o_transport_report = 1;
+			break;
+		  case 'C':
+			opts.o_counters = toptarg;
+			break;
+		  case 'E':
+			opts.o_perf = 1;
+			break;
 		  case 'h':
 			help(&opts, NULL);  exit(0);
 			break;
@@ -244,6 +345,13 @@ int main(int argc, char **argv)
 		  case 'v':
 			opts.o_verbose = 1;
 			break;
+		  case 'w':
+			opts.o_ready_ms = atoi(toptarg);
+			if (opts.o_ready_ms <= 0) {
+				usage(&opts, "-w must be positive");
+				EXIT(1);
+			}
+			break;
 		  default:
 			usage(&opts, "unrecognized option");
 			EXIT(1);
@@ -283,14 +391,7 @@ int main(int argc, char **argv)
 		EXIT(1);
 	}
 
-	if(setsockopt(sock,SOL_SOCKET,SO_RCVBUF,(const char *)&opts.o_rcvbuf_size,
-			sizeof(opts.o_rcvbuf_size)) == SOCKET_ERROR) {
-		printf("WARNING: setsockopt - SO_RCVBUF\n"); fflush(stdout);
-		if (opts.o_output) { fprintf(opts.o_output, "WARNING: "); perror((&opts), "setsockopt - SO_RCVBUF"); fflush(opts.o_output); }
-	}
-	sz = sizeof(cur_size);
-	if (getsockopt(sock,SOL_SOCKET,SO_RCVBUF,(char *)&cur_size,
-			(socklen_t *)&sz) == SOCKET_ERROR) {
+	if ((cur_size = mt_set_sockbuf(sock, SO_RCVBUF, opts.o_rcvbuf_size)) < 0) {
 		fprintf(stderr, "ERROR: ");  perror((&opts), "getsockopt - SO_RCVBUF");
 		EXIT(1);
 	}
@@ -299,14 +400,7 @@ int main(int argc, char **argv)
 		if (opts.o_output) { fprintf(opts.o_output, "WARNING: tried to set SO_RCVBUF to %d, only got %d\n", opts.o_rcvbuf_size, cur_size); fflush(opts.o_output); }
 	}
 
-	if(setsockopt(sock,SOL_SOCKET,SO_SNDBUF,(const char *)&opts.o_Sndbuf_size,
-			sizeof(opts.o_Sndbuf_size)) == SOCKET_ERROR) {
-		printf("WARNING: setsockopt - SO_SNDBUF\n"); fflush(stdout);
-		if (opts.o_output) { fprintf(opts.o_output, "WARNING: "); perror((&opts), "setsockopt - SO_SNDBUF"); fflush(opts.o_output); }
-	}
-	sz = sizeof(cur_size);
-	if (getsockopt(sock,SOL_SOCKET,SO_SNDBUF,(char *)&cur_size,
-			(socklen_t *)&sz) == SOCKET_ERROR) {
+	if ((cur_size = mt_set_sockbuf(sock, SO_SNDBUF, opts.o_Sndbuf_size)) < 0) {
 		fprintf(stderr, "ERROR: ");  perror((&opts), "getsockopt - SO_SNDBUF");
 		EXIT(1);
 	}
@@ -381,7 +475,27 @@ int main(int argc, char **argv)
 		EXIT(1);
 	}
 
-	SLEEP_SEC(1);  /* allow multicast join to complete */
+	/* allow multicast join to complete (the reflector only answers, so it
+	 * has nothing to wait for) */
+	if (opts.o_initiator) {
+		if (opts.o_ready_ms > 0)
+			wait_ready(&opts, sock, &out_sa);
+		else
+			SLEEP_SEC(1);
+	}
+
+	if (mt_transport_open(&xport, opts.o_transport, opts.o_transport_flags, sock,
+			65536, opts.o_rcvbuf_size) < 0)
+		EXIT(1);
+
+	if (opts.o_counters) {
+		char label[64];
+		sprintf(label, "%s %s:%d", opts.o_initiator ? "initiator" : "reflector",
+			argv[toptind], opts.groupport);
+		if (mt_ctr_create(&opts.ctrs, opts.o_counters, "mpong", label,
+				ctr_names, ctr_flags, sizeof(ctr_names) / sizeof(ctr_names[0])) < 0)
+			EXIT(1);
+	}
 
 	if (opts.o_initiator) {
 		opts.start_tvs = (struct timeval *)malloc(opts.o_samples * sizeof(struct timeval));
@@ -389,18 +503,27 @@ int main(int argc, char **argv)
 		memset((char *)opts.start_tvs, 0, opts.o_samples * sizeof(struct timeval));
 		memset((char *)opts.end_tvs, 0, opts.o_samples * sizeof(struct timeval));
 
+		if (opts.o_perf) {
+			mt_perf_open(&perf);
+			mt_perf_start(&perf);
+		}
 		/* The -20 allows 20 cycles to happen without measurements.  This takes care of startup costs. */
 		for (num_rcvd = -20; num_rcvd < opts.o_samples; ++num_rcvd) {
 			current_tv(&start_tv);
-			cur_size = sendto(sock, (char *)&start_tv, sizeof(struct timeval),
-						0, (struct sockaddr *)&out_sa, sizeof(out_sa));
-			if (cur_size == SOCKET_ERROR) { fprintf(stderr, "ERROR: ");  perror((&opts), "send"); EXIT(1); }
-
-			cur_size = recvfrom(sock, buff, 65536, 0, (struct sockaddr *)&src, &fromlen);
+			cur_size = mt_transport_sendrecv(&xport, (char *)&start_tv, sizeof(struct timeval),
+						&out_sa, &rdata, &src);
 			current_tv(&end_tv);
-			if (cur_size == SOCKET_ERROR) { fprintf(stderr, "ERROR: ");  perror((&opts), "recv"); EXIT(1); }
+			if (cur_size < 0) { fprintf(stderr, "ERROR: ");  perror((&opts), "send/recv"); EXIT(1); }
 
 			/* start and end timestamps taken, this part of the loop is non-time-critical */
+			if (opts.ctrs.blk != NULL) {
+				TLONGLONG rtt_ns = (TLONGLONG)(end_tv.tv_sec - start_tv.tv_sec) * 1000000000 +
+					(TLONGLONG)(end_tv.tv_usec - start_tv.tv_usec) * 1000;
+				mt_ctr_add(&opts.ctrs, MPONG_CTR_TRIPS, 1);
+				mt_ctr_add(&opts.ctrs, MPONG_CTR_BYTES, cur_size);
+				mt_ctr_add(&opts.ctrs, MPONG_CTR_RTT_TOTAL, rtt_ns);
+				mt_ctr_set(&opts.ctrs, MPONG_CTR_RTT_LAST, rtt_ns);
+			}
 
 			if (num_rcvd >= 0) {  /* check returned time */
 				if (num_rcvd == 0) first_tv = start_tv;
@@ -408,9 +531,11 @@ int main(int argc, char **argv)
 				opts.end_tvs[num_rcvd] = end_tv;
 				/* sanity check (make sure payload contains start_tv) */
 				if (cur_size != sizeof(struct timeval)) { fprintf(stderr, "ERROR: recvfrom rtn val %d != sizeof struct timeval %d\n", cur_size, sizeof(struct timeval)); EXIT(1); }
-				if (memcmp(buff, (char *)&start_tv, sizeof(struct timeval)) != 0) { fprintf(stderr, "ERROR: recvfrom buff != start_tv\n"); EXIT(1); }
+				if (memcmp(rdata, (char *)&start_tv, sizeof(struct timeval)) != 0) { fprintf(stderr, "ERROR: recvfrom buff != start_tv\n"); EXIT(1); }
 			}
 		}  /* for num_rcvd */
+		if (opts.o_perf)
+			mt_perf_stop(&perf);
 
 		/* Done with active ping-pong phase; calculate results */
 
@@ -477,19 +602,32 @@ int main(int argc, char **argv)
 		else sprintf(timestr2, "%d", max_tv.tv_usec);
 		printf("avg RTT %f us, std dev %f, min RTT %s us, max RTT %s us\n", avg, std, timestr1, timestr2); fflush(stdout);
 		if (opts.o_output) { fprintf(opts.o_output, "avg RTT %f us, std dev %f, min RTT %s us max RTT %s us\n", avg, std, timestr1, timestr2); fflush(opts.o_output); }
+		if (opts.o_transport_report) {
+			mt_transport_report(&xport, stdout);
+			if (opts.o_output) mt_transport_report(&xport, opts.o_output);
+		}
+		if (opts.o_perf) {
+			mt_perf_report(&perf, stdout, "Ping-pong loop", opts.o_samples + 20, "round trip");
+			if (opts.o_output) mt_perf_report(&perf, opts.o_output, "Ping-pong loop", opts.o_samples + 20, "round trip");
+			mt_perf_close(&perf);
+		}
 	}  /* if initator */
 
 	else {  /* not initiator, reflect incoming msg back on other port */
+		/* each reply goes out together with the receive of the next msg */
+		cur_size = mt_transport_sendrecv(&xport, NULL, 0, &out_sa, &rdata, &src);
 		for (;;) {
-			cur_size = recvfrom(sock, buff, 65536, 0, (struct sockaddr *)&src, &fromlen);
-			if (cur_size == SOCKET_ERROR) { fprintf(stderr, "ERROR: ");  perror((&opts), "recv"); EXIT(1); }
+			if (cur_size < 0) { fprintf(stderr, "ERROR: ");  perror((&opts), "send/recv"); EXIT(1); }
+			mt_ctr_add(&opts.ctrs, MPONG_CTR_TRIPS, 1);
+			mt_ctr_add(&opts.ctrs, MPONG_CTR_BYTES, cur_size);
 
-			cur_size = sendto(sock, buff, cur_size, 0, (struct sockaddr *)&out_sa,sizeof(out_sa));
-			if (cur_size == SOCKET_ERROR) { fprintf(stderr, "ERROR: ");  perror((&opts), "send"); EXIT(1); }
+			cur_size = mt_transport_sendrecv(&xport, rdata, cur_size, &out_sa, &rdata, &src);
 		}  /* for ;; */
 	}
 
+	mt_transport_close(&xport);
 	CLOSESOCKET(sock);
+	mt_ctr_close(&opts.ctrs);
 
 	exit(0);
 }  /* main */
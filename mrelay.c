@@ -0,0 +1,929 @@
+/* mrelay.c */
+/*   Program to relay multicast (or unicast) UDP datagrams from one or more
+ * groups to one or more groups or unicast addresses: across a segment
+ * boundary, or to a lab host that cannot join.  Optional delay, jitter,
+ * loss and reordering make it a simple network emulator as well.
+ * See https://community.informatica.com/solutions/1470 for more info.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted without restriction.
+ *
+ THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+ EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+ NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+ PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+ UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+ BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+ INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+ TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+ THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+/* Every datagram received on any input goes to every output; each
+ * (input, output) pair is a path with its own counters.  Datagrams are
+ * read a batch at a time (recvmmsg on Linux) and each output's share of a
+ * batch goes out in one call (sendmmsg), straight from the receive
+ * buffers.  Only delayed and reordered datagrams are copied: into a ring
+ * of fixed-size slots per output (-d), or a hold buffer (-x). */
+
+#if defined(__linux__)
+#define _GNU_SOURCE  /* recvmmsg, sendmmsg */
+#endif
+
+#include "mtools.h"
+
+#include <stdarg.h>
+#include <string.h>
+#if defined(_WIN32)
+#define poll WSAPoll
+#else
+#include <fcntl.h>
+#include <poll.h>
+#endif
+
+#define MRELAY_MAX_IN 16
+#define MRELAY_MAX_OUT 16
+#define MRELAY_MAX_BATCH 1024
+#define MRELAY_MAX_MSG 65536
+#define MRELAY_HOLD_MS 10  /* -x: a held datagram goes anyway after this long */
+
+typedef struct mrelay_options {
+    /* program name (from argv[0] */
+    char *prog_name;
+
+    /* program options */
+    int o_batch;
+    char *o_counters;  /* -C name for live counters, NULL = none */
+    int o_delay_us, o_jitter_us;  /* -d */
+    int o_interval_ms;  /* -I: report period, 0 = at exit only */
+    double o_loss;  /* -L percent */
+    int o_max_len;  /* -m: largest datagram that can be delayed */
+    FILE *o_output;
+    int o_queue;  /* -Q: delay queue slots per output */
+    int o_quiet;
+    int o_rcvbuf_size;
+    double o_reorder;  /* -x percent */
+    int o_Sndbuf_size;
+    unsigned char ttlvar;
+
+    /* state */
+    mt_counters ctrs;  /* -C */
+} mrelay_options;
+
+/* one input: a group (or unicast port) to receive */
+typedef struct mrelay_in {
+    SOCKET sock;
+    struct sockaddr_in addr;
+    char *iface;
+    unsigned long long pkts, bytes;
+} mrelay_in;
+
+/* what happened to the datagrams of one input on one output */
+typedef struct mrelay_path {
+    unsigned long long sent, bytes;
+    unsigned long long lost;  /* -L, on purpose */
+    unsigned long long reordered;  /* -x */
+    unsigned long long queue_full;  /* -d queue had no free slot */
+    unsigned long long too_big;  /* longer than -m, could not be delayed */
+    unsigned long long errors;  /* failed sends */
+} mrelay_path;
+
+/* a datagram waiting in an output's delay queue */
+typedef struct mrelay_slot {
+    TLONGLONG due_ns;
+    int len;
+    int in;  /* input it came from */
+    char *data;  /* o_max_len bytes */
+} mrelay_slot;
+
+/* a datagram to be sent with the output's next batched call */
+typedef struct mrelay_pending {
+    const char *data;
+    int len;
+    int in;
+} mrelay_pending;
+
+/* one output: a group or unicast address to send to */
+typedef struct mrelay_out {
+    SOCKET sock;
+    struct sockaddr_in addr;  /* port 0 = the input's own port */
+    char *iface;
+    mrelay_pending *pend;  /* o_batch + 1 entries */
+    int num_pend;
+    /* -d: ring of slots, q_head is the oldest; the first q_sending of them
+     * are in the pending batch */
+    mrelay_slot *queue;
+    int q_head, q_num, q_sending;
+    TLONGLONG last_due_ns;  /* keeps jittered datagrams in order */
+    /* -x: a datagram held back until the next one has gone */
+    char *held;
+    int held_len, held_in, held_busy;  /* held_len < 0 = none; busy = in the pending batch */
+    TLONGLONG held_ns;
+} mrelay_out;
+
+/* -C live counters */
+#define MRELAY_CTR_IN_PKTS 0
+#define MRELAY_CTR_IN_BYTES 1
+#define MRELAY_CTR_OUT_PKTS 2
+#define MRELAY_CTR_OUT_BYTES 3
+#define MRELAY_CTR_DROPPED 4
+#define MRELAY_CTR_REORDERED 5
+#define MRELAY_CTR_ERRORS 6
+static const char *ctr_names[] = { "in_packets", "in_bytes", "out_packets", "out_bytes",
+	"dropped", "reordered", "send_errors" };
+
+static mrelay_in ins[MRELAY_MAX_IN];
+static mrelay_out outs[MRELAY_MAX_OUT];
+static mrelay_path paths[MRELAY_MAX_IN][MRELAY_MAX_OUT];
+static int num_ins, num_outs;
+static unsigned long long rng_state;
+static volatile int stop_requested;
+
+
+static const char usage_str[] = "[-b batch] [-C name] [-d delay_us[/jitter_us]] [-h] [-I interval_ms] [-L loss_pct] [-m max_len] [-o ofile] [-Q queue_slots] [-q] [-r rcvbuf_size] [-S Sndbuf_size] [-T ttl] [-x reorder_pct] sources destinations";
+
+void usage(mrelay_options *opts, char *msg)
+{
+	if (msg != NULL)
+		fprintf(stderr, "\n%s\n\n", msg);
+	fprintf(stderr, "Usage: %s %s\n\n"
+			"(use -h for detailed help)\n",
+			opts->prog_name, usage_str);
+}  /* usage */
+
+
+void help(mrelay_options *opts, char *msg)
+{
+	if (msg != NULL)
+		fprintf(stderr, "\n%s\n\n", msg);
+	fprintf(stderr, "Usage: %s %s\n", opts->prog_name, usage_str);
+	fprintf(stderr, "Where:\n"
+			"  -b batch : most datagrams read, and sent to each destination, per\n"
+			"             system call (recvmmsg/sendmmsg on Linux) [64]\n"
+			"  -C name : publish live counters for 'mstat' under 'name'\n"
+			"  -d delay_us[/jitter_us] : hold each datagram this long, plus a random\n"
+			"             0 to jitter_us, before sending it (order is kept) [0]\n"
+			"  -h : help\n"
+			"  -I interval_ms : print the per-path counters every interval [0: at\n"
+			"                   exit only]\n"
+			"  -L loss_pct : drop this percentage of datagrams on each path [0]\n"
+			"  -m max_len : largest datagram -d can hold; longer ones are dropped and\n"
+			"               counted [9000]\n"
+			"  -o ofile : print results to file (in addition to stdout)\n"
+			"  -Q queue_slots : datagrams -d can hold per destination [4096]\n"
+			"  -q : no start-up messages\n"
+			"  -r rcvbuf_size : size (bytes) of each UDP receive buffer (SO_RCVBUF)\n"
+			"                   [4194304] (use 0 for system default buff size)\n"
+			"  -S Sndbuf_size : size (bytes) of each UDP send buffer (SO_SNDBUF)\n"
+			"                   [4194304] (use 0 for system default buff size)\n"
+			"  -T ttl : time-to-live of the relayed multicast datagrams [2]\n"
+			"  -x reorder_pct : hold back this percentage of datagrams on each path\n"
+			"                   until the next one has been sent (or %d ms) [0]\n"
+			"\n"
+			"  sources : group:port[@interface][,group:port[@interface]...] to\n"
+			"            receive (group 0.0.0.0 for unicast to 'port')\n"
+			"  destinations : addr[:port][@interface][,addr[:port][@interface]...]\n"
+			"            to send everything received to, multicast group or unicast\n"
+			"            address; without ':port', the port each datagram came in on\n"
+			"\n"
+			"Runs until interrupted, then prints the counters of each path.\n",
+			MRELAY_HOLD_MS
+	);
+}  /* help */
+
+
+/* results go to stdout (and -o ofile) */
+static void display(mrelay_options *opts, const char *format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	vprintf(format, ap);
+	va_end(ap);
+	fflush(stdout);
+	if (opts->o_output) {
+		va_start(ap, format);
+		vfprintf(opts->o_output, format, ap);
+		va_end(ap);
+		fflush(opts->o_output);
+	}
+}  /* display */
+
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop_requested = 1;
+}  /* on_signal */
+
+
+/* xorshift64*: uniform in [0,100) */
+static double rand_percent(void)
+{
+	unsigned long long x = rng_state;
+	x ^= x >> 12;  x ^= x << 25;  x ^= x >> 27;
+	rng_state = x;
+	return (double)((x * 0x2545F4914F6CDD1DULL) >> 11) / 9007199254740992.0 * 100.0;
+}  /* rand_percent */
+
+
+/* Split "addr[:port][@interface]" in place.  Returns 0, or -1 if it is not
+ * an address. */
+static int parse_endpoint(char *spec, struct sockaddr_in *addr, char **iface)
+{
+	char *colon, *at;
+
+	*iface = NULL;
+	if ((at = strchr(spec, '@')) != NULL) {
+		*at = '\0';
+		*iface = at + 1;
+	}
+	memset((char *)addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+	if ((colon = strchr(spec, ':')) != NULL) {
+		*colon = '\0';
+		addr->sin_port = htons((unsigned short)atoi(colon + 1));
+	}
+	addr->sin_addr.s_addr = inet_addr(spec);
+	if (addr->sin_addr.s_addr == INADDR_NONE)
+		return -1;
+	return 0;
+}  /* parse_endpoint */
+
+
+static void set_nonblocking(mrelay_options *opts, SOCKET sock)
+{
+#if defined(_WIN32)
+	u_long on = 1;
+	if (ioctlsocket(sock, FIONBIO, &on) == SOCKET_ERROR) {
+#else
+	if (fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK) < 0) {
+#endif
+		mprintf(opts, "ERROR: ");  perror(opts, "set non-blocking");
+		exit(1);
+	}
+}  /* set_nonblocking */
+
+
+/* Receiving socket for one input: bound to the group and port, joined on
+ * the interface (or the default one). */
+static void open_input(mrelay_options *opts, mrelay_in *in)
+{
+	struct sockaddr_in name;
+	struct ip_mreq imr;
+	int opt, cur_size;
+
+	if ((in->sock = socket(PF_INET,SOCK_DGRAM,0)) == INVALID_SOCKET) {
+		mprintf(opts, "ERROR: ");  perror(opts, "socket");
+		exit(1);
+	}
+	if ((cur_size = mt_set_sockbuf(in->sock, SO_RCVBUF, opts->o_rcvbuf_size)) < 0) {
+		mprintf(opts, "ERROR: ");  perror(opts, "getsockopt - SO_RCVBUF");
+		exit(1);
+	}
+	if (cur_size < opts->o_rcvbuf_size)
+		mprintf(opts, "WARNING: tried to set SO_RCVBUF to %d, only got %d\n", opts->o_rcvbuf_size, cur_size);
+	opt = 1;
+	if (setsockopt(in->sock, SOL_SOCKET, SO_REUSEADDR, (char *)&opt, sizeof(opt)) == SOCKET_ERROR) {
+		mprintf(opts, "ERROR: ");  perror(opts, "setsockopt SO_REUSEADDR");
+		exit(1);
+	}
+
+	name = in->addr;
+	if (bind(in->sock,(struct sockaddr *)&name, sizeof(name)) == SOCKET_ERROR) {
+		/* So OSes don't want you to bind to the m/c group. */
+		name.sin_addr.s_addr = htonl(INADDR_ANY);
+		if (bind(in->sock,(struct sockaddr *)&name, sizeof(name)) == SOCKET_ERROR) {
+			mprintf(opts, "ERROR: ");  perror(opts, "bind");
+			exit(1);
+		}
+	}
+
+	if (IN_MULTICAST(ntohl(in->addr.sin_addr.s_addr))) {
+		memset((char *)&imr, 0, sizeof(imr));
+		imr.imr_multiaddr = in->addr.sin_addr;
+		imr.imr_interface.s_addr = (in->iface != NULL) ? inet_addr(in->iface) : htonl(INADDR_ANY);
+		if (setsockopt(in->sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, (char *)&imr, sizeof(imr)) == SOCKET_ERROR) {
+			mprintf(opts, "ERROR: ");  perror(opts, "setsockopt - IP_ADD_MEMBERSHIP");
+			exit(1);
+		}
+	}
+	set_nonblocking(opts, in->sock);
+}  /* open_input */
+
+
+/* Sending socket for one output, and its batch and queue space. */
+static void open_output(mrelay_options *opts, mrelay_out *out)
+{
+	int cur_size, i;
+#if defined(_WIN32)
+	unsigned int wttl = opts->ttlvar;
+	unsigned long int iface_in;
+#else
+	unsigned char wttl = opts->ttlvar;
+	struct in_addr iface_in;
+#endif
+
+	if ((out->sock = socket(PF_INET,SOCK_DGRAM,0)) == INVALID_SOCKET) {
+		mprintf(opts, "ERROR: ");  perror(opts, "socket");
+		exit(1);
+	}
+	if ((cur_size = mt_set_sockbuf(out->sock, SO_SNDBUF, opts->o_Sndbuf_size)) < 0) {
+		mprintf(opts, "ERROR: ");  perror(opts, "getsockopt - SO_SNDBUF");
+		exit(1);
+	}
+	if (cur_size < opts->o_Sndbuf_size)
+		mprintf(opts, "WARNING: tried to set SO_SNDBUF to %d, only got %d\n", opts->o_Sndbuf_size, cur_size);
+	if (IN_MULTICAST(ntohl(out->addr.sin_addr.s_addr))) {
+		if (setsockopt(out->sock,IPPROTO_IP,IP_MULTICAST_TTL,(char *)&wttl,
+				sizeof(wttl)) == SOCKET_ERROR) {
+			mprintf(opts, "ERROR: ");  perror(opts, "setsockopt - TTL");
+			exit(1);
+		}
+		if (out->iface != NULL) {
+#if defined(_WIN32)
+			iface_in = inet_addr(out->iface);
+#else
+			memset((char *)&iface_in,0,sizeof(iface_in));
+			iface_in.s_addr = inet_addr(out->iface);
+#endif
+			if (setsockopt(out->sock, IPPROTO_IP, IP_MULTICAST_IF, (const char *)&iface_in,
+					sizeof(iface_in)) == SOCKET_ERROR) {
+				mprintf(opts, "ERROR: ");  perror(opts, "setsockopt - IP_MULTICAST_IF");
+				exit(1);
+			}
+		}
+	}
+
+	out->pend = (mrelay_pending *)calloc(opts->o_batch + 1, sizeof(mrelay_pending));
+	out->held = (char *)malloc(MRELAY_MAX_MSG);
+	if (out->pend == NULL || out->held == NULL) {
+		mprintf(opts, "malloc failed\n");
+		exit(1);
+	}
+	out->held_len = -1;
+	if (opts->o_delay_us > 0 || opts->o_jitter_us > 0) {
+		char *data = (char *)malloc((size_t)opts->o_queue * opts->o_max_len);
+		out->queue = (mrelay_slot *)calloc(opts->o_queue, sizeof(mrelay_slot));
+		if (data == NULL || out->queue == NULL) {
+			mprintf(opts, "malloc failed (-Q %d slots of -m %d bytes)\n", opts->o_queue, opts->o_max_len);
+			exit(1);
+		}
+		for (i = 0; i < opts->o_queue; ++i)
+			out->queue[i].data = data + (size_t)i * opts->o_max_len;
+	}
+}  /* open_output */
+
+
+/* Send the output's pending batch in one call where the system allows,
+ * then free the queue slots and hold buffer it used. */
+static void flush_output(mrelay_options *opts, int o)
+{
+	mrelay_out *out = &outs[o];
+	int i, n = out->num_pend;
+#if defined(__linux__)
+	static struct mmsghdr msgs[MRELAY_MAX_BATCH + 1];
+	static struct iovec iovs[MRELAY_MAX_BATCH + 1];
+	static struct sockaddr_in tos[MRELAY_MAX_BATCH + 1];
+	int done = 0, rtn;
+#endif
+
+	if (n == 0)
+		return;
+#if defined(__linux__)
+	for (i = 0; i < n; ++i) {
+		tos[i] = out->addr;
+		if (tos[i].sin_port == 0)
+			tos[i].sin_port = ins[out->pend[i].in].addr.sin_port;
+		iovs[i].iov_base = (void *)out->pend[i].data;
+		iovs[i].iov_len = out->pend[i].len;
+		memset(&msgs[i], 0, sizeof(msgs[i]));
+		msgs[i].msg_hdr.msg_name = &tos[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(tos[i]);
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	while (done < n) {
+		rtn = sendmmsg(out->sock, &msgs[done], n - done, 0);
+		if (rtn < 0) {
+			if (errno == EINTR)
+				continue;
+			++paths[out->pend[done].in][o].errors;  /* skip the one that failed */
+			mt_ctr_add(&opts->ctrs, MRELAY_CTR_ERRORS, 1);
+			++done;
+			continue;
+		}
+		for (i = done; i < done + rtn; ++i) {
+			mrelay_path *p = &paths[out->pend[i].in][o];
+			++p->sent;
+			p->bytes += out->pend[i].len;
+			mt_ctr_add(&opts->ctrs, MRELAY_CTR_OUT_BYTES, out->pend[i].len);
+		}
+		mt_ctr_add(&opts->ctrs, MRELAY_CTR_OUT_PKTS, rtn);
+		done += rtn;
+	}
+#else
+	for (i = 0; i < n; ++i) {
+		struct sockaddr_in to = out->addr;
+		mrelay_path *p = &paths[out->pend[i].in][o];
+		if (to.sin_port == 0)
+			to.sin_port = ins[out->pend[i].in].addr.sin_port;
+		if (sendto(out->sock, out->pend[i].data, out->pend[i].len, 0,
+				(struct sockaddr *)&to, sizeof(to)) == SOCKET_ERROR) {
+			++p->errors;
+			mt_ctr_add(&opts->ctrs, MRELAY_CTR_ERRORS, 1);
+			continue;
+		}
+		++p->sent;
+		p->bytes += out->pend[i].len;
+		mt_ctr_add(&opts->ctrs, MRELAY_CTR_OUT_PKTS, 1);
+		mt_ctr_add(&opts->ctrs, MRELAY_CTR_OUT_BYTES, out->pend[i].len);
+	}
+#endif
+	out->num_pend = 0;
+	out->q_head = (out->q_head + out->q_sending) % opts->o_queue;
+	out->q_num -= out->q_sending;
+	out->q_sending = 0;
+	out->held_busy = 0;
+}  /* flush_output */
+
+
+static void add_pending(mrelay_options *opts, int o, const char *data, int len, int in)
+{
+	mrelay_out *out = &outs[o];
+
+	if (out->num_pend > opts->o_batch)
+		flush_output(opts, o);
+	out->pend[out->num_pend].data = data;
+	out->pend[out->num_pend].len = len;
+	out->pend[out->num_pend].in = in;
+	++out->num_pend;
+}  /* add_pending */
+
+
+/* Past loss and reordering: delay it (-d), or send it with this batch. */
+static void forward(mrelay_options *opts, int o, const char *data, int len, int in, TLONGLONG now_ns)
+{
+	mrelay_out *out = &outs[o];
+	mrelay_slot *s;
+	TLONGLONG due_ns;
+
+	if (out->queue == NULL) {
+		add_pending(opts, o, data, len, in);
+		return;
+	}
+	if (len > opts->o_max_len) {
+		++paths[in][o].too_big;
+		mt_ctr_add(&opts->ctrs, MRELAY_CTR_DROPPED, 1);
+		return;
+	}
+	if (out->q_num == opts->o_queue) {
+		++paths[in][o].queue_full;
+		mt_ctr_add(&opts->ctrs, MRELAY_CTR_DROPPED, 1);
+		return;
+	}
+	due_ns = now_ns + (TLONGLONG)opts->o_delay_us * 1000;
+	if (opts->o_jitter_us > 0)
+		due_ns += (TLONGLONG)(rand_percent() * opts->o_jitter_us * 10);
+	if (due_ns < out->last_due_ns)
+		due_ns = out->last_due_ns;  /* jitter never reorders; -x does that */
+	out->last_due_ns = due_ns;
+	s = &out->queue[(out->q_head + out->q_num) % opts->o_queue];
+	memcpy(s->data, data, len);
+	s->len = len;
+	s->in = in;
+	s->due_ns = due_ns;
+	++out->q_num;
+}  /* forward */
+
+
+/* One datagram from input 'in' for output 'o'. */
+static void relay(mrelay_options *opts, int o, const char *data, int len, int in, TLONGLONG now_ns)
+{
+	mrelay_out *out = &outs[o];
+
+	if (opts->o_loss > 0 && rand_percent() < opts->o_loss) {
+		++paths[in][o].lost;
+		mt_ctr_add(&opts->ctrs, MRELAY_CTR_DROPPED, 1);
+		return;
+	}
+	if (opts->o_reorder > 0 && out->held_len < 0 && rand_percent() < opts->o_reorder) {
+		if (out->held_busy)
+			flush_output(opts, o);  /* the hold buffer is still in the batch */
+		memcpy(out->held, data, len);
+		out->held_len = len;
+		out->held_in = in;
+		out->held_ns = now_ns;
+		++paths[in][o].reordered;
+		mt_ctr_add(&opts->ctrs, MRELAY_CTR_REORDERED, 1);
+		return;
+	}
+	forward(opts, o, data, len, in, now_ns);
+	if (out->held_len >= 0) {  /* the held one goes after this one */
+		forward(opts, o, out->held, out->held_len, out->held_in, now_ns);
+		out->held_busy = (out->queue == NULL);
+		out->held_len = -1;
+	}
+}  /* relay */
+
+
+/* Move what is due from the delay queue (and a held datagram that waited
+ * too long) into the batch, and send it.  Returns the ms until the next
+ * datagram is due (0 = spin), or -1 if none is waiting. */
+static int service_output(mrelay_options *opts, int o, TLONGLONG now_ns)
+{
+	mrelay_out *out = &outs[o];
+	TLONGLONG next_ns = -1;
+
+	if (out->held_len >= 0) {
+		if (now_ns - out->held_ns >= (TLONGLONG)MRELAY_HOLD_MS * 1000000) {
+			forward(opts, o, out->held, out->held_len, out->held_in, now_ns);
+			out->held_busy = (out->queue == NULL);
+			out->held_len = -1;
+		}
+		else
+			next_ns = out->held_ns + (TLONGLONG)MRELAY_HOLD_MS * 1000000;
+	}
+	while (out->queue != NULL && out->q_sending < out->q_num) {
+		mrelay_slot *s = &out->queue[(out->q_head + out->q_sending) % opts->o_queue];
+		if (s->due_ns > now_ns) {
+			if (next_ns < 0 || s->due_ns < next_ns)
+				next_ns = s->due_ns;
+			break;
+		}
+		if (out->num_pend > opts->o_batch)
+			flush_output(opts, o);
+		out->pend[out->num_pend].data = s->data;
+		out->pend[out->num_pend].len = s->len;
+		out->pend[out->num_pend].in = s->in;
+		++out->num_pend;
+		++out->q_sending;
+	}
+	flush_output(opts, o);
+
+	if (next_ns < 0)
+		return -1;
+	return (next_ns - now_ns > 1000000) ? (int)((next_ns - now_ns) / 1000000) - 1 : 0;
+}  /* service_output */
+
+
+/* At exit: send the pending batch, a held datagram and the whole delay
+ * queue now, ahead of time, rather than drop them uncounted. */
+static void drain_output(mrelay_options *opts, int o)
+{
+	mrelay_out *out = &outs[o];
+
+	flush_output(opts, o);
+	if (out->held_len >= 0) {
+		forward(opts, o, out->held, out->held_len, out->held_in, mt_clock_ns());
+		out->held_busy = (out->queue == NULL);
+		out->held_len = -1;
+	}
+	/* due times never decrease along the queue: the last one's is late enough */
+	while (out->queue != NULL && out->q_num > 0)
+		service_output(opts, o, out->queue[(out->q_head + out->q_num - 1) % opts->o_queue].due_ns);
+	flush_output(opts, o);
+}  /* drain_output */
+
+
+/* Read up to o_batch datagrams from one input and relay each to every
+ * output.  Returns how many were read. */
+static int read_input(mrelay_options *opts, int i, char **bufs)
+{
+	mrelay_in *in = &ins[i];
+	TLONGLONG now_ns;
+	int n, k, o;
+#if defined(__linux__)
+	static struct mmsghdr msgs[MRELAY_MAX_BATCH];
+	static struct iovec iovs[MRELAY_MAX_BATCH];
+
+	for (k = 0; k < opts->o_batch; ++k) {
+		iovs[k].iov_base = bufs[k];
+		iovs[k].iov_len = MRELAY_MAX_MSG;
+		memset(&msgs[k], 0, sizeof(msgs[k]));
+		msgs[k].msg_hdr.msg_iov = &iovs[k];
+		msgs[k].msg_hdr.msg_iovlen = 1;
+	}
+	n = recvmmsg(in->sock, msgs, opts->o_batch, MSG_DONTWAIT, NULL);
+	if (n < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return 0;
+		mprintf(opts, "ERROR: ");  perror(opts, "recvmmsg");
+		exit(1);
+	}
+#else
+	static int lens[MRELAY_MAX_BATCH];
+
+	for (n = 0; n < opts->o_batch; ++n) {
+		lens[n] = recv(in->sock, bufs[n], MRELAY_MAX_MSG, 0);
+		if (lens[n] == SOCKET_ERROR)
+			break;  /* would block */
+	}
+#endif
+
+	now_ns = mt_clock_ns();
+	for (k = 0; k < n; ++k) {
+#if defined(__linux__)
+		int len = (int)msgs[k].msg_len;
+#else
+		int len = lens[k];
+#endif
+		++in->pkts;
+		in->bytes += len;
+		mt_ctr_add(&opts->ctrs, MRELAY_CTR_IN_PKTS, 1);
+		mt_ctr_add(&opts->ctrs, MRELAY_CTR_IN_BYTES, len);
+		for (o = 0; o < num_outs; ++o)
+			relay(opts, o, bufs[k], len, i, now_ns);
+	}
+	return n;
+}  /* read_input */
+
+
+static void report(mrelay_options *opts, double elapsed)
+{
+	int i, o;
+
+	display(opts, "--- %.1f s\n", elapsed);
+	for (i = 0; i < num_ins; ++i) {
+		long long kdrops = mt_udp_drops(ins[i].sock);
+		display(opts, "in  %s:%d: %llu datagrams, %llu bytes", inet_ntoa(ins[i].addr.sin_addr),
+				ntohs(ins[i].addr.sin_port), ins[i].pkts, ins[i].bytes);
+		if (kdrops >= 0)
+			display(opts, ", %lld dropped by the kernel (receive buffer full)", kdrops);
+		display(opts, "\n");
+		for (o = 0; o < num_outs; ++o) {
+			mrelay_path *p = &paths[i][o];
+			char dest[32];
+			sprintf(dest, "%s:", inet_ntoa(outs[o].addr.sin_addr));
+			if (outs[o].addr.sin_port == 0)
+				sprintf(dest + strlen(dest), "%d", ntohs(ins[i].addr.sin_port));
+			else
+				sprintf(dest + strlen(dest), "%d", ntohs(outs[o].addr.sin_port));
+			display(opts, "  -> %-21s %12llu sent %14llu bytes", dest, p->sent, p->bytes);
+			if (opts->o_loss > 0)
+				display(opts, ", %llu lost", p->lost);
+			if (opts->o_reorder > 0)
+				display(opts, ", %llu reordered", p->reordered);
+			if (outs[o].queue != NULL)
+				display(opts, ", %llu queue full, %llu too big", p->queue_full, p->too_big);
+			if (p->errors > 0)
+				display(opts, ", %llu send errors", p->errors);
+			display(opts, "\n");
+		}
+	}
+}  /* report */
+
+
+int main(int argc, char **argv)
+{
+	mrelay_options opts;
+	struct pollfd pfds[MRELAY_MAX_IN];
+	char **bufs;
+	char *p, *comma;
+	int opt, i, o, timeout;
+	TLONGLONG start_ns, next_report_ns, now_ns;
+
+	memset(&opts, 0, sizeof(opts));
+	opts.prog_name = argv[0];
+
+#if defined(_WIN32)
+	{
+		WSADATA wsadata;  int wsstatus;
+		if ((wsstatus = WSAStartup(MAKEWORD(2,2), &wsadata)) != 0) {
+			fprintf(stderr,"%s: WSA startup error - %d\n", argv[0], wsstatus);
+			exit(1);
+		}
+	}
+#else
+	signal(SIGPIPE, SIG_IGN);
+#endif /* _WIN32 */
+
+	/* default values for options */
+	opts.o_batch = 64;
+	opts.o_counters = NULL;
+	opts.o_delay_us = 0;  opts.o_jitter_us = 0;
+	opts.o_interval_ms = 0;
+	opts.o_loss = 0.0;
+	opts.o_max_len = 9000;
+	opts.o_output = NULL;
+	opts.o_queue = 4096;
+	opts.o_quiet = 0;
+	opts.o_rcvbuf_size = 0x400000;  /* 4MB */
+	opts.o_reorder = 0.0;
+	opts.o_Sndbuf_size = 0x400000;
+	opts.ttlvar = 2;
+
+	while ((opt = tgetopt(argc, argv, "b:C:d:hI:L:m:o:Q:qr:S:T:x:")) != EOF) {
+		switch (opt) {
+		  case 'b':
+			opts.o_batch = atoi(toptarg);
+			if (opts.o_batch < 1 || opts.o_batch > MRELAY_MAX_BATCH) {
+				usage(&opts, "-b must be 1 to 1024");
+				exit(1);
+			}
+			break;
+		  case 'C':
+			opts.o_counters = toptarg;
+			break;
+		  case 'd':
+			opts.o_delay_us = atoi(toptarg);
+			if ((p = strchr(toptarg, '/')) != NULL)
+				opts.o_jitter_us = atoi(p + 1);
+			if (opts.o_delay_us < 0 || opts.o_jitter_us < 0) {
+				usage(&opts, "-d delay and jitter cannot be negative");
+				exit(1);
+			}
+			break;
+		  case 'h':
+			help(&opts, NULL);  exit(0);
+			break;
+		  case 'I':
+			opts.o_interval_ms = atoi(toptarg);
+			break;
+		  case 'L':
+			opts.o_loss = atof(toptarg);
+			break;
+		  case 'm':
+			opts.o_max_len = atoi(toptarg);
+			if (opts.o_max_len < 1 || opts.o_max_len > MRELAY_MAX_MSG) {
+				usage(&opts, "-m must be 1 to 65536");
+				exit(1);
+			}
+			break;
+		  case 'o':
+			opts.o_output = fopen(toptarg, "w");
+			if (opts.o_output == NULL) {
+				mprintf((&opts), "ERROR: ");  perror((&opts), "fopen");
+				exit(1);
+			}
+			break;
+		  case 'Q':
+			opts.o_queue = atoi(toptarg);
+			if (opts.o_queue < 1) {
+				usage(&opts, "-Q must be positive");
+				exit(1);
+			}
+			break;
+		  case 'q':
+			opts.o_quiet = 1;
+			break;
+		  case 'r':
+			opts.o_rcvbuf_size = atoi(toptarg);
+			break;
+		  case 'S':
+			opts.o_Sndbuf_size = atoi(toptarg);
+			break;
+		  case 'T':
+			opts.ttlvar = (unsigned char)atoi(toptarg);
+			break;
+		  case 'x':
+			opts.o_reorder = atof(toptarg);
+			break;
+		  default:
+			usage(&opts, "unrecognized option");
+			exit(1);
+			break;
+		}  /* switch */
+	}  /* while opt */
+
+	if (opts.o_loss < 0 || opts.o_loss > 100 || opts.o_reorder < 0 || opts.o_reorder > 100) {
+		usage(&opts, "-L and -x percentages must be 0 to 100");
+		exit(1);
+	}
+	if (argc - toptind != 2) {
+		usage(&opts, "need 2 positional parameters");
+		exit(1);
+	}
+
+	for (p = argv[toptind]; p != NULL; p = comma) {
+		if ((comma = strchr(p, ',')) != NULL)
+			*comma++ = '\0';
+		if (num_ins == MRELAY_MAX_IN) {
+			usage(&opts, "too many sources");
+			exit(1);
+		}
+		if (parse_endpoint(p, &ins[num_ins].addr, &ins[num_ins].iface) < 0 ||
+				ins[num_ins].addr.sin_port == 0) {
+			usage(&opts, "sources are group:port[@interface]");
+			exit(1);
+		}
+		++num_ins;
+	}
+	for (p = argv[toptind+1]; p != NULL; p = comma) {
+		if ((comma = strchr(p, ',')) != NULL)
+			*comma++ = '\0';
+		if (num_outs == MRELAY_MAX_OUT) {
+			usage(&opts, "too many destinations");
+			exit(1);
+		}
+		if (parse_endpoint(p, &outs[num_outs].addr, &outs[num_outs].iface) < 0) {
+			usage(&opts, "destinations are addr[:port][@interface]");
+			exit(1);
+		}
+		++num_outs;
+	}
+	/* a destination that is also a source would relay its own output forever */
+	for (o = 0; o < num_outs; ++o) {
+		for (i = 0; i < num_ins; ++i) {
+			if (outs[o].addr.sin_addr.s_addr == ins[i].addr.sin_addr.s_addr &&
+					(outs[o].addr.sin_port == 0 || outs[o].addr.sin_port == ins[i].addr.sin_port)) {
+				mprintf((&opts), "ERROR: destination %s:%d is also a source\n",
+						inet_ntoa(ins[i].addr.sin_addr), ntohs(ins[i].addr.sin_port));
+				exit(1);
+			}
+		}
+	}
+
+	bufs = (char **)malloc(opts.o_batch * sizeof(char *));
+	if (bufs == NULL) { mprintf((&opts), "malloc failed\n"); exit(1); }
+	for (i = 0; i < opts.o_batch; ++i) {
+		if ((bufs[i] = (char *)malloc(MRELAY_MAX_MSG)) == NULL) {
+			mprintf((&opts), "malloc failed\n");
+			exit(1);
+		}
+	}
+	for (i = 0; i < num_ins; ++i) {
+		open_input(&opts, &ins[i]);
+		pfds[i].fd = ins[i].sock;
+		pfds[i].events = POLLIN;
+	}
+	for (o = 0; o < num_outs; ++o)
+		open_output(&opts, &outs[o]);
+
+	if (opts.o_counters) {
+		char label[64];
+		sprintf(label, "%d to %d", num_ins, num_outs);
+		if (mt_ctr_create(&opts.ctrs, opts.o_counters, "mrelay", label,
+				ctr_names, NULL, sizeof(ctr_names) / sizeof(ctr_names[0])) < 0)
+			exit(1);
+	}
+	if (! opts.o_quiet) {
+		display(&opts, "Relaying %d source%s to %d destination%s, batches of %d", num_ins,
+				(num_ins == 1) ? "" : "s", num_outs, (num_outs == 1) ? "" : "s", opts.o_batch);
+		if (opts.o_delay_us > 0 || opts.o_jitter_us > 0)
+			display(&opts, ", delay %d us + up to %d us", opts.o_delay_us, opts.o_jitter_us);
+		if (opts.o_loss > 0)
+			display(&opts, ", %g%% loss", opts.o_loss);
+		if (opts.o_reorder > 0)
+			display(&opts, ", %g%% reordered", opts.o_reorder);
+		display(&opts, "\n");
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	rng_state = (unsigned long long)mt_clock_ns() | 1;
+	start_ns = mt_clock_ns();
+	next_report_ns = start_ns + (TLONGLONG)opts.o_interval_ms * 1000000;
+	timeout = -1;
+	while (! stop_requested) {
+		int rtn;
+
+		if (opts.o_interval_ms > 0) {
+			int report_ms = (int)((next_report_ns - mt_clock_ns()) / 1000000);
+			if (report_ms < 0)
+				report_ms = 0;
+			if (timeout < 0 || report_ms < timeout)
+				timeout = report_ms;
+		}
+		rtn = poll(pfds, num_ins, timeout);
+		if (rtn < 0 && errno != EINTR) {
+			mprintf((&opts), "ERROR: ");  perror((&opts), "poll");
+			exit(1);
+		}
+		for (i = 0; rtn > 0 && i < num_ins; ++i) {
+			if (pfds[i].revents & POLLIN) {
+				/* a full batch means more are waiting: read on, up to a point */
+				int n, rounds = 0;
+				do {
+					n = read_input(&opts, i, bufs);
+					for (o = 0; o < num_outs; ++o)
+						flush_output(&opts, o);  /* before bufs are reused */
+				} while (n == opts.o_batch && ++rounds < 16);
+			}
+		}
+
+		now_ns = mt_clock_ns();
+		timeout = -1;
+		for (o = 0; o < num_outs; ++o) {
+			int ms = service_output(&opts, o, now_ns);
+			if (ms >= 0 && (timeout < 0 || ms < timeout))
+				timeout = ms;
+		}
+		if (opts.o_interval_ms > 0 && now_ns >= next_report_ns) {
+			report(&opts, (now_ns - start_ns) / 1e9);
+			next_report_ns += (TLONGLONG)opts.o_interval_ms * 1000000;
+		}
+	}
+
+	for (o = 0; o < num_outs; ++o)
+		drain_output(&opts, o);
+	report(&opts, (mt_clock_ns() - start_ns) / 1e9);
+
+	for (i = 0; i < num_ins; ++i)
+		CLOSESOCKET(ins[i].sock);
+	for (o = 0; o < num_outs; ++o)
+		CLOSESOCKET(outs[o].sock);
+	mt_ctr_close(&opts.ctrs);
+
+	return(0);
+}  /* main */
@@ -23,9 +23,26 @@
  * modified by Aviad Rozenhek [aviadr1@gmail.com] for open-mtools
  */
 
+#if defined(__linux__)
+#define _GNU_SOURCE  /* sendmmsg */
+#endif
+
 #include "mtools.h"
 
 
+#define MSEND_READY_MAX 64  /* receivers told apart by -w */
+#define MSEND_READY_PROBE_MS 10
+
+#define MSEND_CAP_MAX_SIZES 16
+#define MSEND_CAP_CHECK_MS 100  /* look at mdump's periodic feedback */
+#define MSEND_CAP_MIN_LOST 10  /* ignore fewer losses than this when checking */
+#define MSEND_CAP_FEEDBACK_MS 2000  /* wait for the answer to 'stat' */
+#define MSEND_CAP_STAT_TRIES 3
+#define MSEND_CAP_PRECISION 1.05  /* stop bisecting within 5% */
+#define MSEND_CAP_SENDER_LIMIT 0.95  /* sent below 95% of the rate asked */
+
+#define MSEND_DUAL_BATCH 64  /* -A: messages per batched send on each line */
+
 /* Many of the following definitions are intended to make it easier to write
  * portable code between windows and unix. */
 typedef struct msend_opts {
@@ -47,6 +64,34 @@ typedef struct msend_opts {
     int o_Sndbuf_size;
     int o_tcp;
     int o_unicast_udp;
+    int o_msg_len_max;
+    int o_streams;
+    int o_stream_groups;
+    int o_stream_ports;
+    int o_stream_socks;
+    double o_rate;
+    double o_rate_max;
+    char *o_size_spec;
+    char *o_trace_file;
+    char *o_replay_file;
+    double o_replay_speed;
+    double o_replay_from_secs;  /* -R file@secs, 0 = from the start */
+    int o_replay_from_seq;  /* -R file#seq, -1 = not used */
+    size_table o_sizes;  /* sizes (and gaps) from -z or -T, num == 0 if unused */
+    int o_backend;  /* MSEND_BACKEND_xxx */
+    char *o_backend_if;  /* interface for -B txring */
+    int o_transport, o_transport_flags;  /* MT_TRANSPORT_xxx, MT_URING_xxx */
+    char *o_counters;  /* -C name for live counters, NULL = none */
+    int o_perf;  /* -E: report CPU cost per message */
+    int o_cap_sizes[MSEND_CAP_MAX_SIZES];  /* -c message sizes */
+    int o_cap_num;  /* number of -c sizes, 0 = no capacity search */
+    double o_cap_loss;  /* -c: highest acceptable loss, percent */
+    int o_cap_step_ms;  /* -c: length of each test step */
+    int o_ready_num;  /* -w: receivers to wait for, 0 = sleep 1 s instead */
+    int o_ready_ms;  /* -w: longest wait */
+    char *o_dual_line;  /* -A group_b[:port_b][@interface], NULL = one line */
+    int o_skew_us;  /* -K: line B sent this long after line A (< 0: before) */
+    double o_loss[2];  /* -L: percent of datagrams dropped on purpose, per line */
 
     #define MIN_DEFAULT_SENDBUF_SIZE 65536
 
@@ -55,9 +100,53 @@ typedef struct msend_opts {
     unsigned short groupport;
     unsigned char ttlvar;
     char *bind_if;
+
+    /* state */
+    mt_counters ctrs;  /* -C */
 } msend_opts;
 
-static const char usage_str[] = "[-1|2|3|4|5] [-b burst_count] [-d] [-h] [-l loops] [-m msg_len] [-n num_bursts] [-P payload] [-p pause] [-q] [-S Sndbuf_size] [-s stat_pause] [-t | -u] group port [ttl] [interface]";
+/* -C live counters */
+#define MSEND_CTR_MSGS 0
+#define MSEND_CTR_BYTES 1
+#define MSEND_CTR_BURSTS 2
+static const char *ctr_names[] = { "msgs_sent", "bytes_sent", "bursts_sent" };
+
+
+/* One logical publisher in many-stream mode (-N).  Each stream has its own
+ * destination, rate, message size and sequence space; the timer wheel
+ * decides which stream is due next. */
+typedef struct msend_stream {
+    tw_timer timer;  /* must be first: the wheel hands back &timer */
+    int id;
+    SOCKET sock;
+    struct sockaddr_in sin;
+    int dest;  /* index of (group, port) pair, for per-destination stats */
+    int msg_len;
+    TLONGLONG period_ns;
+    TLONGLONG next_ns;  /* scheduled time of next send */
+    int msg_num;  /* own sequence number */
+    int size_idx;  /* position in the size table (-z / -T) */
+} msend_stream;
+
+/* One line of dual publishing (-A): every message goes out on both, with
+ * the same sequence number. */
+typedef struct msend_line {
+    SOCKET sock;
+    struct sockaddr_in sin;
+    const char *iface;
+    double loss;  /* -L percent */
+    unsigned long long datagrams, dropped, calls;
+} msend_line;
+
+#define STREAM_TICK_NS 1000  /* timer wheel resolution: 1 us */
+
+#define MSEND_BACKEND_SOCKET 0  /* sendto() per message */
+#define MSEND_BACKEND_TXRING 1  /* AF_PACKET PACKET_TX_RING (Linux) */
+#define MSEND_BACKEND_URING 2  /* io_uring batched sendmsg (Linux) */
+
+static const char *backend_names[] = { "socket", "txring", "uring" };
+
+static const char usage_str[] = "[-1|2|3|4|5] [-A group_b[:port_b][@interface]] [-B backend] [-b burst_count] [-C name] [-c sizes[/loss_pct[/step_ms]]] [-d] [-E] [-h] [-K skew_us] [-L loss_a[,loss_b]] [-l loops] [-m msg_len[-max_len]] [-N streams[/groups[/ports[/socks]]]] [-n num_bursts] [-P payload] [-p pause] [-q] [-R capture_file] [-r rate[-max_rate]] [-S Sndbuf_size] [-s stat_pause] [-T trace_file] [-t | -u] [-w receivers[/timeout_ms]] [-x speed] [-z size_dist] group port [ttl] [interface]";
 
 void usage(msend_opts* opts, char *msg)
 {
@@ -81,20 +170,77 @@ void help(msend_opts* opts, char *msg)
 			"  -3 : pre-load opts for moderate load (bursts of 100 8K msgs for 5 seconds)\n"
 			"  -4 : pre-load opts for heavy load (1 burst of 5000 short msgs)\n"
 			"  -5 : pre-load opts for VERY heavy load (1 burst of 50,000 800-byte msgs)\n"
+			"  -A group_b[:port_b][@interface] : dual publish: send every message on\n"
+			"               line A (group port interface) and on line B, with the\n"
+			"               same sequence number, through a second socket; each\n"
+			"               burst goes out in one batched call per line (sendmmsg\n"
+			"               on Linux; no -B, -c, -N, -R or -t)\n"
+			"  -B backend : how datagrams are sent [socket]\n"
+			"               socket : one sendto() per message\n"
+			"               txring[,ifname] : prebuilt frames in an AF_PACKET\n"
+			"                        PACKET_TX_RING, one kernel kick per batch\n"
+			"                        (Linux, needs CAP_NET_RAW; interface defaults\n"
+			"                        to the one owning 'interface'; no -t, -N or -R;\n"
+			"                        sequence numbers are fixed width)\n"
+			"               uring[,sqpoll] : io_uring, sendmsg requests queued\n"
+			"                        and submitted in batches, optionally with a\n"
+			"                        kernel polling thread (Linux; no -t, -N or -R)\n"
 			"  -b burst_count : number of messages per burst [1]\n"
+			"  -C name : publish live counters for 'mstat' under 'name'\n"
+			"  -c size[,size...][/loss_pct[/step_ms]] : find the highest rate each message\n"
+			"               size can be sent at with at most loss_pct loss [0.1], from\n"
+			"               'mdump -a' feedback: double the rate each step of step_ms\n"
+			"               [1000] from -r [1000] (up to -r max_rate), then bisect\n"
+			"               between the last good and first bad rate (UDP socket only;\n"
+			"               no -B, -N, -R, -t, -z or -T)\n"
 			"  -d : decimal numbers in messages [hex])\n"
+			"  -E : report the CPU cost per message of the send loop: cycles, IPC and\n"
+			"       cache misses (perf_event_open hardware counters), CPU time and\n"
+			"       context switches per 1000 messages (software counters, or\n"
+			"       getrusage where perf_event_open is not available)\n"
 			"  -h : help\n"
+			"  -K skew_us : with -A, send line B this long after line A (negative:\n"
+			"               line B first) [0]\n"
+			"  -L loss_a[,loss_b] : with -A, drop this percentage of datagrams on\n"
+			"               purpose on line A and line B, independently [0]\n"
 			"  -l loops : number of times to loop test [1]\n"
 			"  -m msg_len : length of each message (0=use length of sequence number) [0]\n"
+			"               (with -N, 'min-max' spreads sizes across the streams)\n"
+			"  -N streams[/groups[/ports[/socks]]] : simulate many independent publishers,\n"
+			"               spread over consecutive groups and ports starting at 'group'\n"
+			"               and 'port', sending from 'socks' source sockets [1/1/1]\n"
+			"               (-b and -p are ignored, -n counts messages per stream)\n"
 			"  -n num_bursts : number of bursts to send (0=infinite) [0]\n"
 			"  -P payload : hex digits for message content (implicit -m)\n"
 			"  -p pause : pause (milliseconds) between bursts [1000]\n"
 			"  -q : loop more quietly (can use '-qq' for complete silence)\n"
+			"  -R capture_file[@secs|#seq] : replay the UDP payloads of an mcap\n"
+			"                    ('mdump -F mcap'), pcap or pcapng capture to\n"
+			"                    group/port (-b, -m, -n and -p are ignored), from\n"
+			"                    'secs' after its first datagram or from msend\n"
+			"                    message 'seq' (mcap only); indexed mcap files\n"
+			"                    seek straight there\n"
+			"  -r rate[-max_rate] : messages per second per stream with -N [10]\n"
+			"               ('min-max' spreads rates across the streams; with -c,\n"
+			"               the rate to start from and the most to try)\n"
 			"  -S Sndbuf_size : size (bytes) of UDP send buffer (SO_SNDBUF) [65536]\n"
 			"                   (use 0 for system default buff size)\n"
 			"  -s stat_pause : pause (milliseconds) before sending stat msg (0=no stat) [0]\n"
+			"  -T trace_file : take message sizes and inter-send gaps from a trace, one\n"
+			"                  'gap_us size' line per message (-b and -p are ignored,\n"
+			"                  -n counts messages [0=one pass through the trace])\n"
 			"  -t : tcp ('group' becomes destination IP) [multicast]\n"
 			"  -u : unicast udp ('group' becomes destination IP) [multicast]\n"
+			"  -w receivers[/timeout_ms] : after 'echo', start as soon as this many\n"
+			"               receivers (mdump) answer probes sent on the data group(s),\n"
+			"               printing each one's join latency, or after timeout_ms\n"
+			"               [5000] (instead of waiting 1 second; not with -t)\n"
+			"  -x speed : replay speed multiplier for -R (0=as fast as possible) [1]\n"
+			"  -z size_dist : draw message sizes from a distribution (overrides -m):\n"
+			"                 uniform:min,max\n"
+			"                 normal:mean,stddev\n"
+			"                 bimodal:mean1,stddev1,mean2,stddev2,pct1\n"
+			"                 cdf:file (lines of 'size cumulative_probability')\n"
 			"\n"
 			"  group : multicast group or IP address to send to (required)\n"
 			"  port : destination port (required)\n"
@@ -104,10 +250,929 @@ void help(msend_opts* opts, char *msg)
 }  /* help */
 
 
+/* Create the sending socket: SO_SNDBUF, multicast TTL and (optionally) the
+ * outgoing multicast interface. */
+static SOCKET initialize_socket(msend_opts *opts, const char *bind_if)
+{
+	SOCKET sock;
+	int check_size;
+	static int sndbuf_warned = 0;
+#if defined(_WIN32)
+	unsigned int wttl;
+	unsigned long int iface_in;
+#else
+	struct in_addr iface_in;
+#endif /* _WIN32 */
+
+	if (opts->o_tcp) {
+		if((sock = socket(PF_INET,SOCK_STREAM,0)) == INVALID_SOCKET) {
+			mprintf(opts, "ERROR: ");  perror(opts, "socket");
+			exit(1);
+		}
+	} else {
+		if((sock = socket(PF_INET,SOCK_DGRAM,0)) == INVALID_SOCKET) {
+			mprintf(opts, "ERROR: ");  perror(opts, "socket");
+			exit(1);
+		}
+	}
+
+	/* Try to set send buf size and check to see if it took */
+	if ((check_size = mt_set_sockbuf(sock, SO_SNDBUF, opts->o_Sndbuf_size)) < 0) {
+		mprintf(opts, "ERROR: ");  perror(opts, "getsockopt - SO_SNDBUF");
+		exit(1);
+	}
+	if (check_size < opts->o_Sndbuf_size && ! sndbuf_warned) {
+		mprintf(opts, "WARNING: tried to set SO_SNDBUF to %d, only got %d\n",
+				opts->o_Sndbuf_size, check_size);
+		sndbuf_warned = 1;  /* once is enough with many sockets (-N) */
+	}
+
+	if (! opts->o_unicast_udp && ! opts->o_tcp) {
+#if defined(_WIN32)
+		wttl = opts->ttlvar;
+		if (setsockopt(sock,IPPROTO_IP,IP_MULTICAST_TTL,(char *)&wttl,
+					sizeof(wttl)) == SOCKET_ERROR) {
+			mprintf(opts, "ERROR: ");  perror(opts, "setsockopt - TTL");
+			exit(1);
+		}
+#else
+		if (setsockopt(sock,IPPROTO_IP,IP_MULTICAST_TTL,(char *)&opts->ttlvar,
+					sizeof(opts->ttlvar)) == SOCKET_ERROR) {
+			mprintf(opts, "ERROR: ");  perror(opts, "setsockopt - TTL");
+			exit(1);
+		}
+#endif /* _WIN32 */
+	}
+
+	if (bind_if != NULL) {
+#if !defined(_WIN32)
+		memset((char *)&iface_in,0,sizeof(iface_in));
+		iface_in.s_addr = inet_addr(bind_if);
+#else
+		iface_in = inet_addr(bind_if);
+#endif /* !_WIN32 */
+		if(setsockopt(sock, IPPROTO_IP, IP_MULTICAST_IF, (const char*)&iface_in,
+				sizeof(iface_in)) == SOCKET_ERROR) {
+			mprintf(opts, "ERROR: ");  perror(opts, "setsockopt - IP_MULTICAST_IF");
+			exit(1);
+		}
+	}
+
+	return sock;
+}  /* initialize_socket */
+
+
+/* Send one datagram, exiting on error (same policy as the main send loop). */
+static void send_or_die(msend_opts *opts, SOCKET sock, const char *buff, int send_len,
+		struct sockaddr_in *sin)
+{
+	int send_rtn;
+
+	send_rtn = sendto(sock,buff,send_len,0,(struct sockaddr *)sin,sizeof(*sin));
+	if (send_rtn == SOCKET_ERROR) {
+		mprintf(opts, "ERROR: ");  perror(opts, "send");
+		exit(1);
+	}
+	else if (send_rtn != send_len) {
+		mprintf(opts, "ERROR: sendto returned %d, expected %d\n",
+				send_rtn, send_len);
+		exit(1);
+	}
+	mt_ctr_add(&opts->ctrs, MSEND_CTR_MSGS, 1);
+	mt_ctr_add(&opts->ctrs, MSEND_CTR_BYTES, send_len);
+}  /* send_or_die */
+
+
+/* Wait until the monotonic clock reaches 'when_ns': sleep while it is far
+ * away, spin for the last stretch (sleeps overshoot by tens of us). */
+static void pace_until(TLONGLONG when_ns)
+{
+	TLONGLONG now_ns;
+
+	while ((now_ns = mt_clock_ns()) < when_ns) {
+		if (when_ns - now_ns > 200000)
+			SLEEP_USEC((unsigned int)((when_ns - now_ns - 100000) / 1000));
+	}
+}  /* pace_until */
+
+
+/* -w: instead of a fixed second after 'echo', probe with "ready? <n>"
+ * datagrams on the data destinations (dests[i] through socks[i]) every
+ * MSEND_READY_PROBE_MS until o_ready_num receivers have answered
+ * "ready <n> <tool> <pid>", or o_ready_ms has passed.  Receivers are told
+ * apart by source address and pid (several can share a host and port).
+ * An answer proves the receiver's join reached this sender's traffic;
+ * the time to each receiver's first answer is its join latency. */
+static void wait_ready(msend_opts *opts, int num_dests, SOCKET *socks, struct sockaddr_in *dests)
+{
+	struct sockaddr_in ready[MSEND_READY_MAX];
+	unsigned long ready_pids[MSEND_READY_MAX];
+	int num_ready = 0, probe = 0, i, j;
+	TLONGLONG start_ns = mt_clock_ns(), next_probe_ns = start_ns, now_ns;
+	char buf[256];
+
+	while (num_ready < opts->o_ready_num &&
+			(now_ns = mt_clock_ns()) - start_ns < (TLONGLONG)opts->o_ready_ms * 1000000) {
+		fd_set readfds;
+		struct timeval tv;
+		SOCKET max_sock = 0;
+		TLONGLONG wait_ns;
+
+		if (now_ns >= next_probe_ns) {
+			sprintf(buf, "ready? %d", probe++);
+			for (i = 0; i < num_dests; ++i)
+				send_or_die(opts, socks[i], buf, strlen(buf) + 1, &dests[i]);
+			next_probe_ns += MSEND_READY_PROBE_MS * 1000000;
+		}
+
+		FD_ZERO(&readfds);
+		for (i = 0; i < num_dests; ++i) {
+			FD_SET(socks[i], &readfds);
+			if (socks[i] > max_sock)
+				max_sock = socks[i];
+		}
+		wait_ns = next_probe_ns - mt_clock_ns();
+		tv.tv_sec = 0;
+		tv.tv_usec = (wait_ns > 0) ? (long)(wait_ns / 1000) : 0;
+		if (select((int)max_sock + 1, &readfds, NULL, NULL, &tv) <= 0)
+			continue;
+
+		for (i = 0; i < num_dests; ++i) {
+			struct sockaddr_in src;
+			int len, src_len = sizeof(src), n;
+			unsigned long pid = 0;
+			char tool[16];
+
+			if (! FD_ISSET(socks[i], &readfds))
+				continue;
+			FD_CLR(socks[i], &readfds);  /* the same socket may serve several destinations */
+			len = recvfrom(socks[i], buf, sizeof(buf) - 1, 0, (struct sockaddr *)&src, (socklen_t *)&src_len);
+			if (len == SOCKET_ERROR) {
+				mprintf(opts, "ERROR: ");  perror(opts, "recvfrom");
+				exit(1);
+			}
+			buf[len] = '\0';
+			strcpy(tool, "?");
+			if (sscanf(buf, "ready %d %15s %lu", &n, tool, &pid) < 1)
+				continue;
+			for (j = 0; j < num_ready; ++j) {
+				if (ready[j].sin_addr.s_addr == src.sin_addr.s_addr && ready[j].sin_port == src.sin_port &&
+						ready_pids[j] == pid)
+					break;
+			}
+			if (j < num_ready || num_ready == MSEND_READY_MAX)
+				continue;  /* already counted */
+			ready[num_ready] = src;
+			ready_pids[num_ready++] = pid;
+			if (opts->o_quiet < 2) {
+				printf("Receiver %s:%d (%s pid %lu) ready after %.1f ms (probe %d of %d)\n",
+					inet_ntoa(src.sin_addr), ntohs(src.sin_port), tool, pid,
+					(mt_clock_ns() - start_ns) / 1e6, n, probe);
+				fflush(stdout);
+			}
+		}
+	}
+
+	if (num_ready < opts->o_ready_num)
+		mprintf(opts, "WARNING: only %d of %d receivers ready after %d ms, starting anyway\n",
+				num_ready, opts->o_ready_num, opts->o_ready_ms);
+}  /* wait_ready */
+
+
+/* Parse -c "size[,size...][/loss_pct[/step_ms]]". */
+static int parse_capacity(msend_opts *opts, char *spec)
+{
+	char *p = spec, *end;
+
+	opts->o_cap_num = 0;
+	opts->o_cap_loss = 0.1;
+	opts->o_cap_step_ms = 1000;
+	for (;;) {
+		long size = strtol(p, &end, 10);
+		if (end == p || size < 16 || size > 65507 || opts->o_cap_num == MSEND_CAP_MAX_SIZES) {
+			mprintf(opts, "Error, -c sizes must be 16 to 65507 bytes, at most %d of them\n",
+					MSEND_CAP_MAX_SIZES);
+			return -1;
+		}
+		opts->o_cap_sizes[opts->o_cap_num++] = (int)size;
+		if (*end != ',')
+			break;
+		p = end + 1;
+	}
+	if (*end == '/') {
+		opts->o_cap_loss = strtod(end + 1, &end);
+		if (*end == '/')
+			opts->o_cap_step_ms = (int)strtol(end + 1, &end, 10);
+	}
+	if (*end != '\0' || opts->o_cap_loss < 0 || opts->o_cap_step_ms < 100) {
+		mprintf(opts, "Error, bad -c '%s' (loss_pct >= 0, step_ms >= 100)\n", spec);
+		return -1;
+	}
+	return 0;
+}  /* parse_capacity */
+
+
+/* Capacity search (-c): feedback from 'mdump -a' about one test step. */
+typedef struct cap_feedback {
+    int final;  /* 1 = answer to 'stat', else a periodic report */
+    int rcvd;
+    int lost;  /* 'stat': sent - received; periodic: missing sequence numbers */
+    long long local;  /* dropped by the receiver's socket, -1 = unknown */
+} cap_feedback;
+
+/* Wait up to 'timeout_ms' for a 'feedback' datagram from mdump.  Returns
+ * 1 and fills 'fb', or 0 if none came. */
+static int cap_recv_feedback(msend_opts *opts, SOCKET sock, int timeout_ms, cap_feedback *fb)
+{
+	char buf[256];
+	fd_set readfds;
+	struct timeval tv;
+	int len, num_sent;
+
+	for (;;) {
+		FD_ZERO(&readfds);
+		FD_SET(sock, &readfds);
+		tv.tv_sec = timeout_ms / 1000;
+		tv.tv_usec = (timeout_ms % 1000) * 1000;
+		if (select((int)sock + 1, &readfds, NULL, NULL, &tv) <= 0)
+			return 0;
+		len = recv(sock, buf, sizeof(buf) - 1, 0);
+		if (len == SOCKET_ERROR) {
+			mprintf(opts, "ERROR: ");  perror(opts, "recv");
+			exit(1);
+		}
+		buf[len] = '\0';
+		if (sscanf(buf, "feedback final %d %d %lld", &num_sent, &fb->rcvd, &fb->local) == 3) {
+			fb->final = 1;
+			fb->lost = num_sent - fb->rcvd;
+			return 1;
+		}
+		if (sscanf(buf, "feedback %d %d %lld", &fb->rcvd, &fb->lost, &fb->local) == 3) {
+			fb->final = 0;
+			return 1;
+		}
+		/* anything else is not for us */
+	}
+}  /* cap_recv_feedback */
+
+
+/* One capacity test step: 'size'-byte messages paced at 'rate' per second
+ * for o_cap_step_ms, then 'stat' and mdump's answer.  A step that is
+ * clearly losing too much (from the periodic feedback) ends early.
+ * Returns the loss in percent; 'achieved' is the rate actually sent. */
+static double cap_step(msend_opts *opts, SOCKET sock, struct sockaddr_in *sin, char *buff,
+		int size, double rate, double *achieved, cap_feedback *fb)
+{
+	TLONGLONG period_ns = (TLONGLONG)(1e9 / rate), start_ns, next_ns, end_ns, check_ns;
+	char cmdbuf[100];
+	int msg_num = 0, tries;
+
+	sprintf(cmdbuf, "echo capacity step: %d-byte messages at %.0f msgs/sec", size, rate);
+	send_or_die(opts, sock, cmdbuf, strlen(cmdbuf) + 1, sin);
+	SLEEP_MSEC(100);
+	while (cap_recv_feedback(opts, sock, 0, fb))  /* stale reports of the last step */
+		;
+
+	start_ns = next_ns = mt_clock_ns();
+	end_ns = start_ns + (TLONGLONG)opts->o_cap_step_ms * 1000000;
+	check_ns = start_ns + MSEND_CAP_CHECK_MS * 1000000;
+	while (next_ns < end_ns) {
+		pace_until(next_ns);
+		sprintf(buff, "Message %x", msg_num);  /* hex: mdump tracks the sequence */
+		send_or_die(opts, sock, buff, size, sin);
+		++msg_num;
+		next_ns += period_ns;
+
+		if (next_ns >= check_ns) {
+			if (cap_recv_feedback(opts, sock, 0, fb) && fb->lost >= MSEND_CAP_MIN_LOST &&
+					fb->lost * 100.0 > 2 * opts->o_cap_loss * (fb->rcvd + fb->lost))
+				break;  /* well past the threshold already */
+			check_ns += MSEND_CAP_CHECK_MS * 1000000;
+		}
+	}
+	*achieved = msg_num * 1e9 / (mt_clock_ns() - start_ns);
+
+	SLEEP_MSEC(100);  /* let the receiver drain its buffer */
+	sprintf(cmdbuf, "stat %d", msg_num);
+	for (tries = 0; tries < MSEND_CAP_STAT_TRIES; ++tries) {
+		send_or_die(opts, sock, cmdbuf, strlen(cmdbuf), sin);
+		while (cap_recv_feedback(opts, sock, MSEND_CAP_FEEDBACK_MS, fb)) {
+			if (fb->final)
+				return (fb->lost > 0) ? fb->lost * 100.0 / msg_num : 0.0;
+		}
+	}
+	mprintf(opts, "ERROR: no answer to 'stat' (is mdump running with -a?)\n");
+	exit(1);
+	return 0.0;
+}  /* cap_step */
+
+
+/* -c: for each message size, find the highest paced rate whose loss stays
+ * within o_cap_loss percent.  Ramp up by doubling from the start rate until
+ * a step fails, then bisect between the last good rate and the first bad
+ * one.  A step that could not be sent at its rate (this host is the
+ * bottleneck) ends the search for that size. */
+static void capacity_search(msend_opts *opts, SOCKET sock, struct sockaddr_in *sin, char *buff)
+{
+	int i;
+
+	for (i = 0; i < opts->o_cap_num; ++i) {
+		int size = opts->o_cap_sizes[i], sender_limited = 0, at_max = 0;
+		double rate = opts->o_rate, good = 0, bad = 0, good_loss = 0, loss, achieved;
+		cap_feedback fb, bad_fb;
+
+		memset(&bad_fb, 0, sizeof(bad_fb));
+		for (;;) {
+			loss = cap_step(opts, sock, sin, buff, size, rate, &achieved, &fb);
+			if (opts->o_quiet < 2) {
+				printf("  %d bytes at %.0f msgs/sec: sent %.0f msgs/sec, %d received, %.3f%% loss",
+					size, rate, achieved, fb.rcvd, loss);
+				if (fb.local >= 0)
+					printf(" (%lld local)", fb.local);
+				printf(" %s\n", (loss <= opts->o_cap_loss) ? "ok" : "too high");
+				fflush(stdout);
+			}
+			if (loss <= opts->o_cap_loss) {
+				good = rate;  good_loss = loss;
+				if (achieved < MSEND_CAP_SENDER_LIMIT * rate) {
+					sender_limited = 1;
+					good = achieved;
+					break;
+				}
+			}
+			else {
+				bad = rate;  bad_fb = fb;
+			}
+
+			if (bad == 0) {  /* ramp */
+				if (opts->o_rate_max > 0 && rate >= opts->o_rate_max) {
+					at_max = 1;
+					break;
+				}
+				rate *= 2;
+				if (opts->o_rate_max > 0 && rate > opts->o_rate_max)
+					rate = opts->o_rate_max;
+			}
+			else if (good == 0 || bad / good < MSEND_CAP_PRECISION)
+				break;
+			else  /* bisect */
+				rate = (good + bad) / 2;
+		}
+
+		if (good == 0)
+			printf("Capacity for %d-byte messages: below %.0f msgs/sec (loss over %g%% at the start rate)\n",
+				size, opts->o_rate, opts->o_cap_loss);
+		else {
+			printf("Capacity for %d-byte messages: %.0f msgs/sec (%.1f Mbit/s) with %.3f%% loss%s\n",
+				size, good, good * size * 8 / 1e6, good_loss,
+				sender_limited ? ", limited by this sender" :
+				(at_max ? ", the -r maximum" : ""));
+			if (bad > 0)
+				printf("  (at %.0f msgs/sec, loss was %s)\n", bad,
+					(bad_fb.local > 0 && bad_fb.local * 2 >= bad_fb.lost) ?
+					"mostly in the receiver's socket buffer" : "mostly in the network");
+		}
+		fflush(stdout);
+	}
+}  /* capacity_search */
+
+
+/* Replay mode (-R): resend every UDP payload of a capture file to 'sin',
+ * at the original pace scaled by o_replay_speed (0 = as fast as possible),
+ * and report how far the replay drifted from the intended schedule.
+ * Returns the number of messages sent. */
+static int replay_capture(msend_opts *opts, SOCKET sock, struct sockaddr_in *sin)
+{
+	cap_reader reader;
+	cap_record rec;
+	int msg_num = 0, rtn;
+	TLONGLONG start_ns, due_ns, drift_ns, first_ts_ns = 0, last_ts_ns = 0;
+	TLONGLONG max_drift_ns = 0, sum_drift_ns = 0, num_late = 0;
+	double bytes = 0, elapsed;
+
+	if (cap_open(&reader, opts->o_replay_file) < 0)
+		exit(1);
+	if (opts->o_replay_from_seq >= 0)
+		rtn = cap_seek_seq(&reader, opts->o_replay_from_seq);
+	else if (opts->o_replay_from_secs > 0) {
+		if ((rtn = cap_next(&reader, &rec)) > 0)
+			rtn = cap_seek_ns(&reader, rec.ts_ns + (TLONGLONG)(opts->o_replay_from_secs * 1e9));
+	}
+	else
+		rtn = 1;
+	if (rtn < 0)
+		exit(1);
+	if (rtn == 0)
+		mprintf(opts, "WARNING: nothing in %s at or after the start point\n", opts->o_replay_file);
+
+	start_ns = mt_clock_ns();
+	while ((rtn = cap_next(&reader, &rec)) > 0) {
+		if (rec.len > SIZEDIST_MAX_SIZE)
+			continue;  /* cannot be resent as a single datagram */
+		if (msg_num == 0)
+			first_ts_ns = rec.ts_ns;
+		last_ts_ns = rec.ts_ns;
+
+		if (opts->o_replay_speed > 0) {
+			due_ns = start_ns + (TLONGLONG)((rec.ts_ns - first_ts_ns) / opts->o_replay_speed);
+			pace_until(due_ns);
+			drift_ns = mt_clock_ns() - due_ns;
+			sum_drift_ns += drift_ns;
+			if (drift_ns > max_drift_ns)
+				max_drift_ns = drift_ns;
+			if (drift_ns > 100000)
+				++num_late;
+		}
+
+		send_or_die(opts, sock, rec.data, rec.len, sin);
+		bytes += rec.len;
+		++msg_num;
+
+		if (opts->o_quiet == 1 && (msg_num % 10000) == 0) {
+			printf(".");
+			fflush(stdout);
+		}
+	}
+	elapsed = (mt_clock_ns() - start_ns) / 1e9;
+	cap_close(&reader);
+	if (rtn < 0)
+		mprintf(opts, "WARNING: replay stopped at corrupt record\n");
+
+	if (opts->o_quiet < 2) {
+		printf("\nReplayed %d msgs (%.0f bytes) in %.3f sec, capture spanned %.3f sec (%.0f msgs/sec)\n",
+			msg_num, bytes, elapsed, (last_ts_ns - first_ts_ns) / 1e9,
+			(elapsed > 0) ? msg_num / elapsed : 0.0);
+		if (opts->o_replay_speed > 0 && msg_num > 0)
+			printf("Replay timing drift: mean %.1f us, max %.1f us, %lld msgs more than 100 us late\n",
+				sum_drift_ns / 1e3 / msg_num, max_drift_ns / 1e3, (long long)num_late);
+		fflush(stdout);
+	}
+	return msg_num;
+}  /* replay_capture */
+
+
+/* Spread a "min-max" option value linearly across the streams. */
+static double stream_spread(double lo, double hi, int stream, int num_streams)
+{
+	if (hi <= lo || num_streams < 2)
+		return lo;
+	return lo + (hi - lo) * stream / (num_streams - 1);
+}  /* stream_spread */
+
+
+/* Many-stream mode (-N): drive o_streams independent publishers, each with
+ * its own rate, size and sequence space.  Streams are scheduled with a
+ * hierarchical timer wheel, so picking the next stream to send is O(1)
+ * however many there are.  'perf' (-E, else NULL) brackets the send loop.
+ * Returns the number of messages sent. */
+static int send_streams(msend_opts *opts, char *buff, const char *cmdbuf, mt_perf *perf)
+{
+	msend_stream *streams;
+	SOCKET *socks;
+	int *dest_counts;
+	int num_dests, i, msg_num, send_len, tick_msgs, active;
+	tw_wheel *wheel;
+	tw_timer *t;
+	TLONGLONG start_ns, now_ns, next_tick, late_ns, max_late_ns, report_ns;
+	char statbuf[64];
+
+	num_dests = opts->o_stream_groups * opts->o_stream_ports;
+	streams = (msend_stream *)calloc(opts->o_streams, sizeof(msend_stream));
+	socks = (SOCKET *)calloc(opts->o_stream_socks, sizeof(SOCKET));
+	dest_counts = (int *)calloc(num_dests, sizeof(int));
+	wheel = (tw_wheel *)malloc(sizeof(tw_wheel));
+	if (streams == NULL || socks == NULL || dest_counts == NULL || wheel == NULL) {
+		mprintf(opts, "malloc failed\n");
+		exit(1);
+	}
+
+	for (i = 0; i < opts->o_stream_socks; ++i)
+		socks[i] = initialize_socket(opts, opts->bind_if);
+
+	for (i = 0; i < opts->o_streams; ++i) {
+		msend_stream *s = &streams[i];
+		int group = i % opts->o_stream_groups;
+		int port = (i / opts->o_stream_groups) % opts->o_stream_ports;
+		double rate = stream_spread(opts->o_rate, opts->o_rate_max, i, opts->o_streams);
+
+		s->id = i;
+		s->sock = socks[i % opts->o_stream_socks];
+		s->sin.sin_family = AF_INET;
+		s->sin.sin_addr.s_addr = htonl(ntohl(opts->groupaddr) + group);
+		s->sin.sin_port = htons((unsigned short)(opts->groupport + port));
+		s->dest = port * opts->o_stream_groups + group;
+		s->msg_len = (int)stream_spread(opts->o_msg_len, opts->o_msg_len_max, i, opts->o_streams);
+		s->period_ns = (TLONGLONG)(1000000000.0 / rate);
+		if (s->period_ns < 1)
+			s->period_ns = 1;
+		/* each stream starts at a different point of the size table */
+		if (opts->o_sizes.num > 0)
+			s->size_idx = (int)((TLONGLONG)opts->o_sizes.num * i / opts->o_streams);
+	}
+
+	/* 1st msg on every destination: give network hardware time to establish mcast flow */
+	for (i = 0; i < num_dests && i < opts->o_streams; ++i)
+		send_or_die(opts, streams[i].sock, cmdbuf, strlen(cmdbuf)+1, &streams[i].sin);
+	if (opts->o_ready_num > 0) {
+		int num = (num_dests < opts->o_streams) ? num_dests : opts->o_streams;
+		SOCKET *ready_socks = (SOCKET *)malloc(num * sizeof(SOCKET));
+		struct sockaddr_in *ready_dests = (struct sockaddr_in *)malloc(num * sizeof(struct sockaddr_in));
+		if (ready_socks == NULL || ready_dests == NULL) {
+			mprintf(opts, "malloc failed\n");
+			exit(1);
+		}
+		for (i = 0; i < num; ++i) {
+			ready_socks[i] = streams[i].sock;
+			ready_dests[i] = streams[i].sin;
+		}
+		wait_ready(opts, num, ready_socks, ready_dests);
+		free(ready_socks);
+		free(ready_dests);
+	}
+	else
+		SLEEP_SEC(1);
+
+	/* stagger the first sends so the streams do not all fire at once */
+	if (perf != NULL)
+		mt_perf_start(perf);
+	start_ns = mt_clock_ns();
+	tw_init(wheel, start_ns / STREAM_TICK_NS);
+	for (i = 0; i < opts->o_streams; ++i) {
+		msend_stream *s = &streams[i];
+		s->next_ns = start_ns + s->period_ns * i / opts->o_streams;
+		tw_add(wheel, &s->timer, s->next_ns / STREAM_TICK_NS);
+	}
+
+	msg_num = 0;
+	tick_msgs = 0;
+	max_late_ns = 0;
+	active = opts->o_streams;
+	report_ns = start_ns + 1000000000;
+	while (active > 0) {
+		now_ns = mt_clock_ns();
+		tw_advance(wheel, now_ns / STREAM_TICK_NS);
+
+		while ((t = tw_pop(wheel)) != NULL) {
+			msend_stream *s = (msend_stream *)t;
+
+			if (opts->o_decimal)
+				sprintf(buff,"Message %d %d",s->msg_num,s->id);
+			else
+				sprintf(buff,"Message %x %x",s->msg_num,s->id);
+			if (opts->o_sizes.num > 0)
+				send_len = opts->o_sizes.sizes[s->size_idx];
+			else
+				send_len = (s->msg_len == 0) ? (int)strlen(buff) : s->msg_len;
+			send_or_die(opts, s->sock, buff, send_len, &s->sin);
+
+			late_ns = now_ns - s->next_ns;
+			if (late_ns > max_late_ns)
+				max_late_ns = late_ns;
+
+			++s->msg_num;
+			++dest_counts[s->dest];
+			++msg_num;
+			++tick_msgs;
+			if (opts->o_num_bursts != 0 && s->msg_num >= opts->o_num_bursts) {
+				--active;
+				continue;
+			}
+			if (opts->o_sizes.num > 0 && ++s->size_idx == opts->o_sizes.num)
+				s->size_idx = 0;
+			if (opts->o_sizes.gaps_ns)
+				s->next_ns += opts->o_sizes.gaps_ns[s->size_idx];
+			else
+				s->next_ns += s->period_ns;
+			tw_add(wheel, &s->timer, s->next_ns / STREAM_TICK_NS);
+		}
+
+		if (now_ns >= report_ns) {
+			if (opts->o_quiet == 0) {
+				printf("Sent %d msgs in last second (%d total)\n", tick_msgs, msg_num);
+				fflush(stdout);
+			}
+			else if (opts->o_quiet == 1) {
+				printf(".");
+				fflush(stdout);
+			}
+			tick_msgs = 0;
+			report_ns += 1000000000;
+		}
+
+		/* sleep if the next stream is not due for a while; otherwise spin */
+		next_tick = tw_next_tick(wheel);
+		if (next_tick >= 0) {
+			TLONGLONG idle_us = (next_tick * STREAM_TICK_NS - mt_clock_ns()) / 1000;
+			if (idle_us > 100)
+				SLEEP_USEC((unsigned int)(idle_us - 50));
+		}
+	}  /* while active */
+
+	now_ns = mt_clock_ns();
+	if (perf != NULL)
+		mt_perf_stop(perf);
+	if (opts->o_quiet < 2) {
+		printf("\n%d streams sent %d msgs in %.3f sec (%.0f msgs/sec), max schedule lag %lld us\n",
+				opts->o_streams, msg_num, (now_ns - start_ns) / 1e9,
+				msg_num / ((now_ns - start_ns) / 1e9), (long long)(max_late_ns / 1000));
+		fflush(stdout);
+	}
+
+	if (opts->o_stat_pause > 0) {
+		/* one 'stat' per destination, with the count sent to that destination */
+		if (opts->o_quiet < 2)
+			printf("Pausing before sending 'stat'\n");
+		SLEEP_MSEC(opts->o_stat_pause);
+		for (i = 0; i < num_dests && i < opts->o_streams; ++i) {
+			sprintf(statbuf, "stat %d", dest_counts[streams[i].dest]);
+			send_or_die(opts, streams[i].sock, statbuf, strlen(statbuf), &streams[i].sin);
+		}
+	}
+
+	for (i = 0; i < opts->o_stream_socks; ++i)
+		CLOSESOCKET(socks[i]);
+	free(wheel);
+	free(dest_counts);
+	free(socks);
+	free(streams);
+
+	return msg_num;
+}  /* send_streams */
+
+
+/* -A: line B's destination and interface from "group_b[:port_b][@interface]"
+ * (port and interface default to line A's). */
+static void parse_dual_line(msend_opts *opts, msend_line *line)
+{
+	static char spec[100];
+	char *colon, *at;
+
+	if (strlen(opts->o_dual_line) >= sizeof(spec)) {
+		mprintf(opts, "ERROR: -A %s: too long\n", opts->o_dual_line);
+		exit(1);
+	}
+	strcpy(spec, opts->o_dual_line);
+	line->iface = opts->bind_if;
+	if ((at = strchr(spec, '@')) != NULL) {
+		*at = '\0';
+		line->iface = at + 1;
+	}
+	memset((char *)&line->sin, 0, sizeof(line->sin));
+	line->sin.sin_family = AF_INET;
+	line->sin.sin_port = htons(opts->groupport);
+	if ((colon = strchr(spec, ':')) != NULL) {
+		*colon = '\0';
+		line->sin.sin_port = htons((unsigned short)atoi(colon + 1));
+	}
+	line->sin.sin_addr.s_addr = inet_addr(spec);
+	if (line->sin.sin_addr.s_addr == opts->groupaddr && line->sin.sin_port == htons(opts->groupport) &&
+			(line->iface == opts->bind_if ||
+			 (line->iface != NULL && opts->bind_if != NULL && strcmp(line->iface, opts->bind_if) == 0))) {
+		mprintf(opts, "ERROR: -A %s: line B must differ from line A\n", opts->o_dual_line);
+		exit(1);
+	}
+}  /* parse_dual_line */
+
+
+/* xorshift64*, for -L: uniform in [0,100) */
+static double dual_percent(unsigned long long *state)
+{
+	unsigned long long x = *state;
+	x ^= x >> 12;  x ^= x << 25;  x ^= x >> 27;
+	*state = x;
+	return (double)((x * 0x2545F4914F6CDD1DULL) >> 11) / 9007199254740992.0 * 100.0;
+}  /* dual_percent */
+
+
+/* Send 'num' messages on one line in as few calls as the system allows
+ * (one sendmmsg for the lot on Linux, unless the socket buffer fills),
+ * leaving out the ones -L drops.  Exits on error, like the main loop. */
+static void dual_send_batch(msend_opts *opts, msend_line *line, char **bufs, int *lens, int num,
+		unsigned long long *rng)
+{
+#if defined(__linux__)
+	struct mmsghdr msgs[MSEND_DUAL_BATCH];
+	struct iovec iovs[MSEND_DUAL_BATCH];
+	int n = 0, done = 0, rtn, i;
+
+	for (i = 0; i < num; ++i) {
+		if (line->loss > 0 && dual_percent(rng) < line->loss) {
+			++line->dropped;
+			continue;
+		}
+		iovs[n].iov_base = bufs[i];
+		iovs[n].iov_len = lens[i];
+		memset(&msgs[n], 0, sizeof(msgs[n]));
+		msgs[n].msg_hdr.msg_name = &line->sin;
+		msgs[n].msg_hdr.msg_namelen = sizeof(line->sin);
+		msgs[n].msg_hdr.msg_iov = &iovs[n];
+		msgs[n].msg_hdr.msg_iovlen = 1;
+		mt_ctr_add(&opts->ctrs, MSEND_CTR_BYTES, lens[i]);
+		++n;
+	}
+	while (done < n) {
+		++line->calls;
+		rtn = sendmmsg(line->sock, &msgs[done], n - done, 0);
+		if (rtn < 0) {
+			mprintf(opts, "ERROR: ");  perror(opts, "sendmmsg");
+			exit(1);
+		}
+		done += rtn;
+	}
+	line->datagrams += n;
+	mt_ctr_add(&opts->ctrs, MSEND_CTR_MSGS, n);
+#else
+	int i;
+
+	for (i = 0; i < num; ++i) {
+		if (line->loss > 0 && dual_percent(rng) < line->loss) {
+			++line->dropped;
+			continue;
+		}
+		++line->calls;
+		++line->datagrams;
+		send_or_die(opts, line->sock, bufs[i], lens[i], &line->sin);
+	}
+#endif
+}  /* dual_send_batch */
+
+
+/* Dual publishing (-A): the classic burst loop, but every message goes out
+ * on two lines with the same sequence number, MSEND_DUAL_BATCH at a time in
+ * one batched call per line, the second line o_skew_us after the first.
+ * 'echo' and 'stat' go on both lines.  'perf' (-E, else NULL) brackets the
+ * send loop.  Returns the number of messages sent (per line, including
+ * the ones dropped on purpose). */
+static int send_dual(msend_opts *opts, const char *buff, const char *cmdbuf, mt_perf *perf)
+{
+	msend_line lines[2];
+	SOCKET socks[2];
+	struct sockaddr_in dests[2];
+	char *bufs[MSEND_DUAL_BATCH], *data;
+	int lens[MSEND_DUAL_BATCH];
+	int max_len, slot_len, msg_num, burst_num, size_idx, num, i, j, first;
+	unsigned long long rng;
+	TLONGLONG start_ns, next_ns, first_ns, now_ns, skew_ns, max_skew_ns, sum_skew_ns, num_skews;
+	char statbuf[64];
+
+	memset(lines, 0, sizeof(lines));
+	lines[0].sin.sin_family = AF_INET;
+	lines[0].sin.sin_addr.s_addr = opts->groupaddr;
+	lines[0].sin.sin_port = htons(opts->groupport);
+	lines[0].iface = opts->bind_if;
+	parse_dual_line(opts, &lines[1]);
+	for (i = 0; i < 2; ++i) {
+		lines[i].sock = initialize_socket(opts, lines[i].iface);
+		lines[i].loss = opts->o_loss[i];
+		socks[i] = lines[i].sock;
+		dests[i] = lines[i].sin;
+	}
+
+	max_len = (opts->o_msg_len > 0) ? opts->o_msg_len : 32;
+	if (opts->o_sizes.num > 0) {
+		int min_size;  double mean_size;
+		sizedist_stats(&opts->o_sizes, &min_size, &mean_size, &max_len);
+	}
+	/* room for "Message %x" even when -m asks for less; only lens[] goes out */
+	slot_len = (max_len > 32) ? max_len : 32;
+	data = (char *)calloc(MSEND_DUAL_BATCH, slot_len);
+	if (data == NULL) {
+		mprintf(opts, "malloc failed\n");
+		exit(1);
+	}
+	for (i = 0; i < MSEND_DUAL_BATCH; ++i) {
+		bufs[i] = data + i * slot_len;
+		if (opts->o_Payload)
+			memcpy(bufs[i], buff, max_len);  /* -P, already decoded */
+	}
+
+	if (opts->o_quiet < 2) {
+		for (i = 0; i < 2; ++i)
+			printf("Line %c: %s:%d%s%s\n", 'A' + i, inet_ntoa(lines[i].sin.sin_addr),
+				ntohs(lines[i].sin.sin_port), lines[i].iface ? " via " : "",
+				lines[i].iface ? lines[i].iface : "");
+		printf("Line B sent %d us %s line A, %g%%/%g%% dropped on purpose\n",
+			(opts->o_skew_us < 0) ? -opts->o_skew_us : opts->o_skew_us,
+			(opts->o_skew_us < 0) ? "before" : "after", lines[0].loss, lines[1].loss);
+		fflush(stdout);
+	}
+
+	/* 1st msg on both lines: give network hardware time to establish mcast flow */
+	for (i = 0; i < 2; ++i)
+		send_or_die(opts, lines[i].sock, cmdbuf, strlen(cmdbuf)+1, &lines[i].sin);
+	if (opts->o_ready_num > 0)
+		wait_ready(opts, 2, socks, dests);
+	else
+		SLEEP_SEC(1);
+
+	first = (opts->o_skew_us < 0) ? 1 : 0;  /* line that goes first */
+	skew_ns = (TLONGLONG)((opts->o_skew_us < 0) ? -opts->o_skew_us : opts->o_skew_us) * 1000;
+	rng = (unsigned long long)mt_clock_ns() | 1;
+	max_skew_ns = sum_skew_ns = num_skews = 0;
+
+	if (perf != NULL)
+		mt_perf_start(perf);
+	burst_num = 0;
+	msg_num = 0;
+	size_idx = 0;
+	next_ns = start_ns = mt_clock_ns();
+	while (opts->o_num_bursts == 0 || burst_num < opts->o_num_bursts) {
+		if (opts->o_pause > 0 && msg_num > 0)
+			SLEEP_MSEC(opts->o_pause);
+
+		if (opts->o_quiet == 0) {
+			if (opts->o_burst_count == 1)
+				printf("Sending message %d on both lines\n", msg_num);
+			else
+				printf("Sending burst of %d msgs on both lines\n", opts->o_burst_count);
+		}
+		else if (opts->o_quiet == 1) {
+			printf(".");
+			fflush(stdout);
+		}
+
+		for (i = 0; i < opts->o_burst_count; i += num) {
+			num = opts->o_burst_count - i;
+			if (num > MSEND_DUAL_BATCH)
+				num = MSEND_DUAL_BATCH;
+			for (j = 0; j < num; ++j) {
+				char *buff = bufs[j];
+				lens[j] = opts->o_msg_len;
+				if (! opts->o_Payload) {
+					if (opts->o_decimal)
+						sprintf(buff,"Message %d",msg_num + j);
+					else
+						sprintf(buff,"Message %x",msg_num + j);
+					if (opts->o_msg_len == 0)
+						lens[j] = strlen(buff);
+				}
+				if (opts->o_sizes.num > 0) {
+					lens[j] = opts->o_sizes.sizes[size_idx];
+					if (opts->o_sizes.gaps_ns) {  /* -T: one message per burst */
+						next_ns += opts->o_sizes.gaps_ns[size_idx];
+						pace_until(next_ns);
+					}
+					if (++size_idx == opts->o_sizes.num)
+						size_idx = 0;
+				}
+			}
+
+			first_ns = mt_clock_ns();
+			dual_send_batch(opts, &lines[first], bufs, lens, num, &rng);
+			if (skew_ns > 0)
+				pace_until(first_ns + skew_ns);
+			now_ns = mt_clock_ns();  /* achieved skew, call to call */
+			if (now_ns - first_ns > max_skew_ns)
+				max_skew_ns = now_ns - first_ns;
+			sum_skew_ns += now_ns - first_ns;
+			++num_skews;
+			dual_send_batch(opts, &lines[1 - first], bufs, lens, num, &rng);
+			msg_num += num;
+		}
+
+		mt_ctr_add(&opts->ctrs, MSEND_CTR_BURSTS, 1);
+		++ burst_num;
+	}  /* while */
+
+	if (perf != NULL)
+		mt_perf_stop(perf);
+	if (opts->o_quiet < 2 && msg_num > 0) {
+		double elapsed = (mt_clock_ns() - start_ns) / 1e9;
+		printf("\nSent %d msgs on 2 lines in %.3f sec (%.0f msgs/sec per line), "
+			"line %c after line %c by %.1f us on average, %.1f us at most\n",
+			msg_num, elapsed, (elapsed > 0) ? msg_num / elapsed : 0.0,
+			'A' + (1 - first), 'A' + first,
+			(num_skews > 0) ? sum_skew_ns / 1e3 / num_skews : 0.0, max_skew_ns / 1e3);
+		for (i = 0; i < 2; ++i)
+			printf("  line %c: %llu datagrams sent, %llu dropped on purpose, %llu send calls\n",
+				'A' + i, lines[i].datagrams, lines[i].dropped, lines[i].calls);
+		fflush(stdout);
+	}
+
+	if (opts->o_stat_pause > 0) {
+		if (opts->o_quiet < 2)
+			printf("Pausing before sending 'stat'\n");
+		SLEEP_MSEC(opts->o_stat_pause);
+		if (opts->o_quiet < 2)
+			printf("Sending stat on both lines\n");
+		sprintf(statbuf, "stat %d", msg_num);
+		for (i = 0; i < 2; ++i)
+			send_or_die(opts, lines[i].sock, statbuf, strlen(statbuf), &lines[i].sin);
+	}
+
+	for (i = 0; i < 2; ++i)
+		CLOSESOCKET(lines[i].sock);
+	free(data);
+
+	return msg_num;
+}  /* send_dual */
+
+
 int main(int argc, char **argv)
 {
 	int opt;
 	int o_Sndbuf_set;
+	int o_rate_set;
 	int num_parms;
 	int test_num;
 	char equiv_cmd[1024];
@@ -116,19 +1181,21 @@ int main(int argc, char **argv)
 	SOCKET sock;
 	struct sockaddr_in sin;
 	struct timeval tv = {1,0};
-	unsigned int wttl;
 	int burst_num;  /* number of bursts so far */
 	int msg_num;  /* number of messages so far */
 	int send_len;  /* size of datagram to send */
-	int sz, default_sndbuf_sz, check_size, i;
+	int sz, default_sndbuf_sz, i;
 	int send_rtn;
-#if defined(_WIN32)
-	unsigned long int iface_in;
-#else
-	struct in_addr iface_in;
-#endif /* _WIN32 */
+	char *dash, *slash, *comma, *cp;
+	int size_idx;  /* position in the size table (-z / -T) */
+	TLONGLONG next_ns;  /* trace pacing (-T) */
+	TLONGLONG start_ns;
+	pkt_txring ring;  /* -B txring */
+	mt_transport xport;  /* -B socket / uring */
+	mt_perf perf;  /* -E */
     msend_opts opts;
-    memset(&opts, sizeof(opts), 0);
+    memset(&opts, 0, sizeof(opts));
+	memset(&xport, 0, sizeof(xport));  /* closed at the end even when not opened (-N, -R) */
 	opts.prog_name = argv[0];
 
 	buff = malloc(65536);
@@ -173,13 +1240,29 @@ int main(int argc, char **argv)
 	opts.o_Sndbuf_size = MIN_DEFAULT_SENDBUF_SIZE;  o_Sndbuf_set = 0;
 	opts.o_tcp = 0;  /* 0 for udp (multicast or unicast) */
 	opts.o_unicast_udp = 0;  /* 0 for multicast or tcp */
+	opts.o_msg_len_max = 0;  /* same as msg_len */
+	opts.o_streams = 0;  /* classic single-publisher mode */
+	opts.o_stream_groups = opts.o_stream_ports = opts.o_stream_socks = 1;
+	opts.o_rate = 10.0;  opts.o_rate_max = 0.0;  o_rate_set = 0;  /* msgs/sec per stream */
+	opts.o_size_spec = NULL;  /* fixed or sequence-number length */
+	opts.o_trace_file = NULL;
+	opts.o_replay_file = NULL;  opts.o_replay_speed = 1.0;
+	opts.o_replay_from_secs = 0.0;  opts.o_replay_from_seq = -1;
+	opts.o_backend = MSEND_BACKEND_SOCKET;  opts.o_backend_if = NULL;
+	opts.o_transport = MT_TRANSPORT_SOCKET;  opts.o_transport_flags = 0;
+	opts.o_counters = NULL;
+	opts.o_perf = 0;
+	opts.o_cap_num = 0;
+	opts.o_ready_num = 0;  opts.o_ready_ms = 5000;
+	opts.o_dual_line = NULL;  opts.o_skew_us = 0;
+	opts.o_loss[0] = opts.o_loss[1] = 0.0;
 
 	/* default values for optional positional parms. */
 	opts.ttlvar = 2;
 	opts.bind_if = NULL;
 
 	test_num = -1;
-	while ((opt = tgetopt(argc, argv, "12345b:dhl:m:n:p:P:qs:S:tu")) != EOF) {
+	while ((opt = tgetopt(argc, argv, "12345A:B:b:C:c:dEhK:L:l:m:N:n:p:P:qR:r:s:S:T:tuw:x:z:")) != EOF) {
 		switch (opt) {
 		  case '1':
 			test_num = 1;
@@ -236,9 +1319,48 @@ int main(int argc, char **argv)
 			opts.o_stat_pause = 2000;
 			opts.o_Sndbuf_size = default_sndbuf_sz;  o_Sndbuf_set = 0;
 			break;
+		  case 'A':
+			opts.o_dual_line = toptarg;
+			break;
+		  case 'K':
+			opts.o_skew_us = atoi(toptarg);
+			break;
+		  case 'L':
+			opts.o_loss[0] = opts.o_loss[1] = atof(toptarg);
+			comma = strchr(toptarg, ',');
+			if (comma != NULL)
+				opts.o_loss[1] = atof(comma+1);
+			if (opts.o_loss[0] < 0 || opts.o_loss[0] > 100 || opts.o_loss[1] < 0 || opts.o_loss[1] > 100) {
+				usage((&opts), "-L percentages must be 0 to 100");
+				exit(1);
+			}
+			break;
+		  case 'B':
+			if (strcmp(toptarg, "socket") == 0)
+				opts.o_backend = MSEND_BACKEND_SOCKET;
+			else if (strncmp(toptarg, "txring", 6) == 0 &&
+					(toptarg[6] == '\0' || toptarg[6] == ',')) {
+				opts.o_backend = MSEND_BACKEND_TXRING;
+				if (toptarg[6] == ',')
+					opts.o_backend_if = toptarg + 7;
+			}
+			else if (strncmp(toptarg, "uring", 5) == 0 &&
+					mt_transport_parse(toptarg, &opts.o_transport, &opts.o_transport_flags) == 0)
+				opts.o_backend = MSEND_BACKEND_URING;
+			else {
+				mprintf((&opts), "Error, unknown backend '%s'\n", toptarg);
+				exit(1);
+			}
+			break;
 		  case 'b':
 			opts.o_burst_count = atoi(toptarg);
 			break;
+		  case 'C':
+			opts.o_counters = toptarg;
+			break;
+		  case 'E':
+			opts.o_perf = 1;
+			break;
 		  case 'd':
 			opts.o_decimal = 1;
 			break;
@@ -254,6 +1376,33 @@ int main(int argc, char **argv)
 				opts.o_msg_len = 65536;
 				mprintf((&opts), "warning, msg_len lowered to 65536\n");
 			}
+			dash = strchr(toptarg, '-');
+			if (dash) {
+				opts.o_msg_len_max = atoi(dash+1);
+				if (opts.o_msg_len_max > 65536) {
+					opts.o_msg_len_max = 65536;
+					mprintf((&opts), "warning, max msg_len lowered to 65536\n");
+				}
+			}
+			break;
+		  case 'N':
+			opts.o_streams = atoi(toptarg);
+			slash = strchr(toptarg, '/');
+			if (slash) {
+				opts.o_stream_groups = atoi(slash+1);
+				slash = strchr(slash+1, '/');
+			}
+			if (slash) {
+				opts.o_stream_ports = atoi(slash+1);
+				slash = strchr(slash+1, '/');
+			}
+			if (slash)
+				opts.o_stream_socks = atoi(slash+1);
+			if (opts.o_streams < 1 || opts.o_stream_groups < 1 ||
+					opts.o_stream_ports < 1 || opts.o_stream_socks < 1) {
+				mprintf((&opts), "Error, -N values must be positive\n");
+				exit(1);
+			}
 			break;
 		  case 'n':
 			opts.o_num_bursts = atoi(toptarg);
@@ -261,6 +1410,44 @@ int main(int argc, char **argv)
 		  case 'p':
 			opts.o_pause = atoi(toptarg);
 			break;
+		  case 'c':
+			if (parse_capacity(&opts, toptarg) < 0)
+				exit(1);
+			break;
+		  case 'w':
+			opts.o_ready_num = atoi(toptarg);
+			slash = strchr(toptarg, '/');
+			if (slash)
+				opts.o_ready_ms = atoi(slash+1);
+			if (opts.o_ready_num <= 0 || opts.o_ready_num > MSEND_READY_MAX || opts.o_ready_ms <= 0) {
+				mprintf((&opts), "Error, -w needs 1 to %d receivers and a positive timeout\n", MSEND_READY_MAX);
+				exit(1);
+			}
+			break;
+		  case 'R':
+			opts.o_replay_file = toptarg;
+			if ((cp = strrchr(toptarg, '@')) != NULL || (cp = strrchr(toptarg, '#')) != NULL) {
+				char *end;
+				double from = strtod(cp + 1, &end);
+				if (end != cp + 1 && *end == '\0' && from >= 0) {  /* else part of the name */
+					if (*cp == '@')
+						opts.o_replay_from_secs = from;
+					else
+						opts.o_replay_from_seq = (int)strtol(cp + 1, NULL, 0);
+					*cp = '\0';
+				}
+			}
+			break;
+		  case 'r':
+			opts.o_rate = atof(toptarg);  o_rate_set = 1;
+			dash = strchr(toptarg, '-');
+			if (dash)
+				opts.o_rate_max = atof(dash+1);
+			if (opts.o_rate <= 0.0) {
+				mprintf((&opts), "Error, rate must be positive\n");
+				exit(1);
+			}
+			break;
 		  case 'P':
 			opts.o_msg_len = strlen(toptarg);
 			if (opts.o_msg_len > 65536) {
@@ -314,6 +1501,9 @@ int main(int argc, char **argv)
 		  case 'S':
 			opts.o_Sndbuf_size = atoi(toptarg);  o_Sndbuf_set = 1;
 			break;
+		  case 'T':
+			opts.o_trace_file = toptarg;
+			break;
 		  case 't':
 			if (opts.o_unicast_udp) {
 				mprintf((&opts), "Error, -t and -u are mutually exclusive\n");
@@ -328,6 +1518,16 @@ int main(int argc, char **argv)
 			}
 			opts.o_unicast_udp = 1;
 			break;
+		  case 'x':
+			opts.o_replay_speed = atof(toptarg);
+			if (opts.o_replay_speed < 0) {
+				mprintf((&opts), "Error, replay speed must not be negative\n");
+				exit(1);
+			}
+			break;
+		  case 'z':
+			opts.o_size_spec = toptarg;
+			break;
 		  default:
 			usage((&opts), "unrecognized option");
 			exit(1);
@@ -335,8 +1535,90 @@ int main(int argc, char **argv)
 		}  /* switch */
 	}  /* while opt */
 
+	if (opts.o_streams > 0 && (opts.o_tcp || opts.o_Payload)) {
+		usage((&opts), "-N is incompatible with -t and -P");
+		exit(1);
+	}
+
+	if (opts.o_replay_file && (opts.o_streams > 0 || opts.o_tcp || opts.o_Payload ||
+			opts.o_size_spec || opts.o_trace_file)) {
+		usage((&opts), "-R is incompatible with -N, -t, -P, -z and -T");
+		exit(1);
+	}
+
+	if (opts.o_backend != MSEND_BACKEND_SOCKET &&
+			(opts.o_streams > 0 || opts.o_tcp || opts.o_replay_file)) {
+		usage((&opts), "-B txring and -B uring are incompatible with -N, -t and -R");
+		exit(1);
+	}
+
+	if (opts.o_dual_line != NULL && (opts.o_backend != MSEND_BACKEND_SOCKET ||
+			opts.o_cap_num > 0 || opts.o_streams > 0 || opts.o_replay_file || opts.o_tcp)) {
+		usage((&opts), "-A is incompatible with -B, -c, -N, -R and -t");
+		exit(1);
+	}
+	if (opts.o_dual_line == NULL && (opts.o_skew_us != 0 || opts.o_loss[0] > 0 || opts.o_loss[1] > 0)) {
+		usage((&opts), "-K and -L need -A");
+		exit(1);
+	}
+
+	if (opts.o_ready_num > 0 && opts.o_tcp) {
+		usage((&opts), "-w is incompatible with -t");
+		exit(1);
+	}
+
+	if (opts.o_cap_num > 0) {
+		if (opts.o_backend != MSEND_BACKEND_SOCKET || opts.o_streams > 0 || opts.o_replay_file ||
+				opts.o_tcp || opts.o_size_spec || opts.o_trace_file) {
+			usage((&opts), "-c is incompatible with -B, -N, -R, -t, -z and -T");
+			exit(1);
+		}
+		if (! o_rate_set)
+			opts.o_rate = 1000.0;
+	}
+
+	/* precompute message sizes so nothing is drawn on the send path */
+	if (opts.o_size_spec || opts.o_trace_file) {
+		int min_size, max_size;
+		double mean_size;
+
+		if (opts.o_Payload || (opts.o_size_spec && opts.o_trace_file)) {
+			usage((&opts), "-z, -T and -P are mutually exclusive");
+			exit(1);
+		}
+		if (opts.o_size_spec) {
+			if (sizedist_build(&opts.o_sizes, opts.o_size_spec, SIZEDIST_TABLE_SIZE, 0) < 0)
+				exit(1);
+		}
+		else {
+			if (sizedist_load_trace(&opts.o_sizes, opts.o_trace_file) < 0)
+				exit(1);
+			/* the trace sets the pace: one message per "burst", no pause */
+			opts.o_burst_count = 1;
+			opts.o_pause = 0;
+			if (opts.o_num_bursts == 0)
+				opts.o_num_bursts = opts.o_sizes.num;
+		}
+		sizedist_stats(&opts.o_sizes, &min_size, &mean_size, &max_size);
+		if (opts.o_quiet < 2) {
+			printf("Message sizes from %s: %d entries, min %d, mean %.1f, max %d bytes\n",
+				opts.o_size_spec ? opts.o_size_spec : opts.o_trace_file,
+				opts.o_sizes.num, min_size, mean_size, max_size);
+			fflush(stdout);
+		}
+	}
+
 	/* prevent careless usage from killing the network */
-	if (opts.o_num_bursts == 0 && (opts.o_burst_count > 50 || opts.o_pause < 100)) {
+	if (opts.o_streams > 0) {
+		double total_rate = opts.o_streams * (opts.o_rate_max > opts.o_rate ?
+				(opts.o_rate + opts.o_rate_max) / 2 : opts.o_rate);
+		if (opts.o_num_bursts == 0 && total_rate > 1000.0) {
+			usage((&opts), "Danger - heavy traffic chosen with infinite messages per stream.\nUse -n to limit execution time");
+			exit(1);
+		}
+	}
+	else if (opts.o_replay_file == NULL && opts.o_cap_num == 0 &&
+			opts.o_num_bursts == 0 && (opts.o_burst_count > 50 || opts.o_pause < 100)) {
 		usage((&opts), "Danger - heavy traffic chosen with infinite num bursts.\nUse -n to limit execution time");
 		exit(1);
 	}
@@ -395,32 +1677,16 @@ int main(int argc, char **argv)
 	if (default_sndbuf_sz < MIN_DEFAULT_SENDBUF_SIZE && o_Sndbuf_set == 0)
 		mprintf((&opts), "NOTE: system default SO_SNDBUF only %d (%d preferred)\n", default_sndbuf_sz, MIN_DEFAULT_SENDBUF_SIZE);
 
-	if (opts.o_tcp) {
-		if((sock = socket(PF_INET,SOCK_STREAM,0)) == INVALID_SOCKET) {
-			mprintf((&opts), "ERROR: ");  perror((&opts), "socket");
-			exit(1);
-		}
-	} else {
-		if((sock = socket(PF_INET,SOCK_DGRAM,0)) == INVALID_SOCKET) {
-			mprintf((&opts), "ERROR: ");  perror((&opts), "socket");
-			exit(1);
-		}
-	}
+	sock = initialize_socket(&opts, opts.bind_if);
 
-	/* Try to set send buf size and check to see if it took */
-	if (setsockopt(sock,SOL_SOCKET,SO_SNDBUF,(const char *)&opts.o_Sndbuf_size,
-			sizeof(opts.o_Sndbuf_size)) == SOCKET_ERROR) {
-		mprintf((&opts), "WARNING: ");  perror((&opts), "setsockopt - SO_SNDBUF");
-	}
-	sz = sizeof(check_size);
-	if (getsockopt(sock,SOL_SOCKET,SO_SNDBUF,(char *)&check_size,
-			(socklen_t *)&sz) == SOCKET_ERROR) {
-		mprintf((&opts), "ERROR: ");  perror((&opts), "getsockopt - SO_SNDBUF");
-		exit(1);
-	}
-	if (check_size < opts.o_Sndbuf_size) {
-		mprintf((&opts), "WARNING: tried to set SO_SNDBUF to %d, only got %d\n",
-				opts.o_Sndbuf_size, check_size);
+	if (opts.o_perf)
+		mt_perf_open(&perf);
+	if (opts.o_counters) {
+		char label[64];
+		sprintf(label, "%s:%d", argv[toptind], opts.groupport);
+		if (mt_ctr_create(&opts.ctrs, opts.o_counters, "msend", label,
+				ctr_names, NULL, sizeof(ctr_names) / sizeof(ctr_names[0])) < 0)
+			exit(1);
 	}
 
 	memset((char *)&sin,0,sizeof(sin));
@@ -428,50 +1694,72 @@ int main(int argc, char **argv)
 	sin.sin_addr.s_addr = opts.groupaddr;
 	sin.sin_port = htons(opts.groupport);
 
-	if (! opts.o_unicast_udp && ! opts.o_tcp) {
-#if defined(_WIN32)
-		wttl = opts.ttlvar;
-		if (setsockopt(sock,IPPROTO_IP,IP_MULTICAST_TTL,(char *)&wttl,
-					sizeof(wttl)) == SOCKET_ERROR) {
-			mprintf((&opts), "ERROR: ");  perror((&opts), "setsockopt - TTL");
-			exit(1);
-		}
-#else
-		if (setsockopt(sock,IPPROTO_IP,IP_MULTICAST_TTL,(char *)&opts.ttlvar,
-					sizeof(opts.ttlvar)) == SOCKET_ERROR) {
-			mprintf((&opts), "ERROR: ");  perror((&opts), "setsockopt - TTL");
+	if (opts.o_tcp) {
+		if((connect(sock,(struct sockaddr *)&sin,sizeof(sin))) == INVALID_SOCKET) {
+			mprintf((&opts), "ERROR: ");  perror((&opts), "connect");
 			exit(1);
 		}
-#endif /* _WIN32 */
 	}
 
-	if (opts.bind_if != NULL) {
-#if !defined(_WIN32)
-		memset((char *)&iface_in,0,sizeof(iface_in));
-		iface_in.s_addr = inet_addr(opts.bind_if);
-#else
-		iface_in = inet_addr(opts.bind_if);
-#endif /* !_WIN32 */
-		if(setsockopt(sock, IPPROTO_IP, IP_MULTICAST_IF, (const char*)&iface_in,
-				sizeof(iface_in)) == SOCKET_ERROR) {
-			mprintf((&opts), "ERROR: ");  perror((&opts), "setsockopt - IP_MULTICAST_IF");
+	if (opts.o_backend == MSEND_BACKEND_TXRING) {
+		/* bind the UDP socket so the ring's frames share its source port
+		 * (the socket still carries the 'echo' and 'stat' messages) */
+		struct sockaddr_in src;
+		int max_len = opts.o_msg_len;
+
+		memset((char *)&src,0,sizeof(src));
+		src.sin_family = AF_INET;
+		src.sin_addr.s_addr = (opts.bind_if != NULL) ? inet_addr(opts.bind_if) : htonl(INADDR_ANY);
+		if (bind(sock,(struct sockaddr *)&src,sizeof(src)) == SOCKET_ERROR) {
+			mprintf((&opts), "ERROR: ");  perror((&opts), "bind");
+			exit(1);
+		}
+		sz = sizeof(src);
+		if (getsockname(sock,(struct sockaddr *)&src,(socklen_t *)&sz) == SOCKET_ERROR) {
+			mprintf((&opts), "ERROR: ");  perror((&opts), "getsockname");
 			exit(1);
 		}
+		if (opts.o_sizes.num > 0) {
+			int min_size;  double mean_size;
+			sizedist_stats(&opts.o_sizes, &min_size, &mean_size, &max_len);
+		}
+		if (pktring_tx_open(&ring, opts.o_backend_if, &src, &sin,
+				opts.o_unicast_udp ? 64 : opts.ttlvar,
+				opts.o_Payload ? buff : NULL, max_len, opts.o_decimal) < 0)
+			exit(1);
+		if (opts.o_quiet < 2) {
+			printf("TX ring on %s: %d frames of %d bytes, kick every %d frames\n",
+				ring.ifname, ring.frame_nr, ring.frame_size, PKTRING_BATCH);
+			fflush(stdout);
+		}
 	}
+	else if (opts.o_streams == 0 && opts.o_replay_file == NULL && opts.o_dual_line == NULL) {
+		int max_len = (opts.o_msg_len > 0) ? opts.o_msg_len : 32;
 
-	if (opts.o_tcp) {
-		if((connect(sock,(struct sockaddr *)&sin,sizeof(sin))) == INVALID_SOCKET) {
-			mprintf((&opts), "ERROR: ");  perror((&opts), "connect");
-			exit(1);
+		if (opts.o_sizes.num > 0) {
+			int min_size;  double mean_size;
+			sizedist_stats(&opts.o_sizes, &min_size, &mean_size, &max_len);
 		}
+		if (mt_transport_open(&xport, opts.o_transport, opts.o_transport_flags, sock,
+				max_len, 0) < 0)
+			exit(1);
 	}
 
 
 /* Loop the test "opts.o_loops" times (-l option) */
 MAIN_LOOP:
 
-	if (opts.o_num_bursts != 0) {
-		if (opts.o_msg_len == 0) {
+	if (opts.o_num_bursts != 0 && opts.o_streams == 0 && opts.o_replay_file == NULL &&
+			opts.o_cap_num == 0) {
+		if (opts.o_sizes.num > 0) {
+			if (opts.o_quiet < 2) {
+				printf("Sending %d bursts of %d messages, sizes from %s\n",
+					opts.o_num_bursts, opts.o_burst_count,
+					opts.o_size_spec ? opts.o_size_spec : opts.o_trace_file);
+				fflush(stdout);
+			}
+		}
+		else if (opts.o_msg_len == 0) {
 			if (opts.o_quiet < 2) {
 				printf("Sending %d bursts of %d variable-length messages\n",
 					opts.o_num_bursts, opts.o_burst_count);
@@ -492,6 +1780,48 @@ MAIN_LOOP:
 		sprintf(cmdbuf, "echo test %d, sender equiv cmd %s", test_num, equiv_cmd);
 	else
 		sprintf(cmdbuf, "echo sender equiv cmd: %s", equiv_cmd);
+
+	if (opts.o_streams > 0) {
+		if (opts.o_quiet < 2) {
+			printf("Sending %d streams over %d groups, %d ports and %d sockets\n",
+				opts.o_streams, opts.o_stream_groups, opts.o_stream_ports, opts.o_stream_socks);
+			fflush(stdout);
+		}
+		msg_num = send_streams(&opts, buff, cmdbuf, opts.o_perf ? &perf : NULL);
+		if (opts.o_perf) {
+			mt_perf_report(&perf, stdout, "Send loop", msg_num, "message");
+			fflush(stdout);
+		}
+		if (opts.o_quiet < 2)
+			printf("%d messages sent%s\n", msg_num,
+				(opts.o_stat_pause > 0) ? " (not including 'stat')" : "");
+		goto NEXT_LOOP;
+	}
+
+	if (opts.o_dual_line != NULL) {
+		msg_num = send_dual(&opts, buff, cmdbuf, opts.o_perf ? &perf : NULL);
+		if (opts.o_perf) {
+			mt_perf_report(&perf, stdout, "Send loop", msg_num, "message");
+			fflush(stdout);
+		}
+		if (opts.o_quiet < 2)
+			printf("%d messages sent on each line%s\n", msg_num,
+				(opts.o_stat_pause > 0) ? " (not including 'stat')" : "");
+		goto NEXT_LOOP;
+	}
+
+	if (opts.o_cap_num > 0) {
+		if (opts.o_quiet < 2) {
+			printf("Capacity search: %d size%s, at most %g%% loss, %d ms steps\n",
+				opts.o_cap_num, (opts.o_cap_num == 1) ? "" : "s", opts.o_cap_loss, opts.o_cap_step_ms);
+			fflush(stdout);
+		}
+		if (opts.o_ready_num > 0)
+			wait_ready(&opts, 1, &sock, &sin);
+		capacity_search(&opts, sock, &sin, buff);
+		goto NEXT_LOOP;
+	}
+
 	if (opts.o_tcp) {
 		send_rtn = send(sock,cmdbuf,strlen(cmdbuf)+1,0);
 	} else {
@@ -501,10 +1831,29 @@ MAIN_LOOP:
 		mprintf((&opts), "ERROR: ");  perror((&opts), "send");
 		exit(1);
 	}
-	SLEEP_SEC(1);
+	if (opts.o_ready_num > 0)
+		wait_ready(&opts, 1, &sock, &sin);
+	else
+		SLEEP_SEC(1);
+
+	if (opts.o_perf)
+		mt_perf_start(&perf);
+	if (opts.o_replay_file) {
+		if (opts.o_quiet < 2) {
+			printf("Replaying %s at %s\n", opts.o_replay_file,
+				(opts.o_replay_speed > 0) ? "capture timing" : "full speed");
+			fflush(stdout);
+		}
+		msg_num = replay_capture(&opts, sock, &sin);
+		if (opts.o_perf)
+			mt_perf_stop(&perf);
+		goto SEND_STAT;
+	}
 
 	burst_num = 0;
 	msg_num = 0;
+	size_idx = 0;
+	next_ns = start_ns = mt_clock_ns();
 	while (opts.o_num_bursts == 0 || burst_num < opts.o_num_bursts) {
 		if (opts.o_pause > 0 && msg_num > 0)
 			SLEEP_MSEC(opts.o_pause);
@@ -512,7 +1861,11 @@ MAIN_LOOP:
 		/* send burst */
 		for (i = 0; i < opts.o_burst_count; ++i) {
 			send_len = opts.o_msg_len;
-			if (! opts.o_Payload) {
+			if (opts.o_backend == MSEND_BACKEND_TXRING) {
+				if (send_len == 0)
+					send_len = ring.prefix_len;  /* frames hold the number */
+			}
+			else if (! opts.o_Payload) {
 				if (opts.o_decimal)
 					sprintf(buff,"Message %d",msg_num);
 				else
@@ -520,6 +1873,15 @@ MAIN_LOOP:
 				if (opts.o_msg_len == 0)
 					send_len = strlen(buff);
 			}
+			if (opts.o_sizes.num > 0) {
+				send_len = opts.o_sizes.sizes[size_idx];
+				if (opts.o_sizes.gaps_ns) {
+					next_ns += opts.o_sizes.gaps_ns[size_idx];
+					pace_until(next_ns);
+				}
+				if (++size_idx == opts.o_sizes.num)
+					size_idx = 0;
+			}
 
 			if (i == 0) {  /* first msg in batch */
 				if (opts.o_quiet == 0) {  /* not quiet */
@@ -536,23 +1898,56 @@ MAIN_LOOP:
 				/* else opts.o_quiet > 1; very quiet */
 			}
 
-			send_rtn = sendto(sock,buff,send_len,0,(struct sockaddr *)&sin,sizeof(sin));
-			if (send_rtn == SOCKET_ERROR) {
-				mprintf((&opts), "ERROR: ");  perror((&opts), "send");
-				exit(1);
+			if (opts.o_backend == MSEND_BACKEND_TXRING) {
+				if (pktring_tx_send(&ring, send_len, (unsigned int)msg_num) < 0)
+					exit(1);
 			}
-			else if (send_rtn != send_len) {
-				mprintf((&opts), "ERROR: sendto returned %d, expected %d\n",
-						send_rtn, send_len);
+			else if (mt_transport_send(&xport, buff, send_len, &sin) < 0) {
+				mprintf((&opts), "ERROR: ");  perror((&opts), "send");
 				exit(1);
 			}
 
+			mt_ctr_add(&opts.ctrs, MSEND_CTR_MSGS, 1);
+			mt_ctr_add(&opts.ctrs, MSEND_CTR_BYTES, send_len);
 			++msg_num;
 		}  /* for i */
 
+		if (opts.o_backend == MSEND_BACKEND_TXRING && pktring_tx_flush(&ring, 0) < 0)
+			exit(1);
+		if (opts.o_backend != MSEND_BACKEND_TXRING && mt_transport_flush(&xport, 0) < 0) {
+			mprintf((&opts), "ERROR: ");  perror((&opts), "send");
+			exit(1);
+		}
+		mt_ctr_add(&opts.ctrs, MSEND_CTR_BURSTS, 1);
 		++ burst_num;
 	}  /* while */
 
+	if (opts.o_backend == MSEND_BACKEND_TXRING && pktring_tx_flush(&ring, 1) < 0)
+		exit(1);
+	if (opts.o_backend != MSEND_BACKEND_TXRING && mt_transport_flush(&xport, 1) < 0) {
+		mprintf((&opts), "ERROR: ");  perror((&opts), "send");
+		exit(1);
+	}
+	if (opts.o_perf)
+		mt_perf_stop(&perf);
+	if (opts.o_quiet < 2 && msg_num > 0) {
+		double elapsed = (mt_clock_ns() - start_ns) / 1e9;
+		printf("\nSent %d msgs in %.3f sec (%.0f msgs/sec) via %s backend",
+			msg_num, elapsed, (elapsed > 0) ? msg_num / elapsed : 0.0,
+			backend_names[opts.o_backend]);
+		if (opts.o_backend == MSEND_BACKEND_TXRING)
+			printf(", %llu kicks", ring.kicks);
+		printf("\n");
+		if (opts.o_backend != MSEND_BACKEND_TXRING)
+			mt_transport_report(&xport, stdout);
+		fflush(stdout);
+	}
+
+SEND_STAT:
+	if (opts.o_perf) {
+		mt_perf_report(&perf, stdout, "Send loop", msg_num, "message");
+		fflush(stdout);
+	}
 	if (opts.o_stat_pause > 0) {
 		/* send 'stat' message */
 		if (opts.o_quiet < 2)
@@ -581,12 +1976,21 @@ MAIN_LOOP:
 			printf("%d messages sent\n", msg_num);
 	}
 
+NEXT_LOOP:
 	/* Loop the test "opts.o_loops" times (-l option) */
 	-- opts.o_loops;
 	if (opts.o_loops > 0) goto MAIN_LOOP;
 
 
+	if (opts.o_backend == MSEND_BACKEND_TXRING)
+		pktring_tx_close(&ring);
+	else
+		mt_transport_close(&xport);
 	CLOSESOCKET(sock);
+	sizedist_free(&opts.o_sizes);
+	mt_ctr_close(&opts.ctrs);
+	if (opts.o_perf)
+		mt_perf_close(&perf);
 
 	return(0);
 }  /* main */
@@ -0,0 +1,270 @@
+/* mstat.c */
+/*   Program to watch the live counters of running msend, mdump, mpong and
+ * mrelay instances (started with -C name): totals, change and rate per
+ * interval.
+ * See https://community.informatica.com/solutions/1470 for more info.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted without restriction.
+ *
+ THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+ EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+ NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+ PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+ UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+ BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+ INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+ TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+ THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+#include "mtools.h"
+
+#include <stdarg.h>
+
+#define MSTAT_MAX_INSTANCES 64
+
+typedef struct mstat_options {
+    /* program name (from argv[0] */
+    char *prog_name;
+
+    /* program options */
+    int o_interval_ms;
+    int o_count;
+    FILE *o_output;
+} mstat_options;
+
+/* what was seen of one instance at the previous interval */
+typedef struct mstat_instance {
+    char name[80];
+    int pid;
+    TLONGLONG start_ns;
+    TLONGLONG prev_ns;  /* 0 = not seen yet */
+    unsigned long long prev[MT_CTR_MAX];
+} mstat_instance;
+
+
+static const char usage_str[] = "[-h] [-i interval_ms] [-n count] [-o ofile] [name ...]";
+
+void usage(mstat_options *opts, char *msg)
+{
+	if (msg != NULL)
+		fprintf(stderr, "\n%s\n\n", msg);
+	fprintf(stderr, "Usage: %s %s\n\n"
+			"(use -h for detailed help)\n",
+			opts->prog_name, usage_str);
+}  /* usage */
+
+
+void help(mstat_options *opts, char *msg)
+{
+	if (msg != NULL)
+		fprintf(stderr, "\n%s\n\n", msg);
+	fprintf(stderr, "Usage: %s %s\n", opts->prog_name, usage_str);
+	fprintf(stderr, "Where:\n"
+			"  -h : help\n"
+			"  -i interval_ms : time between displays [1000]\n"
+			"  -n count : number of displays (0=until interrupted) [0]\n"
+			"  -o ofile : print results to file (in addition to stdout)\n"
+			"\n"
+			"  name : instance to watch, as given to 'msend/mdump/mpong/mrelay -C name'\n"
+			"         [all running instances; Windows needs the names]\n"
+			"\n"
+			"For each counter: the total, the change since the last display and the\n"
+			"rate per second (levels such as buffer sizes are shown as they are).\n"
+	);
+}  /* help */
+
+
+/* the display goes to stdout (and -o ofile), not stderr like mprintf */
+static void display(mstat_options *opts, const char *format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	vprintf(format, ap);
+	va_end(ap);
+	if (opts->o_output) {
+		va_start(ap, format);
+		vfprintf(opts->o_output, format, ap);
+		va_end(ap);
+	}
+}  /* display */
+
+
+static int pid_alive(int pid)
+{
+#if defined(_WIN32)
+	HANDLE h = OpenProcess(SYNCHRONIZE, FALSE, (DWORD)pid);
+	DWORD rtn;
+	if (h == NULL)
+		return 0;
+	rtn = WaitForSingleObject(h, 0);
+	CloseHandle(h);
+	return rtn == WAIT_TIMEOUT;
+#else
+	return kill(pid, 0) == 0 || errno == EPERM;
+#endif
+}  /* pid_alive */
+
+
+/* Print one instance and remember its values for the next interval.  The
+ * segment is mapped afresh each time, so a restarted instance is seen. */
+static void show_instance(mstat_options *opts, mstat_instance *inst, TLONGLONG now_ns)
+{
+	mt_counters c;
+	mt_ctr_block *blk;
+	unsigned long long vals[MT_CTR_MAX];
+	double secs;
+	int i, num;
+
+	if (mt_ctr_attach(&c, inst->name) < 0) {
+		display(opts, "%s: not found\n", inst->name);
+		inst->prev_ns = 0;
+		return;
+	}
+	blk = c.blk;
+	num = (blk->num_ctrs <= MT_CTR_MAX) ? blk->num_ctrs : MT_CTR_MAX;
+	for (i = 0; i < num; ++i)
+		vals[i] = blk->vals[i];
+
+	if (blk->pid != inst->pid || blk->start_ns != inst->start_ns) {  /* new (or restarted) */
+		inst->pid = blk->pid;
+		inst->start_ns = blk->start_ns;
+		inst->prev_ns = 0;
+	}
+	secs = (inst->prev_ns != 0) ? (now_ns - inst->prev_ns) / 1e9 : 0;
+
+	display(opts, "%s: %s %s (pid %d, up %.1f s)%s\n", inst->name, blk->tool, blk->label,
+		blk->pid, (now_ns - blk->start_ns) / 1e9, pid_alive(blk->pid) ? "" : " EXITED");
+	for (i = 0; i < num; ++i) {
+		if (blk->flags[i] & MT_CTR_GAUGE)
+			display(opts, "  %-24s %16llu\n", blk->names[i], vals[i]);
+		else if (secs > 0)
+			display(opts, "  %-24s %16llu %+14lld %14.1f/s\n", blk->names[i], vals[i],
+				(long long)(vals[i] - inst->prev[i]), (vals[i] - inst->prev[i]) / secs);
+		else
+			display(opts, "  %-24s %16llu\n", blk->names[i], vals[i]);
+		inst->prev[i] = vals[i];
+	}
+	inst->prev_ns = now_ns;
+	mt_ctr_close(&c);
+}  /* show_instance */
+
+
+int main(int argc, char **argv)
+{
+	mstat_options opts;
+	static mstat_instance insts[MSTAT_MAX_INSTANCES];
+	static char names[MSTAT_MAX_INSTANCES][80];
+	int opt, num_insts = 0, num_names, i, j, shown;
+	TLONGLONG next_ns;
+
+	memset(&opts, 0, sizeof(opts));
+	opts.prog_name = argv[0];
+
+	/* default values for options */
+	opts.o_interval_ms = 1000;
+	opts.o_count = 0;
+	opts.o_output = NULL;
+
+	while ((opt = tgetopt(argc, argv, "hi:n:o:")) != EOF) {
+		switch (opt) {
+		  case 'h':
+			help(&opts, NULL);  exit(0);
+			break;
+		  case 'i':
+			opts.o_interval_ms = atoi(toptarg);
+			if (opts.o_interval_ms <= 0) {
+				usage(&opts, "-i must be positive");
+				exit(1);
+			}
+			break;
+		  case 'n':
+			opts.o_count = atoi(toptarg);
+			break;
+		  case 'o':
+			opts.o_output = fopen(toptarg, "w");
+			if (opts.o_output == NULL) {
+				mprintf((&opts), "ERROR: ");  perror((&opts), "fopen");
+				exit(1);
+			}
+			break;
+		  default:
+			usage(&opts, "unrecognized option");
+			exit(1);
+			break;
+		}  /* switch */
+	}  /* while opt */
+
+	/* named instances are watched throughout, otherwise whatever is running */
+	for (i = toptind; i < argc && num_insts < MSTAT_MAX_INSTANCES; ++i) {
+		if (strlen(argv[i]) >= sizeof(insts[0].name)) {
+			usage(&opts, "instance name too long");
+			exit(1);
+		}
+		strcpy(insts[num_insts++].name, argv[i]);
+	}
+	if (num_insts == 0 && mt_ctr_list(names, 0) < 0) {
+		usage(&opts, "name the instances to watch (they cannot be listed here)");
+		exit(1);
+	}
+
+	next_ns = mt_clock_ns();
+	for (shown = 0; opts.o_count == 0 || shown < opts.o_count; ++shown) {
+		TLONGLONG now_ns;
+		time_t secs;
+		char timestr[32];
+
+		if (shown > 0) {
+			next_ns += (TLONGLONG)opts.o_interval_ms * 1000000;
+			now_ns = mt_clock_ns();
+			if (next_ns > now_ns)
+				SLEEP_USEC((unsigned int)((next_ns - now_ns) / 1000));
+		}
+
+		if (argc == toptind) {  /* follow instances as they come and go */
+			num_names = mt_ctr_list(names, MSTAT_MAX_INSTANCES);
+			for (i = 0; i < num_insts; ) {  /* drop the ones gone */
+				for (j = 0; j < num_names && strcmp(names[j], insts[i].name) != 0; ++j)
+					;
+				if (j == num_names)
+					insts[i] = insts[--num_insts];
+				else
+					++i;
+			}
+			for (j = 0; j < num_names; ++j) {  /* add the new ones */
+				for (i = 0; i < num_insts && strcmp(names[j], insts[i].name) != 0; ++i)
+					;
+				if (i == num_insts && num_insts < MSTAT_MAX_INSTANCES) {
+					memset(&insts[num_insts], 0, sizeof(insts[0]));
+					strcpy(insts[num_insts++].name, names[j]);
+				}
+			}
+		}
+
+#if defined(_WIN32)
+		{
+			struct __timeb32 tb;
+			_ftime32(&tb);
+			secs = tb.time;
+		}
+#else
+		{
+			struct timeval tv;
+			gettimeofday(&tv, NULL);
+			secs = tv.tv_sec;
+		}
+#endif
+		strftime(timestr, sizeof(timestr), "%H:%M:%S", localtime(&secs));
+		display(&opts, "--- %s, %d instance%s\n", timestr, num_insts, (num_insts == 1) ? "" : "s");
+		now_ns = mt_clock_ns();
+		for (i = 0; i < num_insts; ++i)
+			show_instance(&opts, &insts[i], now_ns);
+		fflush(stdout);
+		if (opts.o_output)
+			fflush(opts.o_output);
+	}
+
+	return(0);
+}  /* main */
@@ -40,9 +40,10 @@ extern int toptreset;
 extern char *toptarg;
 extern int tgetopt(int nargc, char * const *nargv, const char *ostr);
 
-#define mprintf(opts, format, ...)                                \
-    fprintf(stderr, format, __VA_ARGS__);  fflush(stderr);         \
-    if(opts && opts->o_output) { fprintf(opts->o_output, format, __VA_ARGS__); fflush(opts->o_output); }
+#define mprintf(opts, format, ...) do {                           \
+    fprintf(stderr, format, ##__VA_ARGS__);  fflush(stderr);         \
+    if(opts && opts->o_output) { fprintf(opts->o_output, format, ##__VA_ARGS__); fflush(opts->o_output); } \
+    } while (0)
 
 
 #if defined(_MSC_VER)
@@ -51,6 +52,7 @@ extern int tgetopt(int nargc, char * const *nargv, const char *ostr);
 
 #define SLEEP_SEC(s) Sleep((s) * 1000)
 #define SLEEP_MSEC(s) Sleep(s)
+#define SLEEP_USEC(s) Sleep((s) / 1000)
 #define CLOSESOCKET closesocket
 #define TLONGLONG signed __int64
 
@@ -67,6 +69,7 @@ extern int tgetopt(int nargc, char * const *nargv, const char *ostr);
 #include <pthread.h>
 #define SLEEP_SEC(s) sleep(s)
 #define SLEEP_MSEC(s) usleep((s) * 1000)
+#define SLEEP_USEC(s) usleep(s)
 #define CLOSESOCKET close
 #define SOCKET int
 #define INVALID_SOCKET -1
@@ -81,6 +84,7 @@ extern int tgetopt(int nargc, char * const *nargv, const char *ostr);
 #   define perror(opts, x) mprintf(opts, "%s: %d\n",x,GetLastError())
 #else
 #   include <sys/time.h>
+#   define perror(opts, x) mprintf(opts, "%s: %s\n",x,strerror(errno))
 #endif
 
 #include <string.h>
@@ -118,6 +122,33 @@ extern int tgetopt(int nargc, char * const *nargv, const char *ostr);
 
 #endif
 
+#if defined(_MSC_VER)
+#define MT_INLINE __inline
+#else
+#define MT_INLINE inline
+#endif
+
+/* Monotonic clock in nanoseconds, used for pacing and interval measurement
+ * (unlike gettimeofday(), it does not jump when the wall clock is set). */
+static MT_INLINE TLONGLONG mt_clock_ns(void)
+{
+#if defined(_WIN32)
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER ticks;
+
+	if (freq.QuadPart == 0)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&ticks);
+	return (TLONGLONG)(ticks.QuadPart / freq.QuadPart) * 1000000000 +
+		(TLONGLONG)(ticks.QuadPart % freq.QuadPart) * 1000000000 / freq.QuadPart;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (TLONGLONG)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}  /* mt_clock_ns */
+
 extern int udp_set_url(struct sockaddr_storage *addr, const char *hostname, int port);
 extern struct addrinfo* udp_resolve_host(const char *hostname, int port, int type, int family, int flags);
 extern int udp_join_multicast_group(int sockfd, struct sockaddr *addr);
@@ -125,5 +156,542 @@ extern int udp_set_multicast_sources(int sockfd, struct sockaddr *addr,
                                      int addr_len, char **sources,
                                      int nb_sources, int include);
 
+/* Hierarchical timer wheel (twheel.c).  TW_LEVELS wheels of TW_SLOTS slots
+ * each; a timer is filed in the lowest wheel whose span covers its delay and
+ * cascades down as the wheel turns, so adding and expiring a timer are both
+ * O(1).  Timers are intrusive: embed a tw_timer in the scheduled object. */
+#define TW_BITS 8
+#define TW_SLOTS (1 << TW_BITS)
+#define TW_LEVELS 4
+
+typedef struct tw_timer {
+    struct tw_timer *next, *prev;
+    TLONGLONG expires;  /* absolute tick */
+    int level;  /* wheel holding the timer (-1 when due or idle) */
+} tw_timer;
+
+typedef struct tw_wheel {
+    TLONGLONG now;  /* next tick to be processed */
+    int count;  /* timers scheduled (including due ones not yet popped) */
+    unsigned int occupied[TW_LEVELS][TW_SLOTS / 32];  /* non-empty slots */
+    tw_timer slots[TW_LEVELS][TW_SLOTS];  /* list heads */
+    tw_timer due;  /* expired timers, in expiry order */
+} tw_wheel;
+
+extern void tw_init(tw_wheel *w, TLONGLONG now);
+extern void tw_add(tw_wheel *w, tw_timer *t, TLONGLONG expires);
+extern void tw_del(tw_wheel *w, tw_timer *t);
+extern void tw_advance(tw_wheel *w, TLONGLONG now);
+extern tw_timer *tw_pop(tw_wheel *w);
+extern TLONGLONG tw_next_tick(tw_wheel *w);
+
+/* Precomputed message sizes (sizedist.c), either drawn from a distribution
+ * or loaded, with the inter-send gaps, from a recorded trace. */
+#define SIZEDIST_MIN_SIZE 1
+#define SIZEDIST_MAX_SIZE 65507  /* largest IPv4 UDP payload */
+#define SIZEDIST_TABLE_SIZE 65536
+
+typedef struct size_table {
+    int *sizes;
+    TLONGLONG *gaps_ns;  /* trace only: gap before each message, else NULL */
+    int num;
+} size_table;
+
+extern int sizedist_build(size_table *tbl, const char *spec, int num_entries, unsigned long long seed);
+extern int sizedist_load_trace(size_table *tbl, const char *file);
+extern void sizedist_stats(const size_table *tbl, int *min_size, double *mean_size, int *max_size);
+extern void sizedist_free(size_table *tbl);
+
+/* Framed captures (capture.c).  "mcap" is mdump's native format: a file
+ * header followed by records, each a header plus payload padded to
+ * MCAP_ALIGN bytes.  Fields are in host byte order except addresses and
+ * ports, which are in network order as in a sockaddr_in.
+ *   With MCAP_F_BLOCKS (version 2, 'mdump -O'), the records are grouped in
+ * blocks of block_size bytes: block k starts at offset k * block_size
+ * (block 0 just after the file header) with an mcap_blk_hdr, and no record
+ * crosses a block.  When the file was closed cleanly it ends with an index,
+ * one mcap_idx_ent per block, and an mcap_trailer pointing to it, so a
+ * reader can find a time or sequence number by binary search.
+ *   With MCAP_F_PACKED as well (version 3, 'mdump -R lz4' or 'zstd'), each
+ * block is stored as an mcap_pblk_hdr followed by its records compressed
+ * on their own as one lz4 or zstd frame, padded to MCAP_ALIGN; the next
+ * block follows directly, and the index points at the mcap_pblk_hdrs.
+ * Compression needs HAVE_LZ4 / HAVE_ZSTD at build time (and -llz4 /
+ * -lzstd), for writing and reading alike. */
+#define MCAP_MAGIC "MCAP"
+#define MCAP_BLK_MAGIC "MBLK"
+#define MCAP_IDX_MAGIC "MIDX"
+#define MCAP_PBLK_MAGIC "MPBK"
+#define MCAP_VERSION 3  /* the highest read; written only with MCAP_F_PACKED */
+#define MCAP_ALIGN 8
+#define MCAP_REC_SIZE(len) ((sizeof(mcap_rec_hdr) + (len) + MCAP_ALIGN - 1) & ~((size_t)MCAP_ALIGN - 1))
+#define MCAP_F_BLOCKS 1  /* file header flags */
+#define MCAP_F_PACKED 2
+#define MCAP_CODEC_NONE 0  /* stored as it is */
+#define MCAP_CODEC_LZ4 1
+#define MCAP_CODEC_ZSTD 2
+#define MCAP_NO_SEQ -1  /* record seq: none (not an msend message) */
+
+typedef struct mcap_file_hdr {
+    char magic[4];  /* MCAP_MAGIC */
+    unsigned short version;
+    unsigned short hdr_len;  /* offset of the first record */
+    unsigned int flags;
+    unsigned int group_addr;
+    unsigned short group_port;
+    unsigned short codec;  /* MCAP_F_PACKED: MCAP_CODEC_xxx */
+    unsigned int block_size;  /* MCAP_F_BLOCKS */
+    TLONGLONG reserved3;
+} mcap_file_hdr;
+
+typedef struct mcap_blk_hdr {
+    char magic[4];  /* MCAP_BLK_MAGIC */
+    unsigned int len;  /* bytes used, this header included */
+    unsigned int num_recs;
+    int seq_hi;  /* highest record seq, MCAP_NO_SEQ if none */
+    TLONGLONG first_ns;  /* arrival of the first record */
+    TLONGLONG last_ns;  /* and of the latest */
+} mcap_blk_hdr;
+
+typedef struct mcap_pblk_hdr {
+    mcap_blk_hdr blk;  /* magic MCAP_PBLK_MAGIC; len as decompressed */
+    unsigned int packed_len;  /* bytes following (then padding) */
+    unsigned int codec;  /* MCAP_CODEC_xxx: the file's, or NONE */
+} mcap_pblk_hdr;
+
+typedef struct mcap_idx_ent {
+    TLONGLONG off;  /* of the block header */
+    TLONGLONG first_ns;
+    TLONGLONG ns_hi;  /* latest arrival in this block or any before it */
+    int seq_hi;  /* highest seq in this block or any before it */
+    unsigned int num_recs;
+} mcap_idx_ent;
+
+typedef struct mcap_trailer {  /* the last bytes of an indexed file */
+    char magic[4];  /* MCAP_IDX_MAGIC */
+    unsigned int num_ents;
+    TLONGLONG idx_off;  /* of the first mcap_idx_ent */
+} mcap_trailer;
+
+typedef struct mcap_rec_hdr {
+    unsigned int len;  /* payload bytes following the header */
+    int seq;  /* msend sequence number (version 2), or MCAP_NO_SEQ */
+    TLONGLONG ts_ns;  /* arrival time, ns since the epoch */
+    unsigned int src_addr;
+    unsigned short src_port;
+    unsigned short flags;
+} mcap_rec_hdr;
+
+#define CAP_FORMAT_MCAP 1
+#define CAP_FORMAT_PCAP 2
+#define CAP_FORMAT_PCAPNG 3
+#define CAP_MAX_IFS 16
+
+typedef struct cap_unpacked {  /* packed mcap: one block, decompressed */
+    size_t blk_off;  /* of the block it holds, 0 = none */
+    char *data;  /* block_size bytes */
+} cap_unpacked;
+
+typedef struct cap_reader {
+    const unsigned char *base;  /* whole file, mapped read-only */
+    size_t size;
+    size_t pos;
+    int format;  /* CAP_FORMAT_xxx */
+    int swapped;  /* pcap/pcapng written with the other byte order */
+    int num_ifs;
+    int if_linktype[CAP_MAX_IFS];
+    unsigned long long if_units[CAP_MAX_IFS];  /* timestamp units per second */
+    TLONGLONG last_ts_ns;
+    size_t start;  /* of the first record or block */
+    int version;  /* mcap */
+    /* mcap blocks */
+    size_t block_size;
+    size_t data_end;  /* records end here (the index, if any, follows) */
+    size_t blk_off, blk_end;  /* header and end of the records of the current block */
+    size_t blk_next;  /* header of the next */
+    const mcap_idx_ent *index;  /* from the trailer, or rebuilt */
+    mcap_idx_ent *index_built;
+    int num_index;
+    /* packed mcap: pos and blk_end count from blk_off as if the block
+     * were decompressed in place */
+    int codec;
+    cap_unpacked *unpacked;  /* shared by copies of the reader */
+    cap_unpacked *part_unpacked;  /* one each for the cap_split() parts */
+    int num_part_unpacked;
+} cap_reader;
+
+typedef struct cap_record {
+    const char *data;  /* UDP payload, points into the mapping */
+    int len;
+    TLONGLONG ts_ns;  /* capture time, ns since the epoch */
+    unsigned int src_addr, dst_addr;
+    unsigned short src_port, dst_port;
+    int seq;  /* mcap version 2 only, else MCAP_NO_SEQ */
+} cap_record;
+
+extern int cap_open(cap_reader *r, const char *file);
+extern int cap_next(cap_reader *r, cap_record *rec);
+extern int cap_seek_ns(cap_reader *r, TLONGLONG ns);
+extern int cap_seek_seq(cap_reader *r, int seq);
+extern int cap_split(cap_reader *r, cap_reader *parts, int max_parts);
+extern void cap_close(cap_reader *r);
+extern const char *cap_codec_name(int codec);
+
+/* Capture file writer (capwrite.c): records are copied into a ring of
+ * aligned buffers and a writer thread puts them on disk, in files rotated
+ * by size or time, after packer threads have compressed them if asked to.
+ * The receive side never waits for the disk or the packers. */
+#define CAPW_FORMAT_RAW 0  /* payload bytes only */
+#define CAPW_FORMAT_MCAP 1  /* mcap file header and records, in blocks */
+#define CAPW_BUF_SIZE (1024 * 1024)  /* bytes per write, and per mcap block */
+#define CAPW_ALIGN 4096  /* O_DIRECT alignment of buffers, offsets and lengths */
+#define CAPW_DEFAULT_BUFS 16
+#define CAPW_DEFAULT_PACKERS 2
+#define CAPW_MAX_PACKERS 64
+#define CAPW_MAX_NAME 1024
+
+typedef struct capw_buf {
+    char *data;  /* CAPW_BUF_SIZE bytes, plus room to pad */
+    size_t len;
+    int start_file;  /* open a new file for this buffer */
+    int end_file;  /* close the file after it */
+    unsigned int file_num;  /* of the file it starts */
+    time_t file_secs;
+    /* compressing */
+    char *out;  /* what is written instead */
+    size_t out_len;
+    TLONGLONG packed;  /* 1 + the number of the buffer packed into 'out' */
+} capw_buf;
+
+typedef struct cap_writer {
+    /* settings (capw_parse) */
+    long long rotate_bytes;  /* size=, 0 = no limit */
+    int rotate_secs;  /* time=, 0 = no limit */
+    int keep;  /* keep=, 0 = keep all files */
+    int num_bufs;  /* bufs= */
+    int direct;  /* O_DIRECT / FILE_FLAG_NO_BUFFERING */
+    int codec, level;  /* lz4=, zstd=: MCAP_CODEC_xxx, 0 = not compressed */
+    int num_packers;  /* packers= */
+    char name[CAPW_MAX_NAME];  /* file name template */
+    int format;  /* CAPW_FORMAT_xxx */
+    unsigned long groupaddr;
+    unsigned short groupport;
+
+    capw_buf *bufs;
+    TLONGLONG filled;  /* buffers handed to the writer (receive side) */
+    TLONGLONG written;  /* buffers written (writer thread) */
+    TLONGLONG committed;  /* bytes of whole records in the buffer being filled */
+    TLONGLONG closing;  /* stopping on a signal: take no more records */
+    TLONGLONG recording;  /* capw_record() is under way */
+
+    /* receive side */
+    size_t fill;  /* bytes in the buffer being filled */
+    int new_file;  /* the next record starts a file */
+    int start_pending;  /* the next buffer begun starts a file */
+    unsigned int file_num;  /* files started */
+    time_t file_secs;
+    long long file_bytes;
+    TLONGLONG file_end_ns;  /* time= rotation due */
+    mcap_blk_hdr *blk;  /* mcap: header of the block being filled */
+    unsigned long long records, bytes, dropped;
+    unsigned long long dropped_packing;  /* with the oldest buffer not yet packed */
+    TLONGLONG max_queued, max_pack_queued;
+    int done;
+
+    /* packer threads: take buffers in turn, under 'lock' */
+    struct capw_packer *packers;  /* num_packers, and one for the writer */
+    size_t out_size;
+    TLONGLONG pack_next;  /* the next buffer to pack */
+    TLONGLONG packs_done;
+    unsigned long long pack_in, pack_out;  /* bytes */
+    TLONGLONG pack_ns, start_ns;
+
+    /* writer thread */
+#if defined(_WIN32)
+    HANDLE fh;
+    HANDLE thread;
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE cond;
+#else
+    int fd;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+#endif
+#if defined(_WIN32)
+    CONDITION_VARIABLE pack_cond;
+#else
+    pthread_cond_t pack_cond;
+#endif
+    int file_open, write_failed, warned_prealloc;
+    long long file_off, file_len;
+    unsigned int num_files;  /* opened */
+    char (*names)[CAPW_MAX_NAME];  /* the last keep + 1 files */
+    int keep_slots;
+    TLONGLONG max_write_ns;
+    unsigned long long lost_bytes;
+    mcap_idx_ent *index;  /* mcap: the blocks of the open file */
+    int num_index, max_index;
+} cap_writer;
+
+extern int capw_parse(cap_writer *w, const char *spec);
+extern int capw_open(cap_writer *w, const char *name, int format, unsigned long groupaddr,
+		unsigned short groupport);
+extern int capw_record(cap_writer *w, const char *data, int len, TLONGLONG ts_ns,
+		const struct sockaddr_in *src, int seq);
+extern void capw_report(cap_writer *w, FILE *fp);
+extern void capw_catch_signals(cap_writer *w);
+extern void capw_close(cap_writer *w);
+extern void cap_file_name(const char *tmpl, char *name, size_t size, unsigned int num, time_t secs);
+extern void cap_mcap_header(mcap_file_hdr *fh, unsigned long groupaddr, unsigned short groupport,
+		unsigned int block_size, int codec);
+
+/* Flight recorder (flightrec.c): the latest datagrams as mcap records in a
+ * ring allocated up front; on a trigger, a thread writes the window around
+ * it to a new mcap file. */
+#define FR_DEFAULT_SIZE (64 * 1024 * 1024)
+
+typedef struct flight_rec {
+    /* settings (fr_parse) */
+    size_t size;  /* size=: ring bytes */
+    TLONGLONG window_ns;  /* window=: kept before a trigger, 0 = the whole ring */
+    TLONGLONG post_ns;  /* post=: recorded after it before writing */
+    int trig_gap, trig_drop;  /* gap, drop */
+    TLONGLONG trig_lat_ns;  /* lat=, 0 = off */
+    char name[CAPW_MAX_NAME];  /* file name template */
+    unsigned long groupaddr;
+    unsigned short groupport;
+
+    /* receive side */
+    char *ring;
+    TLONGLONG head, tail;  /* offsets: next record, oldest record */
+    int armed;  /* a trigger is waiting for its 'post' */
+    const char *why;
+    TLONGLONG trig_ns;
+    unsigned long long records, triggers, ignored, not_kept;
+    TLONGLONG closing;  /* stopping on a signal: keep no more datagrams */
+    TLONGLONG recording;  /* fr_record() or fr_trigger() is under way */
+
+    /* the window being written */
+    TLONGLONG dumping;  /* set by the receive side, cleared by the thread */
+    TLONGLONG dump_from, dump_to, dump_pos;  /* dump_pos: written up to here */
+    const char *dump_why;
+    TLONGLONG dump_trig_ns, dump_first_ns, dump_last_ns;
+    unsigned long long dump_records;
+    unsigned int num_dumps, failed;
+    int done;
+#if defined(_WIN32)
+    HANDLE thread;
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE cond;
+#else
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+#endif
+} flight_rec;
+
+extern int fr_parse(flight_rec *f, const char *spec);
+extern int fr_open(flight_rec *f, const char *name, unsigned long groupaddr, unsigned short groupport);
+extern void fr_record(flight_rec *f, const char *data, int len, TLONGLONG ts_ns,
+		const struct sockaddr_in *src, int seq);
+extern void fr_trigger(flight_rec *f, const char *why, TLONGLONG now_ns);
+extern void fr_report(flight_rec *f, FILE *fp);
+extern void fr_catch_signals(flight_rec *f);
+extern void fr_close(flight_rec *f);
+
+/* PACKET_MMAP transmit ring (pktring.c, Linux only): frames are prebuilt
+ * in memory shared with the kernel, and only the lengths, IP id, sequence
+ * digits and checksums are patched per message. */
+#define PKTRING_BATCH 64  /* frames queued per kick */
+
+typedef struct pkt_txring {
+    int fd;
+    char *ring;
+    size_t ring_size;
+    int frame_size, frame_nr;
+    int head;  /* next frame to fill */
+    int pending;  /* frames queued since the last kick */
+    unsigned long long kicks;
+    char ifname[16];
+    unsigned short ip_id;
+    unsigned int ip_sum, udp_sum, payload_sum;  /* partial checksums of constant words */
+    int seq_off, seq_width, seq_decimal;  /* sequence digits, offset from start of frame */
+    int prefix_len;  /* payload bytes covered by payload_sum plus the digits */
+    int fixed_len;  /* payload length with a fixed payload (-P), else -1 */
+} pkt_txring;
+
+extern int pktring_tx_open(pkt_txring *r, const char *ifname, const struct sockaddr_in *src,
+		const struct sockaddr_in *dst, int ttl, const char *payload, int max_len, int decimal);
+extern int pktring_tx_send(pkt_txring *r, int len, unsigned int seq);
+extern int pktring_tx_flush(pkt_txring *r, int wait);
+extern void pktring_tx_close(pkt_txring *r);
+
+/* PACKET_MMAP TPACKET_V3 receive ring (pktring.c, Linux only): the kernel
+ * fills whole blocks, filtered in-kernel by BPF to one group and port, and
+ * the reader walks each block in place. */
+typedef struct pkt_rxring {
+    int fd;
+    char *ring;
+    size_t ring_size;
+    int block_size, block_nr;
+    int cur_block;  /* next block to read */
+    char ifname[16];
+    unsigned long long packets, drops, freezes;  /* from PACKET_STATISTICS */
+} pkt_rxring;
+
+/* called for each datagram; 'data' points into the ring, read only */
+typedef void (*pktring_rx_cb)(void *arg, const char *data, int len,
+		const struct sockaddr_in *src, TLONGLONG ts_ns);
+
+extern int pktring_rx_open(pkt_rxring *r, const char *ifname, unsigned int group,
+		unsigned short port, int ring_bytes);
+extern int pktring_rx_poll(pkt_rxring *r, int timeout_ms, pktring_rx_cb cb, void *arg);
+extern void pktring_rx_stats(pkt_rxring *r);
+extern void pktring_rx_close(pkt_rxring *r);
+extern int pktring_mute_socket(int fd);
+
+/* Datagram transport shared by the tools (transport.c): plain socket calls,
+ * or io_uring on Linux (batched sends, multishot receive into a provided
+ * buffer ring, linked send+receive), optionally with a kernel SQ polling
+ * thread.  Counts datagrams, system calls and CPU time for comparison. */
+#define MT_TRANSPORT_SOCKET 0
+#define MT_TRANSPORT_URING 1
+#define MT_URING_SQPOLL 0x01
+
+typedef struct mt_transport {
+    int kind;  /* MT_TRANSPORT_xxx */
+    int flags;  /* MT_URING_xxx */
+    SOCKET sock;
+    int max_msg;
+    int ring_bytes;
+    char *buf;  /* socket kind: receive buffer */
+    void *uring;  /* io_uring kind: private state */
+    unsigned long long sends, recvs, syscalls;
+    TLONGLONG start_cpu_ns;
+    unsigned int rxq_ovfl;  /* socket drops so far, from SO_RXQ_OVFL data */
+    int have_rxq_ovfl;  /* rxq_ovfl has been seen */
+    TLONGLONG rx_ns;  /* arrival of the last datagram (ns since the epoch) if the
+                         socket has SO_TIMESTAMPNS on, else 0 */
+} mt_transport;
+
+extern int mt_transport_parse(const char *spec, int *kind, int *flags);
+extern int mt_transport_open(mt_transport *t, int kind, int flags, SOCKET sock,
+		int max_msg, int ring_bytes);
+extern int mt_transport_send(mt_transport *t, const char *buf, int len, const struct sockaddr_in *to);
+extern int mt_transport_flush(mt_transport *t, int wait);
+extern int mt_transport_recv(mt_transport *t, const char **data, struct sockaddr_in *from,
+		int timeout_ms);
+extern int mt_transport_sendrecv(mt_transport *t, const char *sbuf, int slen,
+		const struct sockaddr_in *to, const char **rdata, struct sockaddr_in *from);
+extern void mt_transport_report(mt_transport *t, FILE *fp);
+extern void mt_transport_close(mt_transport *t);
+extern int mt_set_sockbuf(SOCKET sock, int optname, int size);
+extern long long mt_udp_drops(SOCKET sock);
+
+/* Kernel receive filter for UDP sockets (sockfilt.c): all given terms must
+ * match; compiled to classic BPF and attached with SO_ATTACH_FILTER. */
+typedef struct sockfilt {
+    int have_src;
+    unsigned int src_addr, src_mask;  /* host byte order */
+    int sport_lo, sport_hi;  /* -1 if unused */
+    int len_min, len_max;  /* payload bytes, -1 if unused */
+    unsigned char prefix[32];
+    int prefix_len;  /* 0 if unused */
+} sockfilt;
+
+extern int sockfilt_parse(sockfilt *f, const char *expr);
+extern int sockfilt_attach(SOCKET sock, const sockfilt *f);
+
+/* Live counters in a named shared-memory segment (counters.c), for 'mstat'
+ * to read while the tool runs.  The writer is the tool's own loop, so an
+ * update is a relaxed load and store (no locked instruction, no system
+ * call); the values sit on cache lines of their own, away from the header
+ * a reader scans.  A tool that was not asked to publish has blk == NULL. */
+#define MT_CTR_MAGIC 0x4e43544d  /* "MTCN" */
+#define MT_CTR_VERSION 1
+#define MT_CTR_MAX 16
+#define MT_CTR_NAME_LEN 24
+#define MT_CTR_PREFIX "mtools."  /* segment name is MT_CTR_PREFIX + -C name */
+
+#define MT_CTR_GAUGE 0x01  /* a level, not a running total: no rate */
+
+typedef struct mt_ctr_block {
+    unsigned int magic, version;  /* version last: readers check both */
+    int pid;
+    int num_ctrs;
+    TLONGLONG start_ns;  /* mt_clock_ns() at creation */
+    char tool[16];  /* "msend", ... */
+    char label[64];  /* what the instance is doing, e.g. group and port */
+    char names[MT_CTR_MAX][MT_CTR_NAME_LEN];
+    unsigned char flags[MT_CTR_MAX];  /* MT_CTR_xxx */
+    char pad[64 - (40 + 64 + MT_CTR_MAX * MT_CTR_NAME_LEN + MT_CTR_MAX) % 64];
+    volatile unsigned long long vals[MT_CTR_MAX];  /* starts on a cache line */
+} mt_ctr_block;
+
+typedef struct mt_counters {
+    mt_ctr_block *blk;  /* NULL: not publishing */
+    int owner;  /* created (rather than attached): remove on close */
+    char name[80];
+#if defined(_WIN32)
+    HANDLE map;
+#endif
+} mt_counters;
+
+extern int mt_ctr_create(mt_counters *c, const char *name, const char *tool, const char *label,
+		const char * const *names, const unsigned char *flags, int num_ctrs);
+extern int mt_ctr_attach(mt_counters *c, const char *name);
+extern int mt_ctr_list(char names[][80], int max_names);
+extern void mt_ctr_close(mt_counters *c);
+
+/* CPU cost of a loop per packet (perfctr.c): perf_event_open counters on
+ * Linux, getrusage (or GetThreadTimes) otherwise; the calling thread only. */
+#define MT_PERF_CYCLES 0
+#define MT_PERF_INSTRUCTIONS 1
+#define MT_PERF_CACHE_MISSES 2
+#define MT_PERF_SWITCHES 3
+#define MT_PERF_TASK_CLOCK 4  /* ns */
+#define MT_PERF_NUM 5
+#define MT_PERF_NONE (~0ULL)  /* counter not available */
+
+typedef struct mt_perf {
+    int fd[MT_PERF_NUM];
+    int num_open;  /* 0: getrusage only */
+    int user_only;  /* perf_event_paranoid kept the kernel out */
+    unsigned long long val[MT_PERF_NUM];  /* after mt_perf_stop() */
+    unsigned long long ru_cpu_ns, ru_switches;  /* getrusage, same interval */
+    TLONGLONG start_ns, wall_ns;
+} mt_perf;
+
+extern void mt_perf_open(mt_perf *p);
+extern void mt_perf_start(mt_perf *p);
+extern void mt_perf_stop(mt_perf *p);
+extern void mt_perf_report(mt_perf *p, FILE *fp, const char *what, unsigned long long packets,
+		const char *unit);
+extern void mt_perf_close(mt_perf *p);
+
+static MT_INLINE void mt_ctr_add(mt_counters *c, int idx, unsigned long long n)
+{
+	if (c->blk != NULL) {
+#if defined(_MSC_VER)
+		c->blk->vals[idx] += n;
+#else
+		__atomic_store_n(&c->blk->vals[idx],
+			__atomic_load_n(&c->blk->vals[idx], __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+#endif
+	}
+}  /* mt_ctr_add */
+
+static MT_INLINE void mt_ctr_set(mt_counters *c, int idx, unsigned long long v)
+{
+	if (c->blk != NULL) {
+#if defined(_MSC_VER)
+		c->blk->vals[idx] = v;
+#else
+		__atomic_store_n(&c->blk->vals[idx], v, __ATOMIC_RELAXED);
+#endif
+	}
+}  /* mt_ctr_set */
+
 
 #endif
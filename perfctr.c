@@ -0,0 +1,218 @@
+/* perfctr.c */
+/*   CPU cost of a send or receive loop, per packet: hardware counters
+ * (cycles, instructions, cache misses) and software ones (context
+ * switches, task clock) from perf_event_open on Linux, or CPU time and
+ * context switches from getrusage where those are not available.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted without restriction.
+ *
+  THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+  EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+  NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+  PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+  UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+  BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+  INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+  TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+  THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+/* The counters follow the calling thread only (pid 0, any CPU), and count
+ * kernel work too when perf_event_paranoid allows it, since most of the
+ * cost of a datagram is in the kernel.  Each counter is opened on its own
+ * so that a missing one (no PMU in most VMs) does not take the others
+ * with it; when the kernel has to multiplex them, the counts are scaled
+ * by time enabled / time running. */
+
+#include "mtools.h"
+
+#if defined(__linux__)
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <linux/perf_event.h>
+#elif ! defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+static const char *perf_names[MT_PERF_NUM] = {
+	"cycles", "instructions", "cache misses", "context switches", "task clock" };
+
+#if defined(__linux__)
+static const unsigned int perf_types[MT_PERF_NUM] = {
+	PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+	PERF_TYPE_SOFTWARE, PERF_TYPE_SOFTWARE };
+static const unsigned long long perf_configs[MT_PERF_NUM] = {
+	PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES,
+	PERF_COUNT_SW_CONTEXT_SWITCHES, PERF_COUNT_SW_TASK_CLOCK };
+
+static int perf_open_one(int type, unsigned long long config, int exclude_kernel)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = exclude_kernel;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}  /* perf_open_one */
+#endif
+
+
+/* CPU time (ns) and context switches of this thread, from getrusage. */
+static void perf_rusage(unsigned long long *cpu_ns, unsigned long long *switches)
+{
+#if defined(_WIN32)
+	FILETIME created, exited, kernel, user;
+	ULARGE_INTEGER k, u;
+
+	GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user);
+	k.LowPart = kernel.dwLowDateTime;  k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime;  u.HighPart = user.dwHighDateTime;
+	*cpu_ns = (k.QuadPart + u.QuadPart) * 100;
+	*switches = 0;  /* not available */
+#else
+	struct rusage ru;
+
+#if defined(RUSAGE_THREAD)
+	getrusage(RUSAGE_THREAD, &ru);
+#else
+	getrusage(RUSAGE_SELF, &ru);
+#endif
+	*cpu_ns = (unsigned long long)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000 +
+		(unsigned long long)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000;
+	*switches = (unsigned long long)(ru.ru_nvcsw + ru.ru_nivcsw);
+#endif
+}  /* perf_rusage */
+
+
+/* Open whatever counters this system offers.  Never fails: at worst the
+ * report falls back to getrusage. */
+void mt_perf_open(mt_perf *p)
+{
+	int i;
+
+	memset(p, 0, sizeof(*p));
+	for (i = 0; i < MT_PERF_NUM; ++i)
+		p->fd[i] = -1;
+#if defined(__linux__)
+	p->user_only = 0;
+	for (i = 0; i < MT_PERF_NUM; ++i) {
+		p->fd[i] = perf_open_one(perf_types[i], perf_configs[i], p->user_only);
+		if (p->fd[i] < 0 && (errno == EACCES || errno == EPERM) && ! p->user_only) {
+			/* perf_event_paranoid: count user space only, from here on */
+			p->user_only = 1;
+			p->num_open = 0;
+			for (i = 0; i < MT_PERF_NUM; ++i) {
+				if (p->fd[i] >= 0)
+					close(p->fd[i]);
+				p->fd[i] = -1;
+			}
+			i = -1;
+			continue;
+		}
+		if (p->fd[i] >= 0)
+			++p->num_open;
+	}
+#endif
+}  /* mt_perf_open */
+
+
+/* Zero the counters and start counting. */
+void mt_perf_start(mt_perf *p)
+{
+	int i;
+
+	for (i = 0; i < MT_PERF_NUM; ++i) {
+		p->val[i] = 0;
+#if defined(__linux__)
+		if (p->fd[i] >= 0) {
+			ioctl(p->fd[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(p->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+#endif
+	}
+	perf_rusage(&p->ru_cpu_ns, &p->ru_switches);
+	p->start_ns = mt_clock_ns();
+}  /* mt_perf_start */
+
+
+/* Stop counting and read the counters into p->val[] (MT_PERF_NONE where
+ * a counter is not available). */
+void mt_perf_stop(mt_perf *p)
+{
+	unsigned long long cpu_ns, switches;
+	int i;
+
+	p->wall_ns = mt_clock_ns() - p->start_ns;
+	for (i = 0; i < MT_PERF_NUM; ++i) {
+		p->val[i] = MT_PERF_NONE;
+#if defined(__linux__)
+		if (p->fd[i] >= 0) {
+			unsigned long long buf[3];  /* value, time enabled, time running */
+			ioctl(p->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+			if (read(p->fd[i], buf, sizeof(buf)) == sizeof(buf) && buf[2] > 0)
+				p->val[i] = (buf[2] < buf[1]) ? (unsigned long long)((double)buf[0] * buf[1] / buf[2]) : buf[0];
+		}
+#endif
+	}
+	perf_rusage(&cpu_ns, &switches);
+	p->ru_cpu_ns = cpu_ns - p->ru_cpu_ns;
+	p->ru_switches = switches - p->ru_switches;
+}  /* mt_perf_stop */
+
+
+/* "what CPU cost: N units in T s, ..." with the cost per unit ("message",
+ * "datagram", ...), from the best source available.  Call after
+ * mt_perf_stop(). */
+void mt_perf_report(mt_perf *p, FILE *fp, const char *what, unsigned long long packets,
+		const char *unit)
+{
+	unsigned long long *v = p->val;
+	double n = (packets > 0) ? (double)packets : 1.0;
+	unsigned long long cpu_ns, switches;
+	int i;
+
+	fprintf(fp, "%s CPU cost: %llu %ss in %.3f s", what, packets, unit, p->wall_ns / 1e9);
+	if (v[MT_PERF_CYCLES] != MT_PERF_NONE)
+		fprintf(fp, ", %.0f cycles/%s", v[MT_PERF_CYCLES] / n, unit);
+	if (v[MT_PERF_CYCLES] != MT_PERF_NONE && v[MT_PERF_INSTRUCTIONS] != MT_PERF_NONE && v[MT_PERF_CYCLES] > 0)
+		fprintf(fp, ", IPC %.2f", (double)v[MT_PERF_INSTRUCTIONS] / v[MT_PERF_CYCLES]);
+	if (v[MT_PERF_CACHE_MISSES] != MT_PERF_NONE)
+		fprintf(fp, ", %.2f cache misses/%s", v[MT_PERF_CACHE_MISSES] / n, unit);
+
+	/* software counters, else getrusage */
+	cpu_ns = (v[MT_PERF_TASK_CLOCK] != MT_PERF_NONE) ? v[MT_PERF_TASK_CLOCK] : p->ru_cpu_ns;
+	switches = (v[MT_PERF_SWITCHES] != MT_PERF_NONE) ? v[MT_PERF_SWITCHES] : p->ru_switches;
+	fprintf(fp, ", %.0f ns CPU/%s, %.2f context switches per 1000 %ss\n",
+		cpu_ns / n, unit, switches * 1000.0 / n, unit);
+
+	fprintf(fp, "  (from %s", (p->num_open > 0) ? "perf_event_open" : "getrusage");
+	if (p->num_open > 0 && p->user_only)
+		fprintf(fp, ", user space only");
+	for (i = 0; i < MT_PERF_NUM; ++i) {
+		if (v[i] == MT_PERF_NONE && p->num_open > 0)
+			fprintf(fp, "; no %s", perf_names[i]);
+	}
+	fprintf(fp, ")\n");
+}  /* mt_perf_report */
+
+
+void mt_perf_close(mt_perf *p)
+{
+#if defined(__linux__)
+	int i;
+
+	for (i = 0; i < MT_PERF_NUM; ++i) {
+		if (p->fd[i] >= 0)
+			close(p->fd[i]);
+		p->fd[i] = -1;
+	}
+#endif
+	p->num_open = 0;
+}  /* mt_perf_close */
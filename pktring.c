@@ -0,0 +1,689 @@
+/* pktring.c */
+/*   AF_PACKET (PACKET_MMAP) rings, Linux only.  The TX ring lets msend
+ * hand complete Ethernet/IP/UDP frames to the kernel through shared memory
+ * and kick it once per batch, instead of one sendto() per datagram.  The
+ * TPACKET_V3 RX ring lets mdump read whole blocks of datagrams in place,
+ * with no per-datagram system call or copy.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted without restriction.
+ *
+  THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+  EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+  NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+  PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+  UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+  BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+  INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+  TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+  THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+/* Every frame in the TX ring is filled in once, at open time, with the
+ * Ethernet, IP and UDP headers and the constant part of the payload.  To
+ * send a message only the lengths, the IP id and the sequence digits are
+ * rewritten, and both checksums are finished from precomputed partial sums
+ * of the words that never change (RFC 1071 sums are order independent, so
+ * the partial sums simply get the changed words added).  Payload bytes past
+ * the "Message <seq>" prefix are zero and contribute nothing to the sum.
+ *
+ * Frames injected on lo are routed as if received from outside, so the
+ * kernel drops them unless it accepts a local source address (sysctl
+ * net.ipv4.conf.lo.accept_local=1, plus route_localnet=1 for 127/8).  A
+ * veth pair with the receiver in another namespace needs no tweaks. */
+
+#include "mtools.h"
+
+#if defined(__linux__)
+
+#include <poll.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+
+#define PR_ETH_LEN 14
+#define PR_IP_LEN 20
+#define PR_UDP_LEN 8
+#define PR_HDRS_LEN (PR_ETH_LEN + PR_IP_LEN + PR_UDP_LEN)
+#define PR_DATA_OFF (TPACKET2_HDRLEN - sizeof(struct sockaddr_ll))
+#define PR_RING_BYTES (16 * 1024 * 1024)
+#define PR_RX_BLOCK_SIZE (1024 * 1024)
+#define PR_RX_BLOCK_TOV_MS 10  /* hand over a partly filled block after this long */
+
+
+static unsigned int pr_sum(const unsigned char *p, int len)
+{
+	unsigned int sum = 0;
+	unsigned short w;
+
+	for (; len > 1; p += 2, len -= 2) {
+		memcpy(&w, p, 2);
+		sum += w;
+	}
+	if (len > 0) {  /* odd trailing byte, padded with zero */
+		unsigned char last[2];
+		last[0] = *p;  last[1] = 0;
+		memcpy(&w, last, 2);
+		sum += w;
+	}
+	return sum;
+}  /* pr_sum */
+
+
+static unsigned short pr_fold(unsigned int sum)
+{
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+	return (unsigned short)~sum;
+}  /* pr_fold */
+
+
+static unsigned char *pr_frame(pkt_txring *r, int idx)
+{
+	return (unsigned char *)r->ring + (size_t)idx * r->frame_size;
+}  /* pr_frame */
+
+
+/* Name of the interface that owns local address 'addr', or -1. */
+static int pr_if_by_addr(unsigned int addr, char *ifname)
+{
+	struct ifaddrs *ifa_list, *ifa;
+	int rtn = -1;
+
+	if (getifaddrs(&ifa_list) < 0)
+		return -1;
+	for (ifa = ifa_list; ifa != NULL; ifa = ifa->ifa_next) {
+		if (ifa->ifa_addr != NULL && ifa->ifa_addr->sa_family == AF_INET &&
+				((struct sockaddr_in *)ifa->ifa_addr)->sin_addr.s_addr == addr) {
+			snprintf(ifname, IFNAMSIZ, "%s", ifa->ifa_name);
+			rtn = 0;
+			break;
+		}
+	}
+	freeifaddrs(ifa_list);
+	return rtn;
+}  /* pr_if_by_addr */
+
+
+/* Destination MAC for a unicast IP on 'ifname', from the ARP cache. */
+static int pr_arp_lookup(unsigned int addr, const char *ifname, unsigned char *mac)
+{
+	FILE *fp;
+	char line[256], ip[64], hw[64], dev[64];
+	unsigned int m[6];
+	int i;
+
+	if ((fp = fopen("/proc/net/arp", "r")) == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (sscanf(line, "%63s %*s %*s %63s %*s %63s", ip, hw, dev) != 3)
+			continue;
+		if (inet_addr(ip) != addr || strcmp(dev, ifname) != 0)
+			continue;
+		if (sscanf(hw, "%x:%x:%x:%x:%x:%x", &m[0], &m[1], &m[2], &m[3], &m[4], &m[5]) != 6)
+			continue;
+		for (i = 0; i < 6; ++i)
+			mac[i] = (unsigned char)m[i];
+		fclose(fp);
+		return 0;
+	}
+	fclose(fp);
+	return -1;
+}  /* pr_arp_lookup */
+
+
+/* Open a TX ring on 'ifname' (or, if NULL, the interface owning src's
+ * address) for UDP datagrams from 'src' to 'dst'.  If 'payload' is non-NULL
+ * every frame carries those 'max_len' bytes; otherwise frames carry
+ * "Message <seq>" with a fixed-width hex (or decimal) sequence number, zero
+ * padded to the requested length.  Returns 0, or -1 after printing why. */
+int pktring_tx_open(pkt_txring *r, const char *ifname, const struct sockaddr_in *src,
+		const struct sockaddr_in *dst, int ttl, const char *payload, int max_len, int decimal)
+{
+	struct ifreq ifr;
+	struct sockaddr_ll sll;
+	struct tpacket_req req;
+	unsigned char tmpl[PR_HDRS_LEN + 32];
+	unsigned char *eth, *ip, *udp;
+	unsigned int saddr, daddr, ifindex;
+	int tmpl_len, prefix_len, frame_need, val, mtu, i;
+	unsigned short w;
+
+	memset(r, 0, sizeof(*r));
+	r->fd = -1;
+	saddr = src->sin_addr.s_addr;
+	daddr = dst->sin_addr.s_addr;
+
+	memset(&ifr, 0, sizeof(ifr));
+	if (ifname != NULL)
+		snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+	else if (saddr == 0 || pr_if_by_addr(saddr, ifr.ifr_name) < 0) {
+		fprintf(stderr, "pktring: need an interface name, or the address of a local interface\n");
+		return -1;
+	}
+
+	if ((r->fd = socket(AF_PACKET, SOCK_RAW, 0)) < 0) {
+		fprintf(stderr, "pktring: socket(AF_PACKET): %s%s\n", strerror(errno),
+			(errno == EPERM) ? " (needs CAP_NET_RAW)" : "");
+		return -1;
+	}
+	if (ioctl(r->fd, SIOCGIFINDEX, &ifr) < 0) {
+		fprintf(stderr, "pktring: unknown interface '%s'\n", ifr.ifr_name);
+		goto ERR;
+	}
+	ifindex = ifr.ifr_ifindex;
+	if (ioctl(r->fd, SIOCGIFMTU, &ifr) < 0) {
+		fprintf(stderr, "pktring: SIOCGIFMTU on '%s': %s\n", ifr.ifr_name, strerror(errno));
+		goto ERR;
+	}
+	mtu = ifr.ifr_mtu;
+	if (saddr == 0) {
+		if (ioctl(r->fd, SIOCGIFADDR, &ifr) < 0) {
+			fprintf(stderr, "pktring: interface '%s' has no IPv4 address\n", ifr.ifr_name);
+			goto ERR;
+		}
+		saddr = ((struct sockaddr_in *)&ifr.ifr_addr)->sin_addr.s_addr;
+	}
+	snprintf(r->ifname, sizeof(r->ifname), "%s", ifr.ifr_name);
+
+	/* the ring cannot fragment, every datagram must fit the MTU */
+	if (PR_IP_LEN + PR_UDP_LEN + max_len > mtu) {
+		fprintf(stderr, "pktring: %d-byte messages exceed the MTU of '%s' (max %d)\n",
+			max_len, r->ifname, mtu - PR_IP_LEN - PR_UDP_LEN);
+		goto ERR;
+	}
+
+	/* Ethernet header */
+	memset(tmpl, 0, sizeof(tmpl));
+	eth = tmpl;
+	if (ioctl(r->fd, SIOCGIFHWADDR, &ifr) < 0) {
+		fprintf(stderr, "pktring: SIOCGIFHWADDR on '%s': %s\n", r->ifname, strerror(errno));
+		goto ERR;
+	}
+	memcpy(eth + 6, ifr.ifr_hwaddr.sa_data, 6);
+	if (IN_MULTICAST(ntohl(daddr))) {
+		unsigned int g = ntohl(daddr);
+		eth[0] = 0x01;  eth[1] = 0x00;  eth[2] = 0x5e;
+		eth[3] = (unsigned char)((g >> 16) & 0x7f);
+		eth[4] = (unsigned char)(g >> 8);
+		eth[5] = (unsigned char)g;
+	}
+	else if (ifr.ifr_hwaddr.sa_family != ARPHRD_LOOPBACK &&
+			pr_arp_lookup(daddr, r->ifname, eth) < 0) {
+		fprintf(stderr, "pktring: no ARP entry for %s on '%s' (ping it first)\n",
+			inet_ntoa(dst->sin_addr), r->ifname);
+		goto ERR;
+	}
+	eth[12] = 0x08;  eth[13] = 0x00;  /* ETH_P_IP */
+
+	/* IPv4 header: length, id and checksum are filled in per message */
+	ip = eth + PR_ETH_LEN;
+	ip[0] = 0x45;
+	ip[8] = (unsigned char)ttl;
+	ip[9] = IPPROTO_UDP;
+	memcpy(ip + 12, &saddr, 4);
+	memcpy(ip + 16, &daddr, 4);
+	r->ip_sum = pr_sum(ip, PR_IP_LEN);
+
+	/* UDP header, and the pseudo-header words that never change */
+	udp = ip + PR_IP_LEN;
+	memcpy(udp, &src->sin_port, 2);
+	memcpy(udp + 2, &dst->sin_port, 2);
+	w = htons(IPPROTO_UDP);
+	r->udp_sum = pr_sum(ip + 12, 8) + w + pr_sum(udp, 4);
+
+	/* constant payload prefix */
+	tmpl_len = PR_HDRS_LEN;
+	prefix_len = 0;
+	if (payload == NULL) {
+		memcpy(tmpl + tmpl_len, "Message ", 8);
+		r->seq_off = PR_HDRS_LEN + 8;
+		r->seq_width = decimal ? 10 : 8;  /* even, so the digits are whole words */
+		r->seq_decimal = decimal;
+		prefix_len = 8 + r->seq_width;
+		memset(tmpl + r->seq_off, '0', r->seq_width);
+		r->payload_sum = pr_sum(tmpl + tmpl_len, 8);
+		tmpl_len += prefix_len;
+	}
+	r->prefix_len = prefix_len;
+
+	/* ring geometry: power-of-two frames, 64 KB (or one-frame) blocks */
+	frame_need = PR_DATA_OFF + PR_HDRS_LEN + max_len;
+	for (r->frame_size = 2048; r->frame_size < frame_need; r->frame_size *= 2)
+		;
+	memset(&req, 0, sizeof(req));
+	req.tp_frame_size = r->frame_size;
+	req.tp_block_size = (r->frame_size > 65536) ? r->frame_size : 65536;
+	req.tp_frame_nr = PR_RING_BYTES / r->frame_size;
+	if (req.tp_frame_nr > 4096)
+		req.tp_frame_nr = 4096;
+	if (req.tp_frame_nr < 64)
+		req.tp_frame_nr = 64;
+	req.tp_frame_nr -= req.tp_frame_nr % (req.tp_block_size / r->frame_size);
+	req.tp_block_nr = req.tp_frame_nr / (req.tp_block_size / r->frame_size);
+	r->frame_nr = req.tp_frame_nr;
+
+	val = TPACKET_V2;
+	if (setsockopt(r->fd, SOL_PACKET, PACKET_VERSION, &val, sizeof(val)) < 0) {
+		fprintf(stderr, "pktring: PACKET_VERSION: %s\n", strerror(errno));
+		goto ERR;
+	}
+	val = 1;  /* straight to the driver; not fatal if unsupported */
+	(void)setsockopt(r->fd, SOL_PACKET, PACKET_QDISC_BYPASS, &val, sizeof(val));
+	if (setsockopt(r->fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0) {
+		fprintf(stderr, "pktring: PACKET_TX_RING: %s\n", strerror(errno));
+		goto ERR;
+	}
+	r->ring_size = (size_t)req.tp_block_size * req.tp_block_nr;
+	r->ring = mmap(NULL, r->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, 0);
+	if (r->ring == MAP_FAILED) {
+		r->ring = NULL;
+		fprintf(stderr, "pktring: mmap: %s\n", strerror(errno));
+		goto ERR;
+	}
+
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_ifindex = ifindex;
+	if (bind(r->fd, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+		fprintf(stderr, "pktring: bind to '%s': %s\n", r->ifname, strerror(errno));
+		goto ERR;
+	}
+
+	/* prebuild every frame */
+	for (i = 0; i < r->frame_nr; ++i) {
+		unsigned char *data = pr_frame(r, i) + PR_DATA_OFF;
+		memcpy(data, tmpl, tmpl_len);
+		if (payload != NULL)
+			memcpy(data + PR_HDRS_LEN, payload, max_len);
+	}
+	if (payload != NULL)
+		r->payload_sum = pr_sum((const unsigned char *)payload, max_len);
+	r->fixed_len = (payload != NULL) ? max_len : -1;
+
+	return 0;
+
+ERR:
+	pktring_tx_close(r);
+	return -1;
+}  /* pktring_tx_open */
+
+
+/* Kick the kernel to transmit every queued frame.  With 'wait', block until
+ * the ring has drained. */
+int pktring_tx_flush(pkt_txring *r, int wait)
+{
+	if (r->pending == 0 && ! wait)
+		return 0;
+	r->pending = 0;
+	++r->kicks;
+	if (send(r->fd, NULL, 0, wait ? 0 : MSG_DONTWAIT) < 0 &&
+			errno != EAGAIN && errno != ENOBUFS) {
+		fprintf(stderr, "pktring: send: %s\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+}  /* pktring_tx_flush */
+
+
+/* Queue one datagram of 'len' payload bytes carrying sequence number 'seq'
+ * (ignored for a fixed payload).  The kernel is kicked every PKTRING_BATCH
+ * frames; call pktring_tx_flush() at the end of a burst.  Returns 0, or -1
+ * after printing why. */
+int pktring_tx_send(pkt_txring *r, int len, unsigned int seq)
+{
+	struct tpacket2_hdr *hdr = (struct tpacket2_hdr *)pr_frame(r, r->head);
+	unsigned char *data = (unsigned char *)hdr + PR_DATA_OFF;
+	unsigned char *ip = data + PR_ETH_LEN;
+	unsigned char *udp = ip + PR_IP_LEN;
+	unsigned int sum;
+	unsigned short w;
+	int i;
+
+	/* the slot is ours again once the kernel has sent what was in it */
+	while (*(volatile unsigned int *)&hdr->tp_status != TP_STATUS_AVAILABLE) {
+		if (hdr->tp_status & TP_STATUS_WRONG_FORMAT) {
+			fprintf(stderr, "pktring: kernel rejected a frame as malformed\n");
+			return -1;
+		}
+		if (pktring_tx_flush(r, 1) < 0)
+			return -1;
+		if (*(volatile unsigned int *)&hdr->tp_status != TP_STATUS_AVAILABLE) {
+			struct pollfd pfd;
+			pfd.fd = r->fd;  pfd.events = POLLOUT;  pfd.revents = 0;
+			(void)poll(&pfd, 1, 1);
+		}
+	}
+
+	if (r->fixed_len >= 0)
+		len = r->fixed_len;
+
+	if (r->seq_width > 0) {
+		unsigned char *d = data + r->seq_off + r->seq_width;
+		if (r->seq_decimal) {
+			for (i = 0; i < r->seq_width; ++i, seq /= 10)
+				*--d = (unsigned char)('0' + seq % 10);
+		} else {
+			for (i = 0; i < r->seq_width; ++i, seq >>= 4)
+				*--d = "0123456789abcdef"[seq & 0xf];
+		}
+	}
+
+	/* IP: total length and id */
+	w = htons((unsigned short)(PR_IP_LEN + PR_UDP_LEN + len));
+	memcpy(ip + 2, &w, 2);
+	sum = r->ip_sum + w;
+	w = htons(r->ip_id++);
+	memcpy(ip + 4, &w, 2);
+	sum += w;
+	w = pr_fold(sum);
+	memcpy(ip + 10, &w, 2);
+
+	/* UDP: length (counted twice, pseudo-header and header) and payload */
+	w = htons((unsigned short)(PR_UDP_LEN + len));
+	memcpy(udp + 4, &w, 2);
+	sum = r->udp_sum + 2 * (unsigned int)w;
+	if (len >= r->prefix_len) {
+		sum += r->payload_sum;
+		if (r->seq_width > 0)
+			sum += pr_sum(data + r->seq_off, r->seq_width);
+	} else {
+		sum += pr_sum(udp + PR_UDP_LEN, len);  /* shorter than the prefix */
+	}
+	w = pr_fold(sum);
+	if (w == 0)
+		w = 0xffff;  /* 0 means "no checksum" */
+	memcpy(udp + 6, &w, 2);
+
+	hdr->tp_len = PR_HDRS_LEN + len;
+	__sync_synchronize();  /* frame contents before the status flip */
+	hdr->tp_status = TP_STATUS_SEND_REQUEST;
+
+	if (++r->head == r->frame_nr)
+		r->head = 0;
+	if (++r->pending >= PKTRING_BATCH)
+		return pktring_tx_flush(r, 0);
+	return 0;
+}  /* pktring_tx_send */
+
+
+void pktring_tx_close(pkt_txring *r)
+{
+	if (r->ring != NULL) {
+		(void)pktring_tx_flush(r, 1);
+		munmap(r->ring, r->ring_size);
+	}
+	if (r->fd >= 0)
+		close(r->fd);
+	r->ring = NULL;
+	r->fd = -1;
+}  /* pktring_tx_close */
+
+
+
+/* Attach a classic BPF program accepting only unfragmented UDP datagrams
+ * to 'group' (any destination if 0) and 'port' that are not our own
+ * outgoing packets.  The socket is SOCK_DGRAM, so offsets are from the IP
+ * header whatever the link layer. */
+static int pr_rx_filter(int fd, unsigned int group, unsigned short port)
+{
+	struct sock_filter prog[16];
+	struct sock_fprog fprog;
+	int n = 0, drop, i;
+
+	prog[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_PKTTYPE);
+	prog[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, PACKET_OUTGOING, 0xff, 0);
+	prog[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 9);  /* protocol */
+	prog[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 0xff);
+	prog[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 6);  /* flags, frag offset */
+	prog[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x3fff, 0xff, 0);
+	if (group != 0) {
+		prog[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 16);  /* dst addr */
+		prog[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohl(group), 0, 0xff);
+	}
+	prog[n++] = (struct sock_filter)BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0);  /* x = IP header len */
+	prog[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_H | BPF_IND, 2);  /* dst port */
+	prog[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, port, 0, 0xff);
+	prog[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0x40000);
+	drop = n;
+	prog[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);
+
+	/* resolve the 0xff placeholders to jumps to 'drop' */
+	for (i = 0; i < drop; ++i) {
+		if (prog[i].jt == 0xff)
+			prog[i].jt = (unsigned char)(drop - i - 1);
+		if (prog[i].jf == 0xff)
+			prog[i].jf = (unsigned char)(drop - i - 1);
+	}
+	fprog.len = (unsigned short)n;
+	fprog.filter = prog;
+	return setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog));
+}  /* pr_rx_filter */
+
+
+/* Attach a filter that drops everything, so a UDP socket kept only for its
+ * multicast membership does not queue copies of what the ring reads. */
+int pktring_mute_socket(int fd)
+{
+	struct sock_filter drop_all = BPF_STMT(BPF_RET | BPF_K, 0);
+	struct sock_fprog fprog;
+
+	fprog.len = 1;
+	fprog.filter = &drop_all;
+	return setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog));
+}  /* pktring_mute_socket */
+
+
+/* Open a TPACKET_V3 RX ring of about 'ring_bytes' on 'ifname' (all
+ * interfaces if NULL), with a kernel filter for group/port (network byte
+ * order, group 0 = any).  Returns 0, or -1 after printing why. */
+int pktring_rx_open(pkt_rxring *r, const char *ifname, unsigned int group,
+		unsigned short port, int ring_bytes)
+{
+	struct tpacket_req3 req;
+	struct sockaddr_ll sll;
+	int val;
+
+	memset(r, 0, sizeof(*r));
+	if ((r->fd = socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_IP))) < 0) {
+		fprintf(stderr, "pktring: socket(AF_PACKET): %s%s\n", strerror(errno),
+			(errno == EPERM) ? " (needs CAP_NET_RAW)" : "");
+		return -1;
+	}
+
+	/* filter before bind, so nothing unwanted is queued in between */
+	if (pr_rx_filter(r->fd, group, ntohs(port)) < 0) {
+		fprintf(stderr, "pktring: SO_ATTACH_FILTER: %s\n", strerror(errno));
+		goto ERR;
+	}
+
+	val = TPACKET_V3;
+	if (setsockopt(r->fd, SOL_PACKET, PACKET_VERSION, &val, sizeof(val)) < 0) {
+		fprintf(stderr, "pktring: PACKET_VERSION: %s\n", strerror(errno));
+		goto ERR;
+	}
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = PR_RX_BLOCK_SIZE;
+	req.tp_block_nr = ring_bytes / PR_RX_BLOCK_SIZE;
+	if (req.tp_block_nr < 4)
+		req.tp_block_nr = 4;
+	req.tp_frame_size = 2048;  /* nominal; V3 packs frames of any size */
+	req.tp_frame_nr = req.tp_block_nr * (req.tp_block_size / req.tp_frame_size);
+	req.tp_retire_blk_tov = PR_RX_BLOCK_TOV_MS;
+	if (setsockopt(r->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+		fprintf(stderr, "pktring: PACKET_RX_RING: %s\n", strerror(errno));
+		goto ERR;
+	}
+	r->block_size = req.tp_block_size;
+	r->block_nr = req.tp_block_nr;
+	r->ring_size = (size_t)r->block_size * r->block_nr;
+	r->ring = mmap(NULL, r->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, r->fd, 0);
+	if (r->ring == MAP_FAILED)  /* MAP_LOCKED needs RLIMIT_MEMLOCK */
+		r->ring = mmap(NULL, r->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, 0);
+	if (r->ring == MAP_FAILED) {
+		r->ring = NULL;
+		fprintf(stderr, "pktring: mmap: %s\n", strerror(errno));
+		goto ERR;
+	}
+
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_IP);
+	if (ifname != NULL) {
+		snprintf(r->ifname, sizeof(r->ifname), "%s", ifname);
+		if ((sll.sll_ifindex = if_nametoindex(ifname)) == 0) {
+			fprintf(stderr, "pktring: unknown interface '%s'\n", ifname);
+			goto ERR;
+		}
+	}
+	else
+		strcpy(r->ifname, "any");
+	if (bind(r->fd, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+		fprintf(stderr, "pktring: bind to '%s': %s\n", r->ifname, strerror(errno));
+		goto ERR;
+	}
+	return 0;
+
+ERR:
+	pktring_rx_close(r);
+	return -1;
+}  /* pktring_rx_open */
+
+
+/* Wait up to 'timeout_ms' (-1 = forever) for the next block, pass every UDP
+ * payload in it to 'cb' without copying, and give the block back to the
+ * kernel.  Returns the number of datagrams, 0 on timeout, -1 on error. */
+int pktring_rx_poll(pkt_rxring *r, int timeout_ms, pktring_rx_cb cb, void *arg)
+{
+	struct tpacket_block_desc *bd;
+	struct tpacket3_hdr *pkt;
+	struct sockaddr_in src;
+	int i, num_pkts, count = 0;
+
+	bd = (struct tpacket_block_desc *)(r->ring + (size_t)r->cur_block * r->block_size);
+	while ((*(volatile unsigned int *)&bd->hdr.bh1.block_status & TP_STATUS_USER) == 0) {
+		struct pollfd pfd;
+		int rtn;
+		pfd.fd = r->fd;  pfd.events = POLLIN | POLLERR;  pfd.revents = 0;
+		rtn = poll(&pfd, 1, timeout_ms);
+		if (rtn < 0 && errno != EINTR) {
+			fprintf(stderr, "pktring: poll: %s\n", strerror(errno));
+			return -1;
+		}
+		if (rtn == 0)
+			return 0;
+	}
+	__sync_synchronize();  /* block status before block contents */
+
+	memset(&src, 0, sizeof(src));
+	src.sin_family = AF_INET;
+	num_pkts = bd->hdr.bh1.num_pkts;
+	pkt = (struct tpacket3_hdr *)((char *)bd + bd->hdr.bh1.offset_to_first_pkt);
+	for (i = 0; i < num_pkts; ++i) {
+		const unsigned char *ip = (const unsigned char *)pkt + pkt->tp_net;
+		int ihl = (ip[0] & 0x0f) * 4;
+		int len = ((ip[ihl + 4] << 8) | ip[ihl + 5]) - 8;
+
+		/* the filter guarantees IPv4/UDP; still respect the snap length */
+		if (len >= 0 && (unsigned int)(ihl + 8 + len) <= pkt->tp_snaplen) {
+			memcpy(&src.sin_addr.s_addr, ip + 12, 4);
+			memcpy(&src.sin_port, ip + ihl, 2);
+			cb(arg, (const char *)ip + ihl + 8, len, &src,
+				(TLONGLONG)pkt->tp_sec * 1000000000 + pkt->tp_nsec);
+			++count;
+		}
+		pkt = (struct tpacket3_hdr *)((char *)pkt + pkt->tp_next_offset);
+	}
+
+	__sync_synchronize();
+	bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+	if (++r->cur_block == r->block_nr)
+		r->cur_block = 0;
+	return count;
+}  /* pktring_rx_poll */
+
+
+/* Add the kernel's counters since the last call to r->packets/drops. */
+void pktring_rx_stats(pkt_rxring *r)
+{
+	struct tpacket_stats_v3 st;
+	socklen_t len = sizeof(st);
+
+	/* reading clears the kernel's counters; atomic adds because mdump's
+	 * interval reporter may call this from another thread */
+	if (getsockopt(r->fd, SOL_PACKET, PACKET_STATISTICS, &st, &len) == 0) {
+		__atomic_fetch_add(&r->packets, st.tp_packets, __ATOMIC_RELAXED);  /* includes drops */
+		__atomic_fetch_add(&r->drops, st.tp_drops, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&r->freezes, st.tp_freeze_q_cnt, __ATOMIC_RELAXED);
+	}
+}  /* pktring_rx_stats */
+
+
+void pktring_rx_close(pkt_rxring *r)
+{
+	if (r->ring != NULL)
+		munmap(r->ring, r->ring_size);
+	if (r->fd >= 0)
+		close(r->fd);
+	r->ring = NULL;
+	r->fd = -1;
+}  /* pktring_rx_close */
+
+#else  /* !__linux__ */
+
+int pktring_tx_open(pkt_txring *r, const char *ifname, const struct sockaddr_in *src,
+		const struct sockaddr_in *dst, int ttl, const char *payload, int max_len, int decimal)
+{
+	memset(r, 0, sizeof(*r));
+	r->fd = -1;
+	fprintf(stderr, "pktring: PACKET_MMAP rings are only available on Linux\n");
+	return -1;
+}  /* pktring_tx_open */
+
+int pktring_tx_flush(pkt_txring *r, int wait)
+{
+	return -1;
+}  /* pktring_tx_flush */
+
+int pktring_tx_send(pkt_txring *r, int len, unsigned int seq)
+{
+	return -1;
+}  /* pktring_tx_send */
+
+void pktring_tx_close(pkt_txring *r)
+{
+}  /* pktring_tx_close */
+
+int pktring_rx_open(pkt_rxring *r, const char *ifname, unsigned int group,
+		unsigned short port, int ring_bytes)
+{
+	memset(r, 0, sizeof(*r));
+	r->fd = -1;
+	fprintf(stderr, "pktring: PACKET_MMAP rings are only available on Linux\n");
+	return -1;
+}  /* pktring_rx_open */
+
+int pktring_rx_poll(pkt_rxring *r, int timeout_ms, pktring_rx_cb cb, void *arg)
+{
+	return -1;
+}  /* pktring_rx_poll */
+
+void pktring_rx_stats(pkt_rxring *r)
+{
+}  /* pktring_rx_stats */
+
+void pktring_rx_close(pkt_rxring *r)
+{
+}  /* pktring_rx_close */
+
+int pktring_mute_socket(int fd)
+{
+	return -1;
+}  /* pktring_mute_socket */
+
+#endif  /* __linux__ */
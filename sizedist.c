@@ -0,0 +1,275 @@
+/* sizedist.c */
+/*   Message size distributions and recorded traces for msend.  Everything
+ * random is drawn once, up front, into a table; the send loop only walks
+ * the table.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted without restriction.
+ *
+  THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+  EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+  NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+  PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+  UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+  BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+  INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+  TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+  THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+#include "mtools.h"
+
+#include <math.h>
+
+#define SD_TWO_PI 6.283185307179586
+
+typedef struct cdf_point {
+    int size;
+    double prob;  /* cumulative probability, 0..1 */
+} cdf_point;
+
+
+/* xorshift64* - small, fast, and good enough for picking message sizes */
+static double sd_uniform(unsigned long long *state)
+{
+	unsigned long long x = *state;
+	x ^= x >> 12;  x ^= x << 25;  x ^= x >> 27;
+	*state = x;
+	return (double)((x * 0x2545F4914F6CDD1DULL) >> 11) / 9007199254740992.0;  /* [0,1) */
+}  /* sd_uniform */
+
+
+static double sd_normal(unsigned long long *state, double mean, double stddev)
+{
+	double u1 = sd_uniform(state), u2 = sd_uniform(state);
+
+	if (u1 < 1e-300)
+		u1 = 1e-300;
+	return mean + stddev * sqrt(-2.0 * log(u1)) * cos(SD_TWO_PI * u2);
+}  /* sd_normal */
+
+
+static int sd_clamp(double size, int min_size, int max_size)
+{
+	if (size < min_size)
+		return min_size;
+	if (size > max_size)
+		return max_size;
+	return (int)(size + 0.5);
+}  /* sd_clamp */
+
+
+/* Read "size cumulative_prob" pairs (prob as a fraction or a percentage). */
+static cdf_point *sd_load_cdf(const char *file, int *num_points)
+{
+	FILE *fp;
+	char line[256];
+	cdf_point *pts = NULL;
+	int num = 0, alloced = 0, i;
+	double scale;
+
+	if ((fp = fopen(file, "r")) == NULL) {
+		fprintf(stderr, "sizedist: cannot open cdf file '%s': %s\n", file, strerror(errno));
+		return NULL;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		int size;  double prob;
+		if (line[0] == '#' || sscanf(line, "%d%*[ \t,]%lf", &size, &prob) != 2)
+			continue;
+		if (num == alloced) {
+			cdf_point *more;
+			alloced = alloced ? alloced * 2 : 64;
+			more = (cdf_point *)realloc(pts, alloced * sizeof(cdf_point));
+			if (more == NULL) { free(pts); fclose(fp); fprintf(stderr, "sizedist: malloc failed\n"); return NULL; }
+			pts = more;
+		}
+		pts[num].size = size;
+		pts[num].prob = prob;
+		++num;
+	}
+	fclose(fp);
+
+	if (num == 0) {
+		fprintf(stderr, "sizedist: no 'size probability' lines in '%s'\n", file);
+		free(pts);
+		return NULL;
+	}
+	scale = (pts[num-1].prob > 1.0) ? 100.0 : 1.0;  /* percentages? */
+	for (i = 0; i < num; ++i) {
+		pts[i].prob /= scale;
+		if (i > 0 && pts[i].prob < pts[i-1].prob) {
+			fprintf(stderr, "sizedist: '%s' line %d: cumulative probability decreases\n", file, i+1);
+			free(pts);
+			return NULL;
+		}
+	}
+	pts[num-1].prob = 1.0;  /* tolerate rounding in the last line */
+	*num_points = num;
+	return pts;
+}  /* sd_load_cdf */
+
+
+static int sd_sample_cdf(const cdf_point *pts, int num, double u)
+{
+	int lo = 0, hi = num - 1;
+
+	while (lo < hi) {  /* first point with prob >= u */
+		int mid = (lo + hi) / 2;
+		if (pts[mid].prob < u)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return pts[lo].size;
+}  /* sd_sample_cdf */
+
+
+/* Build a table of 'num_entries' sizes from a distribution spec:
+ *   uniform:min,max
+ *   normal:mean,stddev
+ *   bimodal:mean1,stddev1,mean2,stddev2,pct1
+ *   cdf:file  (lines of "size cumulative_probability")
+ * Returns 0 on success, -1 (after printing why) on error. */
+int sizedist_build(size_table *tbl, const char *spec, int num_entries, unsigned long long seed)
+{
+	double a = 0, b = 0, c = 0, d = 0, e = 0;
+	unsigned long long state = seed ? seed : 0x9E3779B97F4A7C15ULL;
+	cdf_point *pts = NULL;
+	int num_pts = 0, i;
+	const char *args = strchr(spec, ':');
+
+	memset(tbl, 0, sizeof(*tbl));
+	if (args == NULL) {
+		fprintf(stderr, "sizedist: '%s' should be <distribution>:<parameters>\n", spec);
+		return -1;
+	}
+	++args;
+
+	if (strncmp(spec, "uniform:", 8) == 0) {
+		if (sscanf(args, "%lf,%lf", &a, &b) != 2 || a < 0 || b < a) {
+			fprintf(stderr, "sizedist: expected uniform:min,max\n");
+			return -1;
+		}
+	} else if (strncmp(spec, "normal:", 7) == 0) {
+		if (sscanf(args, "%lf,%lf", &a, &b) != 2 || b < 0) {
+			fprintf(stderr, "sizedist: expected normal:mean,stddev\n");
+			return -1;
+		}
+	} else if (strncmp(spec, "bimodal:", 8) == 0) {
+		if (sscanf(args, "%lf,%lf,%lf,%lf,%lf", &a, &b, &c, &d, &e) != 5 || e < 0 || e > 100) {
+			fprintf(stderr, "sizedist: expected bimodal:mean1,stddev1,mean2,stddev2,pct1\n");
+			return -1;
+		}
+	} else if (strncmp(spec, "cdf:", 4) == 0) {
+		if ((pts = sd_load_cdf(args, &num_pts)) == NULL)
+			return -1;
+	} else {
+		fprintf(stderr, "sizedist: unknown distribution '%s'\n", spec);
+		return -1;
+	}
+
+	tbl->sizes = (int *)malloc(num_entries * sizeof(int));
+	if (tbl->sizes == NULL) {
+		fprintf(stderr, "sizedist: malloc failed\n");
+		free(pts);
+		return -1;
+	}
+	tbl->num = num_entries;
+
+	for (i = 0; i < num_entries; ++i) {
+		double size;
+		switch (spec[0]) {
+		  case 'u':
+			size = a + (b - a + 1) * sd_uniform(&state) - 0.5;
+			break;
+		  case 'n':
+			size = sd_normal(&state, a, b);
+			break;
+		  case 'b':
+			if (sd_uniform(&state) * 100.0 < e)
+				size = sd_normal(&state, a, b);
+			else
+				size = sd_normal(&state, c, d);
+			break;
+		  default:
+			size = sd_sample_cdf(pts, num_pts, sd_uniform(&state));
+			break;
+		}
+		tbl->sizes[i] = sd_clamp(size, SIZEDIST_MIN_SIZE, SIZEDIST_MAX_SIZE);
+	}
+
+	free(pts);
+	return 0;
+}  /* sizedist_build */
+
+
+/* Load a recorded trace: one message per line, "gap_us size", where gap_us
+ * is the (possibly fractional) time since the previous message.  Returns 0
+ * on success, -1 (after printing why) on error. */
+int sizedist_load_trace(size_table *tbl, const char *file)
+{
+	FILE *fp;
+	char line[256];
+	int alloced = 0;
+
+	memset(tbl, 0, sizeof(*tbl));
+	if ((fp = fopen(file, "r")) == NULL) {
+		fprintf(stderr, "sizedist: cannot open trace file '%s': %s\n", file, strerror(errno));
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		double gap_us;  int size;
+		if (line[0] == '#' || sscanf(line, "%lf%*[ \t,]%d", &gap_us, &size) != 2)
+			continue;
+		if (tbl->num == alloced) {
+			int *sizes;  TLONGLONG *gaps_ns = NULL;
+			alloced = alloced ? alloced * 2 : 1024;
+			if ((sizes = (int *)realloc(tbl->sizes, alloced * sizeof(int))) != NULL) {
+				tbl->sizes = sizes;
+				gaps_ns = (TLONGLONG *)realloc(tbl->gaps_ns, alloced * sizeof(TLONGLONG));
+			}
+			if (sizes == NULL || gaps_ns == NULL) {  /* no half-grown table */
+				free(tbl->sizes);  free(tbl->gaps_ns);
+				memset(tbl, 0, sizeof(*tbl));
+				fclose(fp);
+				fprintf(stderr, "sizedist: malloc failed\n");
+				return -1;
+			}
+			tbl->gaps_ns = gaps_ns;
+		}
+		tbl->sizes[tbl->num] = sd_clamp(size, SIZEDIST_MIN_SIZE, SIZEDIST_MAX_SIZE);
+		tbl->gaps_ns[tbl->num] = (gap_us > 0) ? (TLONGLONG)(gap_us * 1000.0) : 0;
+		++tbl->num;
+	}
+	fclose(fp);
+
+	if (tbl->num == 0) {
+		fprintf(stderr, "sizedist: no 'gap_us size' lines in '%s'\n", file);
+		return -1;
+	}
+	return 0;
+}  /* sizedist_load_trace */
+
+
+/* Summarize a table (for the start-of-test banner). */
+void sizedist_stats(const size_table *tbl, int *min_size, double *mean_size, int *max_size)
+{
+	int i;
+	double sum = 0;
+
+	*min_size = *max_size = tbl->num ? tbl->sizes[0] : 0;
+	for (i = 0; i < tbl->num; ++i) {
+		if (tbl->sizes[i] < *min_size) *min_size = tbl->sizes[i];
+		if (tbl->sizes[i] > *max_size) *max_size = tbl->sizes[i];
+		sum += tbl->sizes[i];
+	}
+	*mean_size = tbl->num ? sum / tbl->num : 0;
+}  /* sizedist_stats */
+
+
+void sizedist_free(size_table *tbl)
+{
+	free(tbl->sizes);
+	free(tbl->gaps_ns);
+	memset(tbl, 0, sizeof(*tbl));
+}  /* sizedist_free */
@@ -0,0 +1,244 @@
+/* sockfilt.c */
+/*   Receive filters for UDP sockets: a short expression (source address,
+ * source port, payload length, payload prefix) compiled to a classic BPF
+ * program and attached with SO_ATTACH_FILTER, so the kernel drops unwanted
+ * datagrams before they take receive-buffer space or wake the reader.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted without restriction.
+ *
+  THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+  EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+  NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+  PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+  UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+  BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+  INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+  TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+  THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+/* A filter on a UDP socket runs after the IP header has been pulled, so
+ * offset 0 is the UDP header, the payload starts at 8 and the packet length
+ * includes the 8 header bytes; the source address is read through the
+ * SKF_NET_OFF window.  A load past the end of the packet ends the program
+ * with "drop", so every payload load is preceded by a length check.
+ *
+ * The msend/mdump "echo ..." and "stat ..." control messages pass the
+ * length and prefix tests (they are not data), but not the address and
+ * port tests, so another sender's 'stat' is still filtered out. */
+
+#include "mtools.h"
+
+#if defined(__linux__)
+#include <linux/filter.h>
+#endif
+
+#define SF_MAX_INSNS 64
+#define SF_ACCEPT 0xfe  /* jump placeholders, resolved at the end */
+#define SF_DROP 0xff
+
+
+static int sf_parse_range(const char *val, int *lo, int *hi, int max)
+{
+	char *end;
+
+	*lo = (int)strtol(val, &end, 0);
+	if (end == val)
+		return -1;
+	if (*end == '-')
+		*hi = (int)strtol(end + 1, &end, 0);
+	else
+		*hi = *lo;
+	if (*end != '\0' || *lo < 0 || *hi < *lo || *hi > max)
+		return -1;
+	return 0;
+}  /* sf_parse_range */
+
+
+/* Parse "term[,term...]"; every term must match:
+ *   src=a.b.c.d[/bits]   source address (or subnet)
+ *   sport=port[-port]    source port (or range)
+ *   len=min[-max]        payload length in bytes
+ *   prefix=text          payload starts with 'text' ("0x..." for hex bytes)
+ * Returns 0, or -1 after printing why. */
+int sockfilt_parse(sockfilt *f, const char *expr)
+{
+	char buf[512], *term;
+
+	memset(f, 0, sizeof(*f));
+	f->sport_lo = f->len_min = -1;
+	if (strlen(expr) >= sizeof(buf)) {
+		fprintf(stderr, "sockfilt: filter too long\n");
+		return -1;
+	}
+	strcpy(buf, expr);
+
+	for (term = strtok(buf, ","); term != NULL; term = strtok(NULL, ",")) {
+		char *val = strchr(term, '=');
+		if (val == NULL) {
+			fprintf(stderr, "sockfilt: '%s' should be name=value\n", term);
+			return -1;
+		}
+		*val++ = '\0';
+
+		if (strcmp(term, "src") == 0) {
+			char *slash = strchr(val, '/');
+			int bits = 32;
+			if (slash != NULL) {
+				*slash = '\0';
+				bits = atoi(slash + 1);
+			}
+			if (bits < 1 || bits > 32 || inet_addr(val) == INADDR_NONE) {
+				fprintf(stderr, "sockfilt: bad src '%s'\n", val);
+				return -1;
+			}
+			f->src_mask = (bits == 32) ? 0xffffffff : ~(0xffffffffU >> bits);
+			f->src_addr = ntohl(inet_addr(val)) & f->src_mask;
+			f->have_src = 1;
+		}
+		else if (strcmp(term, "sport") == 0) {
+			if (sf_parse_range(val, &f->sport_lo, &f->sport_hi, 65535) < 0) {
+				fprintf(stderr, "sockfilt: bad sport '%s'\n", val);
+				return -1;
+			}
+		}
+		else if (strcmp(term, "len") == 0) {
+			if (sf_parse_range(val, &f->len_min, &f->len_max, 65535) < 0) {
+				fprintf(stderr, "sockfilt: bad len '%s'\n", val);
+				return -1;
+			}
+		}
+		else if (strcmp(term, "prefix") == 0) {
+			int i, n;
+			if (strncmp(val, "0x", 2) == 0) {
+				n = (int)strlen(val + 2);
+				if (n == 0 || n % 2 != 0 || n / 2 > (int)sizeof(f->prefix)) {
+					fprintf(stderr, "sockfilt: bad hex prefix '%s'\n", val);
+					return -1;
+				}
+				for (i = 0; i < n / 2; ++i) {
+					unsigned int byte;
+					if (sscanf(val + 2 + 2*i, "%2x", &byte) != 1) {
+						fprintf(stderr, "sockfilt: bad hex prefix '%s'\n", val);
+						return -1;
+					}
+					f->prefix[i] = (unsigned char)byte;
+				}
+				f->prefix_len = n / 2;
+			}
+			else {
+				n = (int)strlen(val);
+				if (n == 0 || n > (int)sizeof(f->prefix)) {
+					fprintf(stderr, "sockfilt: prefix must be 1 to %d bytes\n", (int)sizeof(f->prefix));
+					return -1;
+				}
+				memcpy(f->prefix, val, n);
+				f->prefix_len = n;
+			}
+		}
+		else {
+			fprintf(stderr, "sockfilt: unknown filter term '%s'\n", term);
+			return -1;
+		}
+	}
+	return 0;
+}  /* sockfilt_parse */
+
+
+#if defined(__linux__)
+
+/* Compile the filter.  Returns the number of instructions. */
+static int sf_compile(const sockfilt *f, struct sock_filter *prog)
+{
+	int n = 0, accept, i;
+
+	if (f->have_src) {
+		prog[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12);
+		if (f->src_mask != 0xffffffff)
+			prog[n++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_AND | BPF_K, f->src_mask);
+		prog[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, f->src_addr, 0, SF_DROP);
+	}
+	if (f->sport_lo >= 0) {
+		prog[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 0);  /* UDP source port */
+		prog[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, f->sport_lo, 0, SF_DROP);
+		prog[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, f->sport_hi, SF_DROP, 0);
+	}
+
+	if (f->len_min >= 0 || f->prefix_len > 0) {
+		/* let "echo ..." and "stat ..." through (mdump wants more than 5 bytes) */
+		prog[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0);
+		prog[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, 8 + 5, 0, 3);
+		prog[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 8);
+		prog[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x6563686f, SF_ACCEPT, 0);  /* "echo" */
+		prog[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x73746174, SF_ACCEPT, 0);  /* "stat" */
+	}
+	if (f->len_min >= 0) {
+		prog[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0);
+		prog[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 8 + f->len_min, 0, SF_DROP);
+		prog[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, 8 + f->len_max, SF_DROP, 0);
+	}
+	if (f->prefix_len > 0) {
+		const unsigned char *p = f->prefix;
+		int off = 0;
+		prog[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0);
+		prog[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 8 + f->prefix_len, 0, SF_DROP);
+		while (off < f->prefix_len) {
+			int left = f->prefix_len - off;
+			if (left >= 4) {
+				prog[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 8 + off);
+				prog[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+					((unsigned int)p[off] << 24) | (p[off+1] << 16) | (p[off+2] << 8) | p[off+3], 0, SF_DROP);
+				off += 4;
+			}
+			else if (left >= 2) {
+				prog[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 8 + off);
+				prog[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+					(p[off] << 8) | p[off+1], 0, SF_DROP);
+				off += 2;
+			}
+			else {
+				prog[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 8 + off);
+				prog[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, p[off], 0, SF_DROP);
+				off += 1;
+			}
+		}
+	}
+
+	accept = n;
+	prog[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0xffffffff);
+	prog[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);  /* drop */
+
+	/* resolve the placeholders */
+	for (i = 0; i < accept; ++i) {
+		if (BPF_CLASS(prog[i].code) != BPF_JMP)
+			continue;
+		if (prog[i].jt == SF_ACCEPT) prog[i].jt = (unsigned char)(accept - i - 1);
+		else if (prog[i].jt == SF_DROP) prog[i].jt = (unsigned char)(accept - i);
+		if (prog[i].jf == SF_ACCEPT) prog[i].jf = (unsigned char)(accept - i - 1);
+		else if (prog[i].jf == SF_DROP) prog[i].jf = (unsigned char)(accept - i);
+	}
+	return n;
+}  /* sf_compile */
+
+#endif  /* __linux__ */
+
+
+/* Compile the filter and attach it to 'sock'.  Returns the number of BPF
+ * instructions, or -1 with errno set. */
+int sockfilt_attach(SOCKET sock, const sockfilt *f)
+{
+#if defined(__linux__)
+	struct sock_filter prog[SF_MAX_INSNS];
+	struct sock_fprog fprog;
+
+	fprog.len = (unsigned short)sf_compile(f, prog);
+	fprog.filter = prog;
+	if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) == SOCKET_ERROR)
+		return -1;
+	return fprog.len;
+#else
+	errno = EINVAL;
+	return -1;
+#endif
+}  /* sockfilt_attach */
@@ -0,0 +1,875 @@
+/* transport.c */
+/*   Datagram send/receive paths shared by msend, mdump and mpong: plain
+ * socket calls, or io_uring (Linux) with batched sends, multishot receive
+ * into a provided-buffer ring, and linked send+receive pairs.  Either way
+ * the transport counts datagrams, system calls and CPU time, so the cost
+ * per datagram of the two paths can be compared.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted without restriction.
+ *
+  THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+  EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+  NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+  PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+  UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+  BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+  INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+  TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+  THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+/* The io_uring code talks to the kernel directly (io_uring_setup/enter/
+ * register and the shared rings), so it needs only the kernel headers, not
+ * liburing.  It wants Linux 6.0 or later for multishot recvmsg.  SQPOLL
+ * adds a kernel thread that spins for up to MT_URING_SQ_IDLE_MS; it only
+ * pays off with a CPU to spare for it. */
+
+#include "mtools.h"
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <linux/io_uring.h>
+
+#define MT_URING_ENTRIES 256  /* SQ size, and the most sends in flight */
+#define MT_URING_CQ_ENTRIES 4096
+#define MT_URING_BATCH 32  /* queued sends per submission */
+#define MT_URING_SQ_IDLE_MS 100  /* SQPOLL thread sleeps after this long */
+#define MT_URING_BGID 0  /* provided buffer group */
+#define MT_CTRL_LEN 64  /* ancillary data space per received datagram (SO_RXQ_OVFL, SO_TIMESTAMPNS) */
+
+/* user_data tags */
+#define UD_SEND 0x100000000ULL  /* | slot */
+#define UD_RECV_MULTI 0x200000000ULL
+#define UD_RECV_ONE 0x300000000ULL
+#define UD_TAG(ud) ((ud) & 0xffffffff00000000ULL)
+
+typedef struct mt_slot {
+    struct msghdr msg;
+    struct iovec iov;
+    struct sockaddr_in to;
+    int len;
+    char *data;
+} mt_slot;
+
+typedef struct mt_uring {
+    int fd;
+    unsigned int sq_entries;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size;
+    unsigned int *sq_head, *sq_tail, *sq_mask, *sq_flags, *sq_array;
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned int sqe_tail;  /* local copy, published to *sq_tail */
+    unsigned int to_submit;
+
+    /* sends: copied into slots, freed when their completion arrives */
+    mt_slot *slots;
+    char *slot_data;
+    int *free_slots;
+    int num_free;
+    int send_errno;  /* first failed send, reported by the next call */
+
+    /* multishot receive into a ring of provided buffers */
+    struct io_uring_buf_ring *br;
+    size_t br_size;
+    char *bufs;
+    int buf_size, buf_count;
+    int recv_armed;
+    int held_bid;  /* buffer handed to the caller, recycled on the next call */
+    struct msghdr recv_msg;  /* template: only the name and control lengths matter */
+
+    /* single receive, linked behind a send (mt_transport_sendrecv) */
+    struct msghdr one_msg;
+    struct iovec one_iov;
+    struct sockaddr_in one_from;
+    char *one_buf;
+    int one_res;
+    int one_done;
+} mt_uring;
+
+
+static int sys_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}  /* sys_uring_setup */
+
+
+static int sys_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+		unsigned int flags, void *arg, size_t argsz)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}  /* sys_uring_enter */
+
+
+static TLONGLONG mt_cpu_ns(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ((TLONGLONG)ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000 +
+		((TLONGLONG)ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000;
+}  /* mt_cpu_ns */
+
+
+static struct io_uring_sqe *ur_get_sqe(mt_transport *t);
+static int ur_submit(mt_transport *t, unsigned int min_complete, int timeout_ms);
+
+
+/* Pick up the ancillary data the transport understands. */
+static void tr_parse_cmsg(mt_transport *t, struct msghdr *msg)
+{
+	struct cmsghdr *cmsg;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+			memcpy(&t->rxq_ovfl, CMSG_DATA(cmsg), sizeof(t->rxq_ovfl));
+			t->have_rxq_ovfl = 1;
+		}
+#if defined(SCM_TIMESTAMPNS)
+		else if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+			struct timespec ts;
+			memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+			t->rx_ns = (TLONGLONG)ts.tv_sec * 1000000000 + ts.tv_nsec;
+		}
+#endif
+	}
+}  /* tr_parse_cmsg */
+
+
+/* Set up the rings.  Returns 0, or -1 with errno set. */
+static int ur_open(mt_transport *t, int max_msg)
+{
+	mt_uring *u;
+	struct io_uring_params p;
+	int i;
+
+	u = (mt_uring *)calloc(1, sizeof(mt_uring));
+	if (u == NULL)
+		return -1;
+	t->uring = u;
+	u->fd = -1;
+	u->held_bid = -1;
+
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = MT_URING_CQ_ENTRIES;
+	if (t->flags & MT_URING_SQPOLL) {
+		p.flags |= IORING_SETUP_SQPOLL;
+		p.sq_thread_idle = MT_URING_SQ_IDLE_MS;
+	}
+	if ((u->fd = sys_uring_setup(MT_URING_ENTRIES, &p)) < 0)
+		return -1;
+	u->sq_entries = p.sq_entries;
+
+	u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (u->cq_ring_size > u->sq_ring_size)
+			u->sq_ring_size = u->cq_ring_size;
+		u->cq_ring_size = u->sq_ring_size;
+	}
+	u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if (u->sq_ring == MAP_FAILED)
+		return -1;
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		u->cq_ring = u->sq_ring;
+	else {
+		u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+		if (u->cq_ring == MAP_FAILED)
+			return -1;
+	}
+	u->sqes = (struct io_uring_sqe *)mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED)
+		return -1;
+
+	u->sq_head = (unsigned int *)((char *)u->sq_ring + p.sq_off.head);
+	u->sq_tail = (unsigned int *)((char *)u->sq_ring + p.sq_off.tail);
+	u->sq_mask = (unsigned int *)((char *)u->sq_ring + p.sq_off.ring_mask);
+	u->sq_flags = (unsigned int *)((char *)u->sq_ring + p.sq_off.flags);
+	u->sq_array = (unsigned int *)((char *)u->sq_ring + p.sq_off.array);
+	u->cq_head = (unsigned int *)((char *)u->cq_ring + p.cq_off.head);
+	u->cq_tail = (unsigned int *)((char *)u->cq_ring + p.cq_off.tail);
+	u->cq_mask = (unsigned int *)((char *)u->cq_ring + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)((char *)u->cq_ring + p.cq_off.cqes);
+	u->sqe_tail = *u->sq_tail;
+
+	/* send slots */
+	u->slots = (mt_slot *)calloc(u->sq_entries, sizeof(mt_slot));
+	u->slot_data = (char *)malloc((size_t)u->sq_entries * max_msg);
+	u->free_slots = (int *)malloc(u->sq_entries * sizeof(int));
+	if (u->slots == NULL || u->slot_data == NULL || u->free_slots == NULL)
+		return -1;
+	for (i = 0; i < (int)u->sq_entries; ++i) {
+		mt_slot *s = &u->slots[i];
+		s->data = u->slot_data + (size_t)i * max_msg;
+		s->iov.iov_base = s->data;
+		s->msg.msg_iov = &s->iov;
+		s->msg.msg_iovlen = 1;
+		u->free_slots[i] = i;
+	}
+	u->num_free = u->sq_entries;
+
+	u->one_buf = (char *)malloc(max_msg + 1);
+	if (u->one_buf == NULL)
+		return -1;
+	return 0;
+}  /* ur_open */
+
+
+/* Register the provided-buffer ring used by multishot receive (done on the
+ * first receive, so send-only users do not pay for it). */
+static int ur_setup_bufs(mt_transport *t)
+{
+	mt_uring *u = (mt_uring *)t->uring;
+	struct io_uring_buf_reg reg;
+	int i;
+
+	u->buf_count = 64;
+	while (u->buf_count < 4096 && (TLONGLONG)u->buf_count * 65536 < t->ring_bytes)
+		u->buf_count *= 2;  /* must be a power of two */
+	u->buf_size = (int)(sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) +
+			MT_CTRL_LEN + t->max_msg);
+	u->bufs = (char *)malloc((size_t)u->buf_count * u->buf_size);
+	u->br_size = u->buf_count * sizeof(struct io_uring_buf);
+	u->br = (struct io_uring_buf_ring *)mmap(NULL, u->br_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (u->bufs == NULL || u->br == MAP_FAILED) {
+		u->br = NULL;
+		errno = ENOMEM;
+		return -1;
+	}
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (unsigned long)u->br;
+	reg.ring_entries = u->buf_count;
+	reg.bgid = MT_URING_BGID;
+	if (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+		return -1;
+	for (i = 0; i < u->buf_count; ++i) {
+		u->br->bufs[i].addr = (unsigned long)(u->bufs + (size_t)i * u->buf_size);
+		u->br->bufs[i].len = u->buf_size;
+		u->br->bufs[i].bid = (unsigned short)i;
+	}
+	__atomic_store_n(&u->br->tail, (unsigned short)u->buf_count, __ATOMIC_RELEASE);
+
+	memset(&u->recv_msg, 0, sizeof(u->recv_msg));
+	u->recv_msg.msg_namelen = sizeof(struct sockaddr_in);
+	u->recv_msg.msg_controllen = MT_CTRL_LEN;
+	return 0;
+}  /* ur_setup_bufs */
+
+
+/* Give a provided buffer back to the kernel. */
+static void ur_recycle(mt_uring *u, int bid)
+{
+	unsigned short tail = u->br->tail;
+	struct io_uring_buf *b = &u->br->bufs[tail & (u->buf_count - 1)];
+
+	b->addr = (unsigned long)(u->bufs + (size_t)bid * u->buf_size);
+	b->len = u->buf_size;
+	b->bid = (unsigned short)bid;
+	__atomic_store_n(&u->br->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+}  /* ur_recycle */
+
+
+static struct io_uring_sqe *ur_get_sqe(mt_transport *t)
+{
+	mt_uring *u = (mt_uring *)t->uring;
+	struct io_uring_sqe *sqe;
+	unsigned int idx;
+
+	while (u->sqe_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries) {
+		if (ur_submit(t, 0, -1) < 0)  /* SQ full: push it to the kernel */
+			return NULL;
+	}
+	idx = u->sqe_tail & *u->sq_mask;
+	sqe = &u->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	u->sq_array[idx] = idx;
+	++u->sqe_tail;
+	++u->to_submit;
+	return sqe;
+}  /* ur_get_sqe */
+
+
+/* Publish queued SQEs and, if 'min_complete' > 0, wait for that many
+ * completions (up to 'timeout_ms', -1 = forever).  Returns 0, 1 on
+ * timeout, -1 with errno set on error. */
+static int ur_submit(mt_transport *t, unsigned int min_complete, int timeout_ms)
+{
+	mt_uring *u = (mt_uring *)t->uring;
+	unsigned int flags = 0, to_submit;
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	void *argp = NULL;
+	size_t argsz = 0;
+	int rtn;
+
+	__atomic_store_n(u->sq_tail, u->sqe_tail, __ATOMIC_RELEASE);
+	to_submit = u->to_submit;
+	u->to_submit = 0;
+
+	if (t->flags & MT_URING_SQPOLL) {
+		/* the kernel thread picks SQEs up by itself unless it went idle */
+		if (__atomic_load_n(u->sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_NEED_WAKEUP)
+			flags |= IORING_ENTER_SQ_WAKEUP;
+		to_submit = 0;
+		if (flags == 0 && min_complete == 0)
+			return 0;
+	}
+	else if (to_submit == 0 && min_complete == 0)
+		return 0;
+
+	if (min_complete > 0) {
+		flags |= IORING_ENTER_GETEVENTS;
+		if (timeout_ms >= 0) {
+			memset(&arg, 0, sizeof(arg));
+			ts.tv_sec = timeout_ms / 1000;
+			ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+			arg.sigmask_sz = _NSIG / 8;
+			arg.ts = (unsigned long)&ts;
+			flags |= IORING_ENTER_EXT_ARG;
+			argp = &arg;
+			argsz = sizeof(arg);
+		}
+	}
+
+	++t->syscalls;
+	rtn = sys_uring_enter(u->fd, to_submit, min_complete, flags, argp, argsz);
+	if (rtn < 0) {
+		if (errno == ETIME)
+			return 1;
+		if (errno == EINTR)
+			return 0;
+		return -1;
+	}
+	return 0;
+}  /* ur_submit */
+
+
+/* Handle one completion (not the multishot receive's, the caller does
+ * those).  Returns the CQE if it belongs to the receive, else NULL. */
+static struct io_uring_cqe *ur_reap_one(mt_transport *t, int *have)
+{
+	mt_uring *u = (mt_uring *)t->uring;
+	unsigned int head = *u->cq_head;
+	struct io_uring_cqe *cqe;
+	unsigned long long ud;
+
+	*have = 0;
+	if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+		return NULL;
+	*have = 1;
+	cqe = &u->cqes[head & *u->cq_mask];
+	ud = cqe->user_data;
+
+	if (UD_TAG(ud) == UD_SEND) {
+		mt_slot *s = &u->slots[ud & 0xffffffff];
+		if (cqe->res < 0 && u->send_errno == 0)
+			u->send_errno = -cqe->res;
+		else if (cqe->res >= 0 && cqe->res != s->len && u->send_errno == 0)
+			u->send_errno = EMSGSIZE;
+		u->free_slots[u->num_free++] = (int)(ud & 0xffffffff);
+	}
+	else if (UD_TAG(ud) == UD_RECV_ONE) {
+		u->one_res = cqe->res;
+		u->one_done = 1;
+	}
+	else if (UD_TAG(ud) == UD_RECV_MULTI)
+		return cqe;  /* caller consumes it */
+
+	__atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+	return NULL;
+}  /* ur_reap_one */
+
+
+/* Reap every completion that is already there (no system call). */
+static void ur_reap_ready(mt_transport *t)
+{
+	int have = 1;
+
+	while (have) {
+		if (ur_reap_one(t, &have) != NULL)
+			break;  /* a receive: leave it for mt_transport_recv() */
+	}
+}  /* ur_reap_ready */
+
+
+static void ur_close(mt_transport *t)
+{
+	mt_uring *u = (mt_uring *)t->uring;
+
+	if (u == NULL)
+		return;
+	if (u->fd >= 0)
+		close(u->fd);  /* also cancels a pending multishot receive */
+	if (u->sqes != NULL && u->sqes != MAP_FAILED)
+		munmap(u->sqes, u->sq_entries * sizeof(struct io_uring_sqe));
+	if (u->cq_ring != NULL && u->cq_ring != MAP_FAILED && u->cq_ring != u->sq_ring)
+		munmap(u->cq_ring, u->cq_ring_size);
+	if (u->sq_ring != NULL && u->sq_ring != MAP_FAILED)
+		munmap(u->sq_ring, u->sq_ring_size);
+	if (u->br != NULL)
+		munmap(u->br, u->br_size);
+	free(u->bufs);
+	free(u->one_buf);
+	free(u->free_slots);
+	free(u->slot_data);
+	free(u->slots);
+	free(u);
+	t->uring = NULL;
+}  /* ur_close */
+
+#else  /* !__linux__ */
+
+static TLONGLONG mt_cpu_ns(void)
+{
+#if defined(_WIN32)
+	FILETIME created, exited, kernel, user;
+	ULARGE_INTEGER k, u;
+
+	GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user);
+	k.LowPart = kernel.dwLowDateTime;  k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime;  u.HighPart = user.dwHighDateTime;
+	return (TLONGLONG)(k.QuadPart + u.QuadPart) * 100;
+#else
+	return (TLONGLONG)clock() * (1000000000 / CLOCKS_PER_SEC);
+#endif
+}  /* mt_cpu_ns */
+
+#endif  /* __linux__ */
+
+
+/* Parse "socket", "uring" or "uring,sqpoll".  Returns 0, or -1 if unknown. */
+int mt_transport_parse(const char *spec, int *kind, int *flags)
+{
+	*flags = 0;
+	if (strcmp(spec, "socket") == 0)
+		*kind = MT_TRANSPORT_SOCKET;
+	else if (strcmp(spec, "uring") == 0)
+		*kind = MT_TRANSPORT_URING;
+	else if (strcmp(spec, "uring,sqpoll") == 0) {
+		*kind = MT_TRANSPORT_URING;
+		*flags = MT_URING_SQPOLL;
+	}
+	else
+		return -1;
+	return 0;
+}  /* mt_transport_parse */
+
+
+/* Wrap an open, configured UDP socket.  'max_msg' is the largest datagram
+ * to be sent or received; 'ring_bytes' sizes the io_uring receive buffers
+ * (typically the SO_RCVBUF size).  Returns 0, or -1 after printing why. */
+int mt_transport_open(mt_transport *t, int kind, int flags, SOCKET sock, int max_msg, int ring_bytes)
+{
+	memset(t, 0, sizeof(*t));
+	t->kind = kind;
+	t->flags = flags;
+	t->sock = sock;
+	t->max_msg = max_msg;
+	t->ring_bytes = ring_bytes;
+
+	if (kind == MT_TRANSPORT_SOCKET) {
+		t->buf = (char *)malloc(max_msg + 1);
+		if (t->buf == NULL) {
+			fprintf(stderr, "transport: malloc failed\n");
+			return -1;
+		}
+	}
+	else {
+#if defined(__linux__)
+		if (ur_open(t, max_msg) < 0) {
+			fprintf(stderr, "transport: io_uring setup: %s%s\n", strerror(errno),
+				(errno == ENOSYS || errno == EPERM) ? " (io_uring disabled?)" : "");
+			ur_close(t);
+			return -1;
+		}
+#else
+		fprintf(stderr, "transport: io_uring is only available on Linux\n");
+		return -1;
+#endif
+	}
+	t->start_cpu_ns = mt_cpu_ns();
+	return 0;
+}  /* mt_transport_open */
+
+
+/* Send one datagram.  With io_uring the data is copied and queued, and
+ * submitted in batches; call mt_transport_flush() at the end of a burst.
+ * Returns 0, or -1 with errno set (for io_uring possibly from an earlier
+ * send whose completion has just been seen). */
+int mt_transport_send(mt_transport *t, const char *buf, int len, const struct sockaddr_in *to)
+{
+	++t->sends;
+	if (t->kind == MT_TRANSPORT_SOCKET) {
+		int rtn;
+		++t->syscalls;
+		rtn = sendto(t->sock, buf, len, 0, (const struct sockaddr *)to, sizeof(*to));
+		if (rtn == SOCKET_ERROR)
+			return -1;
+		if (rtn != len) {
+			errno = EMSGSIZE;
+			return -1;
+		}
+		return 0;
+	}
+#if defined(__linux__)
+	{
+		mt_uring *u = (mt_uring *)t->uring;
+		struct io_uring_sqe *sqe;
+		mt_slot *s;
+		int idx;
+
+		ur_reap_ready(t);
+		while (u->num_free == 0) {  /* everything in flight: wait for one */
+			if (ur_submit(t, 1, -1) < 0)
+				return -1;
+			ur_reap_ready(t);
+		}
+		if (u->send_errno != 0) {
+			errno = u->send_errno;
+			return -1;
+		}
+
+		idx = u->free_slots[--u->num_free];
+		s = &u->slots[idx];
+		memcpy(s->data, buf, len);
+		s->len = len;
+		s->iov.iov_len = len;
+		s->to = *to;
+		s->msg.msg_name = &s->to;
+		s->msg.msg_namelen = sizeof(s->to);
+
+		if ((sqe = ur_get_sqe(t)) == NULL)
+			return -1;
+		sqe->opcode = IORING_OP_SENDMSG;
+		sqe->fd = t->sock;
+		sqe->addr = (unsigned long)&s->msg;
+		sqe->len = 1;
+		sqe->user_data = UD_SEND | idx;
+		if (u->to_submit >= MT_URING_BATCH)
+			return (ur_submit(t, 0, -1) < 0) ? -1 : 0;
+		return 0;
+	}
+#else
+	errno = EINVAL;
+	return -1;
+#endif
+}  /* mt_transport_send */
+
+
+/* Submit queued sends; with 'wait', also wait until all have completed.
+ * Returns 0, or -1 with errno set. */
+int mt_transport_flush(mt_transport *t, int wait)
+{
+#if defined(__linux__)
+	mt_uring *u = (mt_uring *)t->uring;
+
+	if (t->kind == MT_TRANSPORT_SOCKET)
+		return 0;
+	if (ur_submit(t, 0, -1) < 0)
+		return -1;
+	ur_reap_ready(t);
+	while (wait && u->num_free < (int)u->sq_entries) {
+		if (ur_submit(t, 1, -1) < 0)
+			return -1;
+		ur_reap_ready(t);
+	}
+	if (u->send_errno != 0) {
+		errno = u->send_errno;
+		return -1;
+	}
+#endif
+	return 0;
+}  /* mt_transport_flush */
+
+
+/* Receive one datagram, waiting up to 'timeout_ms' (-1 = forever).  '*data'
+ * points into the transport's buffers and stays valid until the next call.
+ * Returns the length, 0 on timeout (a zero-length datagram is reported as
+ * length 0 too), or -1 with errno set. */
+int mt_transport_recv(mt_transport *t, const char **data, struct sockaddr_in *from, int timeout_ms)
+{
+	if (t->kind == MT_TRANSPORT_SOCKET) {
+		int rtn;
+		socklen_t fromlen = sizeof(*from);
+
+		if (timeout_ms >= 0) {
+			fd_set rfds;
+			struct timeval tv;
+			FD_ZERO(&rfds);
+			FD_SET(t->sock, &rfds);
+			tv.tv_sec = timeout_ms / 1000;
+			tv.tv_usec = (timeout_ms % 1000) * 1000;
+			++t->syscalls;
+			if ((rtn = select((int)t->sock + 1, &rfds, NULL, NULL, &tv)) <= 0)
+				return rtn;
+		}
+		++t->syscalls;
+#if defined(__linux__)
+		{
+			struct msghdr msg;
+			struct iovec iov;
+			char cbuf[MT_CTRL_LEN];
+
+			iov.iov_base = t->buf;
+			iov.iov_len = t->max_msg;
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_name = from;
+			msg.msg_namelen = fromlen;
+			msg.msg_iov = &iov;
+			msg.msg_iovlen = 1;
+			msg.msg_control = cbuf;
+			msg.msg_controllen = sizeof(cbuf);
+			if ((rtn = recvmsg(t->sock, &msg, 0)) == SOCKET_ERROR)
+				return -1;
+			t->rx_ns = 0;
+			if (msg.msg_controllen > 0)
+				tr_parse_cmsg(t, &msg);
+		}
+#else
+		rtn = recvfrom(t->sock, t->buf, t->max_msg, 0, (struct sockaddr *)from, &fromlen);
+		if (rtn == SOCKET_ERROR)
+			return -1;
+#endif
+		++t->recvs;
+		*data = t->buf;
+		return rtn;
+	}
+#if defined(__linux__)
+	{
+		mt_uring *u = (mt_uring *)t->uring;
+		struct io_uring_cqe *cqe;
+		struct io_uring_recvmsg_out *out;
+		int have, res, bid, len;
+		unsigned int cqe_flags;
+
+		if (u->bufs == NULL && ur_setup_bufs(t) < 0)
+			return -1;
+		if (u->held_bid >= 0) {
+			ur_recycle(u, u->held_bid);
+			u->held_bid = -1;
+		}
+
+		for (;;) {
+			if (! u->recv_armed) {
+				struct io_uring_sqe *sqe = ur_get_sqe(t);
+				if (sqe == NULL)
+					return -1;
+				sqe->opcode = IORING_OP_RECVMSG;
+				sqe->fd = t->sock;
+				sqe->addr = (unsigned long)&u->recv_msg;
+				sqe->len = 1;
+				sqe->ioprio = IORING_RECV_MULTISHOT;
+				sqe->flags = IOSQE_BUFFER_SELECT;
+				sqe->buf_group = MT_URING_BGID;
+				sqe->user_data = UD_RECV_MULTI;
+				u->recv_armed = 1;
+			}
+
+			while ((cqe = ur_reap_one(t, &have)) == NULL && have)
+				;
+			if (cqe == NULL) {
+				int rtn = ur_submit(t, 1, timeout_ms);
+				if (rtn < 0)
+					return -1;
+				if (rtn == 1)
+					return 0;  /* timed out */
+				continue;
+			}
+
+			res = cqe->res;
+			cqe_flags = cqe->flags;
+			__atomic_store_n(u->cq_head, *u->cq_head + 1, __ATOMIC_RELEASE);
+			if ((cqe_flags & IORING_CQE_F_MORE) == 0)
+				u->recv_armed = 0;  /* multishot ended, re-arm next time round */
+			if (res < 0) {
+				if (res == -ENOBUFS)
+					continue;  /* all buffers were busy; datagrams wait in the socket */
+				errno = -res;
+				return -1;
+			}
+			if ((cqe_flags & IORING_CQE_F_BUFFER) == 0)
+				continue;
+
+			bid = cqe_flags >> IORING_CQE_BUFFER_SHIFT;
+			out = (struct io_uring_recvmsg_out *)(u->bufs + (size_t)bid * u->buf_size);
+			len = res - (int)(sizeof(*out) + u->recv_msg.msg_namelen + u->recv_msg.msg_controllen);
+			if (len > (int)out->payloadlen)
+				len = out->payloadlen;
+			if (len < 0)
+				len = 0;
+			memcpy(from, (char *)(out + 1), sizeof(*from));
+			t->rx_ns = 0;
+			if (out->controllen > 0) {
+				struct msghdr msg;
+				memset(&msg, 0, sizeof(msg));
+				msg.msg_control = (char *)(out + 1) + u->recv_msg.msg_namelen;
+				msg.msg_controllen = out->controllen;
+				tr_parse_cmsg(t, &msg);
+			}
+			*data = (char *)(out + 1) + u->recv_msg.msg_namelen + u->recv_msg.msg_controllen;
+			u->held_bid = bid;
+			++t->recvs;
+			return len;
+		}
+	}
+#else
+	errno = EINVAL;
+	return -1;
+#endif
+}  /* mt_transport_recv */
+
+
+/* Send a datagram (skipped if 'sbuf' is NULL) and then receive one.  With
+ * io_uring both are submitted together, the receive linked behind the send,
+ * with a single system call.  Returns the received length, or -1 with errno
+ * set. */
+int mt_transport_sendrecv(mt_transport *t, const char *sbuf, int slen, const struct sockaddr_in *to,
+		const char **rdata, struct sockaddr_in *from)
+{
+	if (t->kind == MT_TRANSPORT_SOCKET) {
+		if (sbuf != NULL && mt_transport_send(t, sbuf, slen, to) < 0)
+			return -1;
+		return mt_transport_recv(t, rdata, from, -1);
+	}
+#if defined(__linux__)
+	{
+		mt_uring *u = (mt_uring *)t->uring;
+		struct io_uring_sqe *sqe;
+		int nops = 1;
+
+		if (sbuf != NULL) {
+			if (mt_transport_send(t, sbuf, slen, to) < 0)
+				return -1;
+			u->sqes[(u->sqe_tail - 1) & *u->sq_mask].flags |= IOSQE_IO_LINK;
+			++nops;
+		}
+
+		u->one_iov.iov_base = u->one_buf;
+		u->one_iov.iov_len = t->max_msg;
+		memset(&u->one_msg, 0, sizeof(u->one_msg));
+		u->one_msg.msg_name = &u->one_from;
+		u->one_msg.msg_namelen = sizeof(u->one_from);
+		u->one_msg.msg_iov = &u->one_iov;
+		u->one_msg.msg_iovlen = 1;
+		if ((sqe = ur_get_sqe(t)) == NULL)
+			return -1;
+		sqe->opcode = IORING_OP_RECVMSG;
+		sqe->fd = t->sock;
+		sqe->addr = (unsigned long)&u->one_msg;
+		sqe->len = 1;
+		sqe->user_data = UD_RECV_ONE;
+
+		u->one_done = 0;
+		if (ur_submit(t, nops, -1) < 0)
+			return -1;
+		for (;;) {
+			ur_reap_ready(t);
+			if (u->one_done && u->num_free == (int)u->sq_entries)
+				break;
+			if (ur_submit(t, 1, -1) < 0)
+				return -1;
+		}
+		if (u->send_errno != 0) {
+			errno = u->send_errno;
+			return -1;
+		}
+		if (u->one_res < 0) {
+			errno = -u->one_res;
+			return -1;
+		}
+		++t->recvs;
+		*from = u->one_from;
+		*rdata = u->one_buf;
+		return u->one_res;
+	}
+#else
+	errno = EINVAL;
+	return -1;
+#endif
+}  /* mt_transport_sendrecv */
+
+
+/* One line of counters: datagrams, system calls and CPU per datagram
+ * since mt_transport_open(). */
+void mt_transport_report(mt_transport *t, FILE *fp)
+{
+	unsigned long long dgrams = t->sends + t->recvs;
+	double cpu_us = (mt_cpu_ns() - t->start_cpu_ns) / 1e3;
+
+	fprintf(fp, "%s transport: %llu sent, %llu received, %llu system calls, "
+		"%.3f us CPU per datagram\n",
+		(t->kind == MT_TRANSPORT_SOCKET) ? "socket" :
+			((t->flags & MT_URING_SQPOLL) ? "io_uring (sqpoll)" : "io_uring"),
+		t->sends, t->recvs, t->syscalls,
+		dgrams ? cpu_us / (double)dgrams : 0.0);
+	fflush(fp);
+}  /* mt_transport_report */
+
+
+void mt_transport_close(mt_transport *t)
+{
+#if defined(__linux__)
+	ur_close(t);
+#endif
+	free(t->buf);
+	t->buf = NULL;
+}  /* mt_transport_close */
+
+
+/* Set SO_SNDBUF or SO_RCVBUF and return the size the system actually
+ * granted (Linux reports double what it was asked), or -1 if it cannot be
+ * read back.  Failing to set it is left to the caller to notice. */
+int mt_set_sockbuf(SOCKET sock, int optname, int size)
+{
+	int cur_size, sz;
+
+	(void)setsockopt(sock, SOL_SOCKET, optname, (const char *)&size, sizeof(size));
+	sz = sizeof(cur_size);
+	if (getsockopt(sock, SOL_SOCKET, optname, (char *)&cur_size, (socklen_t *)&sz) == SOCKET_ERROR)
+		return -1;
+	return cur_size;
+}  /* mt_set_sockbuf */
+
+
+/* The kernel's count of datagrams dropped on this UDP socket (receive
+ * buffer full, or rejected by its filter), from /proc/net/udp.  Returns -1
+ * if it cannot be found (or not on Linux). */
+long long mt_udp_drops(SOCKET sock)
+{
+#if defined(__linux__)
+	struct stat st;
+	char line[512];
+	FILE *fp;
+	long long drops = -1;
+
+	if (fstat(sock, &st) < 0 || (fp = fopen("/proc/net/udp", "r")) == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		unsigned long inode;
+		long long d;
+		/* sl local rem st tx:rx tr:when retrnsmt uid timeout inode ref pointer drops */
+		if (sscanf(line, " %*s %*s %*s %*s %*s %*s %*s %*s %*s %lu %*s %*s %lld", &inode, &d) == 2 &&
+				inode == (unsigned long)st.st_ino) {
+			drops = d;
+			break;
+		}
+	}
+	fclose(fp);
+	return drops;
+#else
+	return -1;
+#endif
+}  /* mt_udp_drops */
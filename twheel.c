@@ -0,0 +1,249 @@
+/* twheel.c */
+/*   Hierarchical timer wheel, used by msend to decide which of many
+ * independent streams sends next.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted without restriction.
+ *
+  THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+  EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+  NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+  PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+  UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+  BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+  INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+  TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+  THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+/* The layout follows the classic Varghese/Lauck scheme (as used by the
+ * Linux kernel's timer code): wheel 'l' is indexed by bits
+ * [TW_BITS*l, TW_BITS*(l+1)) of the absolute expiry tick.  Whenever the
+ * low TW_BITS of the current tick wrap to zero, the current slot of the next
+ * wheel up is "cascaded", i.e. its timers are re-filed into lower wheels.
+ * A per-wheel occupancy bitmap lets tw_advance() skip runs of empty slots,
+ * so an idle wheel costs nothing per tick. */
+
+#include "mtools.h"
+
+#define TW_MASK (TW_SLOTS - 1)
+#define TW_MAX_DELTA ((((TLONGLONG)1) << (TW_BITS * TW_LEVELS)) - 1)
+
+
+static void tw_list_init(tw_timer *head)
+{
+	head->next = head;
+	head->prev = head;
+}  /* tw_list_init */
+
+
+static void tw_list_append(tw_timer *head, tw_timer *t)
+{
+	t->prev = head->prev;
+	t->next = head;
+	head->prev->next = t;
+	head->prev = t;
+}  /* tw_list_append */
+
+
+static void tw_list_remove(tw_timer *t)
+{
+	t->prev->next = t->next;
+	t->next->prev = t->prev;
+	t->next = t->prev = t;
+}  /* tw_list_remove */
+
+
+/* Index of first occupied slot at or after 'from' in wheel 'level', or -1. */
+static int tw_find_slot(tw_wheel *w, int level, int from)
+{
+	int word = from >> 5;
+	unsigned int bits = w->occupied[level][word] & (~0u << (from & 31));
+
+	for (;;) {
+		if (bits != 0) {
+#if defined(__GNUC__)
+			return (word << 5) + __builtin_ctz(bits);
+#else
+			int i = 0;
+			while ((bits & 1) == 0) { bits >>= 1; ++i; }
+			return (word << 5) + i;
+#endif
+		}
+		if (++word >= TW_SLOTS / 32)
+			return -1;
+		bits = w->occupied[level][word];
+	}
+}  /* tw_find_slot */
+
+
+/* File a timer into the wheel according to its distance from w->now. */
+static void tw_file(tw_wheel *w, tw_timer *t)
+{
+	TLONGLONG delta = t->expires - w->now;
+	TLONGLONG slot_tick = t->expires;
+	int level, slot;
+
+	if (delta < 0) {
+		t->level = -1;
+		tw_list_append(&w->due, t);
+		return;
+	}
+	if (delta > TW_MAX_DELTA) {
+		/* Beyond the span of the top wheel: park it as far out as possible,
+		 * it gets re-filed with its true expiry when that slot cascades. */
+		delta = TW_MAX_DELTA;
+		slot_tick = w->now + TW_MAX_DELTA;
+	}
+	for (level = 0; level < TW_LEVELS - 1; ++level) {
+		if (delta < (((TLONGLONG)1) << (TW_BITS * (level + 1))))
+			break;
+	}
+	slot = (int)((slot_tick >> (TW_BITS * level)) & TW_MASK);
+	t->level = level;
+	tw_list_append(&w->slots[level][slot], t);
+	w->occupied[level][slot >> 5] |= 1u << (slot & 31);
+}  /* tw_file */
+
+
+/* Re-file every timer in one slot (they all move to lower wheels). */
+static void tw_cascade(tw_wheel *w, int level, int slot)
+{
+	tw_timer list;
+	tw_timer *head = &w->slots[level][slot];
+
+	if (head->next == head)
+		return;
+
+	/* detach the whole slot first, tw_file() may not append back to it */
+	list.next = head->next;  list.prev = head->prev;
+	list.next->prev = &list;  list.prev->next = &list;
+	tw_list_init(head);
+	w->occupied[level][slot >> 5] &= ~(1u << (slot & 31));
+
+	while (list.next != &list) {
+		tw_timer *t = list.next;
+		tw_list_remove(t);
+		tw_file(w, t);
+	}
+}  /* tw_cascade */
+
+
+void tw_init(tw_wheel *w, TLONGLONG now)
+{
+	int level, slot;
+
+	memset(w, 0, sizeof(*w));
+	w->now = now;
+	for (level = 0; level < TW_LEVELS; ++level)
+		for (slot = 0; slot < TW_SLOTS; ++slot)
+			tw_list_init(&w->slots[level][slot]);
+	tw_list_init(&w->due);
+}  /* tw_init */
+
+
+/* Schedule 't' to expire at absolute tick 'expires'.  A tick that has
+ * already been processed makes the timer due immediately. */
+void tw_add(tw_wheel *w, tw_timer *t, TLONGLONG expires)
+{
+	t->expires = expires;
+	tw_file(w, t);
+	++w->count;
+}  /* tw_add */
+
+
+/* Cancel a scheduled (or due but not yet popped) timer. */
+void tw_del(tw_wheel *w, tw_timer *t)
+{
+	tw_timer *head;
+	int slot;
+
+	if (t->next == NULL || t->next == t)
+		return;  /* never added, or already popped */
+	if (t->level >= 0 && t->next == t->prev) {
+		/* only member of its slot: clear the occupancy bit */
+		head = t->next;
+		slot = (int)(head - w->slots[t->level]);
+		w->occupied[t->level][slot >> 5] &= ~(1u << (slot & 31));
+	}
+	tw_list_remove(t);
+	--w->count;
+}  /* tw_del */
+
+
+/* Turn the wheel up to and including tick 'now', moving every timer that
+ * expires on the way onto the due list (collect them with tw_pop()). */
+void tw_advance(tw_wheel *w, TLONGLONG now)
+{
+	while (w->now <= now) {
+		int idx = (int)(w->now & TW_MASK);
+		int next;
+		TLONGLONG skip;
+
+		if (idx == 0) {
+			int level;
+			for (level = 1; level < TW_LEVELS; ++level) {
+				int slot = (int)((w->now >> (TW_BITS * level)) & TW_MASK);
+				tw_cascade(w, level, slot);
+				if (slot != 0)
+					break;
+			}
+		}
+
+		if (w->occupied[0][idx >> 5] & (1u << (idx & 31))) {
+			tw_timer *head = &w->slots[0][idx];
+			tw_timer *t;
+			for (t = head->next; t != head; t = t->next)
+				t->level = -1;
+			/* splice the whole slot onto the tail of the due list */
+			head->next->prev = w->due.prev;
+			w->due.prev->next = head->next;
+			head->prev->next = &w->due;
+			w->due.prev = head->prev;
+			tw_list_init(head);
+			w->occupied[0][idx >> 5] &= ~(1u << (idx & 31));
+		}
+
+		/* jump straight to the next occupied slot, or to the next
+		 * boundary where a higher wheel may cascade timers down */
+		next = (idx + 1 < TW_SLOTS) ? tw_find_slot(w, 0, idx + 1) : -1;
+		skip = (next >= 0) ? next - idx : TW_SLOTS - idx;
+		if (w->now + skip > now + 1)
+			skip = now + 1 - w->now;
+		w->now += skip;
+	}
+}  /* tw_advance */
+
+
+/* Pop the earliest due timer, or NULL when nothing has expired. */
+tw_timer *tw_pop(tw_wheel *w)
+{
+	tw_timer *t = w->due.next;
+
+	if (t == &w->due)
+		return NULL;
+	tw_list_remove(t);
+	--w->count;
+	return t;
+}  /* tw_pop */
+
+
+/* Lower bound on the tick at which the next timer can expire (it may be
+ * earlier than the true expiry when the next timer sits in a higher wheel),
+ * or -1 if nothing is scheduled.  Callers can safely sleep until then. */
+TLONGLONG tw_next_tick(tw_wheel *w)
+{
+	int idx, next;
+
+	if (w->count == 0)
+		return -1;
+	if (w->due.next != &w->due)
+		return w->now - 1;
+	idx = (int)(w->now & TW_MASK);
+	if (idx == 0)
+		return w->now;  /* a cascade is pending at this very tick */
+	next = tw_find_slot(w, 0, idx);
+	if (next >= 0)
+		return w->now + (next - idx);
+	return w->now + (TW_SLOTS - idx);
+}  /* tw_next_tick */
@@ -43,6 +43,17 @@
 
 //#define ff_neterrno() AVERROR(errno)
 
+#if !defined(_WIN32)
+#define WSAGetLastError() errno
+#define WSAEWOULDBLOCK EWOULDBLOCK
+#define WSAEINTR EINTR
+#define WSAEPROTONOSUPPORT EPROTONOSUPPORT
+#define WSAETIMEDOUT ETIMEDOUT
+#define WSAECONNREFUSED ECONNREFUSED
+#define WSAEINPROGRESS EINPROGRESS
+#define closesocket close
+#endif
+
 static int ff_neterrno(void)
 {
     int err = WSAGetLastError();
@@ -73,6 +84,10 @@ static int ff_neterrno(void)
 #   define HAVE_STRUCT_SOCKADDR_IN6 1
 #   define IPPROTO_IPV6 1
 #endif
+#if defined(__linux__)
+#   define HAVE_STRUCT_GROUP_SOURCE_REQ 1
+#   define HAVE_STRUCT_IP_MREQ_SOURCE 1
+#endif
 
 #define AV_LOG_ERROR    16
 #define av_log(ctx, severity, format, ...) fprintf(stderr, format, __VA_ARGS__)